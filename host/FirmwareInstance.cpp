@@ -0,0 +1,15 @@
+#include "FirmwareInstance.h"
+
+#define FIRMWARE_INSTANCE_COPY(name) name(::name),
+
+FirmwareInstance::FirmwareInstance()
+    : FIRMWARE_INSTANCE_STATE(FIRMWARE_INSTANCE_COPY) booted(false) {}
+
+#undef FIRMWARE_INSTANCE_COPY
+
+void FirmwareInstance::swap() {
+    using std::swap;
+#define FIRMWARE_INSTANCE_SWAP(name) swap(name, ::name);
+    FIRMWARE_INSTANCE_STATE(FIRMWARE_INSTANCE_SWAP)
+#undef FIRMWARE_INSTANCE_SWAP
+}
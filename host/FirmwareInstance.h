@@ -0,0 +1,96 @@
+#ifndef FIRMWARE_INSTANCE_H
+#define FIRMWARE_INSTANCE_H
+
+#include <utility>
+#include "HostBoard.h"
+#include "hardware.h"
+#include "general.h"
+#include "main.h"
+#include "Telemetry.h"
+#include "CommandInterface.h"
+#include "Sparkline.h"
+#include "Watchdog.h"
+#include "I2CBus.h"
+#include "PowerManager.h"
+#include "MotionSensors.h"
+#include "SegmentClock.h"
+#include "InputTrace.h"
+#include "MemoryMonitor.h"
+#include "SceneLibrary.h"
+#include "LatencyTracker.h"
+
+// Every INSTANCE_STATE global of the firmware plus the board it runs on.
+// Keep this list in sync when the firmware gains new per-controller state.
+#define FIRMWARE_INSTANCE_STATE(X) \
+    X(hostBoard) \
+    X(Wire) \
+    X(stateStack) \
+    X(currentState) \
+    X(expanderPinStates) \
+    X(leftButtonPressed) \
+    X(rightButtonPressed) \
+    X(backButtonPressed) \
+    X(scheduleButtonPressed) \
+    X(lightAdjusted) \
+    X(tempAdjusted) \
+    X(scheduleAdjusted) \
+    X(timeAdjusted) \
+    X(historyAdjusted) \
+    X(memoryAdjusted) \
+    X(START_TIME) \
+    X(ADDED_TIME) \
+    X(TIME_WHEEL_RANGE) \
+    X(lastTimeWheelValue) \
+    X(selectedScene) \
+    X(adjustRepeat) \
+    X(storeRepeat) \
+    X(room1) \
+    X(room2) \
+    X(mainDisplay) \
+    X(strip) \
+    X(clockDisplay) \
+    X(telemetry) \
+    X(commands) \
+    X(sparkline) \
+    X(crashRecord) \
+    X(watchdog) \
+    X(i2cBus) \
+    X(power) \
+    X(motionSensors) \
+    X(segmentClock) \
+    X(inputTrace) \
+    X(memoryMonitor) \
+    X(scenes) \
+    X(latency)
+
+// One simulated controller. The firmware only ever touches the calling
+// thread's globals, so stepping an instance means swapping its state in,
+// running the firmware and swapping it back out. Any thread may do this,
+// which lets a work-stealing pool move instances between cores freely.
+class FirmwareInstance {
+public:
+#define FIRMWARE_INSTANCE_MEMBER(name) decltype(::name) name;
+    FIRMWARE_INSTANCE_STATE(FIRMWARE_INSTANCE_MEMBER)
+#undef FIRMWARE_INSTANCE_MEMBER
+
+    // Set once setup() has run on this instance
+    bool booted;
+
+    // Captures the calling thread's globals, i.e. a freshly booted controller
+    // as long as that thread has not run the firmware yet.
+    FirmwareInstance();
+
+    void swap();
+};
+
+// Swaps the instance in for the lifetime of the scope
+class ActiveInstance {
+public:
+    explicit ActiveInstance(FirmwareInstance& instance) : active(instance) { active.swap(); }
+    ~ActiveInstance() { active.swap(); }
+
+private:
+    FirmwareInstance& active;
+};
+
+#endif // FIRMWARE_INSTANCE_H
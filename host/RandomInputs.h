@@ -0,0 +1,92 @@
+#ifndef RANDOM_INPUTS_H
+#define RANDOM_INPUTS_H
+
+#include <algorithm>
+#include <random>
+#include "HostBoard.h"
+#include "hardware.h"
+
+// A reproducible stream of inputs for one controller, one call per
+// millisecond: button presses of 50-900 ms, PIR pulses, temperatures and
+// daylight drifting around values where the AC and lights keep switching,
+// turns of the time wheel and Serial commands. The same seed gives the same
+// stream.
+class RandomInputs {
+public:
+    explicit RandomInputs(uint32_t seed) : rng(seed) {}
+
+    // Inputs present at power-up
+    void boot() {
+        hostBoard.analog[ROOM1_TEMP_SENSOR_PIN] = temps[0];
+        hostBoard.analog[ROOM2_TEMP_SENSOR_PIN] = temps[1];
+        hostBoard.analog[PHOTO_RESISTOR_PIN] = daylight;
+        hostBoard.analog[TIME_WHEEL_PIN] = 0;
+        hostBoard.digital[ROOM1_PIR_PIN] = LOW;
+        hostBoard.digital[ROOM2_PIR_PIN] = LOW;
+    }
+
+    // Inputs for the coming millisecond
+    void apply() {
+        tick++;
+        if (held < 0 && chance(1500)) {
+            held = BUTTONS[rng() % 4];
+            hostBoard.digital[held] = LOW;
+            releaseAt = tick + 50 + rng() % 850;
+        } else if (held >= 0 && tick >= releaseAt) {
+            hostBoard.digital[held] = HIGH;
+            held = -1;
+        }
+        if (chance(4000)) {
+            hostBoard.digital[ROOM1_PIR_PIN] ^= 1;
+        }
+        if (chance(4000)) {
+            hostBoard.digital[ROOM2_PIR_PIN] ^= 1;
+        }
+        // TMP36 readings around 20 degrees, where the AC keeps switching
+        if (tick % 1000 == 0) {
+            for (int r = 0; r < 2; r++) {
+                temps[r] = std::min(160, std::max(140, temps[r] + (int)(rng() % 3) - 1));
+            }
+            hostBoard.analog[ROOM1_TEMP_SENSOR_PIN] = temps[0];
+            hostBoard.analog[ROOM2_TEMP_SENSOR_PIN] = temps[1];
+        }
+        if (tick % 500 == 0) {
+            daylight = std::min(1023, std::max(0, daylight + (int)(rng() % 41) - 20));
+            hostBoard.analog[PHOTO_RESISTOR_PIN] = daylight;
+        }
+        if (chance(200000)) {
+            hostBoard.analog[TIME_WHEEL_PIN] = rng() % 1024;
+        }
+        if (chance(20000)) {
+            for (const char* c = COMMANDS[rng() % COMMAND_COUNT]; *c; c++) {
+                hostBoard.serialRx.push_back(*c);
+            }
+            hostBoard.serialRx.push_back('\n');
+        }
+    }
+
+private:
+    static const int BUTTONS[4];
+    static const int COMMAND_COUNT = 10;
+    static const char* const COMMANDS[COMMAND_COUNT];
+
+    std::mt19937 rng;
+    uint64_t tick = 0;
+    int held = -1;
+    uint64_t releaseAt = 0;
+    int temps[2] = { 150, 148 };
+    int daylight = 500;
+
+    bool chance(uint32_t oneIn) {
+        return rng() % oneIn == 0;
+    }
+};
+
+inline const int RandomInputs::BUTTONS[4] = { LEFT_BUTTON_PIN, RIGHT_BUTTON_PIN, BACK_BUTTON_PIN, SCHEDULE_BUTTON_PIN };
+inline const char* const RandomInputs::COMMANDS[RandomInputs::COMMAND_COUNT] = {
+    "SET 1 TARGET 23.5", "SET 2 TARGET 19", "SET 1 LIGHT 3", "SET 2 LIGHT 0",
+    "SET 1 SCHED 000000001122334400000000", "SET SCENE NIGHT", "SET SCENE HOME",
+    "SET TIME 600", "GET HEALTH", "DUMP"
+};
+
+#endif // RANDOM_INPUTS_H
@@ -0,0 +1,139 @@
+#ifndef TRACE_CAPTURE_H
+#define TRACE_CAPTURE_H
+
+#include <string>
+#include <vector>
+#include "HostBoard.h"
+#include "hardware.h"
+#include "TelemetryDecoder.h"
+
+// Input trace records (SET TRACE 1) read back from a captured Serial
+// stream, and applied to the host board. Shared by the host programs that
+// drive the firmware from a recording.
+
+static const int DIGITAL_PINS[TRACE_PIN_COUNT] = {
+    LEFT_BUTTON_PIN, RIGHT_BUTTON_PIN, BACK_BUTTON_PIN, SCHEDULE_BUTTON_PIN, ROOM1_PIR_PIN, ROOM2_PIR_PIN
+};
+static const int ANALOG_PINS[TRACE_ANALOG_COUNT] = {
+    TIME_WHEEL_PIN, PHOTO_RESISTOR_PIN, ROOM1_TEMP_SENSOR_PIN, ROOM2_TEMP_SENSOR_PIN
+};
+
+struct TraceEvent {
+    uint32_t time;
+    uint8_t kind;
+    uint8_t levels;
+    int analog[TRACE_ANALOG_COUNT];
+    std::string command;
+};
+
+// Pulls trace records and telemetry samples out of a captured stream
+class CaptureReader : public TelemetryDecoder {
+public:
+    std::vector<TraceEvent> events;
+    std::vector<TelemetryRecord> records;
+    unsigned long skippedRecords = 0;
+
+protected:
+    void onRecord(const TelemetryRecord& record) override {
+        checkSeq(record.seq);
+        records.push_back(record);
+    }
+
+    void onText(uint8_t seq, const std::string& text) override {
+        checkSeq(seq);
+    }
+
+    void onTrace(uint8_t seq, const uint8_t* body, size_t len) override {
+        checkSeq(seq);
+        size_t pos = 0;
+        while (pos < len) {
+            uint32_t delta;
+            size_t used = getVarint(body + pos, len - pos, &delta);
+            if (used == 0 || pos + used >= len) {
+                synced = false;
+                return;
+            }
+            pos += used;
+            TraceEvent event = current;
+            event.kind = body[pos] & TRACE_KIND_MASK;
+            event.command.clear();
+            pos++;
+            if (event.kind == TRACE_COMMAND) {
+                if (pos >= len || pos + 1 + body[pos] > len) {
+                    synced = false;
+                    return;
+                }
+                event.command.assign((const char*)body + pos + 1, body[pos]);
+                pos += 1 + body[pos];
+            } else {
+                event.levels = body[pos - 1] & TRACE_PIN_MASK;
+                if (pos >= len) {
+                    synced = false;
+                    return;
+                }
+                uint8_t mask = body[pos++];
+                for (int i = 0; i < TRACE_ANALOG_COUNT; i++) {
+                    if (event.kind == TRACE_START) {
+                        event.analog[i] = 0;
+                    }
+                    if (!(mask & (1 << i))) {
+                        continue;
+                    }
+                    uint32_t raw;
+                    used = getVarint(body + pos, len - pos, &raw);
+                    if (used == 0) {
+                        synced = false;
+                        return;
+                    }
+                    pos += used;
+                    event.analog[i] += zigzagDecode(raw);
+                }
+            }
+            if (event.kind == TRACE_START) {
+                event.time = delta;
+                synced = true;
+            } else {
+                event.time = current.time + delta;
+            }
+            current = event;
+            if (synced) {
+                events.push_back(event);
+            } else {
+                skippedRecords++;
+            }
+        }
+    }
+
+private:
+    TraceEvent current = {};
+    bool synced = false;
+    bool haveSeq = false;
+    uint8_t lastSeq = 0;
+
+    // Relative records are useless after lost frames until the next START
+    void checkSeq(uint8_t seq) {
+        if (haveSeq && seq != (uint8_t)(lastSeq + 1)) {
+            synced = false;
+        }
+        haveSeq = true;
+        lastSeq = seq;
+    }
+};
+
+inline void applyTraceEvent(const TraceEvent& event) {
+    if (event.kind == TRACE_COMMAND) {
+        for (char c : event.command) {
+            hostBoard.serialRx.push_back(c);
+        }
+        hostBoard.serialRx.push_back('\n');
+        return;
+    }
+    for (int i = 0; i < TRACE_PIN_COUNT; i++) {
+        hostBoard.digital[DIGITAL_PINS[i]] = (event.levels & (1 << i)) ? HIGH : LOW;
+    }
+    for (int i = 0; i < TRACE_ANALOG_COUNT; i++) {
+        hostBoard.analog[ANALOG_PINS[i]] = event.analog[i];
+    }
+}
+
+#endif // TRACE_CAPTURE_H
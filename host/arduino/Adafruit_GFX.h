@@ -0,0 +1,4 @@
+#ifndef HOST_ADAFRUIT_GFX_H
+#define HOST_ADAFRUIT_GFX_H
+
+#endif // HOST_ADAFRUIT_GFX_H
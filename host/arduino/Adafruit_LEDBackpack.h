@@ -0,0 +1,35 @@
+#ifndef HOST_ADAFRUIT_LED_BACKPACK_H
+#define HOST_ADAFRUIT_LED_BACKPACK_H
+
+#include "Arduino.h"
+#include "Wire.h"
+
+// HT16K33 backpack; writeDisplay() sends the same 17 byte I2C frame as the
+// real driver so bus traffic can be observed through HostBoard.
+class Adafruit_LEDBackpack {
+public:
+    uint16_t displaybuffer[8];
+
+    Adafruit_LEDBackpack() { clear(); }
+    bool begin(uint8_t address = 0x70);
+    void setBrightness(uint8_t b);
+    void writeDisplay();
+    void clear() { memset(displaybuffer, 0, sizeof(displaybuffer)); }
+
+protected:
+    uint8_t i2cAddress = 0x70;
+};
+
+class Adafruit_7segment : public Adafruit_LEDBackpack, public Print {
+public:
+    size_t write(uint8_t c) override;
+    using Print::write;
+    void writeDigitRaw(uint8_t x, uint8_t bitmask);
+    void writeDigitNum(uint8_t x, uint8_t num, bool dot = false);
+    void drawColon(bool state);
+
+private:
+    uint8_t position = 0;
+};
+
+#endif // HOST_ADAFRUIT_LED_BACKPACK_H
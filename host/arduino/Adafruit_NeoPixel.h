@@ -0,0 +1,37 @@
+#ifndef HOST_ADAFRUIT_NEOPIXEL_H
+#define HOST_ADAFRUIT_NEOPIXEL_H
+
+#include "Arduino.h"
+
+#define NEO_GRB 0x52
+#define NEO_KHZ800 0x0000
+
+// Pixel buffer in GRB order, the same layout the real library uses
+class Adafruit_NeoPixel {
+public:
+    Adafruit_NeoPixel(uint16_t n, int16_t pin, uint16_t type);
+    Adafruit_NeoPixel(const Adafruit_NeoPixel& other);
+    Adafruit_NeoPixel(Adafruit_NeoPixel&& other);
+    Adafruit_NeoPixel& operator=(const Adafruit_NeoPixel& other);
+    Adafruit_NeoPixel& operator=(Adafruit_NeoPixel&& other);
+    ~Adafruit_NeoPixel();
+
+    void begin() {}
+    void show();
+    void setPixelColor(uint16_t n, uint32_t c);
+    void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b);
+    void fill(uint32_t c = 0, uint16_t first = 0, uint16_t count = 0);
+    void clear();
+    void setBrightness(uint8_t b) {}
+    uint32_t getPixelColor(uint16_t n) const;
+    uint8_t* getPixels() const { return pixels; }
+    uint16_t numPixels() const { return numLEDs; }
+    static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+
+private:
+    uint16_t numLEDs;
+    uint16_t numBytes;
+    uint8_t* pixels;
+};
+
+#endif // HOST_ADAFRUIT_NEOPIXEL_H
@@ -0,0 +1,144 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Minimal Arduino core for building the firmware natively. All board state
+// (clock, pins, UART) lives in HostBoard so host programs can drive inputs
+// and inspect outputs.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define strncpy_P strncpy
+#define strcat_P strcat
+#define strcmp_P strcmp
+#define snprintf_P snprintf
+#define sprintf_P sprintf
+
+#define B00000 0
+#define B00001 1
+#define B00010 2
+#define B00011 3
+#define B00100 4
+#define B00101 5
+#define B00110 6
+#define B00111 7
+#define B01000 8
+#define B01001 9
+#define B01010 10
+#define B01011 11
+#define B01100 12
+#define B01101 13
+#define B01110 14
+#define B01111 15
+#define B10000 16
+#define B10001 17
+#define B10010 18
+#define B10011 19
+#define B10100 20
+#define B10101 21
+#define B10110 22
+#define B10111 23
+#define B11000 24
+#define B11001 25
+#define B11010 26
+#define B11011 27
+#define B11100 28
+#define B11101 29
+#define B11110 30
+#define B11111 31
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+int analogRead(uint8_t pin);
+long map(long x, long inMin, long inMax, long outMin, long outMax);
+using std::min;
+using std::max;
+template <typename T> T constrain(T x, T low, T high) { return x < low ? low : (x > high ? high : x); }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class String {
+public:
+    String(const char* s = "") : value(s) {}
+    const char* c_str() const { return value.c_str(); }
+    unsigned int length() const { return value.size(); }
+    bool operator==(const String& other) const { return value == other.value; }
+private:
+    std::string value;
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+    size_t print(const char* s) { return write(s); }
+    size_t print(const String& s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int n) { return printFormatted("%d", n); }
+    size_t print(unsigned int n) { return printFormatted("%u", n); }
+    size_t print(long n) { return printFormatted("%ld", n); }
+    size_t print(unsigned long n) { return printFormatted("%lu", n); }
+    size_t print(double n, int digits = 2);
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T& v) { return print(v) + println(); }
+private:
+    template <typename T> size_t printFormatted(const char* format, T v) {
+        char buffer[24];
+        snprintf(buffer, sizeof(buffer), format, v);
+        return write(buffer);
+    }
+};
+
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long baud);
+    int available();
+    int read();
+    int peek();
+    int availableForWrite();
+    size_t write(uint8_t c) override;
+    using Print::write;
+    void flush() {}
+};
+
+extern thread_local HardwareSerial Serial;
+
+#endif // HOST_ARDUINO_H
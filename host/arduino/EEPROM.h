@@ -0,0 +1,46 @@
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include "Arduino.h"
+#include "HostBoard.h"
+
+// ATmega328P EEPROM backed by HostBoard, so each simulated controller has
+// its own. Like the real library it is header only.
+class EEPROMClass {
+public:
+    uint8_t read(int index) { return valid(index) ? hostBoard.eeprom[index] : 0; }
+    void write(int index, uint8_t value) {
+        if (valid(index)) {
+            hostBoard.eeprom[index] = value;
+            hostBoard.eepromWrites++;
+        }
+    }
+    void update(int index, uint8_t value) {
+        if (read(index) != value) {
+            write(index, value);
+        }
+    }
+    uint16_t length() { return HostBoard::EEPROM_SIZE; }
+
+    template <typename T> T& get(int index, T& value) {
+        uint8_t* bytes = (uint8_t*)&value;
+        for (size_t i = 0; i < sizeof(T); i++) {
+            bytes[i] = read(index + i);
+        }
+        return value;
+    }
+    template <typename T> const T& put(int index, const T& value) {
+        const uint8_t* bytes = (const uint8_t*)&value;
+        for (size_t i = 0; i < sizeof(T); i++) {
+            update(index + i, bytes[i]);
+        }
+        return value;
+    }
+
+private:
+    static bool valid(int index) { return index >= 0 && index < HostBoard::EEPROM_SIZE; }
+};
+
+static EEPROMClass EEPROM;
+
+#endif // HOST_EEPROM_H
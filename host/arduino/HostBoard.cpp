@@ -0,0 +1,435 @@
+#include <chrono>
+#include <thread>
+#include "Arduino.h"
+#include "Wire.h"
+#include "LiquidCrystal.h"
+#include "Adafruit_NeoPixel.h"
+#include "Adafruit_LEDBackpack.h"
+#include "HostBoard.h"
+
+thread_local HostBoard hostBoard;
+thread_local HardwareSerial Serial;
+thread_local TwoWire Wire;
+
+static uint64_t wallMicros() {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static uint64_t nowMicros() {
+    return hostBoard.realTime ? wallMicros() : hostBoard.nowMicros;
+}
+
+HostBoard::HostBoard() {
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    reset();
+}
+
+void HostBoard::reset() {
+    nowMicros = 0;
+    // Buttons are wired active low with pull-ups
+    memset(digital, HIGH, sizeof(digital));
+    memset(analog, 0, sizeof(analog));
+    serialRx.clear();
+    serialTx.clear();
+    serialIdleAtMicros = 0;
+    memset(i2cTransactions, 0, sizeof(i2cTransactions));
+    memset(i2cBytes, 0, sizeof(i2cBytes));
+    memset(i2cMicros, 0, sizeof(i2cMicros));
+    memset(busCosts, 0, sizeof(busCosts));
+    stripShows = 0;
+    stripShowMicros = 0;
+    lcdWrites = 0;
+    lcdCommands = 0;
+}
+
+// Time models for an Uno at 16 MHz. They only feed the cost figures; the
+// virtual clock does not move.
+// analogRead: 13 ADC clocks at 125 kHz plus the call
+static const double ANALOG_READ_MICROS = 112;
+// digitalRead: about 60 CPU cycles for the pin lookup and the read
+static const double DIGITAL_READ_MICROS = 3.75;
+// LiquidCrystal in 4-bit mode sends two nibbles per byte, each with about
+// a dozen digitalWrite()s and a 100 us settle delay
+static const double LCD_BYTE_MICROS = 250;
+// clear() and home() wait another 2 ms for the controller
+static const double LCD_RETURN_MICROS = 2000;
+// WS2812: 24 bits of 1.25 us per pixel, then the 50 us latch
+static const double STRIP_BIT_MICROS = 1.25;
+static const double STRIP_LATCH_MICROS = 50;
+
+void HostBoard::book(BusKind kind, unsigned long units, double micros) {
+    int phase = busPhase ? busPhase() : 0;
+    if (phase < 0 || phase >= BUS_PHASES) {
+        phase = 0;
+    }
+    BusCost& cost = busCosts[phase][kind];
+    cost.calls++;
+    cost.units += units;
+    cost.micros += micros;
+}
+
+void HostBoard::advance(uint64_t micros) {
+    if (realTime) {
+        std::this_thread::sleep_for(std::chrono::microseconds(micros));
+    } else {
+        nowMicros += micros;
+    }
+}
+
+// Core
+
+unsigned long millis() {
+    return nowMicros() / 1000;
+}
+
+unsigned long micros() {
+    return nowMicros();
+}
+
+void delay(unsigned long ms) {
+    hostBoard.advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    hostBoard.advance(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+int digitalRead(uint8_t pin) {
+    hostBoard.book(HostBoard::BUS_DIGITAL_READ, 1, DIGITAL_READ_MICROS);
+    return pin < HostBoard::PIN_COUNT ? hostBoard.digital[pin] : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    if (pin < HostBoard::PIN_COUNT) {
+        hostBoard.digital[pin] = value;
+    }
+}
+
+int analogRead(uint8_t pin) {
+    hostBoard.book(HostBoard::BUS_ANALOG_READ, 1, ANALOG_READ_MICROS);
+    return pin < HostBoard::PIN_COUNT ? hostBoard.analog[pin] : 0;
+}
+
+long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        write(buffer[i]);
+    }
+    return size;
+}
+
+size_t Print::print(double n, int digits) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+    return write(buffer);
+}
+
+// UART: bytes leave at the configured baud rate through a 64 byte buffer.
+// Writing into a full buffer blocks (advances the clock) like the real core.
+
+static uint64_t serialByteMicros() {
+    return hostBoard.serialBaud ? 10000000ULL / hostBoard.serialBaud : 0;
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+    hostBoard.serialBaud = baud;
+}
+
+int HardwareSerial::available() {
+    return hostBoard.serialRx.size();
+}
+
+int HardwareSerial::read() {
+    if (hostBoard.serialRx.empty()) {
+        return -1;
+    }
+    int c = hostBoard.serialRx.front();
+    hostBoard.serialRx.pop_front();
+    return c;
+}
+
+int HardwareSerial::peek() {
+    return hostBoard.serialRx.empty() ? -1 : hostBoard.serialRx.front();
+}
+
+int HardwareSerial::availableForWrite() {
+    uint64_t byteTime = serialByteMicros();
+    uint64_t now = nowMicros();
+    if (byteTime == 0 || hostBoard.serialIdleAtMicros <= now) {
+        return HostBoard::SERIAL_TX_BUFFER - 1;
+    }
+    int queued = (hostBoard.serialIdleAtMicros - now + byteTime - 1) / byteTime;
+    return queued >= HostBoard::SERIAL_TX_BUFFER - 1 ? 0 : HostBoard::SERIAL_TX_BUFFER - 1 - queued;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    uint64_t byteTime = serialByteMicros();
+    if (byteTime != 0) {
+        if (availableForWrite() == 0 && !hostBoard.realTime) {
+            hostBoard.nowMicros = hostBoard.serialIdleAtMicros - (HostBoard::SERIAL_TX_BUFFER - 2) * byteTime;
+        }
+        uint64_t now = nowMicros();
+        hostBoard.serialIdleAtMicros = (hostBoard.serialIdleAtMicros > now ? hostBoard.serialIdleAtMicros : now) + byteTime;
+    }
+    hostBoard.serialTx.push_back(c);
+    return 1;
+}
+
+// I2C
+
+void TwoWire::setClock(uint32_t clock) {
+    hostBoard.i2cClock = clock;
+}
+
+void TwoWire::setWireTimeout(uint32_t timeout, bool resetWithTimeout) {
+    hostBoard.i2cTimeoutMicros = timeout;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+    txAddress = address & 0x7F;
+    txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (txLength >= sizeof(txBuffer)) {
+        return 0;
+    }
+    txBuffer[txLength++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t len) {
+    size_t written = 0;
+    while (written < len && write(data[written])) {
+        written++;
+    }
+    return written;
+}
+
+// Start, address byte, data bytes (each with its ACK bit) and stop
+uint8_t TwoWire::endTransmission(bool stop) {
+    unsigned long bits = 1 + (1 + txLength) * 9 + 1;
+    double micros = bits * 1e6 / hostBoard.i2cClock;
+    hostBoard.i2cTransactions[txAddress]++;
+    hostBoard.i2cBytes[txAddress] += txLength;
+    hostBoard.i2cMicros[txAddress] += micros;
+    hostBoard.book(HostBoard::BUS_I2C, bits, micros);
+    if (hostBoard.onI2CWrite) {
+        hostBoard.onI2CWrite(txAddress, txBuffer, txLength);
+    }
+    return 0;
+}
+
+// HD44780
+
+LiquidCrystal::LiquidCrystal(uint8_t rs, uint8_t enable, uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7) {
+    memset(screen, ' ', sizeof(screen));
+    memset(glyphs, 0, sizeof(glyphs));
+}
+
+void LiquidCrystal::begin(uint8_t cols, uint8_t rows) {
+    clear();
+}
+
+void LiquidCrystal::clear() {
+    hostBoard.lcdCommands++;
+    hostBoard.book(HostBoard::BUS_LCD_COMMAND, 1, LCD_BYTE_MICROS + LCD_RETURN_MICROS);
+    memset(screen, ' ', sizeof(screen));
+    col = 0;
+    row = 0;
+}
+
+void LiquidCrystal::home() {
+    hostBoard.lcdCommands++;
+    hostBoard.book(HostBoard::BUS_LCD_COMMAND, 1, LCD_BYTE_MICROS + LCD_RETURN_MICROS);
+    col = 0;
+    row = 0;
+}
+
+void LiquidCrystal::setCursor(uint8_t newCol, uint8_t newRow) {
+    hostBoard.lcdCommands++;
+    hostBoard.book(HostBoard::BUS_LCD_COMMAND, 1, LCD_BYTE_MICROS);
+    col = newCol;
+    row = newRow;
+}
+
+// The CGRAM address, then the glyph's eight rows as data
+void LiquidCrystal::createChar(uint8_t location, uint8_t charmap[]) {
+    hostBoard.lcdCommands++;
+    hostBoard.book(HostBoard::BUS_LCD_COMMAND, 9, 9 * LCD_BYTE_MICROS);
+    memcpy(glyphs[location & 7], charmap, 8);
+}
+
+void LiquidCrystal::display() {
+    hostBoard.lcdCommands++;
+    hostBoard.book(HostBoard::BUS_LCD_COMMAND, 1, LCD_BYTE_MICROS);
+    visible = true;
+}
+
+void LiquidCrystal::noDisplay() {
+    hostBoard.lcdCommands++;
+    hostBoard.book(HostBoard::BUS_LCD_COMMAND, 1, LCD_BYTE_MICROS);
+    visible = false;
+}
+
+size_t LiquidCrystal::write(uint8_t c) {
+    hostBoard.lcdWrites++;
+    hostBoard.book(HostBoard::BUS_LCD_DATA, 1, LCD_BYTE_MICROS);
+    if (row < ROWS && col < COLS) {
+        screen[row][col] = c;
+    }
+    col++;
+    return 1;
+}
+
+// WS2812
+
+Adafruit_NeoPixel::Adafruit_NeoPixel(uint16_t n, int16_t pin, uint16_t type)
+    : numLEDs(n), numBytes(n * 3), pixels(new uint8_t[n * 3]()) {}
+
+Adafruit_NeoPixel::Adafruit_NeoPixel(const Adafruit_NeoPixel& other)
+    : numLEDs(other.numLEDs), numBytes(other.numBytes), pixels(new uint8_t[other.numBytes]) {
+    memcpy(pixels, other.pixels, numBytes);
+}
+
+Adafruit_NeoPixel& Adafruit_NeoPixel::operator=(const Adafruit_NeoPixel& other) {
+    if (this != &other) {
+        uint8_t* copy = new uint8_t[other.numBytes];
+        memcpy(copy, other.pixels, other.numBytes);
+        delete[] pixels;
+        pixels = copy;
+        numLEDs = other.numLEDs;
+        numBytes = other.numBytes;
+    }
+    return *this;
+}
+
+Adafruit_NeoPixel::Adafruit_NeoPixel(Adafruit_NeoPixel&& other)
+    : numLEDs(other.numLEDs), numBytes(other.numBytes), pixels(other.pixels) {
+    other.numLEDs = 0;
+    other.numBytes = 0;
+    other.pixels = nullptr;
+}
+
+Adafruit_NeoPixel& Adafruit_NeoPixel::operator=(Adafruit_NeoPixel&& other) {
+    if (this != &other) {
+        delete[] pixels;
+        numLEDs = other.numLEDs;
+        numBytes = other.numBytes;
+        pixels = other.pixels;
+        other.numLEDs = 0;
+        other.numBytes = 0;
+        other.pixels = nullptr;
+    }
+    return *this;
+}
+
+Adafruit_NeoPixel::~Adafruit_NeoPixel() {
+    delete[] pixels;
+}
+
+void Adafruit_NeoPixel::show() {
+    unsigned long bits = numLEDs * 24UL;
+    double micros = bits * STRIP_BIT_MICROS + STRIP_LATCH_MICROS;
+    hostBoard.stripShows++;
+    hostBoard.stripShowMicros += micros;
+    hostBoard.book(HostBoard::BUS_STRIP, bits, micros);
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint32_t c) {
+    setPixelColor(n, (uint8_t)(c >> 16), (uint8_t)(c >> 8), (uint8_t)c);
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b) {
+    if (n < numLEDs) {
+        pixels[n * 3] = g;
+        pixels[n * 3 + 1] = r;
+        pixels[n * 3 + 2] = b;
+    }
+}
+
+void Adafruit_NeoPixel::fill(uint32_t c, uint16_t first, uint16_t count) {
+    if (first >= numLEDs) {
+        return;
+    }
+    uint16_t end = (count == 0 || first + count > numLEDs) ? numLEDs : first + count;
+    for (uint16_t i = first; i < end; i++) {
+        setPixelColor(i, c);
+    }
+}
+
+void Adafruit_NeoPixel::clear() {
+    memset(pixels, 0, numBytes);
+}
+
+uint32_t Adafruit_NeoPixel::getPixelColor(uint16_t n) const {
+    if (n >= numLEDs) {
+        return 0;
+    }
+    const uint8_t* p = &pixels[n * 3];
+    return Color(p[1], p[0], p[2]);
+}
+
+// HT16K33
+
+bool Adafruit_LEDBackpack::begin(uint8_t address) {
+    i2cAddress = address;
+    const uint8_t oscillatorOn = 0x21;
+    const uint8_t displayOn = 0x81;
+    Wire.beginTransmission(i2cAddress);
+    Wire.write(oscillatorOn);
+    Wire.endTransmission();
+    Wire.beginTransmission(i2cAddress);
+    Wire.write(displayOn);
+    Wire.endTransmission();
+    setBrightness(15);
+    return true;
+}
+
+void Adafruit_LEDBackpack::setBrightness(uint8_t b) {
+    Wire.beginTransmission(i2cAddress);
+    Wire.write((uint8_t)(0xE0 | (b > 15 ? 15 : b)));
+    Wire.endTransmission();
+}
+
+void Adafruit_LEDBackpack::writeDisplay() {
+    Wire.beginTransmission(i2cAddress);
+    Wire.write((uint8_t)0x00);
+    for (int i = 0; i < 8; i++) {
+        Wire.write(displaybuffer[i] & 0xFF);
+        Wire.write(displaybuffer[i] >> 8);
+    }
+    Wire.endTransmission();
+}
+
+static const uint8_t SEGMENT_DIGITS[] = { 0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F };
+
+size_t Adafruit_7segment::write(uint8_t c) {
+    if (c == '\n') {
+        position = 0;
+    } else if (c >= '0' && c <= '9' && position < 5) {
+        writeDigitNum(position, c - '0');
+        position = (position == 1) ? 3 : position + 1;
+    }
+    return 1;
+}
+
+void Adafruit_7segment::writeDigitRaw(uint8_t x, uint8_t bitmask) {
+    if (x < 5) {
+        displaybuffer[x] = bitmask;
+    }
+}
+
+void Adafruit_7segment::writeDigitNum(uint8_t x, uint8_t num, bool dot) {
+    writeDigitRaw(x, SEGMENT_DIGITS[num % 10] | (dot ? 0x80 : 0));
+}
+
+void Adafruit_7segment::drawColon(bool state) {
+    displaybuffer[2] = state ? 0x02 : 0;
+}
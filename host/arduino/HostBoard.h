@@ -0,0 +1,81 @@
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Everything the mocked Arduino core reads from or writes to. Host programs
+// set inputs here, advance the clock and collect outputs. Like the firmware's
+// INSTANCE_STATE globals there is one board per thread.
+struct HostBoard {
+    static const int PIN_COUNT = 20;
+    static const int SERIAL_TX_BUFFER = 64;
+    static const int EEPROM_SIZE = 1024;
+    // Enough for the firmware's loop phases
+    static const int BUS_PHASES = 10;
+
+    // External operations, each with a modelled time on the Uno
+    enum BusKind {
+        BUS_I2C,
+        BUS_LCD_COMMAND,
+        BUS_LCD_DATA,
+        BUS_STRIP,
+        BUS_ANALOG_READ,
+        BUS_DIGITAL_READ,
+        BUS_KIND_COUNT
+    };
+
+    struct BusCost {
+        // Transactions, LCD operations, shows or reads
+        unsigned long calls;
+        // Bits on the wire for I2C and the strip, bytes for the LCD, else calls
+        unsigned long units;
+        double micros;
+    };
+
+    // Virtual clock, unless realTime is set (then millis() follows the wall clock)
+    uint64_t nowMicros = 0;
+    bool realTime = false;
+
+    uint8_t digital[PIN_COUNT];
+    int analog[PIN_COUNT];
+
+    std::deque<uint8_t> serialRx;
+    std::vector<uint8_t> serialTx;
+    unsigned long serialBaud = 0;
+    uint64_t serialIdleAtMicros = 0;
+
+    uint32_t i2cClock = 100000;
+    uint32_t i2cTimeoutMicros = 0;
+    unsigned long i2cTransactions[128];
+    unsigned long i2cBytes[128];
+    double i2cMicros[128];
+    std::function<void(uint8_t address, const uint8_t* data, uint8_t len)> onI2CWrite;
+
+    unsigned long stripShows = 0;
+    // Time the strip data takes on the wire at 800 kHz, interrupts off on the board
+    unsigned long stripShowMicros = 0;
+    // Characters written to and instructions sent to the LCD
+    unsigned long lcdWrites = 0;
+    unsigned long lcdCommands = 0;
+
+    // Costs are booked to the slot busPhase returns, or slot 0 without it.
+    // Host programs point it at the firmware's current loop phase.
+    std::function<int()> busPhase;
+    BusCost busCosts[BUS_PHASES][BUS_KIND_COUNT];
+
+    // Erased (0xFF) at construction and kept across reset(), like the chip's
+    uint8_t eeprom[EEPROM_SIZE];
+    unsigned long eepromWrites = 0;
+
+    HostBoard();
+    void reset();
+    void advance(uint64_t micros);
+    void book(BusKind kind, unsigned long units, double micros);
+};
+
+extern thread_local HostBoard hostBoard;
+
+#endif // HOST_BOARD_H
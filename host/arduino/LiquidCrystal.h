@@ -0,0 +1,32 @@
+#ifndef HOST_LIQUID_CRYSTAL_H
+#define HOST_LIQUID_CRYSTAL_H
+
+#include "Arduino.h"
+
+// HD44780 model: keeps the visible characters and the CGRAM glyphs
+class LiquidCrystal : public Print {
+public:
+    static const int COLS = 16;
+    static const int ROWS = 2;
+
+    char screen[ROWS][COLS];
+    uint8_t glyphs[8][8];
+    bool visible = true;
+
+    LiquidCrystal(uint8_t rs, uint8_t enable, uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7);
+    void begin(uint8_t cols, uint8_t rows);
+    void clear();
+    void home();
+    void setCursor(uint8_t col, uint8_t row);
+    void createChar(uint8_t location, uint8_t charmap[]);
+    void display();
+    void noDisplay();
+    size_t write(uint8_t c) override;
+    using Print::write;
+
+private:
+    uint8_t col = 0;
+    uint8_t row = 0;
+};
+
+#endif // HOST_LIQUID_CRYSTAL_H
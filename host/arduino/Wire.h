@@ -0,0 +1,27 @@
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include "Arduino.h"
+
+#define WIRE_HAS_TIMEOUT
+
+class TwoWire {
+public:
+    void begin() {}
+    void setClock(uint32_t clock);
+    void setWireTimeout(uint32_t timeout = 25000, bool resetWithTimeout = false);
+    bool getWireTimeoutFlag() { return false; }
+    void clearWireTimeoutFlag() {}
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t* data, size_t len);
+    uint8_t endTransmission(bool stop = true);
+private:
+    uint8_t txAddress = 0;
+    uint8_t txBuffer[32];
+    uint8_t txLength = 0;
+};
+
+extern thread_local TwoWire Wire;
+
+#endif // HOST_WIRE_H
@@ -0,0 +1,444 @@
+// Times the firmware's hot functions natively against the mocked core and
+// counts the hardware work each call causes.
+//
+//   g++ -std=c++17 -O2 -Ihost/arduino -Ihost -Isrc/include src/impl/*.cpp host/arduino/HostBoard.cpp
+//       host/FirmwareInstance.cpp host/bench.cpp -o bench
+//   ./bench [--filter text] [--min-ms 200] [--json out.json] [--baseline old.json] [--threshold 10]
+//   ./bench --budget 60
+//
+// For every benchmark the report gives ns/op and, per op, I2C transactions,
+// LCD character writes, LCD instructions, strip.show() calls, the time
+// those shows keep the strip's data line busy (interrupts are off for all of
+// it on the board) and the modelled time all of its external operations take
+// on the Uno (see HostBoard.cpp). --json
+// writes the same figures for later runs to compare against: with
+// --baseline each line also shows the change in ns/op, and the exit status
+// is 1 if any benchmark got slower by more than --threshold percent or now
+// does more hardware calls per op. Functions that only queue I2C writes
+// flush the queue inside the op, so their bus traffic is counted too.
+// Every benchmark starts from a freshly booted controller.
+//
+// --budget runs a controller for that many seconds of device time on random
+// inputs, one loop() pass per millisecond, and splits the modelled I/O time
+// by loop phase: how much of every second each phase spends on the I2C bus,
+// the LCD, the strip and pin reads, and its worst single pass.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FirmwareInstance.h"
+#include "PowerManager.h"
+#include "RandomInputs.h"
+
+struct BenchOptions {
+    const char* filter = NULL;
+    double minMs = 200;
+    const char* jsonPath = NULL;
+    const char* baselinePath = NULL;
+    double threshold = 10;
+    double budgetSeconds = 0;
+};
+
+struct Benchmark {
+    const char* name;
+    std::function<void()> prepare;
+    std::function<void(unsigned long i)> op;
+};
+
+struct Result {
+    std::string name;
+    double nsPerOp = 0;
+    unsigned long iterations = 0;
+    double i2c = 0;
+    double lcdWrites = 0;
+    double lcdCommands = 0;
+    double stripShows = 0;
+    double stripMicros = 0;
+    double deviceMicros = 0;
+};
+
+struct Counters {
+    unsigned long i2c;
+    unsigned long lcdWrites;
+    unsigned long lcdCommands;
+    unsigned long stripShows;
+    unsigned long stripMicros;
+    double deviceMicros;
+
+    static Counters read() {
+        Counters counters = { 0, hostBoard.lcdWrites, hostBoard.lcdCommands, hostBoard.stripShows, hostBoard.stripShowMicros, 0 };
+        for (int address = 0; address < 128; address++) {
+            counters.i2c += hostBoard.i2cTransactions[address];
+        }
+        for (int phase = 0; phase < HostBoard::BUS_PHASES; phase++) {
+            counters.deviceMicros += phaseMicros(phase);
+        }
+        return counters;
+    }
+
+    static double phaseMicros(int phase) {
+        double micros = 0;
+        for (int kind = 0; kind < HostBoard::BUS_KIND_COUNT; kind++) {
+            micros += hostBoard.busCosts[phase][kind].micros;
+        }
+        return micros;
+    }
+};
+
+// Keeps results of pure functions alive without a measurable cost
+static volatile long sink;
+
+static void bootFirmware() {
+    hostBoard.analog[ROOM1_TEMP_SENSOR_PIN] = 147;
+    hostBoard.analog[ROOM2_TEMP_SENSOR_PIN] = 147;
+    hostBoard.analog[PHOTO_RESISTOR_PIN] = 500;
+    setup();
+    i2cBus.flush();
+}
+
+static std::vector<Benchmark> benchmarks() {
+    std::vector<Benchmark> list;
+    list.push_back({ "readTemperature", NULL, [](unsigned long i) {
+        hostBoard.analog[ROOM1_TEMP_SENSOR_PIN] = 140 + i % 16;
+        sink = (long)room1.readTemperature();
+    } });
+    list.push_back({ "adjustAC/steady", [] {
+        room1.currentTemp = 21.0;
+        room1.targetTemp = 22.0;
+        room1.adjustAC();
+        i2cBus.flush();
+    }, [](unsigned long) {
+        room1.adjustAC();
+    } });
+    // Heating and cooling in turn, so every call switches both relays
+    list.push_back({ "adjustAC/switch", NULL, [](unsigned long i) {
+        room1.currentTemp = (i & 1) ? 23.0 : 21.0;
+        room1.adjustAC();
+        i2cBus.flush();
+    } });
+    list.push_back({ "checkSchedule", [] {
+        for (int h = 0; h < 24; h++) {
+            room1.setScheduledLevel(h, 2);
+        }
+        room1.checkSchedule();
+    }, [](unsigned long) {
+        room1.checkSchedule();
+    } });
+    list.push_back({ "handleInactivity", [] {
+        room1.peoplePresent = true;
+        room1.inactive = false;
+        room1.lastMotionTime = currentTime();
+    }, [](unsigned long) {
+        room1.handleInactivity();
+    } });
+    list.push_back({ "updateNeoPixelBrightness", NULL, [](unsigned long i) {
+        room1.lightIntensity = i % 5;
+        room1.updateNeoPixelBrightness(false);
+    } });
+    list.push_back({ "daylightDemand", NULL, [](unsigned long i) {
+        sink = DaylightHarvester::demand(i % 1024);
+    } });
+    // Every call is past the update interval, so each one filters a reading
+    list.push_back({ "autoAdjustLight", [] {
+        room1.autoLightEnabled = true;
+    }, [](unsigned long i) {
+        hostBoard.analog[PHOTO_RESISTOR_PIN] = 300 + (i * 37) % 500;
+        hostBoard.nowMicros += DaylightHarvester::UPDATE_MS * 1000;
+        room1.autoAdjustLight();
+    } });
+    list.push_back({ "printTemperature", NULL, [](unsigned long i) {
+        printTemperature(10.0 + (i % 200) * 0.1);
+    } });
+    list.push_back({ "printCentered", NULL, [](unsigned long i) {
+        printCentered("Room 1 Light", i & 1);
+    } });
+    list.push_back({ "getTimestamp", NULL, [](unsigned long) {
+        sink = getTimestamp().length();
+    } });
+    list.push_back({ "StateStack push+pop", NULL, [](unsigned long) {
+        stateStack.push(ROOM_MENU);
+        stateStack.pop();
+    } });
+    list.push_back({ "StateStack topState", NULL, [](unsigned long) {
+        sink = stateStack.topState() + stateStack.isHistoryAvailable();
+    } });
+    // Level changes on one room's segment of a strip of each length; a
+    // bar only rewrites the pixels between the old and new level
+    static const uint16_t STRIP_LENGTHS[] = { 8, 150, 300 };
+    static const char* const SEGMENT_NAMES[2][3] = {
+        { "segment bar/8px", "segment bar/150px", "segment bar/300px" },
+        { "segment dimmer/8px", "segment dimmer/150px", "segment dimmer/300px" }
+    };
+    for (int style = LIGHT_BAR; style <= LIGHT_DIMMER; style++) {
+        for (int n = 0; n < 3; n++) {
+            uint16_t length = STRIP_LENGTHS[n];
+            auto pixels = std::make_shared<Adafruit_NeoPixel>(length, LIGHT_STRIP_PIN, NEO_GRB + NEO_KHZ800);
+            auto segment = std::make_shared<LightSegment>(0, length / 2, (LightStyle)style);
+            list.push_back({ SEGMENT_NAMES[style][n], NULL, [pixels, segment](unsigned long i) {
+                if (segment->apply(*pixels, (i % 4) + 1)) {
+                    pixels->show();
+                }
+            } });
+        }
+    }
+    // A full pass every call: the clock moves one loop tick each time
+    list.push_back({ "loop", NULL, [](unsigned long) {
+        hostBoard.nowMicros += 50000;
+        loop();
+        hostBoard.serialTx.clear();
+    } });
+    return list;
+}
+
+static Result run(const Benchmark& benchmark, const FirmwareInstance& pristine, double minMs) {
+    FirmwareInstance instance(pristine);
+    ActiveInstance active(instance);
+    bootFirmware();
+    if (benchmark.prepare) {
+        benchmark.prepare();
+    }
+    Result result;
+    result.name = benchmark.name;
+    unsigned long iterations = 1;
+    unsigned long done = 0;
+    while (true) {
+        Counters before = Counters::read();
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned long i = 0; i < iterations; i++) {
+            benchmark.op(done + i);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        Counters after = Counters::read();
+        done += iterations;
+        if (ns >= minMs * 1e6) {
+            result.iterations = iterations;
+            result.nsPerOp = ns / iterations;
+            result.i2c = (double)(after.i2c - before.i2c) / iterations;
+            result.lcdWrites = (double)(after.lcdWrites - before.lcdWrites) / iterations;
+            result.lcdCommands = (double)(after.lcdCommands - before.lcdCommands) / iterations;
+            result.stripShows = (double)(after.stripShows - before.stripShows) / iterations;
+            result.stripMicros = (double)(after.stripMicros - before.stripMicros) / iterations;
+            result.deviceMicros = (after.deviceMicros - before.deviceMicros) / iterations;
+            return result;
+        }
+        // Aim a little past the minimum so the measured batch is the last one
+        double estimate = ns > 0 ? minMs * 1e6 * 1.2 / (ns / iterations) : iterations * 10.0;
+        iterations = estimate > iterations * 10.0 ? iterations * 10 : (unsigned long)estimate + 1;
+    }
+}
+
+// One benchmark per line, so a baseline can be read back without a JSON library
+static void writeJson(const char* path, const std::vector<Result>& results) {
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        perror(path);
+        exit(2);
+    }
+    fprintf(out, "{\"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        fprintf(out, "  {\"name\": \"%s\", \"ns_per_op\": %.2f, \"iterations\": %lu, \"i2c_per_op\": %.4f, "
+            "\"lcd_writes_per_op\": %.4f, \"lcd_commands_per_op\": %.4f, \"strip_shows_per_op\": %.4f, "
+            "\"strip_us_per_op\": %.2f, \"device_us_per_op\": %.2f}%s\n",
+            r.name.c_str(), r.nsPerOp, r.iterations, r.i2c, r.lcdWrites, r.lcdCommands, r.stripShows, r.stripMicros,
+            r.deviceMicros, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    fclose(out);
+}
+
+static bool readNumber(const char* line, const char* key, double& value) {
+    const char* field = strstr(line, key);
+    return field && sscanf(field + strlen(key), "%lf", &value) == 1;
+}
+
+static std::map<std::string, Result> readJson(const char* path) {
+    std::map<std::string, Result> results;
+    FILE* in = fopen(path, "r");
+    if (in == NULL) {
+        perror(path);
+        exit(2);
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), in)) {
+        const char* name = strstr(line, "\"name\": \"");
+        if (name == NULL) {
+            continue;
+        }
+        name += strlen("\"name\": \"");
+        const char* end = strchr(name, '"');
+        Result r;
+        r.name.assign(name, end ? end - name : strlen(name));
+        readNumber(line, "\"ns_per_op\": ", r.nsPerOp);
+        readNumber(line, "\"i2c_per_op\": ", r.i2c);
+        readNumber(line, "\"lcd_writes_per_op\": ", r.lcdWrites);
+        readNumber(line, "\"lcd_commands_per_op\": ", r.lcdCommands);
+        readNumber(line, "\"strip_shows_per_op\": ", r.stripShows);
+        readNumber(line, "\"strip_us_per_op\": ", r.stripMicros);
+        // Missing from baselines written before the cost model
+        r.deviceMicros = -1;
+        readNumber(line, "\"device_us_per_op\": ", r.deviceMicros);
+        results[r.name] = r;
+    }
+    fclose(in);
+    return results;
+}
+
+// Counts are exact, so any increase is a change in behaviour, not noise
+static bool moreCalls(const Result& now, const Result& before) {
+    const double epsilon = 1e-3;
+    return now.i2c > before.i2c + epsilon || now.lcdWrites > before.lcdWrites + epsilon
+        || now.lcdCommands > before.lcdCommands + epsilon || now.stripShows > before.stripShows + epsilon
+        || now.stripMicros > before.stripMicros + epsilon
+        || (before.deviceMicros >= 0 && now.deviceMicros > before.deviceMicros + epsilon);
+}
+
+static const char* const PHASE_LABELS[PHASE_COUNT] = {
+    "SETUP", "WAKE", "INPUT", "COMMANDS", "ROOMS", "MENU", "CLOCK", "BUS", "TELEMETRY"
+};
+
+// Modelled on-device I/O time of every loop phase over a run on random inputs
+static int runBudget(double seconds, const FirmwareInstance& pristine) {
+    FirmwareInstance instance(pristine);
+    ActiveInstance active(instance);
+    RandomInputs inputs(1);
+    inputs.boot();
+    hostBoard.busPhase = [] { return (int)crashRecord.phase; };
+    setup();
+    double bootMicros = Counters::read().deviceMicros;
+    memset(hostBoard.busCosts, 0, sizeof(hostBoard.busCosts));
+    unsigned long transactions[128];
+    unsigned long bytes[128];
+    double busMicros[128];
+    memcpy(transactions, hostBoard.i2cTransactions, sizeof(transactions));
+    memcpy(bytes, hostBoard.i2cBytes, sizeof(bytes));
+    memcpy(busMicros, hostBoard.i2cMicros, sizeof(busMicros));
+
+    unsigned long passes = (unsigned long)(seconds * 1000);
+    unsigned long awake = 0;
+    double worst[PHASE_COUNT] = {};
+    double last[PHASE_COUNT] = {};
+    for (unsigned long pass = 0; pass < passes; pass++) {
+        inputs.apply();
+        uint32_t before = power.passes();
+        loop();
+        hostBoard.serialTx.clear();
+        hostBoard.nowMicros += 1000;
+        if (power.passes() != before) {
+            awake++;
+        }
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            double total = Counters::phaseMicros(phase);
+            worst[phase] = std::max(worst[phase], total - last[phase]);
+            last[phase] = total;
+        }
+    }
+
+    double deviceMicros = seconds * 1e6;
+    printf("budget: %.0f s of device time, %lu passes, %lu awake; setup() took %.1f ms of I/O\n", seconds, passes,
+        awake, bootMicros / 1000);
+    printf("%-10s %9s %9s %9s %9s %9s %9s %10s %6s %10s %10s\n", "phase", "i2c", "lcd cmd", "lcd chr", "strip",
+        "adc", "pins", "total", "cpu", "per awake", "worst");
+    double sums[HostBoard::BUS_KIND_COUNT + 1] = {};
+    for (int phase = PHASE_WAKE; phase < PHASE_COUNT; phase++) {
+        printf("%-10s", PHASE_LABELS[phase]);
+        double total = 0;
+        for (int kind = 0; kind < HostBoard::BUS_KIND_COUNT; kind++) {
+            double micros = hostBoard.busCosts[phase][kind].micros;
+            printf(" %9.1f", micros / seconds);
+            sums[kind] += micros;
+            total += micros;
+        }
+        sums[HostBoard::BUS_KIND_COUNT] += total;
+        printf(" %10.1f %5.1f%% %10.1f %10.1f\n", total / seconds, total / deviceMicros * 100,
+            awake ? total / awake : 0, worst[phase]);
+    }
+    printf("%-10s", "all");
+    for (int kind = 0; kind <= HostBoard::BUS_KIND_COUNT; kind++) {
+        printf(kind < HostBoard::BUS_KIND_COUNT ? " %9.1f" : " %10.1f", sums[kind] / seconds);
+    }
+    double total = sums[HostBoard::BUS_KIND_COUNT];
+    printf(" %5.1f%% %10.1f\n", total / deviceMicros * 100, awake ? total / awake : 0);
+
+    printf("i2c by address:\n");
+    for (int address = 0; address < 128; address++) {
+        unsigned long count = hostBoard.i2cTransactions[address] - transactions[address];
+        if (count == 0) {
+            continue;
+        }
+        printf("  0x%02X %10lu transactions %10lu bytes %10.1f us/s\n", address, count,
+            hostBoard.i2cBytes[address] - bytes[address], (hostBoard.i2cMicros[address] - busMicros[address]) / seconds);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) {
+            options.minMs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            options.jsonPath = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            options.baselinePath = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            options.threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            options.budgetSeconds = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--filter text] [--min-ms N] [--json out.json] [--baseline old.json] [--threshold pct]\n"
+                "       %s --budget seconds\n", argv[0], argv[0]);
+            return 2;
+        }
+    }
+    // Taken before the firmware runs on this thread, i.e. a controller at reset
+    FirmwareInstance pristine;
+    if (options.budgetSeconds > 0) {
+        return runBudget(options.budgetSeconds, pristine);
+    }
+    std::map<std::string, Result> baseline;
+    if (options.baselinePath) {
+        baseline = readJson(options.baselinePath);
+    }
+
+    printf("%-26s %12s %8s %8s %8s %8s %8s %9s", "benchmark", "ns/op", "i2c", "lcd chr", "lcd cmd", "show", "show us",
+        "dev us");
+    printf(options.baselinePath ? " %9s\n" : "\n", "vs base");
+    std::vector<Result> results;
+    bool regressed = false;
+    for (const Benchmark& benchmark : benchmarks()) {
+        if (options.filter && strstr(benchmark.name, options.filter) == NULL) {
+            continue;
+        }
+        Result r = run(benchmark, pristine, options.minMs);
+        results.push_back(r);
+        printf("%-26s %12.1f %8.3f %8.3f %8.3f %8.3f %8.1f %9.1f", r.name.c_str(), r.nsPerOp, r.i2c, r.lcdWrites,
+            r.lcdCommands, r.stripShows, r.stripMicros, r.deviceMicros);
+        if (options.baselinePath) {
+            auto old = baseline.find(r.name);
+            if (old == baseline.end() || old->second.nsPerOp <= 0) {
+                printf(" %9s", "new");
+            } else {
+                double change = (r.nsPerOp / old->second.nsPerOp - 1) * 100;
+                bool worse = change > options.threshold || moreCalls(r, old->second);
+                printf(" %+8.1f%%%s", change, worse ? " REGRESSED" : "");
+                regressed = regressed || worse;
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    if (options.jsonPath) {
+        writeJson(options.jsonPath, results);
+    }
+    return regressed ? 1 : 0;
+}
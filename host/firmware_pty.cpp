@@ -0,0 +1,196 @@
+// Runs the firmware natively in real time and exposes its UART on a PTY, so
+// host tools can talk to it exactly like to a board on /dev/ttyACM0.
+//
+//   g++ -std=c++17 -O2 -Ihost/arduino -Isrc/include src/impl/*.cpp host/arduino/HostBoard.cpp
+//       host/firmware_pty.cpp -o firmware_pty
+//   ./firmware_pty [--link /tmp/ha-room-controller] [--lcd]
+//
+// Inputs are driven from stdin, one command per line:
+//   press left|right|back|schedule [ms]   pir <room> on|off
+//   temp <room> <celsius>                  light <adc>          wheel <adc>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <string>
+#include "HostBoard.h"
+#include "hardware.h"
+#include "main.h"
+
+struct RoomPins {
+    int tempPin;
+    int pirPin;
+};
+
+static const RoomPins ROOM_PINS[] = {
+    { ROOM1_TEMP_SENSOR_PIN, ROOM1_PIR_PIN },
+    { ROOM2_TEMP_SENSOR_PIN, ROOM2_PIR_PIN }
+};
+
+static unsigned long buttonReleaseAt[HostBoard::PIN_COUNT];
+
+// TMP36: 10 mV per degree with a 500 mV offset
+static int tmp36Reading(float celsius) {
+    return (int)round((0.5 + celsius / 100.0) * 1023.0 / 5.0);
+}
+
+static int buttonPin(const char* name) {
+    if (strcmp(name, "left") == 0) return LEFT_BUTTON_PIN;
+    if (strcmp(name, "right") == 0) return RIGHT_BUTTON_PIN;
+    if (strcmp(name, "back") == 0) return BACK_BUTTON_PIN;
+    if (strcmp(name, "schedule") == 0) return SCHEDULE_BUTTON_PIN;
+    return -1;
+}
+
+static void handleInput(char* line) {
+    char* command = strtok(line, " \t\r\n");
+    char* arg1 = strtok(NULL, " \t\r\n");
+    char* arg2 = strtok(NULL, " \t\r\n");
+    if (command == NULL) {
+        return;
+    }
+    if (strcmp(command, "press") == 0 && arg1) {
+        int pin = buttonPin(arg1);
+        if (pin >= 0) {
+            hostBoard.digital[pin] = LOW;
+            buttonReleaseAt[pin] = millis() + (arg2 ? atoi(arg2) : 100);
+            return;
+        }
+    } else if (strcmp(command, "pir") == 0 && arg1 && arg2) {
+        int room = atoi(arg1) - 1;
+        if (room >= 0 && room < 2) {
+            hostBoard.digital[ROOM_PINS[room].pirPin] = strcmp(arg2, "on") == 0 ? HIGH : LOW;
+            return;
+        }
+    } else if (strcmp(command, "temp") == 0 && arg1 && arg2) {
+        int room = atoi(arg1) - 1;
+        if (room >= 0 && room < 2) {
+            hostBoard.analog[ROOM_PINS[room].tempPin] = tmp36Reading(atof(arg2));
+            return;
+        }
+    } else if (strcmp(command, "light") == 0 && arg1) {
+        hostBoard.analog[PHOTO_RESISTOR_PIN] = atoi(arg1);
+        return;
+    } else if (strcmp(command, "wheel") == 0 && arg1) {
+        hostBoard.analog[TIME_WHEEL_PIN] = atoi(arg1);
+        return;
+    }
+    fprintf(stderr, "unknown input: %s\n", command);
+}
+
+static void releaseButtons() {
+    unsigned long now = millis();
+    for (int pin = 0; pin < HostBoard::PIN_COUNT; pin++) {
+        if (buttonReleaseAt[pin] != 0 && (long)(now - buttonReleaseAt[pin]) >= 0) {
+            hostBoard.digital[pin] = HIGH;
+            buttonReleaseAt[pin] = 0;
+        }
+    }
+}
+
+static void printLcd(char last[2][17]) {
+    for (int row = 0; row < 2; row++) {
+        if (memcmp(last[row], mainDisplay.screen[row], 16) != 0) {
+            memcpy(last[row], mainDisplay.screen[row], 16);
+            fprintf(stderr, "lcd%d |%.16s|\n", row, last[row]);
+        }
+    }
+}
+
+static int openPty(const char* link) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("posix_openpt");
+        exit(1);
+    }
+    const char* slavePath = ptsname(master);
+    // Keep a raw slave handle open: no echo back into the firmware's RX,
+    // and the master does not see EIO while no client is connected.
+    int slave = open(slavePath, O_RDWR | O_NOCTTY);
+    termios tty;
+    tcgetattr(slave, &tty);
+    cfmakeraw(&tty);
+    tcsetattr(slave, TCSANOW, &tty);
+    if (link) {
+        unlink(link);
+        if (symlink(slavePath, link) != 0) {
+            perror(link);
+            exit(1);
+        }
+    }
+    printf("%s\n", link ? link : slavePath);
+    fflush(stdout);
+    return master;
+}
+
+int main(int argc, char** argv) {
+    const char* link = NULL;
+    bool showLcd = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--link") == 0 && i + 1 < argc) {
+            link = argv[++i];
+        } else if (strcmp(argv[i], "--lcd") == 0) {
+            showLcd = true;
+        }
+    }
+
+    int master = openPty(link);
+    hostBoard.realTime = true;
+    for (const RoomPins& room : ROOM_PINS) {
+        hostBoard.analog[room.tempPin] = tmp36Reading(22.0);
+        hostBoard.digital[room.pirPin] = LOW;
+    }
+    hostBoard.analog[PHOTO_RESISTOR_PIN] = 500;
+    setup();
+
+    char lcd[2][17] = {};
+    std::string input;
+    pollfd fds[2] = { { STDIN_FILENO, POLLIN, 0 }, { master, POLLIN, 0 } };
+    bool stdinOpen = true;
+    while (true) {
+        fds[0].fd = stdinOpen ? STDIN_FILENO : -1;
+        poll(fds, 2, 1);
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            char buffer[256];
+            ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (n <= 0) {
+                stdinOpen = false;
+            } else {
+                input.append(buffer, n);
+                size_t end;
+                while ((end = input.find('\n')) != std::string::npos) {
+                    std::string line = input.substr(0, end);
+                    input.erase(0, end + 1);
+                    handleInput(&line[0]);
+                }
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            uint8_t buffer[256];
+            ssize_t n = read(master, buffer, sizeof(buffer));
+            for (ssize_t i = 0; i < n; i++) {
+                hostBoard.serialRx.push_back(buffer[i]);
+            }
+        }
+
+        releaseButtons();
+        loop();
+        if (showLcd) {
+            printLcd(lcd);
+        }
+
+        if (!hostBoard.serialTx.empty()) {
+            ssize_t n = write(master, hostBoard.serialTx.data(), hostBoard.serialTx.size());
+            if (n > 0) {
+                hostBoard.serialTx.erase(hostBoard.serialTx.begin(), hostBoard.serialTx.begin() + n);
+            } else if (n < 0 && errno != EAGAIN) {
+                hostBoard.serialTx.clear();
+            }
+        }
+    }
+}
@@ -0,0 +1,537 @@
+// Runs many independent controllers against synthetic rooms on a
+// work-stealing thread pool, all on virtual time.
+//
+//   g++ -std=c++17 -O2 -pthread -Ihost/arduino -Ihost -Isrc/include src/impl/*.cpp
+//       host/arduino/HostBoard.cpp host/FirmwareInstance.cpp host/fleet_sim.cpp -o fleet_sim
+//   ./fleet_sim --instances 2000 --hours 2 [--threads N] [--tick-ms 10] [--chunk-s 60] [--scaling]
+//   ./fleet_sim --fork-at 6 --instances 26 --hours 2 [--threads N]
+//
+// Each controller gets a simulated house: occupancy that comes and goes with
+// PIR pulses while someone is in, a first-order thermal model per room that
+// reacts to the heating/cooling relays on the I2C expander, and daylight on
+// the photoresistor. While someone is home they now and then open a room on
+// the panel and go back to the welcome screen a few seconds later. The
+// report gives simulated controller-seconds per wall-second, a few policy
+// figures averaged over the fleet and the input-to-output latency of every
+// button press, PIR motion and command (LatencyTracker.h), to the tick.
+//
+// With --fork-at one house runs alone up to that hour and its controller is
+// saved as a binary snapshot (SystemSnapshot.h). Every instance then starts
+// from that house, with the snapshot restored into a freshly booted
+// controller and a different comfort setpoint and light schedule, and runs
+// --hours further. All forks see the same occupancy and weather, so the
+// per-variant report compares the settings alone.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "FirmwareInstance.h"
+#include "SystemSnapshot.h"
+
+struct SimOptions {
+    int instances = 500;
+    int threads = 0;
+    double hours = 1.0;
+    int tickMs = 10;
+    int chunkSeconds = 60;
+    bool scaling = false;
+    double forkHours = 0;
+};
+
+struct RoomTrace {
+    int tempPin;
+    int pirPin;
+    int heatingPin;
+    int coolingPin;
+    float temp;
+    bool occupied;
+    uint64_t nextPirUs;
+    uint64_t pirOffUs;
+};
+
+struct PolicyTotals {
+    double roomSeconds = 0;
+    double heatingSeconds = 0;
+    double coolingSeconds = 0;
+    double occupiedSeconds = 0;
+    double lightOnSeconds = 0;
+    double lightOnEmptySeconds = 0;
+    double degreeSeconds = 0;
+    // Settled latencies in ms, and events without a visible effect
+    std::vector<uint16_t> latencies[LATENCY_SOURCE_COUNT];
+    unsigned long noEffect[LATENCY_SOURCE_COUNT] = {};
+
+    void add(const PolicyTotals& other) {
+        roomSeconds += other.roomSeconds;
+        heatingSeconds += other.heatingSeconds;
+        coolingSeconds += other.coolingSeconds;
+        occupiedSeconds += other.occupiedSeconds;
+        lightOnSeconds += other.lightOnSeconds;
+        lightOnEmptySeconds += other.lightOnEmptySeconds;
+        degreeSeconds += other.degreeSeconds;
+        for (int source = 0; source < LATENCY_SOURCE_COUNT; source++) {
+            latencies[source].insert(latencies[source].end(), other.latencies[source].begin(),
+                other.latencies[source].end());
+            noEffect[source] += other.noEffect[source];
+        }
+    }
+};
+
+class SimController {
+public:
+    FirmwareInstance firmware;
+    RoomTrace rooms[ROOM_COUNT];
+    uint8_t expander = 0;
+    float outdoorTemp;
+    std::mt19937 rng;
+    // Panel use has its own stream, so the house is the same with or without it
+    std::mt19937 panelRng;
+    int panelPin = -1;
+    uint64_t panelReleaseUs = 0;
+    uint64_t panelBackUs = 0;
+    uint32_t latencySeen = 0;
+    uint64_t simulatedUs = 0;
+    uint64_t startUs = 0;
+    uint64_t endUs;
+    PolicyTotals totals;
+
+    SimController(unsigned seed, uint64_t durationUs) : rng(seed), panelRng(~seed), endUs(durationUs) {
+        std::uniform_real_distribution<float> startTemp(16.0, 26.0);
+        std::uniform_real_distribution<float> outdoor(-5.0, 32.0);
+        outdoorTemp = outdoor(rng);
+        const RoomConfig* configs[ROOM_COUNT] = { &firmware.room1.config, &firmware.room2.config };
+        for (int r = 0; r < ROOM_COUNT; r++) {
+            rooms[r] = { configs[r]->tempSensorPin, configs[r]->pirPin, configs[r]->heatingPin,
+                configs[r]->coolingPin, startTemp(rng), false, 0, 0 };
+            firmware.hostBoard.digital[rooms[r].pirPin] = LOW;
+            firmware.hostBoard.analog[rooms[r].tempPin] = tmp36Reading(rooms[r].temp);
+        }
+        watchExpander();
+    }
+
+    // Continues base's house, including its random stream, on a new
+    // controller that has not booted yet; see restore()
+    SimController(const SimController& base, uint64_t durationUs)
+        : expander(base.expander), outdoorTemp(base.outdoorTemp), rng(base.rng), panelRng(base.panelRng),
+          panelPin(base.panelPin), panelReleaseUs(base.panelReleaseUs), panelBackUs(base.panelBackUs),
+          simulatedUs(base.simulatedUs), startUs(base.simulatedUs), endUs(base.simulatedUs + durationUs) {
+        std::copy(base.rooms, base.rooms + ROOM_COUNT, rooms);
+        firmware.hostBoard.nowMicros = base.firmware.hostBoard.nowMicros;
+        memcpy(firmware.hostBoard.digital, base.firmware.hostBoard.digital, sizeof(firmware.hostBoard.digital));
+        memcpy(firmware.hostBoard.analog, base.firmware.hostBoard.analog, sizeof(firmware.hostBoard.analog));
+        watchExpander();
+    }
+
+    // Boots the controller and carries on from a snapshot. Must run with the
+    // instance swapped in.
+    bool restore(const std::vector<uint8_t>& snapshot) {
+        setup();
+        firmware.booted = true;
+        return restoreSnapshot(::rooms, ROOM_COUNT, snapshot.data(), snapshot.size());
+    }
+
+    // Advances this controller by up to chunkUs of virtual time. Must run
+    // with the instance swapped in. Returns true while there is more to do.
+    bool step(uint64_t chunkUs, uint64_t tickUs) {
+        if (!firmware.booted) {
+            setup();
+            firmware.booted = true;
+        }
+        uint64_t chunkEnd = std::min(simulatedUs + chunkUs, endUs);
+        while (simulatedUs < chunkEnd) {
+            updateInputs(tickUs);
+            uint64_t before = hostBoard.nowMicros;
+            loop();
+            hostBoard.nowMicros += tickUs;
+            uint64_t elapsed = hostBoard.nowMicros - before;
+            simulatedUs += elapsed;
+            account(elapsed / 1e6);
+            collectLatencies();
+        }
+        // Nobody reads the UART here; keep memory flat
+        hostBoard.serialTx.clear();
+        return simulatedUs < endUs;
+    }
+
+private:
+    void watchExpander() {
+        firmware.hostBoard.onI2CWrite = [this](uint8_t address, const uint8_t* data, uint8_t len) {
+            if (address == EXPANDER_ADDRESS && len == 1) {
+                expander = data[0];
+            }
+        };
+    }
+
+    static int tmp36Reading(float celsius) {
+        int reading = (int)lround((0.5 + celsius / 100.0) * 1023.0 / 5.0);
+        return reading < 0 ? 0 : (reading > 1023 ? 1023 : reading);
+    }
+
+    void updateInputs(uint64_t tickUs) {
+        double dt = tickUs / 1e6;
+        uint64_t now = hostBoard.nowMicros;
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        for (RoomTrace& room : rooms) {
+            // Someone arrives or leaves on average every 20 minutes
+            if (unit(rng) < dt / 1200.0) {
+                room.occupied = !room.occupied;
+                room.nextPirUs = now;
+            }
+            if (room.occupied && now >= room.nextPirUs) {
+                hostBoard.digital[room.pirPin] = HIGH;
+                room.pirOffUs = now + 1000000;
+                room.nextPirUs = now + (uint64_t)(5e6 + unit(rng) * 35e6);
+            }
+            if (hostBoard.digital[room.pirPin] == HIGH && now >= room.pirOffUs) {
+                hostBoard.digital[room.pirPin] = LOW;
+            }
+
+            // Heat loss towards outside over ~3 hours, relays move ~3 degrees/hour
+            bool heating = expander & (1 << room.heatingPin);
+            bool cooling = expander & (1 << room.coolingPin);
+            double rate = (outdoorTemp - room.temp) / (3 * 3600.0) + (heating ? 3 / 3600.0 : 0) - (cooling ? 3 / 3600.0 : 0);
+            room.temp += rate * dt;
+            hostBoard.analog[room.tempPin] = tmp36Reading(room.temp);
+        }
+        double dayFraction = fmod((START_TIME + ADDED_TIME + hostBoard.nowMicros / 1000) / 86400000.0, 1.0);
+        double daylight = sin((dayFraction - 0.25) * 2 * M_PI);
+        hostBoard.analog[PHOTO_RESISTOR_PIN] = 500 + (int)(200 * daylight);
+        updatePanel(dt, now);
+    }
+
+    // One room opened on the panel about every 10 minutes while someone is
+    // home, and back to the welcome screen 2-10 s later. Presses last 150 ms.
+    void updatePanel(double dt, uint64_t now) {
+        if (panelPin >= 0) {
+            if (now >= panelReleaseUs) {
+                hostBoard.digital[panelPin] = HIGH;
+                panelPin = -1;
+            }
+            return;
+        }
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        int pin = -1;
+        if (panelBackUs > 0 && now >= panelBackUs) {
+            pin = BACK_BUTTON_PIN;
+            panelBackUs = 0;
+        } else if (panelBackUs == 0 && (rooms[0].occupied || rooms[1].occupied) && unit(panelRng) < dt / 600.0) {
+            pin = unit(panelRng) < 0.5 ? LEFT_BUTTON_PIN : RIGHT_BUTTON_PIN;
+            panelBackUs = now + (uint64_t)(2e6 + unit(panelRng) * 8e6);
+        }
+        if (pin >= 0) {
+            hostBoard.digital[pin] = LOW;
+            panelPin = pin;
+            panelReleaseUs = now + 150000;
+        }
+    }
+
+    // Closes at most LatencyTracker::MAX_OPEN events a pass, so none are missed
+    void collectLatencies() {
+        for (; latencySeen != latency.closedCount(); latencySeen++) {
+            const LatencyEvent& event = latency.closedEvent(latencySeen);
+            if (event.outputs != 0) {
+                totals.latencies[event.source].push_back(event.settled);
+            } else {
+                totals.noEffect[event.source]++;
+            }
+        }
+    }
+
+    void account(double seconds) {
+        for (int r = 0; r < ROOM_COUNT; r++) {
+            const RoomControl& room = *::rooms[r];
+            totals.roomSeconds += seconds;
+            totals.degreeSeconds += rooms[r].temp * seconds;
+            if (room.acState == HEATING) totals.heatingSeconds += seconds;
+            if (room.acState == COOLING) totals.coolingSeconds += seconds;
+            if (rooms[r].occupied) totals.occupiedSeconds += seconds;
+            if (room.lightIntensity > 0) {
+                totals.lightOnSeconds += seconds;
+                if (!rooms[r].occupied) totals.lightOnEmptySeconds += seconds;
+            }
+        }
+    }
+};
+
+// Each worker pops from the back of its own deque and steals from the front
+// of the others when it runs dry. A task is one chunk of one controller; a
+// controller that still has time left goes back onto the executing worker.
+class WorkStealingPool {
+public:
+    struct WorkerStats {
+        unsigned long executed = 0;
+        unsigned long stolen = 0;
+    };
+
+    explicit WorkStealingPool(int threadCount) : workers(threadCount) {}
+
+    template <typename Step>
+    std::vector<WorkerStats> run(size_t taskCount, Step step) {
+        remaining = taskCount;
+        for (size_t i = 0; i < taskCount; i++) {
+            workers[i % workers.size()].tasks.push_back(i);
+        }
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < workers.size(); w++) {
+            threads.emplace_back([this, w, &step] { work(w, step); });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        std::vector<WorkerStats> stats;
+        for (Worker& worker : workers) {
+            stats.push_back(worker.stats);
+        }
+        return stats;
+    }
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+        WorkerStats stats;
+    };
+
+    std::deque<Worker> workers;
+    std::atomic<size_t> remaining;
+
+    bool popOwn(size_t self, size_t& task) {
+        std::lock_guard<std::mutex> guard(workers[self].lock);
+        if (workers[self].tasks.empty()) {
+            return false;
+        }
+        task = workers[self].tasks.back();
+        workers[self].tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t self, size_t& task) {
+        for (size_t offset = 1; offset < workers.size(); offset++) {
+            Worker& victim = workers[(self + offset) % workers.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename Step>
+    void work(size_t self, Step& step) {
+        Worker& worker = workers[self];
+        while (remaining.load() > 0) {
+            size_t task;
+            if (!popOwn(self, task)) {
+                if (!steal(self, task)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                worker.stats.stolen++;
+            }
+            worker.stats.executed++;
+            if (step(task)) {
+                std::lock_guard<std::mutex> guard(worker.lock);
+                worker.tasks.push_back(task);
+            } else {
+                remaining--;
+            }
+        }
+    }
+};
+
+struct RunResult {
+    double wallSeconds;
+    double controllerSeconds;
+    PolicyTotals totals;
+    std::vector<WorkStealingPool::WorkerStats> workers;
+};
+
+typedef std::vector<std::unique_ptr<SimController>> Fleet;
+
+static RunResult runControllers(const SimOptions& options, int threads, Fleet& fleet) {
+    uint64_t chunkUs = (uint64_t)options.chunkSeconds * 1000000;
+    uint64_t tickUs = (uint64_t)options.tickMs * 1000;
+    WorkStealingPool pool(threads);
+    auto start = std::chrono::steady_clock::now();
+    RunResult result;
+    result.workers = pool.run(fleet.size(), [&](size_t index) {
+        SimController& controller = *fleet[index];
+        ActiveInstance active(controller.firmware);
+        return controller.step(chunkUs, tickUs);
+    });
+    result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.controllerSeconds = 0;
+    for (auto& controller : fleet) {
+        result.controllerSeconds += (controller->simulatedUs - controller->startUs) / 1e6;
+        result.totals.add(controller->totals);
+    }
+    return result;
+}
+
+static RunResult runFleet(const SimOptions& options, int threads) {
+    uint64_t durationUs = (uint64_t)(options.hours * 3600e6);
+    Fleet fleet;
+    for (int i = 0; i < options.instances; i++) {
+        fleet.emplace_back(new SimController(1000 + i, durationUs));
+    }
+    return runControllers(options, threads, fleet);
+}
+
+static void printLatencies(const PolicyTotals& totals) {
+    static const char* const NAMES[LATENCY_SOURCE_COUNT] = { "button", "motion", "command" };
+    for (int source = 0; source < LATENCY_SOURCE_COUNT; source++) {
+        std::vector<uint16_t> ms = totals.latencies[source];
+        if (ms.empty() && totals.noEffect[source] == 0) {
+            continue;
+        }
+        printf("latency %s: settled=%zu no_effect=%lu", NAMES[source], ms.size(), totals.noEffect[source]);
+        if (!ms.empty()) {
+            std::sort(ms.begin(), ms.end());
+            printf(" p50=%ums p99=%ums max=%ums", ms[(ms.size() - 1) / 2], ms[(ms.size() - 1) * 99 / 100], ms.back());
+        }
+        printf("\n");
+    }
+}
+
+static void printResult(const SimOptions& options, int threads, const RunResult& result, bool details) {
+    printf("threads=%d instances=%d wall=%.2fs controller_s=%.0f controller_s_per_wall_s=%.0f\n",
+        threads, options.instances, result.wallSeconds, result.controllerSeconds,
+        result.controllerSeconds / result.wallSeconds);
+    if (!details) {
+        return;
+    }
+    for (size_t w = 0; w < result.workers.size(); w++) {
+        printf("  worker %zu: chunks=%lu stolen=%lu\n", w, result.workers[w].executed, result.workers[w].stolen);
+    }
+    const PolicyTotals& t = result.totals;
+    printf("policy: heating=%.1f%% cooling=%.1f%% occupied=%.1f%% light_on=%.1f%% light_on_while_empty=%.1f%%\n",
+        100 * t.heatingSeconds / t.roomSeconds, 100 * t.coolingSeconds / t.roomSeconds,
+        100 * t.occupiedSeconds / t.roomSeconds, 100 * t.lightOnSeconds / t.roomSeconds,
+        100 * t.lightOnEmptySeconds / t.roomSeconds);
+    printLatencies(t);
+}
+
+struct Variant {
+    float setpoint;
+    // Light level scheduled for every hour, 0 for none
+    int scheduledLight;
+};
+
+// Comfort setpoints from 16 to 22 degrees, each without and with the lights
+// scheduled on all day
+static Variant variantFor(int index) {
+    return { 16.0f + 0.5f * ((index / 2) % 13), index % 2 == 0 ? 0 : 2 };
+}
+
+static int runWhatIf(const SimOptions& options, int threads) {
+    uint64_t chunkUs = (uint64_t)options.chunkSeconds * 1000000;
+    uint64_t tickUs = (uint64_t)options.tickMs * 1000;
+    SimController base(1000, (uint64_t)(options.forkHours * 3600e6));
+    std::vector<uint8_t> snapshot(snapshotSize(ROOM_COUNT));
+    {
+        ActiveInstance active(base.firmware);
+        while (base.step(chunkUs, tickUs)) {
+        }
+        snapshot.resize(saveSnapshot(::rooms, ROOM_COUNT, snapshot.data(), snapshot.size()));
+    }
+
+    uint64_t durationUs = (uint64_t)(options.hours * 3600e6);
+    Fleet fleet;
+    for (int i = 0; i < options.instances; i++) {
+        fleet.emplace_back(new SimController(base, durationUs));
+        ActiveInstance active(fleet.back()->firmware);
+        if (!fleet.back()->restore(snapshot)) {
+            fprintf(stderr, "snapshot of %zu bytes was rejected\n", snapshot.size());
+            return 1;
+        }
+        // Saving right after a restore must give back the same bytes
+        if (i == 0) {
+            std::vector<uint8_t> again(snapshotSize(ROOM_COUNT));
+            again.resize(saveSnapshot(::rooms, ROOM_COUNT, again.data(), again.size()));
+            if (again != snapshot) {
+                fprintf(stderr, "snapshot does not survive a restore\n");
+                return 1;
+            }
+        }
+        Variant variant = variantFor(i);
+        for (RoomControl* room : ::rooms) {
+            bool setback = room->setback;
+            room->setTarget(variant.setpoint);
+            if (setback) {
+                room->enterSetback();
+            }
+            for (int h = 0; h < 24; h++) {
+                room->setScheduledLevel(h, variant.scheduledLight);
+            }
+        }
+    }
+    printf("fork: snapshot at %.1f h, %zu bytes (version %d), %d variants\n",
+        options.forkHours, snapshot.size(), SNAPSHOT_VERSION, options.instances);
+
+    RunResult result = runControllers(options, threads, fleet);
+    printResult(options, threads, result, true);
+    for (int i = 0; i < options.instances; i++) {
+        Variant variant = variantFor(i);
+        const PolicyTotals& t = fleet[i]->totals;
+        printf("  setpoint=%.1f schedule=%d heating=%.1f%% cooling=%.1f%% light_on=%.1f%% mean_temp=%.2f\n",
+            variant.setpoint, variant.scheduledLight,
+            100 * t.heatingSeconds / t.roomSeconds, 100 * t.coolingSeconds / t.roomSeconds,
+            100 * t.lightOnSeconds / t.roomSeconds, t.degreeSeconds / t.roomSeconds);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    SimOptions options;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--instances") == 0 && hasValue) {
+            options.instances = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            options.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hours") == 0 && hasValue) {
+            options.hours = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--tick-ms") == 0 && hasValue) {
+            options.tickMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--chunk-s") == 0 && hasValue) {
+            options.chunkSeconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scaling") == 0) {
+            options.scaling = true;
+        } else if (strcmp(argv[i], "--fork-at") == 0 && hasValue) {
+            options.forkHours = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--instances N] [--threads N] [--hours H] [--tick-ms MS] [--chunk-s S] [--scaling] [--fork-at H]\n", argv[0]);
+            return 2;
+        }
+    }
+    int maxThreads = options.threads > 0 ? options.threads : (int)std::thread::hardware_concurrency();
+    if (maxThreads < 1) {
+        maxThreads = 1;
+    }
+    if (options.instances < 1 || options.tickMs < 1 || options.chunkSeconds < 1) {
+        fprintf(stderr, "instances, tick and chunk must be positive\n");
+        return 2;
+    }
+
+    if (options.forkHours > 0) {
+        return runWhatIf(options, maxThreads);
+    }
+    if (options.scaling) {
+        for (int threads = 1; threads < maxThreads; threads *= 2) {
+            printResult(options, threads, runFleet(options, threads), false);
+        }
+    }
+    printResult(options, maxThreads, runFleet(options, maxThreads), true);
+    return 0;
+}
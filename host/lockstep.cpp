@@ -0,0 +1,368 @@
+// Runs two builds of the firmware side by side on the same inputs and
+// compares what they drive on every tick: the expander byte, the NeoPixel
+// buffer, the LCD and the clock. Meant for checking that an optimisation of
+// the control logic leaves its behaviour alone.
+//
+//   git worktree add ../reference HEAD
+//   tools/amalgamate.py --namespace reference --source ../reference/src --output build/reference.cpp
+//   tools/amalgamate.py --namespace candidate --output build/candidate.cpp
+//   g++ -std=c++17 -O2 -pthread -Ihost/arduino -Ihost -Isrc/include -Itools build/reference.cpp
+//       build/candidate.cpp host/arduino/HostBoard.cpp host/lockstep.cpp -o lockstep
+//   ./lockstep [--ticks 10000000] [--seed 1] [--chunk 65536]
+//   ./lockstep --trace capture.bin
+//
+// The two builds are the amalgamated firmware wrapped in different
+// namespaces. Each runs on its own thread, so each has its own thread-local
+// firmware state and host board. A tick is one loop() pass followed by one
+// millisecond of virtual time. The threads run a chunk of ticks at a time,
+// and their outputs are compared tick by tick between chunks. The first
+// tick that differs is reported and the exit status is 1.
+//
+// Inputs are either a seeded random stream (host/RandomInputs.h) or a
+// recorded input trace (see host/trace_replay.cpp).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "RandomInputs.h"
+#include "TraceCapture.h"
+
+#define FIRMWARE_BUILD_API \
+    void setup(); \
+    void loop(); \
+    extern thread_local LiquidCrystal mainDisplay; \
+    extern thread_local Adafruit_NeoPixel strip;
+
+namespace reference {
+FIRMWARE_BUILD_API
+}
+
+namespace candidate {
+FIRMWARE_BUILD_API
+}
+
+#undef FIRMWARE_BUILD_API
+
+struct FirmwareBuild {
+    const char* name;
+    void (*setup)();
+    void (*loop)();
+    // Thread-local, so these must be called on the build's own thread
+    LiquidCrystal& (*display)();
+    Adafruit_NeoPixel& (*strip)();
+};
+
+static const FirmwareBuild BUILDS[2] = {
+    { "reference", reference::setup, reference::loop,
+        []() -> LiquidCrystal& { return reference::mainDisplay; },
+        []() -> Adafruit_NeoPixel& { return reference::strip; } },
+    { "candidate", candidate::setup, candidate::loop,
+        []() -> LiquidCrystal& { return candidate::mainDisplay; },
+        []() -> Adafruit_NeoPixel& { return candidate::strip; } }
+};
+
+// Pixels kept as they are for the report; longer strips are only compared
+// by their hash beyond these
+static const int REPORT_PIXELS = 16;
+
+struct TickOutputs {
+    uint32_t millis;
+    uint8_t expander;
+    bool lcdVisible;
+    uint16_t pixelCount;
+    uint32_t pixelHash;
+    uint8_t pixels[REPORT_PIXELS * 3];
+    char lcd[LiquidCrystal::ROWS][LiquidCrystal::COLS];
+
+    bool sameClock(const TickOutputs& other) const {
+        return millis == other.millis;
+    }
+
+    bool sameExpander(const TickOutputs& other) const {
+        return expander == other.expander;
+    }
+
+    bool samePixels(const TickOutputs& other) const {
+        return pixelCount == other.pixelCount && pixelHash == other.pixelHash;
+    }
+
+    bool sameLcd(const TickOutputs& other) const {
+        return lcdVisible == other.lcdVisible && memcmp(lcd, other.lcd, sizeof(lcd)) == 0;
+    }
+
+    bool operator==(const TickOutputs& other) const {
+        return sameClock(other) && sameExpander(other) && samePixels(other) && sameLcd(other);
+    }
+};
+
+static uint32_t fnv1a(const uint8_t* data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Inputs for one lane. Both lanes get their own copy and must see exactly
+// the same stream.
+class InputSource {
+public:
+    virtual ~InputSource() {}
+    // Inputs present at power-up
+    virtual void boot() = 0;
+    // Inputs for the coming tick
+    virtual void apply() = 0;
+};
+
+class RandomSource : public InputSource {
+public:
+    explicit RandomSource(uint32_t seed) : inputs(seed) {}
+
+    void boot() override {
+        inputs.boot();
+    }
+
+    void apply() override {
+        inputs.apply();
+    }
+
+private:
+    RandomInputs inputs;
+};
+
+// Recorded inputs, applied at the millisecond they were recorded like
+// trace_replay does
+class TraceInputs : public InputSource {
+public:
+    explicit TraceInputs(const std::vector<TraceEvent>& events) : events(events) {}
+
+    void boot() override {
+        applyTraceEvent(events.front());
+    }
+
+    void apply() override {
+        while (next < events.size() && events[next].time <= millis()) {
+            applyTraceEvent(events[next++]);
+        }
+    }
+
+private:
+    const std::vector<TraceEvent>& events;
+    size_t next = 0;
+};
+
+// One build on its own thread, stepped a chunk of ticks at a time
+class Lane {
+public:
+    std::vector<TickOutputs> outputs;
+
+    Lane(const FirmwareBuild& build, std::unique_ptr<InputSource> inputs)
+        : build(build), inputs(std::move(inputs)), thread([this] { work(); }) {}
+
+    ~Lane() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            quit = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+    void start(uint64_t ticks) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            pending = ticks;
+        }
+        wake.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [this] { return pending == 0; });
+    }
+
+private:
+    const FirmwareBuild& build;
+    std::unique_ptr<InputSource> inputs;
+    std::mutex lock;
+    std::condition_variable wake;
+    uint64_t pending = 0;
+    bool quit = false;
+    uint8_t expander = 0;
+    std::thread thread;
+
+    void work() {
+        hostBoard.onI2CWrite = [this](uint8_t address, const uint8_t* data, uint8_t len) {
+            if (address == EXPANDER_ADDRESS && len == 1) {
+                expander = data[0];
+            }
+        };
+        inputs->boot();
+        build.setup();
+        while (true) {
+            uint64_t ticks;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [this] { return pending > 0 || quit; });
+                if (quit) {
+                    return;
+                }
+                ticks = pending;
+            }
+            outputs.resize(ticks);
+            for (TickOutputs& out : outputs) {
+                inputs->apply();
+                build.loop();
+                // Nobody reads the UART here; keep memory flat
+                hostBoard.serialTx.clear();
+                capture(out);
+                hostBoard.nowMicros += 1000;
+            }
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                pending = 0;
+            }
+            wake.notify_all();
+        }
+    }
+
+    void capture(TickOutputs& out) {
+        out.millis = millis();
+        out.expander = expander;
+        const LiquidCrystal& display = build.display();
+        out.lcdVisible = display.visible;
+        memcpy(out.lcd, display.screen, sizeof(out.lcd));
+        const Adafruit_NeoPixel& strip = build.strip();
+        out.pixelCount = strip.numPixels();
+        size_t bytes = out.pixelCount * 3;
+        out.pixelHash = fnv1a(strip.getPixels(), bytes);
+        memset(out.pixels, 0, sizeof(out.pixels));
+        memcpy(out.pixels, strip.getPixels(), std::min(bytes, sizeof(out.pixels)));
+    }
+};
+
+static void printPixels(const TickOutputs& out) {
+    for (int i = 0; i < std::min<int>(out.pixelCount, REPORT_PIXELS); i++) {
+        // Buffer order is GRB
+        printf(" %02x%02x%02x", out.pixels[i * 3 + 1], out.pixels[i * 3], out.pixels[i * 3 + 2]);
+    }
+    printf("%s\n", out.pixelCount > REPORT_PIXELS ? " ..." : "");
+}
+
+static void printLcd(const TickOutputs& out) {
+    for (int row = 0; row < LiquidCrystal::ROWS; row++) {
+        printf(" \"");
+        for (char c : out.lcd[row]) {
+            putchar(c >= ' ' && c < 127 ? c : '?');
+        }
+        printf("\"");
+    }
+    printf("%s\n", out.lcdVisible ? "" : " (off)");
+}
+
+static void reportDivergence(uint64_t tick, const TickOutputs outs[2]) {
+    const TickOutputs& ref = outs[0];
+    const TickOutputs& cand = outs[1];
+    printf("first divergence at tick %llu:\n", (unsigned long long)tick);
+    for (int b = 0; b < 2; b++) {
+        printf("  %-9s millis %-10u expander 0x%02x%s%s%s\n", BUILDS[b].name, outs[b].millis, outs[b].expander,
+            ref.sameClock(cand) ? "" : "  *clock", ref.sameExpander(cand) ? "" : "  *expander",
+            ref.samePixels(cand) ? "" : "  *pixels");
+        printf("            pixels");
+        printPixels(outs[b]);
+        printf("            lcd%s", ref.sameLcd(cand) ? "" : "*");
+        printLcd(outs[b]);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t ticks = 0;
+    uint32_t seed = 1;
+    uint64_t chunk = 65536;
+    const char* tracePath = NULL;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--ticks") == 0 && hasValue) {
+            ticks = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+            seed = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--chunk") == 0 && hasValue) {
+            chunk = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--trace") == 0 && hasValue) {
+            tracePath = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--ticks N] [--seed S] [--chunk N] [--trace capture.bin]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (chunk < 1) {
+        fprintf(stderr, "chunk must be positive\n");
+        return 2;
+    }
+
+    CaptureReader reader;
+    if (tracePath != NULL) {
+        FILE* in = fopen(tracePath, "rb");
+        if (in == NULL) {
+            perror(tracePath);
+            return 2;
+        }
+        uint8_t buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+            reader.feed(buffer, n);
+        }
+        fclose(in);
+        if (reader.events.empty()) {
+            fprintf(stderr, "%s: no trace records (was SET TRACE 1 sent?)\n", tracePath);
+            return 2;
+        }
+        // Past the last record, plus time for its effects to show
+        if (ticks == 0) {
+            ticks = reader.events.back().time + 3000;
+        }
+    } else if (ticks == 0) {
+        ticks = 10000000;
+    }
+
+    std::unique_ptr<Lane> lanes[2];
+    for (int b = 0; b < 2; b++) {
+        std::unique_ptr<InputSource> inputs;
+        if (tracePath != NULL) {
+            inputs.reset(new TraceInputs(reader.events));
+        } else {
+            inputs.reset(new RandomSource(seed));
+        }
+        lanes[b].reset(new Lane(BUILDS[b], std::move(inputs)));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t done = 0; done < ticks; done += chunk) {
+        uint64_t count = std::min(chunk, ticks - done);
+        for (auto& lane : lanes) {
+            lane->start(count);
+        }
+        for (auto& lane : lanes) {
+            lane->wait();
+        }
+        const std::vector<TickOutputs>& ref = lanes[0]->outputs;
+        const std::vector<TickOutputs>& cand = lanes[1]->outputs;
+        auto mismatch = std::mismatch(ref.begin(), ref.end(), cand.begin());
+        if (mismatch.first != ref.end()) {
+            TickOutputs outs[2] = { *mismatch.first, *mismatch.second };
+            reportDivergence(done + (mismatch.first - ref.begin()), outs);
+            return 1;
+        }
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("lockstep: %llu ticks (%.1f s virtual) in %.2f s wall, %.2f M ticks/s, outputs identical\n",
+        (unsigned long long)ticks, lanes[0]->outputs.back().millis / 1000.0, wall, ticks / wall / 1e6);
+    return 0;
+}
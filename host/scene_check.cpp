@@ -0,0 +1,86 @@
+// Checks that a scene applied to an empty room only moves its comfort
+// setpoint: the room stays at the setback and warms up to the scene's
+// temperature once someone comes in.
+//
+//   g++ -std=c++17 -O2 -Ihost/arduino -Ihost -Isrc/include -Itools src/impl/*.cpp host/arduino/HostBoard.cpp
+//       host/scene_check.cpp -o scene_check
+//   ./scene_check
+//
+// HOME (22 °C) is applied over Serial to room 1 after it was left empty,
+// to room 2 with nobody in it since boot, and to room 1 again while it is
+// inactive but not yet empty. The exit status is 1 if any room ends up
+// somewhere it should not.
+
+#include <stdio.h>
+#include "HostBoard.h"
+#include "hardware.h"
+#include "main.h"
+
+static const float HOME_TEMP = 22.0;
+
+static int failures = 0;
+
+static void run(unsigned long ms) {
+    for (unsigned long i = 0; i < ms; i++) {
+        loop();
+        hostBoard.serialTx.clear();
+        hostBoard.nowMicros += 1000;
+    }
+}
+
+static void command(const char* text) {
+    for (const char* c = text; *c; c++) {
+        hostBoard.serialRx.push_back(*c);
+    }
+    hostBoard.serialRx.push_back('\n');
+    run(500);
+}
+
+static void motion(int pin) {
+    hostBoard.digital[pin] = HIGH;
+    run(1000);
+    hostBoard.digital[pin] = LOW;
+    run(500);
+}
+
+static void expect(const char* what, const RoomControl& room, float target, float comfort, bool setback) {
+    bool ok = room.targetTemp == target && room.comfortTemp == comfort && room.setback == setback;
+    printf("%s %s: target=%.1f comfort=%.1f setback=%d\n", ok ? "ok  " : "FAIL", what, room.targetTemp,
+        room.comfortTemp, room.setback);
+    failures += ok ? 0 : 1;
+}
+
+int main() {
+    hostBoard.analog[ROOM1_TEMP_SENSOR_PIN] = 147;
+    hostBoard.analog[ROOM2_TEMP_SENSOR_PIN] = 150;
+    hostBoard.analog[PHOTO_RESISTOR_PIN] = 500;
+    hostBoard.digital[ROOM1_PIR_PIN] = LOW;
+    hostBoard.digital[ROOM2_PIR_PIN] = LOW;
+    setup();
+    // Motion within 2 s of boot counts as the same motion
+    run(3000);
+
+    motion(ROOM1_PIR_PIN);
+    run(30000);
+    expect("room 1 left empty", room1, SETBACK_TEMP, room1.comfortTemp, true);
+
+    command("SET SCENE HOME");
+    expect("room 1 empty after HOME", room1, SETBACK_TEMP, HOME_TEMP, true);
+    expect("room 2 empty since boot after HOME", room2, SETBACK_TEMP, HOME_TEMP, true);
+
+    motion(ROOM1_PIR_PIN);
+    expect("room 1 after motion", room1, HOME_TEMP, HOME_TEMP, false);
+    expect("room 2 still empty", room2, SETBACK_TEMP, HOME_TEMP, true);
+
+    command("SET 1 TARGET 21");
+    run(16000);
+    expect("room 1 inactive", room1, SETBACK_TEMP, 21.0, true);
+    command("SET SCENE HOME");
+    expect("room 1 inactive after HOME", room1, SETBACK_TEMP, HOME_TEMP, true);
+    run(5000);
+    expect("room 1 empty again", room1, SETBACK_TEMP, HOME_TEMP, true);
+    motion(ROOM1_PIR_PIN);
+    expect("room 1 after motion", room1, HOME_TEMP, HOME_TEMP, false);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,172 @@
+// Replays an input trace recorded by the firmware (SET TRACE 1) through the
+// unchanged firmware on a virtual clock, and compares the telemetry it
+// produces with the telemetry recorded alongside the trace.
+//
+//   g++ -std=c++17 -O2 -Ihost/arduino -Ihost -Isrc/include -Itools src/impl/*.cpp host/arduino/HostBoard.cpp
+//       host/trace_replay.cpp -o trace_replay
+//   ./trace_replay capture.bin [--report 10]
+//
+// capture.bin is the raw byte stream read from the controller's Serial port,
+// e.g. `stty -F /dev/ttyACM0 9600 raw && cat /dev/ttyACM0 > capture.bin`.
+// The replayed controller boots at millis() 0 with the inputs of the first
+// START record and gets every recorded input change and command at the
+// millisecond it was recorded. A trace that did not start at boot can
+// diverge because of state built up before recording began. The exit
+// status is 1 if any compared telemetry sample differs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "main.h"
+#include "PowerManager.h"
+#include "TraceCapture.h"
+
+// Inputs are held for this long after the last record so its effects show
+// up in the telemetry
+static const unsigned long TAIL_MS = 3000;
+
+// Telemetry of the replayed controller, by uptime
+class ReplayTelemetry : public TelemetryDecoder {
+public:
+    std::map<int32_t, TelemetryRecord> records;
+
+protected:
+    void onRecord(const TelemetryRecord& record) override {
+        records[record.values[FIELD_UPTIME_MS]] = record;
+    }
+};
+
+static std::string fieldName(int field) {
+    static const char* globalNames[GLOBAL_FIELD_COUNT] = { "uptime", "clock", "outdoor light" };
+    static const char* roomNames[ROOM_FIELD_COUNT] = { "temp", "target", "light", "flags" };
+    if (field < GLOBAL_FIELD_COUNT) {
+        return globalNames[field];
+    }
+    int room = (field - GLOBAL_FIELD_COUNT) / ROOM_FIELD_COUNT;
+    return "room" + std::to_string(room + 1) + " " + roomNames[(field - GLOBAL_FIELD_COUNT) % ROOM_FIELD_COUNT];
+}
+
+static std::vector<uint8_t> readFile(const char* path) {
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) {
+        perror(path);
+        exit(2);
+    }
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(in);
+    return data;
+}
+
+int main(int argc, char** argv) {
+    const char* path = NULL;
+    int reportLimit = 10;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            reportLimit = atoi(argv[++i]);
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "usage: %s capture.bin [--report N]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<uint8_t> capture = readFile(path);
+    CaptureReader reader;
+    reader.feed(capture.data(), capture.size());
+    if (reader.events.empty()) {
+        fprintf(stderr, "%s: no trace records (was SET TRACE 1 sent?)\n", path);
+        return 2;
+    }
+    const std::vector<TraceEvent>& events = reader.events;
+    uint32_t traceStart = events.front().time;
+    uint32_t traceEnd = events.back().time;
+    printf("trace: %zu records, %.1f s from uptime %.1f s, %lu records skipped after lost frames\n",
+        events.size(), (traceEnd - traceStart) / 1000.0, traceStart / 1000.0, reader.skippedRecords);
+
+    applyTraceEvent(events.front());
+    setup();
+    ReplayTelemetry replayed;
+    std::vector<double> passNanos;
+    size_t next = 0;
+    auto wallStart = std::chrono::steady_clock::now();
+    // setup() takes time of its own, so events go by millis(), not by pass
+    while (millis() <= traceEnd + TAIL_MS) {
+        while (next < events.size() && events[next].time <= millis()) {
+            applyTraceEvent(events[next++]);
+        }
+        uint32_t before = power.passes();
+        auto start = std::chrono::steady_clock::now();
+        loop();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        if (power.passes() != before && millis() >= traceStart) {
+            passNanos.push_back(ns);
+        }
+        replayed.feed(hostBoard.serialTx.data(), hostBoard.serialTx.size());
+        hostBoard.serialTx.clear();
+        hostBoard.nowMicros += 1000;
+    }
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+
+    double virtualMs = traceEnd + TAIL_MS;
+    printf("replay: %.1f s virtual in %.1f ms wall (%.0fx real time)\n", virtualMs / 1000, wallMs, virtualMs / wallMs);
+    if (!passNanos.empty()) {
+        std::sort(passNanos.begin(), passNanos.end());
+        double total = 0;
+        for (double ns : passNanos) {
+            total += ns;
+        }
+        printf("loop passes: %zu, mean %.0f ns, p50 %.0f ns, p99 %.0f ns, max %.0f ns (host)\n", passNanos.size(),
+            total / passNanos.size(), passNanos[passNanos.size() / 2], passNanos[passNanos.size() * 99 / 100],
+            passNanos.back());
+    }
+
+    unsigned long compared = 0;
+    unsigned long diverged = 0;
+    unsigned long unmatched = 0;
+    for (const TelemetryRecord& recorded : reader.records) {
+        int32_t uptime = recorded.values[FIELD_UPTIME_MS];
+        if (uptime < (int32_t)traceStart || uptime > (int32_t)traceEnd) {
+            continue;
+        }
+        auto found = replayed.records.find(uptime);
+        if (found == replayed.records.end()) {
+            unmatched++;
+            continue;
+        }
+        compared++;
+        const TelemetryRecord& replay = found->second;
+        int fieldCount = GLOBAL_FIELD_COUNT + recorded.roomCount * ROOM_FIELD_COUNT;
+        bool differs = replay.roomCount != recorded.roomCount;
+        for (int i = 1; i < fieldCount; i++) {
+            if (replay.values[i] == recorded.values[i]) {
+                continue;
+            }
+            if (!differs && (long)diverged < reportLimit) {
+                printf("  t=%d ms %s: recorded %d, replayed %d\n", uptime, fieldName(i).c_str(),
+                    recorded.values[i], replay.values[i]);
+            }
+            differs = true;
+        }
+        if (differs) {
+            diverged++;
+        }
+    }
+    printf("telemetry: %lu samples compared, %lu diverged, %lu without a replayed sample at the same uptime\n",
+        compared, diverged, unmatched);
+    return diverged > 0 ? 1 : 0;
+}
@@ -0,0 +1,49 @@
+#include "ButtonRepeat.h"
+
+ButtonRepeat::ButtonRepeat() : held(0), blocked(false), repeats(0), stepSize(1), nextRepeat(0), releasedAt(0) {}
+
+// Returns how many steps to move in the given direction (-1, 0 or 1) on
+// this pass: one on the press, none until the initial delay has passed,
+// then a growing number per interval while the button stays down.
+int ButtonRepeat::steps(int8_t direction, unsigned long now, RepeatRate rate) {
+    if (direction == 0) {
+        if (held != 0) {
+            releasedAt = now;
+        }
+        held = 0;
+        blocked = false;
+        return 0;
+    }
+    if (blocked) {
+        return 0;
+    }
+    if (direction != held) {
+        bool bounce = held == 0 && now - releasedAt < DEBOUNCE_MS;
+        held = direction;
+        repeats = 0;
+        stepSize = 1;
+        nextRepeat = now + rate.initialDelay;
+        return bounce ? 0 : direction;
+    }
+    if (rate.interval == 0 || (long)(now - nextRepeat) < 0) {
+        return 0;
+    }
+    // Keep the cadence when a pass is a little late, but don't catch up
+    // on a backlog of missed repeats
+    nextRepeat += rate.interval;
+    if ((long)(now - nextRepeat) >= 0) {
+        nextRepeat = now + rate.interval;
+    }
+    int step = stepSize;
+    if (++repeats >= rate.accelerateAfter && stepSize < rate.maxStep) {
+        repeats = 0;
+        stepSize = min(stepSize * 2, (int)rate.maxStep);
+    }
+    return direction * step;
+}
+
+// Ignores the buttons until both are released, so a press that opened a
+// menu does not also adjust its value
+void ButtonRepeat::suppress() {
+    blocked = true;
+}
@@ -0,0 +1,380 @@
+#include "hardware.h"
+#include "general.h"
+#include "Telemetry.h"
+#include "CommandInterface.h"
+#include "Watchdog.h"
+#include "I2CBus.h"
+#include "PowerManager.h"
+#include "InputTrace.h"
+#include "MemoryMonitor.h"
+#include "SceneLibrary.h"
+#include "LatencyTracker.h"
+
+INSTANCE_STATE CommandInterface commands;
+
+static const char ROOM_SETTING_NAMES[CommandInterface::SETTING_COUNT][7] PROGMEM = {
+    "SCHED", "TARGET", "LIGHT"
+};
+
+// Returns the length written. The sign goes separately, or -0.5 would
+// lose it to the integer part.
+static int formatTenths(char* buffer, size_t size, float value) {
+    int tenths = (int)round(value * 10);
+    return snprintf_P(buffer, size, tenths < 0 ? PSTR("-%d.%d") : PSTR("%d.%d"), abs(tenths) / 10, abs(tenths) % 10);
+}
+
+// The whole token must be a number: "1x" is rejected rather than read as 1
+static bool parseLong(const char* text, long& value) {
+    char* end;
+    value = strtol(text, &end, 10);
+    return end != text && *end == '\0';
+}
+
+static bool parseFloat(const char* text, float& value) {
+    char* end;
+    value = strtod(text, &end);
+    return end != text && *end == '\0';
+}
+
+CommandInterface::CommandInterface()
+    : lineLength(0), overflow(false), lineReady(false), lineTime(0), dumpStep(-1) {}
+
+// Consumes whatever is already in the RX buffer; never waits for more.
+// A complete line is only executed once its reply is sure to fit into the
+// TX buffer, otherwise it is kept and the rest stays queued in the UART.
+void CommandInterface::poll(RoomControl* const rooms[], int roomCount) {
+    continueDump(rooms, roomCount);
+    while (dumpStep < 0 && (lineReady || Serial.available() > 0)) {
+        if (lineReady) {
+            if (telemetry.txFree() < REPLY_RESERVE) {
+                return;
+            }
+            if (overflow) {
+                telemetry.sendText_P(PSTR("ERR too long"));
+            } else if (lineLength > 0) {
+                line[lineLength] = '\0';
+                execute(rooms, roomCount);
+            }
+            lineLength = 0;
+            overflow = false;
+            lineReady = false;
+            continueDump(rooms, roomCount);
+            continue;
+        }
+        char c = Serial.read();
+        if (c == '\r') {
+            continue;
+        }
+        if (c == '\n') {
+            lineReady = true;
+            lineTime = millis();
+        } else if (lineLength < LINE_SIZE - 1) {
+            line[lineLength++] = c;
+        } else {
+            overflow = true;
+        }
+    }
+}
+
+void CommandInterface::execute(RoomControl* const rooms[], int roomCount) {
+    inputTrace.command(line);
+    latency.open(LATENCY_COMMAND, lineTime);
+    char* command = strtok(line, " ");
+    if (command == NULL) {
+        return;
+    }
+    if (strcmp_P(command, PSTR("DUMP")) == 0) {
+        dumpStep = 0;
+        return;
+    }
+    bool set = strcmp_P(command, PSTR("SET")) == 0;
+    bool save = strcmp_P(command, PSTR("SAVE")) == 0;
+    if (!set && !save && strcmp_P(command, PSTR("GET")) != 0) {
+        telemetry.sendText_P(PSTR("ERR command"));
+        return;
+    }
+    char* target = strtok(NULL, " ");
+    if (target == NULL) {
+        telemetry.sendText_P(PSTR("ERR syntax"));
+        return;
+    }
+    if (strcmp_P(target, PSTR("SCENE")) == 0) {
+        handleSceneCommand(set, save, strtok(NULL, " "), rooms, roomCount);
+        return;
+    }
+    if (save) {
+        telemetry.sendText_P(PSTR("ERR command"));
+        return;
+    }
+    if (strcmp_P(target, PSTR("TIME")) == 0) {
+        handleTimeCommand(set, strtok(NULL, " "));
+        return;
+    }
+    if (strcmp_P(target, PSTR("HEALTH")) == 0 && !set) {
+        watchdog.reportHealth();
+        return;
+    }
+    if (strcmp_P(target, PSTR("BUS")) == 0 && !set) {
+        i2cBus.report();
+        return;
+    }
+    if (strcmp_P(target, PSTR("POWER")) == 0 && !set) {
+        power.report();
+        return;
+    }
+    if (strcmp_P(target, PSTR("MEM")) == 0 && !set) {
+        memoryMonitor.report();
+        return;
+    }
+    if (strcmp_P(target, PSTR("TRACE")) == 0) {
+        handleTraceCommand(set, strtok(NULL, " "));
+        return;
+    }
+    if (strcmp_P(target, PSTR("LAT")) == 0) {
+        handleLatencyCommand(set, strtok(NULL, " "));
+        return;
+    }
+    long index;
+    if (!parseLong(target, index) || index < 1 || index > roomCount) {
+        telemetry.sendText_P(PSTR("ERR room"));
+        return;
+    }
+    char* field = strtok(NULL, " ");
+    char* value = strtok(NULL, " ");
+    if (field == NULL || (set && value == NULL) || strtok(NULL, " ") != NULL) {
+        telemetry.sendText_P(PSTR("ERR syntax"));
+        return;
+    }
+    handleRoomCommand(set, *rooms[index - 1], index, field, value);
+}
+
+void CommandInterface::handleRoomCommand(bool set, RoomControl& room, int index, char* field, char* value) {
+    if (strcmp_P(field, PSTR("STATS")) == 0 && !set) {
+        replyStats(room, index);
+        return;
+    }
+    RoomSetting setting = SETTING_COUNT;
+    for (uint8_t i = 0; i < SETTING_COUNT; i++) {
+        if (strcmp_P(field, ROOM_SETTING_NAMES[i]) == 0) {
+            setting = (RoomSetting)i;
+        }
+    }
+    if (setting == SETTING_SCHED) {
+        if (set) {
+            if (strlen(value) != 24) {
+                telemetry.sendText_P(PSTR("ERR value"));
+                return;
+            }
+            for (int i = 0; i < 24; i++) {
+                if (value[i] < '0' || value[i] > '4') {
+                    telemetry.sendText_P(PSTR("ERR value"));
+                    return;
+                }
+            }
+            for (int i = 0; i < 24; i++) {
+                room.setScheduledLevel(i, value[i] - '0');
+            }
+            scheduleAdjusted = true;
+        }
+    } else if (setting == SETTING_TARGET) {
+        if (set) {
+            float temp;
+            if (!parseFloat(value, temp) || temp < 10 || temp > 30) {
+                telemetry.sendText_P(PSTR("ERR value"));
+                return;
+            }
+            room.setTarget(round(temp * 2) / 2.0);
+            tempAdjusted = true;
+        }
+    } else if (setting == SETTING_LIGHT) {
+        if (set) {
+            long intensity;
+            if (!parseLong(value, intensity) || intensity < 0 || intensity > 4) {
+                telemetry.sendText_P(PSTR("ERR value"));
+                return;
+            }
+            room.lightIntensity = intensity;
+            room.updateNeoPixelBrightness(true);
+            room.hourOverride = hour();
+        }
+    } else {
+        telemetry.sendText_P(PSTR("ERR field"));
+        return;
+    }
+    replyRoom(room, index, setting);
+}
+
+void CommandInterface::handleTimeCommand(bool set, char* value) {
+    if (set) {
+        long minutes;
+        if (value == NULL || !parseLong(value, minutes) || minutes < 0 || minutes >= 24 * 60) {
+            telemetry.sendText_P(PSTR("ERR value"));
+            return;
+        }
+        ADDED_TIME = (unsigned long)minutes * 60000;
+        timeAdjusted = true;
+    }
+    replyTime();
+}
+
+// SET applies the named scene, SAVE stores the rooms' settings under the
+// name; both reply like GET with the scene list
+void CommandInterface::handleSceneCommand(bool set, bool save, char* name, RoomControl* const rooms[], int roomCount) {
+    if (set || save) {
+        if (name == NULL || strlen(name) >= SCENE_NAME_SIZE) {
+            telemetry.sendText_P(PSTR("ERR value"));
+            return;
+        }
+        if (save) {
+            int8_t existing = scenes.find(name);
+            if (existing != SceneLibrary::NONE && existing < SceneLibrary::BUILT_IN) {
+                telemetry.sendText_P(PSTR("ERR value"));
+                return;
+            }
+            if (scenes.save(name, rooms, roomCount) == SceneLibrary::NONE) {
+                telemetry.sendText_P(PSTR("ERR full"));
+                return;
+            }
+        } else {
+            int8_t index = scenes.find(name);
+            if (index == SceneLibrary::NONE) {
+                telemetry.sendText_P(PSTR("ERR scene"));
+                return;
+            }
+            scenes.apply(index, rooms, roomCount);
+        }
+    }
+    scenes.report();
+}
+
+// TRACE <recording> <frames lost>
+void CommandInterface::handleTraceCommand(bool set, char* value) {
+    if (set) {
+        if (value == NULL || (strcmp_P(value, PSTR("0")) != 0 && strcmp_P(value, PSTR("1")) != 0)) {
+            telemetry.sendText_P(PSTR("ERR value"));
+            return;
+        }
+        if (value[0] == '1') {
+            inputTrace.start();
+        } else {
+            inputTrace.stop();
+        }
+    }
+    char buffer[24];
+    snprintf_P(buffer, sizeof(buffer), PSTR("TRACE %d %u"), inputTrace.active(), inputTrace.lost());
+    telemetry.sendText(buffer);
+}
+
+// SET turns the EVT frames on or off and replies LAT <streaming> <lost>;
+// GET with a source replies with that source's figures instead
+void CommandInterface::handleLatencyCommand(bool set, char* value) {
+    if (!set && value != NULL) {
+        int8_t source = LatencyTracker::sourceNamed(value);
+        if (source >= 0) {
+            latency.report((LatencySource)source);
+            return;
+        }
+        telemetry.sendText_P(PSTR("ERR value"));
+        return;
+    }
+    if (set) {
+        if (value == NULL || (strcmp_P(value, PSTR("0")) != 0 && strcmp_P(value, PSTR("1")) != 0)) {
+            telemetry.sendText_P(PSTR("ERR value"));
+            return;
+        }
+        latency.setStreaming(value[0] == '1');
+    }
+    char buffer[24];
+    snprintf_P(buffer, sizeof(buffer), PSTR("LAT %d %u"), latency.streaming(), latency.lost());
+    telemetry.sendText(buffer);
+}
+
+bool CommandInterface::replyRoom(const RoomControl& room, int index, RoomSetting setting) {
+    char buffer[40];
+    int length = snprintf_P(buffer, sizeof(buffer), PSTR("%d "), index);
+    strcpy_P(buffer + length, ROOM_SETTING_NAMES[setting]);
+    length += strlen(buffer + length);
+    buffer[length++] = ' ';
+    if (setting == SETTING_SCHED) {
+        for (int i = 0; i < 24; i++) {
+            buffer[length++] = '0' + room.scheduledLevel(i);
+        }
+        buffer[length] = '\0';
+    } else if (setting == SETTING_TARGET) {
+        formatTenths(buffer + length, sizeof(buffer) - length, room.targetTemp);
+    } else {
+        snprintf_P(buffer + length, sizeof(buffer) - length, PSTR("%d"), room.lightIntensity);
+    }
+    return telemetry.sendText(buffer);
+}
+
+// <room> STATE <temp> <target> <light> <ac> <present> <inactive> <schedule> <auto light>
+bool CommandInterface::replyState(const RoomControl& room, int index) {
+    char buffer[TELEMETRY_MAX_FRAME];
+    int length = snprintf_P(buffer, sizeof(buffer), PSTR("%d STATE "), index);
+    length += formatTenths(buffer + length, sizeof(buffer) - length, room.currentTemp);
+    buffer[length++] = ' ';
+    length += formatTenths(buffer + length, sizeof(buffer) - length, room.targetTemp);
+    snprintf_P(buffer + length, sizeof(buffer) - length, PSTR(" %d %d %d %d %d %d"),
+        room.lightIntensity, room.acState, room.peoplePresent, room.inactive,
+        room.scheduleActive, room.autoLightEnabled);
+    return telemetry.sendText(buffer);
+}
+
+// <room> STATS <heating s> <cooling s> <off s> <ac switches> <lit-pixel s> <light switches>
+bool CommandInterface::replyStats(const RoomControl& room, int index) {
+    char buffer[TELEMETRY_MAX_FRAME];
+    unsigned long now = millis();
+    const EnergyStats& energy = room.energy;
+    snprintf_P(buffer, sizeof(buffer), PSTR("%d STATS %lu %lu %lu %u %lu %u"), index,
+        (unsigned long)(energy.acTime(now, HEATING) >> EnergyStats::FRACTION_BITS),
+        (unsigned long)(energy.acTime(now, COOLING) >> EnergyStats::FRACTION_BITS),
+        (unsigned long)(energy.acTime(now, OFF) >> EnergyStats::FRACTION_BITS),
+        energy.acSwitches(),
+        (unsigned long)(energy.lightTime(now) >> EnergyStats::FRACTION_BITS),
+        energy.lightSwitches());
+    return telemetry.sendText(buffer);
+}
+
+bool CommandInterface::replyTime() {
+    char buffer[32];
+    snprintf_P(buffer, sizeof(buffer), PSTR("TIME %lu %02d:%02d"), ADDED_TIME / 60000, hour(), minute());
+    return telemetry.sendText(buffer);
+}
+
+// DUMP is spread over several loops: each line is only sent once the
+// previous one fitted into the TX buffer. Each room takes three lines, and
+// a last DUMP <rooms> line marks the end.
+void CommandInterface::continueDump(RoomControl* const rooms[], int roomCount) {
+    while (dumpStep >= 0 && telemetry.txFree() >= REPLY_RESERVE) {
+        bool sent;
+        if (dumpStep == 0) {
+            sent = replyTime();
+        } else {
+            int index = (dumpStep - 1) / 3;
+            if (index >= roomCount) {
+                char buffer[17];
+                snprintf_P(buffer, sizeof(buffer), PSTR("DUMP %d"), roomCount);
+                if (telemetry.sendText(buffer)) {
+                    dumpStep = -1;
+                }
+                return;
+            }
+            switch ((dumpStep - 1) % 3) {
+            case 0:
+                sent = replyState(*rooms[index], index + 1);
+                break;
+            case 1:
+                sent = replyRoom(*rooms[index], index + 1, SETTING_SCHED);
+                break;
+            default:
+                sent = replyStats(*rooms[index], index + 1);
+                break;
+            }
+        }
+        if (!sent) {
+            return;
+        }
+        dumpStep++;
+    }
+}
@@ -0,0 +1,57 @@
+#include "DaylightHarvester.h"
+
+// Wanted light in 1/64 levels at ambient readings 0, 64, ..., 1024. Full
+// light in the dark, falling off between dusk (~350) and daylight (~700).
+static const uint16_t DAYLIGHT_CURVE[17] PROGMEM = {
+    256, 256, 256, 256, 256, 256, 192, 150, 108, 66, 24, 0, 0, 0, 0, 0, 0
+};
+
+DaylightHarvester::DaylightHarvester() : started(false), current(0), filtered(0), lastUpdate(0) {
+}
+
+// Linear interpolation between the two nearest curve points
+int DaylightHarvester::demand(int ambient) {
+    ambient = constrain(ambient, 0, 1023);
+    uint8_t index = ambient >> 6;
+    uint8_t fraction = ambient & 63;
+    int low = pgm_read_word(&DAYLIGHT_CURVE[index]);
+    int high = pgm_read_word(&DAYLIGHT_CURVE[index + 1]);
+    return low + ((high - low) * fraction) / 64;
+}
+
+bool DaylightHarvester::due(unsigned long now) const {
+    return !started || now - lastUpdate >= UPDATE_MS;
+}
+
+// Returns true if the level changed. The first update takes the nearest
+// level straight away, so the lights are right from boot.
+bool DaylightHarvester::update(unsigned long now, int reading, int16_t gain, int16_t offset) {
+    if (!due(now)) {
+        return false;
+    }
+    lastUpdate = now;
+    long ambient = constrain((long)reading * gain / UNITY_GAIN + offset, 0L, 1023L);
+    if (!started) {
+        started = true;
+        filtered = ambient << FILTER_SHIFT;
+        current = (demand(ambient) + STEP / 2) / STEP;
+        return true;
+    }
+    filtered += ambient - (filtered >> FILTER_SHIFT);
+    int wanted = demand(filtered >> FILTER_SHIFT);
+    uint8_t next = current;
+    if (current < MAX_LEVEL && wanted >= current * STEP + STEP / 2 + BRIGHTEN_MARGIN) {
+        next++;
+    } else if (current > 0 && wanted <= current * STEP - STEP / 2 - DIM_MARGIN) {
+        next--;
+    }
+    if (next == current) {
+        return false;
+    }
+    current = next;
+    return true;
+}
+
+int DaylightHarvester::level() const {
+    return current;
+}
@@ -0,0 +1,52 @@
+#include "EnergyStats.h"
+
+EnergyStats::EnergyStats()
+    : pixelTotal(0), acChanges(0), lightChanges(0), acState(OFF), pixels(0), acSince(0), lightSince(0) {
+    memset(acTotals, 0, sizeof(acTotals));
+}
+
+// Milliseconds to 24.8 seconds without a 64-bit intermediate
+uint32_t EnergyStats::toFixed(unsigned long ms) {
+    return ((uint32_t)(ms / 1000) << FRACTION_BITS) + ((ms % 1000) << FRACTION_BITS) / 1000;
+}
+
+void EnergyStats::setAC(unsigned long now, ACState state) {
+    if (state == acState) {
+        return;
+    }
+    acTotals[acState] += toFixed(now - acSince);
+    acSince = now;
+    acState = state;
+    acChanges++;
+}
+
+void EnergyStats::setLight(unsigned long now, uint8_t lit) {
+    if (lit == pixels) {
+        return;
+    }
+    pixelTotal += toFixed(now - lightSince) * pixels;
+    lightSince = now;
+    pixels = lit;
+    lightChanges++;
+}
+
+// Totals include the interval still running
+uint32_t EnergyStats::acTime(unsigned long now, ACState state) const {
+    uint32_t total = acTotals[state];
+    if (state == acState) {
+        total += toFixed(now - acSince);
+    }
+    return total;
+}
+
+uint32_t EnergyStats::lightTime(unsigned long now) const {
+    return pixelTotal + toFixed(now - lightSince) * pixels;
+}
+
+uint16_t EnergyStats::acSwitches() const {
+    return acChanges;
+}
+
+uint16_t EnergyStats::lightSwitches() const {
+    return lightChanges;
+}
@@ -0,0 +1,147 @@
+#include "I2CBus.h"
+#include "Telemetry.h"
+
+INSTANCE_STATE I2CBus i2cBus;
+
+I2CBus::I2CBus() : head(0), count(0), stalls(0), clock(0), deviceCount(0) {}
+
+void I2CBus::begin() {
+#ifdef WIRE_HAS_TIMEOUT
+    Wire.setWireTimeout(TIMEOUT_US, true);
+#endif
+}
+
+// Devices not registered here share the standard mode clock and no counters
+void I2CBus::addDevice(uint8_t address, uint32_t deviceClock) {
+    if (deviceCount < MAX_DEVICES) {
+        DeviceStats& stats = devices[deviceCount++];
+        memset(&stats, 0, sizeof(stats));
+        stats.address = address;
+        stats.clock = deviceClock;
+    }
+}
+
+I2CBus::DeviceStats* I2CBus::device(uint8_t address) {
+    for (int i = 0; i < deviceCount; i++) {
+        if (devices[i].address == address) {
+            return &devices[i];
+        }
+    }
+    return NULL;
+}
+
+void I2CBus::write(uint8_t address, const uint8_t* data, uint8_t length) {
+    if (length > MAX_DATA) {
+        length = MAX_DATA;
+    }
+    for (int i = 0; i < count; i++) {
+        Transaction& queued = queue[(head + i) % QUEUE_SIZE];
+        bool sameRegister = queued.address == address && queued.length == length && (length == 1 || queued.data[0] == data[0]);
+        // The head may be mid-retry; leave it alone
+        if (sameRegister && (i > 0 || queued.attempts == 0)) {
+            memcpy(queued.data, data, length);
+            return;
+        }
+    }
+    if (count == QUEUE_SIZE) {
+        stalls++;
+        while (count == QUEUE_SIZE) {
+            runNext();
+        }
+    }
+    Transaction& transaction = queue[(head + count) % QUEUE_SIZE];
+    transaction.address = address;
+    transaction.length = length;
+    transaction.attempts = 0;
+    transaction.queuedAt = micros();
+    memcpy(transaction.data, data, length);
+    count++;
+}
+
+bool I2CBus::transmit(Transaction& transaction) {
+    DeviceStats* stats = device(transaction.address);
+    uint32_t wanted = stats ? stats->clock : STANDARD_MODE;
+    if (wanted != clock) {
+        Wire.setClock(wanted);
+        clock = wanted;
+    }
+    Wire.beginTransmission(transaction.address);
+    Wire.write(transaction.data, transaction.length);
+    uint8_t result = Wire.endTransmission();
+    transaction.attempts++;
+    if (stats == NULL) {
+        return result == 0;
+    }
+    stats->transactions++;
+    if (result != 0) {
+        stats->errors++;
+        stats->lastError = result;
+        if (result == ERROR_TIMEOUT) {
+            stats->timeouts++;
+        }
+#ifdef WIRE_HAS_TIMEOUT
+        Wire.clearWireTimeoutFlag();
+#endif
+        return false;
+    }
+    // A write can wait behind delay() calls for far longer than 16 bits of us
+    unsigned long latency = micros() - transaction.queuedAt;
+    if (latency > stats->worstMicros) {
+        stats->worstMicros = latency > 0xFFFF ? 0xFFFF : latency;
+    }
+    return true;
+}
+
+// Sends the head of the queue; a failed write stays queued for a retry on
+// the next call until it runs out of attempts.
+void I2CBus::runNext() {
+    Transaction& transaction = queue[head];
+    if (transmit(transaction) || transaction.attempts >= MAX_ATTEMPTS) {
+        head = (head + 1) % QUEUE_SIZE;
+        count--;
+    }
+}
+
+void I2CBus::service() {
+    unsigned long start = micros();
+    while (count > 0 && micros() - start < SERVICE_BUDGET_US) {
+        uint8_t before = count;
+        runNext();
+        if (count == before) {
+            return;
+        }
+    }
+}
+
+// Blocks until everything queued has been sent or given up on
+void I2CBus::flush() {
+    while (count > 0) {
+        runNext();
+    }
+}
+
+uint16_t I2CBus::errors(uint8_t address) {
+    DeviceStats* stats = device(address);
+    return stats ? stats->errors : 0;
+}
+
+bool I2CBus::queued(uint8_t address) const {
+    for (int i = 0; i < count; i++) {
+        if (queue[(head + i) % QUEUE_SIZE].address == address) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// BUS <stalls> then <address> <transactions> <errors> <timeouts> <worst us> per device
+bool I2CBus::report() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    int length = snprintf_P(buffer, sizeof(buffer), PSTR("BUS %u"), stalls);
+    for (int i = 0; i < deviceCount && length < (int)sizeof(buffer); i++) {
+        const DeviceStats& stats = devices[i];
+        length += snprintf_P(buffer + length, sizeof(buffer) - length, PSTR(" %02X %u %u %u %u"), stats.address,
+            stats.transactions, stats.errors, stats.timeouts, stats.worstMicros);
+    }
+    return telemetry.sendText(buffer);
+}
@@ -0,0 +1,149 @@
+#include "hardware.h"
+#include "InputTrace.h"
+#include "Telemetry.h"
+
+INSTANCE_STATE InputTrace inputTrace;
+
+#ifdef INPUT_TRACE
+static const uint8_t DIGITAL_PINS[TRACE_PIN_COUNT] = {
+    LEFT_BUTTON_PIN, RIGHT_BUTTON_PIN, BACK_BUTTON_PIN, SCHEDULE_BUTTON_PIN, ROOM1_PIR_PIN, ROOM2_PIR_PIN
+};
+static const uint8_t ANALOG_PINS[TRACE_ANALOG_COUNT] = {
+    TIME_WHEEL_PIN, PHOTO_RESISTOR_PIN, ROOM1_TEMP_SENSOR_PIN, ROOM2_TEMP_SENSOR_PIN
+};
+
+InputTrace::InputTrace()
+    : recording(false), resync(true), levels(0), lastRecord(0), firstPending(0), length(0), lostFrames(0) {
+    memset(values, 0, sizeof(values));
+}
+
+void InputTrace::start() {
+    if (recording) {
+        return;
+    }
+    recording = true;
+    resync = true;
+    length = 0;
+    appendInputs(millis(), true);
+    flush();
+}
+
+void InputTrace::stop() {
+    if (recording) {
+        flush();
+        recording = false;
+    }
+}
+
+bool InputTrace::active() const {
+    return recording;
+}
+
+void InputTrace::samplePins() {
+    if (recording) {
+        appendInputs(millis(), false);
+    }
+}
+
+void InputTrace::sample() {
+    if (recording) {
+        appendInputs(millis(), true);
+    }
+}
+
+// Appends an INPUT record if anything changed since the last one, or a
+// START record with the full state if the trace has to be resynchronised
+void InputTrace::appendInputs(unsigned long now, bool readAnalog) {
+    if (length + MAX_INPUT_RECORD > MAX_BODY) {
+        flush();
+    }
+    uint8_t currentLevels = 0;
+    for (uint8_t i = 0; i < TRACE_PIN_COUNT; i++) {
+        if (digitalRead(DIGITAL_PINS[i])) {
+            currentLevels |= 1 << i;
+        }
+    }
+    int16_t current[TRACE_ANALOG_COUNT];
+    uint8_t mask = 0;
+    for (uint8_t i = 0; i < TRACE_ANALOG_COUNT; i++) {
+        current[i] = (readAnalog || resync) ? analogRead(ANALOG_PINS[i]) : values[i];
+        if (current[i] != values[i]) {
+            mask |= 1 << i;
+        }
+    }
+    if (!resync && mask == 0 && currentLevels == levels) {
+        return;
+    }
+    if (length == 0) {
+        firstPending = now;
+    }
+    if (resync) {
+        length += putVarint(&body[length], now);
+        body[length++] = TRACE_START | currentLevels;
+        mask = (1 << TRACE_ANALOG_COUNT) - 1;
+        memset(values, 0, sizeof(values));
+    } else {
+        length += putVarint(&body[length], now - lastRecord);
+        body[length++] = TRACE_INPUT | currentLevels;
+    }
+    body[length++] = mask;
+    for (uint8_t i = 0; i < TRACE_ANALOG_COUNT; i++) {
+        if (mask & (1 << i)) {
+            length += putVarint(&body[length], zigzagEncode(current[i] - values[i]));
+            values[i] = current[i];
+        }
+    }
+    levels = currentLevels;
+    lastRecord = now;
+    resync = false;
+}
+
+// Records a Serial command line just before it is executed
+void InputTrace::command(const char* line) {
+    if (!recording) {
+        return;
+    }
+    uint8_t size = min(strlen(line), (size_t)(MAX_BODY - MAX_INPUT_RECORD - 7));
+    if (length + MAX_INPUT_RECORD + 7 + size > MAX_BODY) {
+        flush();
+    }
+    unsigned long now = millis();
+    if (resync) {
+        appendInputs(now, true);
+    }
+    if (length == 0) {
+        firstPending = now;
+    }
+    length += putVarint(&body[length], now - lastRecord);
+    body[length++] = TRACE_COMMAND;
+    body[length++] = size;
+    memcpy(&body[length], line, size);
+    length += size;
+    lastRecord = now;
+}
+
+void InputTrace::service() {
+    if (length > 0 && millis() - firstPending >= FLUSH_MS) {
+        flush();
+    }
+}
+
+// A frame that doesn't fit into the TX buffer is dropped. Sequence numbers
+// only count queued frames, so the host can't see the loss; the next
+// record is a START instead.
+void InputTrace::flush() {
+    if (length == 0) {
+        return;
+    }
+    if (!telemetry.sendTrace(body, length)) {
+        lostFrames++;
+        resync = true;
+    }
+    length = 0;
+}
+
+unsigned int InputTrace::lost() const {
+    return lostFrames;
+}
+
+#endif
@@ -0,0 +1,227 @@
+#include "hardware.h"
+#include "LatencyTracker.h"
+#include "I2CBus.h"
+#include "Telemetry.h"
+
+INSTANCE_STATE LatencyTracker latency;
+
+#ifdef LATENCY_TRACE
+static const char LATENCY_SOURCE_NAMES[LATENCY_SOURCE_COUNT][8] PROGMEM = {
+    "BUTTON", "MOTION", "COMMAND"
+};
+// Upper bound of each histogram bucket in ms, finest around the UI's delays
+static const uint16_t LATENCY_BOUNDS[LatencyTracker::BUCKETS] PROGMEM = {
+    10, 20, 35, 50, 75, 100, 150, 200, 300, 500, 1000, 0xFFFF
+};
+
+LatencyTracker::LatencyTracker()
+    : openMask(0), lastId(0), lastButtons(0), relayMask(0), stream(false), dropped(0) {
+    memset(histogram, 0, sizeof(histogram));
+    memset(noEffect, 0, sizeof(noEffect));
+    memset(worst, 0, sizeof(worst));
+#ifndef __AVR__
+    closedTotal = 0;
+#endif
+}
+
+// Returns the new event's ID, 0 if every slot is taken
+uint8_t LatencyTracker::open(LatencySource source, unsigned long time) {
+    for (uint8_t slot = 0; slot < MAX_OPEN; slot++) {
+        if (openMask & (1 << slot)) {
+            continue;
+        }
+        LatencyEvent& event = events[slot];
+        // IDs wrap, skipping 0
+        lastId = lastId == 0xFF ? 1 : lastId + 1;
+        event.input = time;
+        event.first = 0;
+        event.settled = 0;
+        event.id = lastId;
+        event.source = source;
+        event.outputs = 0;
+        event.passes = 0;
+        openMask |= 1 << slot;
+        return lastId;
+    }
+    if (dropped < 0xFFFF) {
+        dropped++;
+    }
+    return 0;
+}
+
+// Button levels of an awake pass; a press of any button opens an event
+void LatencyTracker::buttons(uint8_t pressed, unsigned long time) {
+    if (pressed & ~lastButtons) {
+        open(LATENCY_BUTTON, time);
+    }
+    lastButtons = pressed;
+}
+
+void LatencyTracker::output(uint8_t kind) {
+    outputTo(openMask, kind);
+}
+
+void LatencyTracker::outputTo(uint8_t slots, uint8_t kind) {
+    if (slots == 0) {
+        return;
+    }
+    unsigned long now = millis();
+    for (uint8_t slot = 0; slot < MAX_OPEN; slot++) {
+        if (!(slots & (1 << slot))) {
+            continue;
+        }
+        LatencyEvent& event = events[slot];
+        unsigned long elapsed = now - event.input;
+        uint16_t ms = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+        if (event.outputs == 0) {
+            event.first = ms;
+        }
+        event.settled = ms;
+        event.outputs |= kind;
+    }
+}
+
+// The expander byte went into the I2C queue; it counts as output of the
+// events open now once it is sent
+void LatencyTracker::relaysQueued() {
+    relayMask |= openMask;
+}
+
+// End of an awake loop pass, after the I2C queue was serviced
+void LatencyTracker::endPass() {
+    if (relayMask != 0 && !i2cBus.queued(EXPANDER_ADDRESS)) {
+        outputTo(relayMask & openMask, OUTPUT_RELAYS);
+        relayMask = 0;
+    }
+    for (uint8_t slot = 0; slot < MAX_OPEN; slot++) {
+        if (!(openMask & (1 << slot))) {
+            continue;
+        }
+        LatencyEvent& event = events[slot];
+        if (++event.passes >= 2) {
+            close(slot, event.outputs != 0);
+        }
+    }
+}
+
+void LatencyTracker::close(uint8_t slot, bool settled) {
+    LatencyEvent& event = events[slot];
+    openMask &= ~(1 << slot);
+    relayMask &= ~(1 << slot);
+    if (settled) {
+        uint8_t* counts = histogram[event.source];
+        uint8_t bucket = 0;
+        while (event.settled > pgm_read_word(&LATENCY_BOUNDS[bucket])) {
+            bucket++;
+        }
+        // Halving keeps the shape of the distribution when a count is full
+        if (counts[bucket] == 0xFF) {
+            for (uint8_t i = 0; i < BUCKETS; i++) {
+                counts[i] /= 2;
+            }
+        }
+        counts[bucket]++;
+        if (event.settled > worst[event.source]) {
+            worst[event.source] = event.settled;
+        }
+    } else if (noEffect[event.source] < 0xFFFF) {
+        noEffect[event.source]++;
+    }
+    // Sent right away; an event the Serial buffer has no room for is lost
+    if (stream && !send(event) && dropped < 0xFFFF) {
+        dropped++;
+    }
+#ifndef __AVR__
+    closed[closedTotal % MAX_OPEN] = event;
+    closedTotal++;
+#endif
+}
+
+void LatencyTracker::setStreaming(bool on) {
+    stream = on;
+}
+
+bool LatencyTracker::streaming() const {
+    return stream;
+}
+
+uint16_t LatencyTracker::lost() const {
+    return dropped;
+}
+
+// EVT <id> <source> <input ms> <first output ms> <settled ms> <outputs>
+// Outputs are L(CD), S(trip) and R(elays), or - for none
+bool LatencyTracker::send(const LatencyEvent& event) {
+    char buffer[TELEMETRY_MAX_FRAME];
+    char name[8];
+    char outputs[4];
+    uint8_t length = 0;
+    if (event.outputs & OUTPUT_LCD) outputs[length++] = 'L';
+    if (event.outputs & OUTPUT_STRIP) outputs[length++] = 'S';
+    if (event.outputs & OUTPUT_RELAYS) outputs[length++] = 'R';
+    if (length == 0) outputs[length++] = '-';
+    outputs[length] = '\0';
+    strcpy_P(name, LATENCY_SOURCE_NAMES[event.source]);
+    snprintf_P(buffer, sizeof(buffer), PSTR("EVT %u %s %lu %u %u %s"), event.id, name, (unsigned long)event.input,
+        event.first, event.settled, outputs);
+    return telemetry.sendText(buffer);
+}
+
+// LAT <source> <settled> <no effect> <p50 ms> <p99 ms> <max ms> <lost>
+bool LatencyTracker::report(LatencySource source) {
+    char buffer[TELEMETRY_MAX_FRAME];
+    char name[8];
+    uint32_t settled = 0;
+    for (uint8_t i = 0; i < BUCKETS; i++) {
+        settled += histogram[source][i];
+    }
+    strcpy_P(name, LATENCY_SOURCE_NAMES[source]);
+    snprintf_P(buffer, sizeof(buffer), PSTR("LAT %s %lu %u %u %u %u %u"), name, (unsigned long)settled, noEffect[source],
+        percentile(source, 50), percentile(source, 99), worst[source], dropped);
+    return telemetry.sendText(buffer);
+}
+
+int8_t LatencyTracker::sourceNamed(const char* name) {
+    for (uint8_t i = 0; i < LATENCY_SOURCE_COUNT; i++) {
+        if (strcmp_P(name, LATENCY_SOURCE_NAMES[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#ifndef __AVR__
+uint32_t LatencyTracker::closedCount() const {
+    return closedTotal;
+}
+
+const LatencyEvent& LatencyTracker::closedEvent(uint32_t index) const {
+    return closed[index % MAX_OPEN];
+}
+#endif
+
+// Upper bound of the bucket holding the percentile, capped at the maximum
+uint16_t LatencyTracker::percentile(LatencySource source, uint8_t percent) const {
+    const uint8_t* counts = histogram[source];
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < BUCKETS; i++) {
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint32_t rank = (total * percent + 99) / 100;
+    uint32_t seen = 0;
+    uint8_t bucket = 0;
+    while (bucket < BUCKETS - 1) {
+        seen += counts[bucket];
+        if (seen >= rank) {
+            break;
+        }
+        bucket++;
+    }
+    uint16_t bound = pgm_read_word(&LATENCY_BOUNDS[bucket]);
+    return bound < worst[source] ? bound : worst[source];
+}
+
+#endif
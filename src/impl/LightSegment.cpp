@@ -0,0 +1,73 @@
+#include "LightSegment.h"
+
+// Warm white channel scale per level, roughly even steps to the eye
+static const uint8_t DIMMER_LEVELS[LightSegment::MAX_LEVEL + 1] PROGMEM = { 0, 24, 64, 140, 255 };
+
+LightSegment::LightSegment(uint16_t first, uint16_t length, LightStyle style)
+    : first(first), length(length), style(style), shownLevel(UNKNOWN) {
+}
+
+uint16_t LightSegment::litPixels(uint8_t level) const {
+    return (uint32_t)length * level / MAX_LEVEL;
+}
+
+uint16_t LightSegment::end() const {
+    return first + length;
+}
+
+uint32_t LightSegment::color(uint8_t level) const {
+    if (level == 0) {
+        return 0;
+    }
+    if (style == LIGHT_BAR) {
+        return Adafruit_NeoPixel::Color(0, 255, 0);
+    }
+    uint8_t scale = pgm_read_byte(&DIMMER_LEVELS[level]);
+    return Adafruit_NeoPixel::Color(scale, (uint16_t)scale * 180 / 255, (uint16_t)scale * 100 / 255);
+}
+
+// The first pixel goes through setPixelColor() for the strip's colour
+// order; the rest of the run is copied from it in doubling blocks
+void LightSegment::fill(Adafruit_NeoPixel& strip, uint32_t color, uint16_t from, uint16_t count) {
+    if (count == 0) {
+        return;
+    }
+    strip.setPixelColor(from, color);
+    uint8_t* start = strip.getPixels() + from * 3;
+    uint16_t done = 3;
+    uint16_t total = count * 3;
+    while (done < total) {
+        uint16_t block = min(done, (uint16_t)(total - done));
+        memcpy(start + done, start, block);
+        done += block;
+    }
+}
+
+// Returns true if any pixel changed
+bool LightSegment::apply(Adafruit_NeoPixel& strip, uint8_t level) {
+    if (level > MAX_LEVEL) {
+        level = MAX_LEVEL;
+    }
+    if (level == shownLevel) {
+        return false;
+    }
+    if (style == LIGHT_DIMMER || shownLevel == UNKNOWN) {
+        uint16_t lit = style == LIGHT_DIMMER ? (level ? length : 0) : litPixels(level);
+        fill(strip, color(level), first, lit);
+        fill(strip, 0, first + lit, length - lit);
+    } else {
+        uint16_t before = litPixels(shownLevel);
+        uint16_t after = litPixels(level);
+        if (after > before) {
+            fill(strip, color(level), first + before, after - before);
+        } else {
+            fill(strip, 0, first + after, before - after);
+        }
+    }
+    shownLevel = level;
+    return true;
+}
+
+void LightSegment::invalidate() {
+    shownLevel = UNKNOWN;
+}
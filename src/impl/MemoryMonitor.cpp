@@ -0,0 +1,106 @@
+#include "MemoryMonitor.h"
+#include "Telemetry.h"
+
+INSTANCE_STATE MemoryMonitor memoryMonitor;
+
+#ifdef __AVR__
+static const uint8_t PAINT = 0xC5;
+
+extern uint8_t _end;
+extern uint8_t __stack;
+extern uint8_t __heap_start;
+extern char* __brkval;
+
+// Runs before the stack pointer and r1 are set up, so no C. Fills
+// everything from the end of .noinit up to RAMEND; .data and .bss are
+// initialised after this.
+void paintStack() __attribute__((naked, used, section(".init1")));
+void paintStack() {
+    __asm volatile(
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :: "i"(PAINT));
+}
+
+static uint8_t* heapEnd() {
+    return __brkval ? (uint8_t*)__brkval : &__heap_start;
+}
+#endif
+
+MemoryMonitor::MemoryMonitor() : lastScan(0), heap(0), peak(0), current(0), lowest(0xFFFF) {
+}
+
+bool MemoryMonitor::service() {
+    unsigned long now = millis();
+    if (now - lastScan < SCAN_MS) {
+        return false;
+    }
+    lastScan = now;
+    return scan();
+}
+
+// Returns true if any of the figures changed
+bool MemoryMonitor::scan() {
+#ifdef __AVR__
+    uint8_t* bottom = heapEnd();
+    // Everything above the previous mark is known to be used already
+    uint8_t* mark = &__stack + 1 - peak;
+    uint8_t* p = bottom;
+    while (p < mark && *p == PAINT) {
+        p++;
+    }
+    uint16_t newHeap = bottom - &__heap_start;
+    uint16_t newPeak = &__stack + 1 - p;
+    uint16_t newCurrent = (uint8_t*)SP - bottom;
+    uint16_t gap = p - bottom;
+    bool changed = newHeap != heap || newPeak != peak || newCurrent != current || gap < lowest;
+    heap = newHeap;
+    peak = newPeak;
+    current = newCurrent;
+    if (gap < lowest) {
+        lowest = gap;
+    }
+    return changed;
+#else
+    return false;
+#endif
+}
+
+uint16_t MemoryMonitor::staticBytes() const {
+#ifdef __AVR__
+    return &__heap_start - (uint8_t*)RAMSTART;
+#else
+    return 0;
+#endif
+}
+
+uint16_t MemoryMonitor::heapBytes() const {
+    return heap;
+}
+
+uint16_t MemoryMonitor::stackPeak() const {
+    return peak;
+}
+
+uint16_t MemoryMonitor::freeNow() const {
+    return current;
+}
+
+uint16_t MemoryMonitor::minFree() const {
+    return lowest == 0xFFFF ? 0 : lowest;
+}
+
+// MEM <static> <heap> <stack peak> <free now> <min free>
+bool MemoryMonitor::report() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    snprintf_P(buffer, sizeof(buffer), PSTR("MEM %u %u %u %u %u"), staticBytes(), heapBytes(), stackPeak(), freeNow(), minFree());
+    return telemetry.sendText(buffer);
+}
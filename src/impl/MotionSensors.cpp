@@ -0,0 +1,75 @@
+#include "MotionSensors.h"
+
+INSTANCE_STATE MotionSensors motionSensors;
+
+// Keeps the compiler from moving event accesses across the index updates
+static inline void barrier() {
+    __asm__ __volatile__("" ::: "memory");
+}
+
+MotionSensors::MotionSensors() : channelCount(0), dropped(0) {}
+
+// Registers a sensor and returns its channel. The pin-change interrupt for
+// the pin is enabled by the PowerManager.
+uint8_t MotionSensors::watch(uint8_t pin) {
+    if (channelCount >= MAX_CHANNELS) {
+        return channelCount - 1;
+    }
+    Channel& channel = channels[channelCount];
+    channel.pin = pin;
+    channel.level = digitalRead(pin);
+    channel.head = 0;
+    channel.tail = 0;
+    return channelCount++;
+}
+
+// Interrupt context: one event per sensor whose level changed
+void MotionSensors::capture() {
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < channelCount; i++) {
+        Channel& channel = channels[i];
+        bool level = digitalRead(channel.pin);
+        if (level == channel.level) {
+            continue;
+        }
+        channel.level = level;
+        uint8_t next = (channel.head + 1) % QUEUE_SIZE;
+        if (next == channel.tail) {
+            dropped++;
+            continue;
+        }
+        channel.events[channel.head].time = now;
+        channel.events[channel.head].rising = level;
+        barrier();
+        channel.head = next;
+    }
+}
+
+void MotionSensors::poll() {
+#ifndef __AVR__
+    capture();
+#endif
+}
+
+bool MotionSensors::pop(uint8_t channel, MotionEvent& event) {
+    Channel& queue = channels[channel];
+    if (queue.tail == queue.head) {
+        return false;
+    }
+    barrier();
+    event = queue.events[queue.tail];
+    queue.tail = (queue.tail + 1) % QUEUE_SIZE;
+    return true;
+}
+
+// True while the sensor output is high, i.e. motion is still going on
+bool MotionSensors::active(uint8_t channel) const {
+    return channels[channel].level;
+}
+
+uint16_t MotionSensors::overflows() const {
+    noInterrupts();
+    uint16_t count = dropped;
+    interrupts();
+    return count;
+}
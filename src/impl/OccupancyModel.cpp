@@ -0,0 +1,44 @@
+#include "OccupancyModel.h"
+
+OccupancyModel::OccupancyModel() : currentSlot(-1), slotOccupied(false) {
+    memset(bins, 0, sizeof(bins));
+}
+
+void OccupancyModel::recordMotion(unsigned long now) {
+    update(now);
+    slotOccupied = true;
+}
+
+// Folds the slot that just ended into its bin. Slots skipped by a clock
+// adjustment were never observed and keep their old value.
+void OccupancyModel::update(unsigned long now) {
+    int8_t slot = (now / SLOT_MS) % SLOT_COUNT;
+    if (slot == currentSlot) {
+        return;
+    }
+    if (currentSlot >= 0) {
+        int target = slotOccupied ? 255 : 0;
+        int bin = bins[currentSlot];
+        bins[currentSlot] = bin + ((target - bin) >> DECAY_SHIFT);
+    }
+    currentSlot = slot;
+    slotOccupied = false;
+}
+
+uint8_t OccupancyModel::likelihood(int slot) const {
+    return bins[slot % SLOT_COUNT];
+}
+
+// Minutes until the next slot that is usually occupied, looking at most
+// maxSlots ahead; 0 if the current one is, -1 if none is
+int OccupancyModel::minutesUntilExpected(unsigned long now, int maxSlots) const {
+    if (currentSlot < 0) {
+        return -1;
+    }
+    for (int i = 0; i <= maxSlots; i++) {
+        if (likelihood(currentSlot + i) >= EXPECTED_THRESHOLD) {
+            return i == 0 ? 0 : (SLOT_MS * i - now % SLOT_MS) / 60000;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,165 @@
+#include "PowerManager.h"
+#include "hardware.h"
+#include "I2CBus.h"
+#include "Telemetry.h"
+#include "MotionSensors.h"
+#include "LatencyTracker.h"
+
+#ifdef __AVR__
+#include <avr/sleep.h>
+
+static volatile bool pinChanged = false;
+
+// The PIR sensors sit on PCINT2 (D5, D6), buttons on PCINT1 and PCINT2
+ISR(PCINT0_vect) {
+    pinChanged = true;
+}
+
+ISR(PCINT1_vect) {
+    pinChanged = true;
+}
+
+ISR(PCINT2_vect) {
+    pinChanged = true;
+    motionSensors.capture();
+}
+#endif
+
+// HT16K33 dimming command, low nibble is the duty cycle
+#define HT16K33_DIMMING 0xE0
+
+INSTANCE_STATE PowerManager power;
+
+PowerManager::PowerManager()
+    : lastTick(0), lastInput(0), workStart(0), idleStart(0), awakeMicros(0), totalMicros(0),
+      tickPasses(0), inputPasses(0), sleeping(false), displaysOn(true) {
+#ifndef __AVR__
+    wakePinCount = 0;
+#endif
+}
+
+void PowerManager::addWakePin(uint8_t pin) {
+#ifdef __AVR__
+    *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+    *digitalPinToPCICR(pin) |= _BV(digitalPinToPCICRbit(pin));
+#else
+    if (wakePinCount < MAX_WAKE_PINS) {
+        wakePins[wakePinCount] = pin;
+        wakeLevels[wakePinCount] = digitalRead(pin);
+        wakePinCount++;
+    }
+#endif
+}
+
+bool PowerManager::inputChanged() {
+#ifdef __AVR__
+    noInterrupts();
+    bool changed = pinChanged;
+    pinChanged = false;
+    interrupts();
+    return changed;
+#else
+    bool changed = false;
+    for (int i = 0; i < wakePinCount; i++) {
+        uint8_t level = digitalRead(wakePins[i]);
+        if (level != wakeLevels[i]) {
+            wakeLevels[i] = level;
+            changed = true;
+        }
+    }
+    return changed;
+#endif
+}
+
+// Keeps the ratio exact while never overflowing: both halve together
+void PowerManager::account(unsigned long from, unsigned long to, bool awake) {
+    uint32_t elapsed = to - from;
+    if (totalMicros + elapsed < totalMicros) {
+        awakeMicros /= 2;
+        totalMicros /= 2;
+    }
+    totalMicros += elapsed;
+    if (awake) {
+        awakeMicros += elapsed;
+    }
+}
+
+// Called first thing in loop(). Returns true if there is work to do,
+// otherwise idles until the next interrupt and returns false.
+bool PowerManager::wait() {
+    unsigned long now = millis();
+    bool event = inputChanged() || Serial.available() > 0;
+    bool tick = now - lastTick >= TICK_MS;
+    if (!event && !tick) {
+        if (!sleeping) {
+            sleeping = true;
+            idleStart = micros();
+        }
+#ifdef __AVR__
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        sleep_mode();
+#endif
+        return false;
+    }
+    if (tick) {
+        lastTick = now;
+        tickPasses++;
+    } else {
+        inputPasses++;
+    }
+    workStart = micros();
+    if (sleeping) {
+        sleeping = false;
+        account(idleStart, workStart, false);
+    }
+    return true;
+}
+
+void PowerManager::done() {
+    unsigned long now = micros();
+    account(workStart, now, true);
+    sleeping = true;
+    idleStart = now;
+}
+
+// Clock dimmed and LCD blanked while every room is empty and nobody has
+// touched a button for a while. The LCD backlight isn't switchable on this
+// board, so blanking the text is all it can do.
+void PowerManager::updateDisplays(RoomControl* const rooms[], int roomCount, bool input) {
+    unsigned long now = millis();
+    if (input) {
+        lastInput = now;
+    }
+    bool anyonePresent = false;
+    for (int i = 0; i < roomCount; i++) {
+        anyonePresent = anyonePresent || rooms[i]->peoplePresent;
+    }
+    bool on = anyonePresent || now - lastInput < DISPLAY_TIMEOUT_MS;
+    if (on == displaysOn) {
+        return;
+    }
+    displaysOn = on;
+    uint8_t command = HT16K33_DIMMING | (on ? BRIGHT : DIM);
+    i2cBus.write(CLOCK_ADDRESS, &command, 1);
+    if (on) {
+        mainDisplay.display();
+        latency.output(OUTPUT_LCD);
+    } else {
+        mainDisplay.noDisplay();
+    }
+}
+
+// POWER <tick passes> <input passes> <awake per mille> <lost PIR edges>
+// Loop passes that did work, for tick or input
+uint32_t PowerManager::passes() const {
+    return tickPasses + inputPasses;
+}
+
+bool PowerManager::report() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    uint32_t perMille = totalMicros / 1000;
+    unsigned long duty = perMille ? awakeMicros / perMille : 1000;
+    snprintf_P(buffer, sizeof(buffer), PSTR("POWER %lu %lu %lu %u"), (unsigned long)tickPasses, (unsigned long)inputPasses, duty,
+             motionSensors.overflows());
+    return telemetry.sendText(buffer);
+}
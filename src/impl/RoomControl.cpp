@@ -1,6 +1,12 @@
 #include "hardware.h"
 #include "general.h"
 #include "RoomControl.h"
+#include "Sparkline.h"
+#include "MotionSensors.h"
+#include "LatencyTracker.h"
+
+INSTANCE_STATE ButtonRepeat adjustRepeat;
+INSTANCE_STATE ButtonRepeat storeRepeat;
 
 void RoomControl::display() {
     isDisplayed = true;
@@ -9,10 +15,11 @@ void RoomControl::display() {
 
 void RoomControl::init() {
     pinMode(config.pirPin, INPUT);
+    motionChannel = motionSensors.watch(config.pirPin);
 }
 
 void RoomControl::displayRoomMenu() {
-    printCentered(name.c_str(), 0);
+    printCentered_P(name, 0);
     mainDisplay.setCursor(0, 1);
     mainDisplay.print(F("<Light    Temp.>"));
 }
@@ -24,15 +31,40 @@ void RoomControl::handleRoomMenu() {
         delay(200);
     } else if (rightButtonPressed) {
         stateStack.push(ROOM_TEMP_CONTROL);
+        adjustRepeat.suppress();
+        mainDisplay.clear();
+        delay(200);
+    } else if (scheduleButtonPressed) {
+        stateStack.push(ROOM_HISTORY);
+        sparkline.invalidate();
         mainDisplay.clear();
         delay(200);
     }
 }
 
 void RoomControl::displayRoomTempControl() {
+    char buffer[9];
+    strcpy_P(buffer, name);
+    strcat_P(buffer, PSTR(": "));
     mainDisplay.setCursor(0, 0);
-    mainDisplay.print(name.c_str());
-    mainDisplay.print(F(": "));
+    mainDisplay.print(buffer);
+    drawTempTarget();
+    mainDisplay.setCursor(0, 1);
+    mainDisplay.print(F("-"));
+    mainDisplay.setCursor(11, 1);
+    if (acState != OFF && etaMinutes > 0) {
+        char buffer[12];
+        snprintf_P(buffer, sizeof(buffer), PSTR("%3dm"), etaMinutes);
+        mainDisplay.print(buffer);
+    } else {
+        mainDisplay.print(F("    "));
+    }
+    mainDisplay.setCursor(15, 1);
+    mainDisplay.print(F("+"));
+}
+
+// Current temperature with the heading arrow, and the target below it
+void RoomControl::drawTempTarget() {
     mainDisplay.setCursor(9, 0);
     mainDisplay.print(currentTemp, 1);
     if (currentTemp != targetTemp) {
@@ -40,31 +72,93 @@ void RoomControl::displayRoomTempControl() {
     }
     mainDisplay.print(F("   "));
     printTemperature(targetTemp);
-    mainDisplay.setCursor(0, 1);
-    mainDisplay.print(F("-"));
-    mainDisplay.setCursor(15, 1);
-    mainDisplay.print(F("+"));
+    latency.output(OUTPUT_LCD);
 }
 
 void RoomControl::handleRoomTempControl() {
-    if (leftButtonPressed && targetTemp > 10) {
-        targetTemp -= 0.5;
-        tempAdjusted = true;
-        delay(200);
-    } else if (rightButtonPressed && targetTemp < 30) {
-        targetTemp += 0.5;
-        tempAdjusted = true;
+    int8_t direction = (rightButtonPressed ? 1 : 0) - (leftButtonPressed ? 1 : 0);
+    int steps = adjustRepeat.steps(direction, millis(), TEMP_REPEAT);
+    if (steps == 0) {
+        return;
+    }
+    float target = constrain(targetTemp + steps * 0.5f, 10.0f, 30.0f);
+    if (target != targetTemp) {
+        setTarget(target);
+        drawTempTarget();
+    }
+}
+
+// Last 12 hours of temperature, one column per half hour, and the range
+void RoomControl::displayRoomHistory() {
+    char buffer[17];
+    strcpy_P(buffer, name);
+    strcat_P(buffer, PSTR(" last 12h"));
+    printCentered(buffer, 0);
+    sparkline.draw(history, mainDisplay);
+    mainDisplay.setCursor(0, 1);
+    for (int i = 0; i < Sparkline::CHARS; i++) {
+        mainDisplay.write(byte(Sparkline::FIRST_CHAR + i));
+    }
+    int16_t low = sparkline.low();
+    int16_t high = sparkline.high();
+    // The sign goes separately, or -0.5 would lose it to the integer part
+    int length = snprintf_P(buffer, sizeof(buffer), low < 0 ? PSTR(" -%d.%d") : PSTR(" %d.%d"), abs(low) / 10, abs(low) % 10);
+    snprintf_P(buffer + length, sizeof(buffer) - length, high < 0 ? PSTR("--%d.%d") : PSTR("-%d.%d"), abs(high) / 10,
+        abs(high) % 10);
+    mainDisplay.print(buffer);
+}
+
+void RoomControl::handleRoomHistory() {
+    if (scheduleButtonPressed) {
+        stateStack.push(ROOM_STATS);
+        mainDisplay.clear();
         delay(200);
     }
 }
 
+// Fixed-point seconds as hours, one decimal below 100 h
+static void formatHours(char* buffer, size_t size, uint32_t fixedSeconds) {
+    unsigned long tenths = (fixedSeconds >> EnergyStats::FRACTION_BITS) / 360;
+    if (tenths < 1000) {
+        snprintf_P(buffer, size, PSTR("%lu.%lu"), tenths / 10, tenths % 10);
+    } else {
+        snprintf_P(buffer, size, PSTR("%lu"), tenths / 10);
+    }
+}
+
+// Heating and cooling hours, lit-pixel hours and relay switch count
+void RoomControl::displayRoomStats() {
+    unsigned long now = millis();
+    char heat[12];
+    char cool[12];
+    char buffer[40];
+    formatHours(heat, sizeof(heat), energy.acTime(now, HEATING));
+    formatHours(cool, sizeof(cool), energy.acTime(now, COOLING));
+    snprintf_P(buffer, sizeof(buffer), PSTR("H %sh C %sh"), heat, cool);
+    mainDisplay.clear();
+    printCentered(buffer, 0);
+    formatHours(heat, sizeof(heat), energy.lightTime(now));
+    snprintf_P(buffer, sizeof(buffer), PSTR("L %spxh S%u"), heat, energy.acSwitches());
+    printCentered(buffer, 1);
+    statsDrawnAt = now;
+}
+
 void RoomControl::autoUpdateTemperature() {
     float temp = readTemperature();
+    thermal.observe(millis(), temp, acState);
+    if (history.record(millis(), temp)) {
+        historyAdjusted = true;
+    }
     if (temp != currentTemp) {
         currentTemp = temp;
         tempAdjusted = true;
     }
     adjustAC();
+    int eta = thermal.minutesToReach(currentTemp, targetTemp);
+    if (eta != etaMinutes) {
+        etaMinutes = eta;
+        tempAdjusted = true;
+    }
 }
 
 float RoomControl::readTemperature() {
@@ -75,36 +169,43 @@ float RoomControl::readTemperature() {
 }
 
 void RoomControl::adjustAC() {
-    if (currentTemp < targetTemp && acState != HEATING) {
-        setACState(HEATING);
-    } else if (currentTemp > targetTemp && acState != COOLING) {
-        setACState(COOLING);
-    } else if (currentTemp == targetTemp && acState != OFF) {
-        setACState(OFF);
+    if (stageAC()) {
+        PCF8574_Write(expanderPinStates);
     }
 }
 
-void RoomControl::setACState(ACState state) {
-    switch (state) {
-    case HEATING:
-        setExpanderPin(config.heatingPin, HIGH);
-        setExpanderPin(config.coolingPin, LOW);
-        break;
-    case COOLING:
-        setExpanderPin(config.heatingPin, LOW);
-        setExpanderPin(config.coolingPin, HIGH);
-        break;
-    case OFF:
-        setExpanderPin(config.heatingPin, LOW);
-        setExpanderPin(config.coolingPin, LOW);
-        break;
+// Picks the AC state for the target and sets the relay bits without
+// writing the expander. Returns true if the state changed.
+bool RoomControl::stageAC() {
+    ACState state = OFF;
+    if (currentTemp < targetTemp) {
+        state = HEATING;
+    } else if (currentTemp > targetTemp) {
+        state = COOLING;
     }
+    if (state == acState) {
+        return false;
+    }
+    stageACState(state);
+    return true;
+}
+
+void RoomControl::setACState(ACState state) {
+    stageACState(state);
+    PCF8574_Write(expanderPinStates);
+}
+
+void RoomControl::stageACState(ACState state) {
+    stageExpanderPin(config.heatingPin, state == HEATING);
+    stageExpanderPin(config.coolingPin, state == COOLING);
+    energy.setAC(millis(), state);
     acState = state;
 }
 
 void RoomControl::displayRoomLightControl() {
     char buffer[17];
-    snprintf(buffer, sizeof(buffer), "%s Light", name.c_str());
+    strcpy_P(buffer, name);
+    strcat_P(buffer, PSTR(" Light"));
     printCentered(buffer, 0);
     mainDisplay.setCursor(0, 1);
     mainDisplay.print(F("- "));
@@ -132,6 +233,8 @@ void RoomControl::handleRoomLightControl() {
         delay(200);
     } else if (scheduleButtonPressed) {
         stateStack.push(ROOM_SCHEDULE);
+        adjustRepeat.suppress();
+        storeRepeat.suppress();
         selectedHour = hour();
         delay(200);
     }
@@ -141,24 +244,28 @@ void RoomControl::updateNeoPixelBrightness(bool manual) {
     if (manual) {
         autoLightEnabled = false;
     }
-    int startIndex = config.lightStripStartIndex;
-    int endIndex = startIndex + 4;
-    // clearing
-    for (int i = startIndex; i < endIndex; i++) {
-        strip.setPixelColor(i, strip.Color(0, 0, 0));
-    }
-    // setting color
-    for (int i = startIndex; i < startIndex + lightIntensity; i++) {
-        strip.setPixelColor(i, strip.Color(0, 255, 0));
+    // The whole strip goes out on every show(), so skip it if nothing changed
+    if (stageLight()) {
+        strip.show();
+        latency.output(OUTPUT_STRIP);
     }
-    strip.show();
-    lightAdjusted = true;
+}
 
+// Puts the level into the strip's buffer only; the caller shows it.
+// Returns true if any pixel changed.
+bool RoomControl::stageLight() {
+    bool changed = lights.apply(strip, lightIntensity);
+    energy.setLight(millis(), lightIntensity);
+    lightAdjusted = true;
+    return changed;
 }
 
 void RoomControl::autoAdjustLight() {
-    int outdoorLightLevel = analogRead(PHOTO_RESISTOR_PIN);
-    int targetIntensity = mapOutdoorLighting(outdoorLightLevel);
+    unsigned long now = millis();
+    if (daylight.due(now)) {
+        daylight.update(now, analogRead(PHOTO_RESISTOR_PIN), config.daylightGain, config.daylightOffset);
+    }
+    int targetIntensity = daylight.level();
     if (autoLightEnabled && !scheduleActive && targetIntensity != lightIntensity) {
         lightIntensity = targetIntensity;
         updateNeoPixelBrightness(false);
@@ -166,51 +273,84 @@ void RoomControl::autoAdjustLight() {
 }
 
 void RoomControl::displayRoomSchedule() {
-    int nextHour = (selectedHour + 1) % 24;
-    int scheduledLightIntensity = schedule[selectedHour];
-
     mainDisplay.clear();
-    char buffer[17];
+    drawScheduleLabel();
+    mainDisplay.setCursor(0, 1);
+    mainDisplay.print(F("<"));
+    mainDisplay.setCursor(4, 1);
+    mainDisplay.print(F(":00"));
+    mainDisplay.setCursor(11, 1);
+    mainDisplay.print(F(":00 >"));
+    drawScheduleHours();
+}
 
-    if (scheduledLightIntensity == 0) {
-        printCentered("[unset]", 0);
+// Scheduled level of the selected hour, padded over the whole row since
+// the label changes width
+void RoomControl::drawScheduleLabel() {
+    char label[14];
+    if (scheduledLevel(selectedHour) == 0) {
+        strcpy_P(label, PSTR("[unset]"));
     } else {
-        int percentage = scheduledLightIntensity * 25;
-        sprintf(buffer, "[%d%% light]", percentage);
-        printCentered(buffer, 0);
+        sprintf_P(label, PSTR("[%d%% light]"), scheduledLevel(selectedHour) * 25);
     }
+    char row[17];
+    int startPos = (16 - strlen(label)) / 2;
+    snprintf_P(row, sizeof(row), PSTR("%*s%-*s"), startPos, "", 16 - startPos, label);
+    mainDisplay.setCursor(0, 0);
+    mainDisplay.print(row);
+    latency.output(OUTPUT_LCD);
+}
 
-    sprintf(buffer, "< %02d:00", selectedHour);
-    mainDisplay.setCursor(0, 1);
+void RoomControl::drawScheduleHours() {
+    char buffer[4];
+    sprintf_P(buffer, PSTR("%02d"), selectedHour);
+    mainDisplay.setCursor(2, 1);
     mainDisplay.print(buffer);
-
-    sprintf(buffer, "%02d:00 >", nextHour);
+    sprintf_P(buffer, PSTR("%02d"), (selectedHour + 1) % 24);
     mainDisplay.setCursor(9, 1);
     mainDisplay.print(buffer);
+    latency.output(OUTPUT_LCD);
 }
 
 void RoomControl::handleRoomSchedule() {
-    if (leftButtonPressed) {
-        selectedHour = (selectedHour == 0) ? 23 : selectedHour - 1;
-        scheduleAdjusted = true;
-        delay(200);
-    } else if (rightButtonPressed) {
-        selectedHour = (selectedHour + 1) % 24;
-        scheduleAdjusted = true;
-        delay(200);
-    } else if (scheduleButtonPressed) {
-        schedule[selectedHour] = lightIntensity;
-        if (schedule[selectedHour] != 0) {
+    int8_t direction = (rightButtonPressed ? 1 : 0) - (leftButtonPressed ? 1 : 0);
+    int steps = adjustRepeat.steps(direction, millis(), SCHEDULE_REPEAT);
+    if (steps != 0) {
+        int previousLevel = scheduledLevel(selectedHour);
+        selectedHour = ((selectedHour + steps) % 24 + 24) % 24;
+        drawScheduleHours();
+        if (scheduledLevel(selectedHour) != previousLevel) {
+            drawScheduleLabel();
+        }
+    } else if (storeRepeat.steps(scheduleButtonPressed ? 1 : 0, millis(), SINGLE_PRESS) != 0) {
+        setScheduledLevel(selectedHour, lightIntensity);
+        if (lightIntensity != 0) {
             scheduleActive = true;
         }
-        scheduleAdjusted = true;
-        delay(200);
+        drawScheduleLabel();
     }
 }
 
+uint8_t RoomControl::scheduledLevel(int hour) const {
+    uint8_t pair = schedule[hour / 2];
+    return hour % 2 ? pair >> 4 : pair & 0x0F;
+}
+
+void RoomControl::setScheduledLevel(int hour, uint8_t level) {
+    uint8_t& pair = schedule[hour / 2];
+    pair = hour % 2 ? (pair & 0x0F) | level << 4 : (pair & 0xF0) | level;
+}
+
 void RoomControl::checkSchedule() {
     int currentHour = hour();
-    int scheduledLight = schedule[currentHour];
+    if (!scheduleEnabled) {
+        scheduleActive = false;
+        if (currentHour != hourOverride && hourOverride != -1) {
+            resetRoomOverride();
+        }
+        return;
+    }
+    int scheduledLight = scheduledLevel(currentHour);
     bool shouldUpdate = scheduledLight != 0 && scheduledLight != lightIntensity;
 
     if (shouldUpdate && currentHour != hourOverride) {
@@ -238,19 +378,36 @@ void RoomControl::resetRoomOverride() {
     lastMotionTime = currentTime();
 }
 
-void RoomControl::detectRoomMotion(bool motionDetected) {
-    unsigned long timeDiff = currentTime() - lastMotionTime;
-
-    if (motionDetected && (timeDiff > 2000)) {
-        lastMotionTime = currentTime();
-        autoLightEnabled = true;
-        peoplePresent = true;
+// Works through the PIR edges queued since the last call. A rising edge is
+// new motion unless it comes within 2 s of the last one; a falling edge
+// means motion went on until then. No inactivity while the output is high.
+void RoomControl::detectRoomMotion() {
+    MotionEvent event;
+    while (motionSensors.pop(motionChannel, event)) {
+        unsigned long time = currentTimeAt(event.time);
+        if (!event.rising) {
+            lastMotionTime = time;
+        } else if (time - lastMotionTime > 2000) {
+            latency.open(LATENCY_MOTION, event.time);
+            registerMotion(time);
+        }
     }
-    if (peoplePresent && !scheduleActive && hour() != hourOverride) {
+    if (peoplePresent && !scheduleActive && hour() != hourOverride && !motionSensors.active(motionChannel)) {
         handleInactivity();
     }
 }
 
+void RoomControl::registerMotion(unsigned long time) {
+    occupancy.recordMotion(time);
+    if (!peoplePresent || inactive) {
+        restoreComfort();
+        inactive = false;
+    }
+    lastMotionTime = time;
+    autoLightEnabled = true;
+    peoplePresent = true;
+}
+
 void RoomControl::handleInactivity() {
     unsigned long timeDiff = currentTime() - lastMotionTime;
 
@@ -262,10 +419,7 @@ void RoomControl::handleInactivity() {
         peoplePresent = false;
         inactive = false;
     } else if (timeDiff > 15000 && !inactive) { // 15 seconds of inactivity
-        if (targetTemp != 18.0) {
-            targetTemp = 18.0;
-            tempAdjusted = true;
-        }
+        enterSetback();
         if (lightIntensity > 0) {
             lightIntensity = (lightIntensity > 1) ? 1 : 0;
             updateNeoPixelBrightness(true);
@@ -274,11 +428,84 @@ void RoomControl::handleInactivity() {
     }
 }
 
+// Brings an empty room to its comfort setpoint ahead of a slot in which it
+// is usually occupied, early enough for the thermal model to get there, and
+// puts its lights on auto shortly before. Drops back to the setback once the
+// prediction window passes without anyone showing up.
+void RoomControl::anticipateOccupancy() {
+    unsigned long now = currentTime();
+    occupancy.update(now);
+    if (peoplePresent) {
+        preconditioning = false;
+        return;
+    }
+    int untilOccupied = occupancy.minutesUntilExpected(now, PRECONDITION_MAX_SLOTS);
+    if (!preconditioning && untilOccupied >= 0) {
+        int lead = thermal.minutesToReach(currentTemp, comfortTemp);
+        if (untilOccupied <= max(lead, PRECONDITION_DEFAULT_MINUTES)) {
+            preconditioning = true;
+            lightsArmed = false;
+            restoreComfort();
+        }
+    } else if (preconditioning && untilOccupied < 0) {
+        preconditioning = false;
+        enterSetback();
+        if (lightsArmed) {
+            if (lightIntensity != 0) {
+                lightIntensity = 0;
+                updateNeoPixelBrightness(true);
+            }
+            autoLightEnabled = false;
+        }
+    }
+    if (preconditioning && !lightsArmed && untilOccupied <= PRECONDITION_LIGHT_MINUTES) {
+        lightsArmed = true;
+        autoLightEnabled = true;
+    }
+}
+
+// A setpoint chosen by hand, over Serial or by a scene. It becomes the
+// comfort setpoint and ends any setback.
+void RoomControl::setTarget(float temp) {
+    targetTemp = temp;
+    comfortTemp = temp;
+    setback = false;
+}
+
+// A setpoint that is not meant for whoever is in the room right now, from a
+// scene. An empty room keeps its setback and gets the new comfort setpoint
+// when someone comes in.
+void RoomControl::setComfort(float temp) {
+    setTarget(temp);
+    if ((!peoplePresent && !preconditioning) || inactive) {
+        enterSetback();
+    }
+}
+
+// Never raises the target: a comfort setpoint below the setback stays
+void RoomControl::enterSetback() {
+    if (!setback) {
+        setback = true;
+        targetTemp = min(comfortTemp, SETBACK_TEMP);
+        tempAdjusted = true;
+    }
+}
+
+// Only undoes our own setback; a setpoint set in the meantime ended it
+void RoomControl::restoreComfort() {
+    if (setback) {
+        setback = false;
+        targetTemp = comfortTemp;
+        tempAdjusted = true;
+    }
+}
+
 bool RoomControl::shouldUpdate() {
     autoAdjustLight();
     autoUpdateTemperature();
     checkSchedule();
-    detectRoomMotion(digitalRead(config.pirPin));
+    detectRoomMotion();
+    anticipateOccupancy();
     if (lightAdjusted && (currentState == ROOM_LIGHT_CONTROL)) {
         return true;
     }
@@ -288,5 +515,11 @@ bool RoomControl::shouldUpdate() {
     if (scheduleAdjusted && (currentState == ROOM_SCHEDULE)) {
         return true;
     }
+    if (historyAdjusted && (currentState == ROOM_HISTORY)) {
+        return true;
+    }
+    if (isDisplayed && (currentState == ROOM_STATS) && millis() - statsDrawnAt >= STATS_REFRESH_MS) {
+        return true;
+    }
     return false;
 }
\ No newline at end of file
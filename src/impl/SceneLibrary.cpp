@@ -0,0 +1,161 @@
+#include <EEPROM.h>
+#include "hardware.h"
+#include "general.h"
+#include "SceneLibrary.h"
+#include "Telemetry.h"
+#include "LatencyTracker.h"
+
+INSTANCE_STATE SceneLibrary scenes;
+
+#define K SCENE_KEEP
+static const Scene BUILT_IN_SCENES[SceneLibrary::BUILT_IN] PROGMEM = {
+    // Schedules back on at the comfort setpoint, lights left alone
+    { "HOME", { { K, 44, 1 }, { K, 44, 1 }, { K, 44, 1 }, { K, 44, 1 } } },
+    { "NIGHT", { { 0, 36, 0 }, { 0, 36, 0 }, { 0, 36, 0 }, { 0, 36, 0 } } },
+    { "AWAY", { { 0, 30, 0 }, { 0, 30, 0 }, { 0, 30, 0 }, { 0, 30, 0 } } }
+};
+#undef K
+
+SceneLibrary::SceneLibrary() : applied(NONE) {
+}
+
+// False for an empty user slot
+bool SceneLibrary::load(uint8_t index, Scene& scene) const {
+    if (index < BUILT_IN) {
+        memcpy_P(&scene, &BUILT_IN_SCENES[index], sizeof(Scene));
+        return true;
+    }
+    if (index >= COUNT) {
+        return false;
+    }
+    int address = EEPROM_BASE + (index - BUILT_IN) * SLOT_SIZE;
+    if (EEPROM.read(address) != SLOT_MAGIC) {
+        return false;
+    }
+    EEPROM.get(address + 1, scene);
+    scene.name[SCENE_NAME_SIZE - 1] = '\0';
+    return true;
+}
+
+int8_t SceneLibrary::find(const char* name) const {
+    Scene scene;
+    for (uint8_t i = 0; i < COUNT; i++) {
+        if (load(i, scene) && strcmp(scene.name, name) == 0) {
+            return i;
+        }
+    }
+    return NONE;
+}
+
+// Steps through the scenes that exist, wrapping around
+int8_t SceneLibrary::next(int8_t from, int8_t direction) const {
+    Scene scene;
+    int8_t index = from;
+    for (uint8_t i = 0; i < COUNT; i++) {
+        index = (index + direction + COUNT) % COUNT;
+        if (load(index, scene)) {
+            return index;
+        }
+    }
+    return from;
+}
+
+bool SceneLibrary::apply(uint8_t index, RoomControl* const rooms[], int roomCount) {
+    Scene scene;
+    if (!load(index, scene)) {
+        return false;
+    }
+    roomCount = min(roomCount, SCENE_MAX_ROOMS);
+    for (int r = 0; r < roomCount; r++) {
+        const RoomScene& target = scene.rooms[r];
+        RoomControl& room = *rooms[r];
+        if (target.scheduleEnabled != SCENE_KEEP) {
+            room.scheduleEnabled = target.scheduleEnabled;
+        }
+        // Like a manual change: holds against the schedule for this hour
+        if (target.light != SCENE_KEEP) {
+            room.lightIntensity = min(target.light, (uint8_t)LightSegment::MAX_LEVEL);
+            room.autoLightEnabled = false;
+            room.hourOverride = hour();
+        }
+        if (target.target != SCENE_KEEP) {
+            room.setComfort(constrain(target.target, (uint8_t)20, (uint8_t)60) / 2.0);
+            tempAdjusted = true;
+        }
+    }
+    bool lightsChanged = false;
+    bool acChanged = false;
+    for (int r = 0; r < roomCount; r++) {
+        lightsChanged |= rooms[r]->stageLight();
+        acChanged |= rooms[r]->stageAC();
+    }
+    if (lightsChanged) {
+        strip.show();
+        latency.output(OUTPUT_STRIP);
+    }
+    if (acChanged) {
+        PCF8574_Write(expanderPinStates);
+    }
+    applied = index;
+    return true;
+}
+
+// Stores the rooms' current settings under the name, replacing a user
+// scene of the same name or taking the first free slot. Returns the index,
+// or NONE if the name is a built-in one or every slot is taken.
+int8_t SceneLibrary::save(const char* name, const RoomControl* const rooms[], int roomCount) {
+    int8_t index = find(name);
+    if (index != NONE && index < BUILT_IN) {
+        return NONE;
+    }
+    Scene scene;
+    for (uint8_t i = BUILT_IN; index == NONE && i < COUNT; i++) {
+        if (!load(i, scene)) {
+            index = i;
+        }
+    }
+    if (index == NONE) {
+        return NONE;
+    }
+    memset(&scene, 0, sizeof(scene));
+    strncpy(scene.name, name, SCENE_NAME_SIZE - 1);
+    for (int r = 0; r < SCENE_MAX_ROOMS; r++) {
+        RoomScene& target = scene.rooms[r];
+        if (r < roomCount) {
+            target.light = rooms[r]->lightIntensity;
+            target.target = (uint8_t)round(rooms[r]->targetTemp * 2);
+            target.scheduleEnabled = rooms[r]->scheduleEnabled;
+        } else {
+            target.light = target.target = target.scheduleEnabled = SCENE_KEEP;
+        }
+    }
+    // Magic last, so a reset halfway leaves the slot empty rather than corrupt
+    int address = EEPROM_BASE + (index - BUILT_IN) * SLOT_SIZE;
+    EEPROM.update(address, 0xFF);
+    EEPROM.put(address + 1, scene);
+    EEPROM.update(address, SLOT_MAGIC);
+    return index;
+}
+
+int8_t SceneLibrary::lastApplied() const {
+    return applied;
+}
+
+// SCENE <last applied or -> <name of every scene that exists>
+bool SceneLibrary::report() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    Scene scene;
+    strcpy_P(buffer, PSTR("SCENE "));
+    if (applied != NONE && load(applied, scene)) {
+        strcat(buffer, scene.name);
+    } else {
+        strcat_P(buffer, PSTR("-"));
+    }
+    for (uint8_t i = 0; i < COUNT; i++) {
+        if (load(i, scene)) {
+            strcat_P(buffer, PSTR(" "));
+            strcat(buffer, scene.name);
+        }
+    }
+    return telemetry.sendText(buffer);
+}
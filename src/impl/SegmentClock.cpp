@@ -0,0 +1,38 @@
+#include "hardware.h"
+#include "SegmentClock.h"
+#include "I2CBus.h"
+
+INSTANCE_STATE SegmentClock segmentClock;
+
+SegmentClock::SegmentClock() : valid(false), busErrors(0) {
+    memset(shown, 0, sizeof(shown));
+}
+
+void SegmentClock::show(uint8_t hours, uint8_t minutes) {
+    // A failed write may have left any position stale
+    uint16_t errors = i2cBus.errors(CLOCK_ADDRESS);
+    if (errors != busErrors) {
+        busErrors = errors;
+        valid = false;
+    }
+    clockDisplay.writeDigitNum(0, hours / 10);
+    clockDisplay.writeDigitNum(1, hours % 10);
+    clockDisplay.drawColon(true);
+    clockDisplay.writeDigitNum(3, minutes / 10);
+    clockDisplay.writeDigitNum(4, minutes % 10);
+    for (uint8_t i = 0; i < POSITIONS; i++) {
+        uint16_t segments = clockDisplay.displaybuffer[i];
+        if (valid && segments == shown[i]) {
+            continue;
+        }
+        uint8_t data[3] = { (uint8_t)(i * 2), (uint8_t)(segments & 0xFF), (uint8_t)(segments >> 8) };
+        i2cBus.write(CLOCK_ADDRESS, data, sizeof(data));
+        shown[i] = segments;
+    }
+    valid = true;
+}
+
+// Makes the next show() queue every position
+void SegmentClock::invalidate() {
+    valid = false;
+}
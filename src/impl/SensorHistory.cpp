@@ -0,0 +1,99 @@
+#include "SensorHistory.h"
+
+SensorHistory::SensorHistory()
+    : head(0), count(0), newestAvg(0), closed(0), slotStart(0), lastSample(0), sum(0), samples(0), low(0), high(0) {
+    memset(deltas, 0, sizeof(deltas));
+    memset(spreads, 0, sizeof(spreads));
+}
+
+int16_t SensorHistory::currentAvg() const {
+    return (sum + (sum >= 0 ? samples / 2 : -(long)samples / 2)) / (long)samples;
+}
+
+void SensorHistory::closeSlot() {
+    int16_t avg = currentAvg();
+    int delta = count == 0 ? 0 : constrain(avg - newestAvg, -127, 127);
+    // A clamped delta only shifts the slots before it; the chain stays exact
+    newestAvg = count == 0 ? avg : newestAvg + delta;
+    deltas[head] = delta;
+    int below = min(max(newestAvg - low, 0), (int)MAX_SPREAD);
+    int above = min(max(high - newestAvg, 0), (int)MAX_SPREAD);
+    spreads[head] = (below << 4) | above;
+    head = (head + 1) % SLOT_COUNT;
+    if (count < SLOT_COUNT) {
+        count++;
+    }
+    closed++;
+    samples = 0;
+}
+
+// Takes a reading at most once a second and closes the slot every half
+// hour of uptime. Returns true when anything get() reports has changed.
+bool SensorHistory::record(unsigned long now, float value) {
+    bool changed = false;
+    if (now - slotStart >= SLOT_MS) {
+        if (samples > 0) {
+            closeSlot();
+            changed = true;
+        }
+        slotStart = now;
+    }
+    if (samples > 0 && now - lastSample < SAMPLE_MS) {
+        return changed;
+    }
+    lastSample = now;
+
+    int16_t tenths = (int16_t)round(value * 10);
+    if (samples == 0) {
+        low = high = tenths;
+        sum = tenths;
+        samples = 1;
+        return true;
+    }
+    int16_t before = currentAvg();
+    if (tenths < low) {
+        low = tenths;
+        changed = true;
+    }
+    if (tenths > high) {
+        high = tenths;
+        changed = true;
+    }
+    sum += tenths;
+    samples++;
+    return changed || currentAvg() != before;
+}
+
+// Age 0 is the slot in progress, 1 the last completed one and so on
+bool SensorHistory::get(int age, Sample& sample) const {
+    if (age == 0) {
+        if (samples == 0) {
+            return false;
+        }
+        sample.avg = currentAvg();
+        sample.min = low;
+        sample.max = high;
+        return true;
+    }
+    if (age > count) {
+        return false;
+    }
+    int index = (head + SLOT_COUNT - 1) % SLOT_COUNT;
+    int16_t avg = newestAvg;
+    for (int i = 1; i < age; i++) {
+        avg -= deltas[index];
+        index = (index + SLOT_COUNT - 1) % SLOT_COUNT;
+    }
+    sample.avg = avg;
+    sample.min = avg - (spreads[index] >> 4);
+    sample.max = avg + (spreads[index] & 0x0F);
+    return true;
+}
+
+int SensorHistory::size() const {
+    return count;
+}
+
+uint16_t SensorHistory::closedSlots() const {
+    return closed;
+}
@@ -0,0 +1,88 @@
+#include "Sparkline.h"
+
+INSTANCE_STATE Sparkline sparkline;
+
+Sparkline::Sparkline() : source(NULL), closedSlots(0), scaleLow(0), scaleHigh(MIN_SPAN) {
+    memset(newest, 0, sizeof(newest));
+}
+
+void Sparkline::invalidate() {
+    source = NULL;
+}
+
+int16_t Sparkline::low() const {
+    return scaleLow;
+}
+
+int16_t Sparkline::high() const {
+    return scaleHigh;
+}
+
+// Scales the vertical axis to the range of the shown slots
+void Sparkline::rescale(const SensorHistory& history) {
+    SensorHistory::Sample sample;
+    bool any = false;
+    for (int age = 0; age < COLUMNS; age++) {
+        if (!history.get(age, sample)) {
+            continue;
+        }
+        if (!any || sample.min < scaleLow) scaleLow = sample.min;
+        if (!any || sample.max > scaleHigh) scaleHigh = sample.max;
+        any = true;
+    }
+    if (!any) {
+        scaleLow = scaleHigh = 0;
+    }
+    if (scaleHigh - scaleLow < MIN_SPAN) {
+        scaleLow = (scaleLow + scaleHigh) / 2 - MIN_SPAN / 2;
+        scaleHigh = scaleLow + MIN_SPAN;
+    }
+}
+
+// Draws the five columns of one character. Returns false if a slot
+// doesn't fit the current scale.
+bool Sparkline::buildChar(int index, const SensorHistory& history, uint8_t* glyph) const {
+    memset(glyph, 0, 8);
+    int span = scaleHigh - scaleLow;
+    for (int i = 0; i < 5; i++) {
+        SensorHistory::Sample sample;
+        if (!history.get(COLUMNS - 1 - (index * 5 + i), sample)) {
+            continue;
+        }
+        if (sample.min < scaleLow || sample.max > scaleHigh) {
+            return false;
+        }
+        uint8_t bit = 1 << (4 - i);
+        int bottom = (sample.min - scaleLow) * 7 / span;
+        int top = (sample.max - scaleLow) * 7 / span;
+        for (int level = bottom; level <= top; level++) {
+            glyph[7 - level] |= bit;
+        }
+    }
+    return true;
+}
+
+// Between closed slots only the newest column can change, so only the last
+// character is redrawn then, and uploaded if it differs
+void Sparkline::draw(const SensorHistory& history, LiquidCrystal& lcd) {
+    uint8_t glyph[8];
+    bool full = source != &history || history.closedSlots() != closedSlots;
+    if (!full) {
+        if (!buildChar(CHARS - 1, history, glyph)) {
+            full = true;
+        } else if (memcmp(glyph, newest, sizeof(newest)) != 0) {
+            memcpy(newest, glyph, sizeof(newest));
+            lcd.createChar(FIRST_CHAR + CHARS - 1, glyph);
+        }
+    }
+    if (full) {
+        rescale(history);
+        for (int c = 0; c < CHARS; c++) {
+            buildChar(c, history, glyph);
+            lcd.createChar(FIRST_CHAR + c, glyph);
+        }
+        memcpy(newest, glyph, sizeof(newest));
+        source = &history;
+        closedSlots = history.closedSlots();
+    }
+}
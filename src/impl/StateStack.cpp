@@ -28,3 +28,11 @@ bool StateStack::isHistoryAvailable() const {
 int StateStack::size() const {
     return top + 1;
 }
+
+SystemState StateStack::at(int index) const {
+    return stack[index];
+}
+
+void StateStack::clear() {
+    top = -1;
+}
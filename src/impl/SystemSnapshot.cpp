@@ -0,0 +1,220 @@
+#include "hardware.h"
+#include "general.h"
+#include "main.h"
+#include "SegmentClock.h"
+#include "SystemSnapshot.h"
+#include "TelemetryFormat.h"
+
+static const size_t SNAPSHOT_HEADER_SIZE = 3;
+// currentState, stack depth, expander, flags, clock, time wheel
+static const size_t SNAPSHOT_GLOBAL_SIZE = 10;
+// Three temperatures, light, selected hour, override, motion age, flags,
+// ETA, AC state, the schedule packed two hours to a byte and more flags
+static const size_t SNAPSHOT_ROOM_SIZE = 30;
+static_assert(sizeof(RoomControl::schedule) == 12, "the snapshot copies the packed schedule as is");
+
+static const uint8_t ADJUSTED_LIGHT = 0x01;
+static const uint8_t ADJUSTED_TEMP = 0x02;
+static const uint8_t ADJUSTED_SCHEDULE = 0x04;
+static const uint8_t ADJUSTED_TIME = 0x08;
+static const uint8_t ADJUSTED_HISTORY = 0x10;
+static const uint8_t ADJUSTED_MEMORY = 0x20;
+
+static const uint8_t SNAPSHOT_PRESENT = 0x01;
+static const uint8_t SNAPSHOT_INACTIVE = 0x02;
+static const uint8_t SNAPSHOT_SCHEDULE_ACTIVE = 0x04;
+static const uint8_t SNAPSHOT_SCHEDULE_ENABLED = 0x08;
+static const uint8_t SNAPSHOT_AUTO_LIGHT = 0x10;
+static const uint8_t SNAPSHOT_PRECONDITIONING = 0x20;
+static const uint8_t SNAPSHOT_LIGHTS_ARMED = 0x40;
+static const uint8_t SNAPSHOT_DISPLAYED = 0x80;
+// Second flags byte
+static const uint8_t SNAPSHOT_SETBACK = 0x01;
+
+static uint8_t* putLE16(uint8_t* out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    return out + 2;
+}
+
+static uint8_t* putLE32(uint8_t* out, uint32_t value) {
+    out = putLE16(out, value);
+    return putLE16(out, value >> 16);
+}
+
+static uint16_t getLE16(const uint8_t* in) {
+    return in[0] | (uint16_t)in[1] << 8;
+}
+
+static uint32_t getLE32(const uint8_t* in) {
+    return getLE16(in) | (uint32_t)getLE16(in + 2) << 16;
+}
+
+static int16_t toTenths(float temp) {
+    return (int16_t)round(temp * 10);
+}
+
+size_t snapshotSize(int roomCount) {
+    return SNAPSHOT_HEADER_SIZE + SNAPSHOT_GLOBAL_SIZE + StateStack::MAX_STACK_SIZE +
+        roomCount * SNAPSHOT_ROOM_SIZE + 1;
+}
+
+size_t saveSnapshot(const RoomControl* const rooms[], int roomCount, uint8_t* out, size_t size) {
+    int depth = stateStack.size();
+    size_t len = snapshotSize(roomCount) - (StateStack::MAX_STACK_SIZE - depth);
+    if (size < len) {
+        return 0;
+    }
+    unsigned long clock = currentTime();
+    uint8_t* p = out;
+    *p++ = SNAPSHOT_MAGIC;
+    *p++ = SNAPSHOT_VERSION;
+    *p++ = roomCount;
+
+    *p++ = currentState;
+    *p++ = depth;
+    *p++ = expanderPinStates;
+    uint8_t adjusted = 0;
+    if (lightAdjusted) adjusted |= ADJUSTED_LIGHT;
+    if (tempAdjusted) adjusted |= ADJUSTED_TEMP;
+    if (scheduleAdjusted) adjusted |= ADJUSTED_SCHEDULE;
+    if (timeAdjusted) adjusted |= ADJUSTED_TIME;
+    if (historyAdjusted) adjusted |= ADJUSTED_HISTORY;
+    if (memoryAdjusted) adjusted |= ADJUSTED_MEMORY;
+    *p++ = adjusted;
+    p = putLE32(p, clock);
+    p = putLE16(p, lastTimeWheelValue);
+    for (int i = 0; i < depth; i++) {
+        *p++ = stateStack.at(i);
+    }
+
+    for (int r = 0; r < roomCount; r++) {
+        const RoomControl& room = *rooms[r];
+        p = putLE16(p, toTenths(room.currentTemp));
+        p = putLE16(p, toTenths(room.targetTemp));
+        p = putLE16(p, toTenths(room.comfortTemp));
+        *p++ = room.lightIntensity;
+        *p++ = room.selectedHour;
+        *p++ = room.hourOverride;
+        // Motion times are clock times, so they are kept as ages
+        p = putLE32(p, clock - room.lastMotionTime);
+        uint8_t flags = 0;
+        if (room.peoplePresent) flags |= SNAPSHOT_PRESENT;
+        if (room.inactive) flags |= SNAPSHOT_INACTIVE;
+        if (room.scheduleActive) flags |= SNAPSHOT_SCHEDULE_ACTIVE;
+        if (room.scheduleEnabled) flags |= SNAPSHOT_SCHEDULE_ENABLED;
+        if (room.autoLightEnabled) flags |= SNAPSHOT_AUTO_LIGHT;
+        if (room.preconditioning) flags |= SNAPSHOT_PRECONDITIONING;
+        if (room.lightsArmed) flags |= SNAPSHOT_LIGHTS_ARMED;
+        if (room.isDisplayed) flags |= SNAPSHOT_DISPLAYED;
+        *p++ = flags;
+        p = putLE16(p, room.etaMinutes);
+        *p++ = room.acState;
+        // Same packing as in RoomControl
+        memcpy(p, room.schedule, sizeof(room.schedule));
+        p += sizeof(room.schedule);
+        *p++ = room.setback ? SNAPSHOT_SETBACK : 0;
+    }
+
+    *p = crc8(out, p - out);
+    return len;
+}
+
+static bool validLevel(uint8_t level) {
+    return level <= LightSegment::MAX_LEVEL;
+}
+
+// Every field that indexes a table or drives an output must be in range
+static bool validRoom(const uint8_t* p) {
+    int8_t hourOverride = (int8_t)p[8];
+    if (!validLevel(p[6]) || p[7] >= 24 || hourOverride < -1 || hourOverride >= 24 || p[16] > COOLING ||
+        (p[29] & ~SNAPSHOT_SETBACK) != 0) {
+        return false;
+    }
+    for (int i = 0; i < 12; i++) {
+        if (!validLevel(p[17 + i] & 0x0F) || !validLevel(p[17 + i] >> 4)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool restoreSnapshot(RoomControl* const rooms[], int roomCount, const uint8_t* data, size_t len) {
+    if (len < SNAPSHOT_HEADER_SIZE + SNAPSHOT_GLOBAL_SIZE + 1 || data[0] != SNAPSHOT_MAGIC ||
+        data[1] != SNAPSHOT_VERSION || data[2] != roomCount) {
+        return false;
+    }
+    const uint8_t* p = data + SNAPSHOT_HEADER_SIZE;
+    int depth = p[1];
+    if (depth > StateStack::MAX_STACK_SIZE ||
+        len != snapshotSize(roomCount) - (StateStack::MAX_STACK_SIZE - depth) ||
+        crc8(data, len - 1) != data[len - 1] || p[0] > SCENE_MENU) {
+        return false;
+    }
+    const uint8_t* stack = p + SNAPSHOT_GLOBAL_SIZE;
+    for (int i = 0; i < depth; i++) {
+        if (stack[i] > SCENE_MENU) {
+            return false;
+        }
+    }
+    for (int r = 0; r < roomCount; r++) {
+        if (!validRoom(stack + depth + r * SNAPSHOT_ROOM_SIZE)) {
+            return false;
+        }
+    }
+
+    currentState = (SystemState)p[0];
+    expanderPinStates = p[2];
+    uint8_t adjusted = p[3];
+    // The clock carries on from the snapshot's time
+    unsigned long clock = getLE32(p + 4);
+    ADDED_TIME = clock - START_TIME - millis();
+    lastTimeWheelValue = (int16_t)getLE16(p + 8);
+    p += SNAPSHOT_GLOBAL_SIZE;
+    stateStack.clear();
+    for (int i = 0; i < depth; i++) {
+        stateStack.push((SystemState)*p++);
+    }
+
+    for (int r = 0; r < roomCount; r++) {
+        RoomControl& room = *rooms[r];
+        room.currentTemp = (int16_t)getLE16(p) / 10.0;
+        room.targetTemp = (int16_t)getLE16(p + 2) / 10.0;
+        room.comfortTemp = (int16_t)getLE16(p + 4) / 10.0;
+        room.lightIntensity = p[6];
+        room.selectedHour = p[7];
+        room.hourOverride = (int8_t)p[8];
+        room.lastMotionTime = clock - getLE32(p + 9);
+        uint8_t flags = p[13];
+        room.peoplePresent = flags & SNAPSHOT_PRESENT;
+        room.inactive = flags & SNAPSHOT_INACTIVE;
+        room.scheduleActive = flags & SNAPSHOT_SCHEDULE_ACTIVE;
+        room.scheduleEnabled = flags & SNAPSHOT_SCHEDULE_ENABLED;
+        room.autoLightEnabled = flags & SNAPSHOT_AUTO_LIGHT;
+        room.preconditioning = flags & SNAPSHOT_PRECONDITIONING;
+        room.lightsArmed = flags & SNAPSHOT_LIGHTS_ARMED;
+        room.isDisplayed = flags & SNAPSHOT_DISPLAYED;
+        room.etaMinutes = (int16_t)getLE16(p + 14);
+        ACState state = (ACState)p[16];
+        memcpy(room.schedule, p + 17, sizeof(room.schedule));
+        room.setback = p[29] & SNAPSHOT_SETBACK;
+        p += SNAPSHOT_ROOM_SIZE;
+        // Outputs are staged per room and committed together below
+        room.stageACState(state);
+        room.stageLight();
+    }
+    PCF8574_Write(expanderPinStates);
+    strip.show();
+    mainDisplay.clear();
+    displayCurrentMenu();
+    segmentClock.show(hour(), minute());
+
+    // Last, so redraws still pending in the snapshot stay pending
+    lightAdjusted = adjusted & ADJUSTED_LIGHT;
+    tempAdjusted = adjusted & ADJUSTED_TEMP;
+    scheduleAdjusted = adjusted & ADJUSTED_SCHEDULE;
+    timeAdjusted = adjusted & ADJUSTED_TIME;
+    historyAdjusted = adjusted & ADJUSTED_HISTORY;
+    memoryAdjusted = adjusted & ADJUSTED_MEMORY;
+    return true;
+}
@@ -0,0 +1,198 @@
+#include "hardware.h"
+#include "general.h"
+#include "Telemetry.h"
+
+INSTANCE_STATE Telemetry telemetry;
+
+// Type, sequence, room count or field mask, every field, CRC
+static_assert(3 + (TELEMETRY_MAX_FIELDS + 6) / 7 + TELEMETRY_MAX_FIELDS * 5 + 1 <= TELEMETRY_MAX_FRAME,
+    "a sample frame with every room must fit TELEMETRY_MAX_FRAME");
+static_assert(TELEMETRY_MAX_FRAME <= 252, "frames must stay within one COBS block and txBuffer within 8-bit indexes");
+
+Telemetry::Telemetry()
+    : txHead(0), txTail(0), frameHead(0), codeAt(0), code(0), crc(0), seq(0), framesSinceKey(KEY_FRAME_INTERVAL),
+      lastFrameTime(0), droppedFrames(0) {
+    memset(lastValues, 0, sizeof(lastValues));
+}
+
+int Telemetry::txFree() const {
+    int used = (txHead - txTail + TX_BUFFER_SIZE) % TX_BUFFER_SIZE;
+    return TX_BUFFER_SIZE - 1 - used;
+}
+
+uint8_t Telemetry::next(uint8_t index) {
+    return index + 1 == TX_BUFFER_SIZE ? 0 : index + 1;
+}
+
+// Frames are COBS encoded straight into txBuffer, so no frame is ever
+// copied on the stack. Under 254 bytes the encoding adds exactly one code
+// byte, so a frame of len bytes plus its CRC takes len + 3 bytes with the
+// delimiter. The whole frame is dropped when that doesn't fit, so the
+// stream never carries half a frame. len covers the type and sequence
+// bytes and must match what is put() before endFrame().
+bool Telemetry::beginFrame(uint8_t type, size_t len) {
+    if (txFree() < (int)len + 3) {
+        droppedFrames++;
+        return false;
+    }
+    codeAt = txHead;
+    frameHead = next(txHead);
+    code = 1;
+    crc = 0;
+    put(type);
+    put(seq);
+    return true;
+}
+
+void Telemetry::put(uint8_t data) {
+    crc = crc8Update(crc, data);
+    encode(data);
+}
+
+void Telemetry::putField(uint32_t value) {
+    while (value >= 0x80) {
+        put((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    put((uint8_t)value);
+}
+
+// Same output as cobsEncode(); frames never reach its 254-byte blocks
+void Telemetry::encode(uint8_t data) {
+    if (data == 0) {
+        txBuffer[codeAt] = code;
+        codeAt = frameHead;
+        code = 1;
+    } else {
+        txBuffer[frameHead] = data;
+        code++;
+    }
+    frameHead = next(frameHead);
+}
+
+// Appends the CRC and delimiter and hands the frame to pump()
+void Telemetry::endFrame() {
+    encode(crc);
+    txBuffer[codeAt] = code;
+    txBuffer[frameHead] = 0;
+    txHead = next(frameHead);
+    seq++;
+}
+
+void Telemetry::sample(RoomControl* const rooms[], int roomCount) {
+    unsigned long now = millis();
+    if (now - lastFrameTime < FRAME_INTERVAL) {
+        return;
+    }
+    lastFrameTime = now;
+    if (roomCount > TELEMETRY_MAX_ROOMS) {
+        roomCount = TELEMETRY_MAX_ROOMS;
+    }
+
+    int32_t values[TELEMETRY_MAX_FIELDS];
+    int fieldCount = GLOBAL_FIELD_COUNT + roomCount * ROOM_FIELD_COUNT;
+    values[FIELD_UPTIME_MS] = (int32_t)now;
+    values[FIELD_CLOCK_MINUTES] = hour() * 60 + minute();
+    values[FIELD_OUTDOOR_LIGHT] = analogRead(PHOTO_RESISTOR_PIN);
+    for (int r = 0; r < roomCount; r++) {
+        const RoomControl& room = *rooms[r];
+        int32_t* roomValues = &values[GLOBAL_FIELD_COUNT + r * ROOM_FIELD_COUNT];
+        uint8_t flags = room.acState & ROOM_FLAG_AC_MASK;
+        if (room.peoplePresent) flags |= ROOM_FLAG_PRESENT;
+        if (room.inactive) flags |= ROOM_FLAG_INACTIVE;
+        if (room.scheduleActive) flags |= ROOM_FLAG_SCHEDULE;
+        if (room.autoLightEnabled) flags |= ROOM_FLAG_AUTO_LIGHT;
+        if (room.preconditioning) flags |= ROOM_FLAG_PRECONDITION;
+        roomValues[ROOM_FIELD_TEMP] = (int32_t)round(room.currentTemp * 10);
+        roomValues[ROOM_FIELD_TARGET] = (int32_t)round(room.targetTemp * 10);
+        roomValues[ROOM_FIELD_LIGHT] = room.lightIntensity;
+        roomValues[ROOM_FIELD_FLAGS] = flags;
+    }
+
+    bool keyFrame = framesSinceKey >= KEY_FRAME_INTERVAL;
+    uint32_t mask = 0;
+    size_t len = 2;
+    if (keyFrame) {
+        len++;
+        for (int i = 0; i < fieldCount; i++) {
+            len += varintSize(zigzagEncode(values[i]));
+        }
+    } else {
+        for (int i = 0; i < fieldCount; i++) {
+            if (values[i] != lastValues[i]) {
+                mask |= 1UL << i;
+                len += varintSize(zigzagEncode(values[i] - lastValues[i]));
+            }
+        }
+        len += varintSize(mask);
+    }
+
+    // Deltas are always taken against the last frame that was actually queued
+    if (!beginFrame(keyFrame ? FRAME_KEY : FRAME_DELTA, len)) {
+        return;
+    }
+    if (keyFrame) {
+        put(roomCount);
+        for (int i = 0; i < fieldCount; i++) {
+            putField(zigzagEncode(values[i]));
+        }
+    } else {
+        putField(mask);
+        for (int i = 0; i < fieldCount; i++) {
+            if (mask & (1UL << i)) {
+                putField(zigzagEncode(values[i] - lastValues[i]));
+            }
+        }
+    }
+    endFrame();
+    memcpy(lastValues, values, fieldCount * sizeof(int32_t));
+    framesSinceKey = keyFrame ? 1 : framesSinceKey + 1;
+}
+
+// Text beyond TELEMETRY_MAX_FRAME is cut off
+bool Telemetry::sendText(const char* text) {
+    size_t length = min(strlen(text), (size_t)(TELEMETRY_MAX_FRAME - 3));
+    if (!beginFrame(FRAME_TEXT, length + 2)) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        put(text[i]);
+    }
+    endFrame();
+    return true;
+}
+
+bool Telemetry::sendText_P(PGM_P text) {
+    size_t length = min(strlen_P(text), (size_t)(TELEMETRY_MAX_FRAME - 3));
+    if (!beginFrame(FRAME_TEXT, length + 2)) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        put(pgm_read_byte(text + i));
+    }
+    endFrame();
+    return true;
+}
+
+bool Telemetry::sendTrace(const uint8_t* body, size_t len) {
+    if (len > TELEMETRY_MAX_FRAME - 3 || !beginFrame(FRAME_TRACE, len + 2)) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        put(body[i]);
+    }
+    endFrame();
+    return true;
+}
+
+// Moves queued bytes into the UART buffer without ever waiting on it
+void Telemetry::pump() {
+    while (txTail != txHead && Serial.availableForWrite() > 0) {
+        Serial.write(txBuffer[txTail]);
+        txTail = next(txTail);
+    }
+}
+
+unsigned int Telemetry::dropped() const {
+    return droppedFrames;
+}
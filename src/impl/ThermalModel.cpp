@@ -0,0 +1,71 @@
+#include "ThermalModel.h"
+
+ThermalModel::ThermalModel()
+    : segmentState(-1), segmentStarted(false), segmentTemp(0), lastTemp(0), segmentStart(0) {
+    memset(rates, 0, sizeof(rates));
+    memset(samples, 0, sizeof(samples));
+}
+
+void ThermalModel::startSegment(unsigned long now, int16_t temp) {
+    segmentStarted = true;
+    segmentTemp = temp;
+    segmentStart = now;
+}
+
+void ThermalModel::addSample(ACState state, long milliPerMinute) {
+    milliPerMinute = constrain(milliPerMinute, -32000L, 32000L);
+    if (samples[state] == 0) {
+        rates[state] = milliPerMinute;
+    } else {
+        rates[state] += (milliPerMinute - rates[state]) >> RATE_SHIFT;
+    }
+    if (samples[state] < 255) {
+        samples[state]++;
+    }
+}
+
+// Called with the state the AC was in while temp was read
+void ThermalModel::observe(unsigned long now, float temp, ACState state) {
+    int16_t tenths = (int16_t)round(temp * 10);
+    if (state != segmentState) {
+        segmentState = state;
+        segmentStarted = false;
+        lastTemp = tenths;
+        return;
+    }
+    if (!segmentStarted) {
+        if (tenths != lastTemp) {
+            startSegment(now, tenths);
+        }
+        return;
+    }
+    unsigned long elapsed = now - segmentStart;
+    if (abs(tenths - segmentTemp) >= MIN_CHANGE) {
+        if (elapsed > 0) {
+            // Milli-degrees per minute. Whole seconds keep the product within
+            // 32 bits for any change an int16_t holds; a segment lasts minutes.
+            unsigned long seconds = max(elapsed / 1000, 1UL);
+            addSample(state, (long)(tenths - segmentTemp) * 100 * 60 / (long)seconds);
+        }
+        startSegment(now, tenths);
+    } else if (elapsed > MAX_SEGMENT_MS) {
+        addSample(state, 0);
+        startSegment(now, tenths);
+    }
+}
+
+// Minutes the AC needs to move the room from one temperature to another, or
+// UNKNOWN if it hasn't been seen to make progress in that direction yet
+int ThermalModel::minutesToReach(float from, float to) const {
+    long delta = (long)round((to - from) * 10) * 100;
+    if (delta == 0) {
+        return 0;
+    }
+    ACState state = delta > 0 ? HEATING : COOLING;
+    long milliPerMinute = samples[state] ? rates[state] : 0;
+    if ((delta > 0 && milliPerMinute <= 0) || (delta < 0 && milliPerMinute >= 0)) {
+        return UNKNOWN;
+    }
+    long minutes = (delta + milliPerMinute - (delta > 0 ? 1 : -1)) / milliPerMinute;
+    return minutes > MAX_MINUTES ? MAX_MINUTES : (int)minutes;
+}
@@ -0,0 +1,138 @@
+#include "Watchdog.h"
+#include "Telemetry.h"
+
+#ifdef __AVR__
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#define NOINIT __attribute__((section(".noinit")))
+#else
+#define NOINIT
+#endif
+
+static const uint16_t CRASH_MAGIC = 0xC0DE;
+static const uint8_t NO_PHASE = 0xFF;
+
+static const char PHASE_NAMES[PHASE_COUNT][10] PROGMEM = {
+    "SETUP", "WAKE", "INPUT", "COMMANDS", "ROOMS", "MENU", "CLOCK", "BUS", "TELEMETRY"
+};
+static const char RESET_NAMES[][9] PROGMEM = {
+    "POWER_ON", "EXTERNAL", "BROWNOUT", "WATCHDOG", "UNKNOWN"
+};
+// Soft deadlines in ms; MENU includes the 200 ms button debounce delays.
+// WAKE is not checked, on idle passes it runs until the next wake-up.
+static const uint16_t PHASE_DEADLINE_MS[PHASE_COUNT] PROGMEM = {
+    0, 0, 10, 20, 100, 300, 50, 5, 10
+};
+
+INSTANCE_STATE CrashRecord crashRecord NOINIT;
+INSTANCE_STATE Watchdog watchdog;
+
+#ifdef __AVR__
+static uint8_t resetFlags NOINIT;
+
+// Runs before the C runtime starts. After a watchdog reset the watchdog
+// stays enabled, so it has to be stopped before anything slow happens.
+void captureResetFlags() __attribute__((naked, used, section(".init3")));
+void captureResetFlags() {
+    resetFlags = MCUSR;
+    MCUSR = 0;
+    wdt_disable();
+}
+
+ISR(WDT_vect) {
+    crashRecord.hungPhase = crashRecord.phase;
+}
+#endif
+
+Watchdog::Watchdog() : cause(RESET_POWER_ON), phaseStart(0), timing(false), overruns(0), worstPhase(NO_PHASE), worstMs(0) {
+    memset(&previous, 0, sizeof(previous));
+    previous.hungPhase = NO_PHASE;
+}
+
+void Watchdog::begin() {
+    bool valid = crashRecord.magic == CRASH_MAGIC;
+    if (valid) {
+        previous = crashRecord;
+    }
+#ifdef __AVR__
+    // Optiboot may already have cleared MCUSR, the crash record doesn't lie
+    if ((valid && previous.hungPhase != NO_PHASE) || (resetFlags & _BV(WDRF))) {
+        cause = RESET_WATCHDOG;
+    } else if (resetFlags & _BV(BORF)) {
+        cause = RESET_BROWN_OUT;
+    } else if (resetFlags & _BV(EXTRF)) {
+        cause = RESET_EXTERNAL;
+    } else if ((resetFlags & _BV(PORF)) || !valid) {
+        cause = RESET_POWER_ON;
+    } else {
+        cause = RESET_UNKNOWN;
+    }
+#else
+    cause = (valid && previous.hungPhase != NO_PHASE) ? RESET_WATCHDOG : RESET_POWER_ON;
+#endif
+    crashRecord.magic = CRASH_MAGIC;
+    crashRecord.phase = PHASE_SETUP;
+    crashRecord.hungPhase = NO_PHASE;
+    crashRecord.loops = 0;
+    phaseStart = millis();
+#ifdef __AVR__
+    wdt_enable(WDTO_1S);
+    WDTCSR |= _BV(WDIE);
+#endif
+}
+
+void Watchdog::endPhase(unsigned long now) {
+    uint8_t phase = crashRecord.phase;
+    unsigned long elapsed = now - phaseStart;
+    uint16_t deadline = pgm_read_word(&PHASE_DEADLINE_MS[phase]);
+    if (deadline > 0 && elapsed > deadline) {
+        overruns++;
+        if (elapsed > worstMs) {
+            worstMs = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+            worstPhase = phase;
+        }
+    }
+}
+
+void Watchdog::enter(LoopPhase phase) {
+    unsigned long now = millis();
+    if (timing) {
+        endPhase(now);
+    }
+    crashRecord.phase = phase;
+    phaseStart = now;
+    timing = true;
+}
+
+// End of loop(): the only place the watchdog gets fed
+void Watchdog::heartbeat() {
+    endPhase(millis());
+    timing = false;
+    crashRecord.loops++;
+#ifdef __AVR__
+    wdt_reset();
+    WDTCSR |= _BV(WDIE);
+#endif
+}
+
+// BOOT <reset cause> <phase the last run was in> <loops it completed>
+bool Watchdog::reportBoot() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    char causeName[9];
+    char phaseName[10];
+    strcpy_P(causeName, RESET_NAMES[cause]);
+    uint8_t lastPhase = previous.hungPhase != NO_PHASE ? previous.hungPhase : previous.phase;
+    bool known = previous.magic == CRASH_MAGIC && lastPhase < PHASE_COUNT;
+    strcpy_P(phaseName, known ? PHASE_NAMES[lastPhase] : PSTR("-"));
+    snprintf_P(buffer, sizeof(buffer), PSTR("BOOT %s %s %lu"), causeName, phaseName, (unsigned long)previous.loops);
+    return telemetry.sendText(buffer);
+}
+
+// HEALTH <loops> <overruns> <worst phase> <worst ms>
+bool Watchdog::reportHealth() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    char phaseName[10];
+    strcpy_P(phaseName, worstPhase < PHASE_COUNT ? PHASE_NAMES[worstPhase] : PSTR("-"));
+    snprintf_P(buffer, sizeof(buffer), PSTR("HEALTH %lu %u %s %u"), (unsigned long)crashRecord.loops, overruns, phaseName, worstMs);
+    return telemetry.sendText(buffer);
+}
@@ -1,37 +1,52 @@
 #include "Arduino.h"
 #include "hardware.h"
 #include "general.h"
+#include "I2CBus.h"
+#include "LatencyTracker.h"
 
-unsigned long START_TIME = getMillisFromHour(START_HOUR);
+INSTANCE_STATE StateStack stateStack;
+INSTANCE_STATE SystemState currentState = WELCOME_SCREEN;
+INSTANCE_STATE byte expanderPinStates = 0x00;
+
+INSTANCE_STATE bool leftButtonPressed = false;
+INSTANCE_STATE bool rightButtonPressed = false;
+INSTANCE_STATE bool backButtonPressed = false;
+INSTANCE_STATE bool scheduleButtonPressed = false;
+INSTANCE_STATE bool lightAdjusted = false;
+INSTANCE_STATE bool tempAdjusted = false;
+INSTANCE_STATE bool scheduleAdjusted = false;
+INSTANCE_STATE bool timeAdjusted = false;
+INSTANCE_STATE bool historyAdjusted = false;
+INSTANCE_STATE bool memoryAdjusted = false;
+
+INSTANCE_STATE unsigned long START_TIME = getMillisFromHour(START_HOUR);
+INSTANCE_STATE unsigned long ADDED_TIME = 0;
 
 void setExpanderPin(int pin, bool state) {
+    stageExpanderPin(pin, state);
+    PCF8574_Write(expanderPinStates);
+}
+
+// Changes the pin in expanderPinStates only; several changes can then go
+// out in one PCF8574_Write()
+void stageExpanderPin(int pin, bool state) {
     if (state) {
         expanderPinStates |= (1 << pin);
     } else {
         expanderPinStates &= ~(1 << pin);
     }
-    PCF8574_Write(expanderPinStates);
 }
 
 void PCF8574_Write(byte data) {
-    Wire.beginTransmission(EXPANDER_ADDRESS);
-    Wire.write(data);
-    Wire.endTransmission();
-}
-
-int mapOutdoorLighting(int lightReading) {
-    if (lightReading < 380) {
-        return 4;
-    } else {
-        return map(lightReading, 380, 679, 3, 0);
-    }
+    i2cBus.write(EXPANDER_ADDRESS, &data, 1);
+    latency.relaysQueued();
 }
 
 void printTemperature(float temp) {
     int integerPart = (int)temp;
     int fractionalPart = (int)((temp - integerPart) * 10);
     char displayStr[10];
-    snprintf(displayStr, sizeof(displayStr), "%d.%d C", integerPart, fractionalPart);
+    snprintf_P(displayStr, sizeof(displayStr), PSTR("%d.%d C"), integerPart, fractionalPart);
     printCentered(displayStr, 1);
 }
 
@@ -41,6 +56,19 @@ void printCentered(const char* text, int row) {
     mainDisplay.print(text);
 }
 
+void printCentered_P(PGM_P text, int row) {
+    char buffer[17];
+    strncpy_P(buffer, text, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    printCentered(buffer, row);
+}
+
+void createChar_P(uint8_t location, const byte* glyph) {
+    byte buffer[8];
+    memcpy_P(buffer, glyph, sizeof(buffer));
+    mainDisplay.createChar(location, buffer);
+}
+
 String getTimestamp() {
     unsigned long millisec = currentTime();
     unsigned long hours = (millisec / 3600000) % 24;
@@ -49,13 +77,18 @@ String getTimestamp() {
     unsigned long ms = millisec % 1000;
 
     char formattedTime[13]; // Buffer to hold formatted time string
-    sprintf(formattedTime, "%02lu:%02lu:%02lu.%03lu", hours, mins, secs, ms);
+    sprintf_P(formattedTime, PSTR("%02lu:%02lu:%02lu.%03lu"), hours, mins, secs, ms);
 
     return String(formattedTime);
 }
 
 unsigned long currentTime() {
-    return (unsigned long)millis() + START_TIME + ADDED_TIME;
+    return currentTimeAt(millis());
+}
+
+// Clock time of an earlier millis() reading
+unsigned long currentTimeAt(unsigned long ms) {
+    return ms + START_TIME + ADDED_TIME;
 }
 
 unsigned long getMillisFromHour(int hour) {
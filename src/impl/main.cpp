@@ -1,24 +1,68 @@
 #include "main.h"
 #include "hardware.h"
 #include "general.h"
+#include "Telemetry.h"
+#include "CommandInterface.h"
+#include "Watchdog.h"
+#include "I2CBus.h"
+#include "PowerManager.h"
+#include "MotionSensors.h"
+#include "SegmentClock.h"
+#include "InputTrace.h"
+#include "MemoryMonitor.h"
+#include "SceneLibrary.h"
+#include "LatencyTracker.h"
 
 // Hardware
-LiquidCrystal mainDisplay(12, 13, 11, 10, 9, 8);
-Adafruit_NeoPixel strip(8, 4, NEO_GRB + NEO_KHZ800);
-Adafruit_7segment clockDisplay = Adafruit_7segment();
-unsigned long TIME_WHEEL_RANGE = getMillisFromHour(4);
+INSTANCE_STATE LiquidCrystal mainDisplay(12, 13, 11, 10, 9, 8);
+INSTANCE_STATE Adafruit_NeoPixel strip(LIGHT_STRIP_PIXELS, LIGHT_STRIP_PIN, NEO_GRB + NEO_KHZ800);
+INSTANCE_STATE Adafruit_7segment clockDisplay = Adafruit_7segment();
+INSTANCE_STATE unsigned long TIME_WHEEL_RANGE = getMillisFromHour(4);
+INSTANCE_STATE int lastTimeWheelValue = 0;
+INSTANCE_STATE int8_t selectedScene = 0;
+
+// Custom characters for the LCD, copied out of flash when they are created
+const byte solidBlock[8] PROGMEM = {
+    B11111,
+    B11111,
+    B11111,
+    B11111,
+    B11111,
+    B11111,
+    B11111,
+    B11111 };
+const byte arrowUp[8] PROGMEM = {
+    B00100,
+    B01110,
+    B11111,
+    B00100,
+    B00100,
+    B00100,
+    B00100,
+    B00000 };
+const byte arrowDown[8] PROGMEM = {
+    B00100,
+    B00100,
+    B00100,
+    B00100,
+    B11111,
+    B01110,
+    B00100,
+    B00000 };
 
 // Rooms
-RoomConfig room1Config(ROOM1_TEMP_SENSOR_PIN, ROOM1_HEATING_PIN, ROOM1_COOLING_PIN, ROOM1_PIR_PIN, ROOM1_LIGHT_STRIP_IND);
-RoomConfig room2Config(ROOM2_TEMP_SENSOR_PIN, ROOM2_HEATING_PIN, ROOM2_COOLING_PIN, ROOM2_PIR_PIN, ROOM2_LIGHT_STRIP_IND);
-RoomControl room1("Room 1", room1Config);
-RoomControl room2("Room 2", room2Config);
+static const char ROOM1_NAME[] PROGMEM = "Room 1";
+static const char ROOM2_NAME[] PROGMEM = "Room 2";
+INSTANCE_STATE RoomControl room1(ROOM1_NAME, RoomConfig(ROOM1_TEMP_SENSOR_PIN, ROOM1_HEATING_PIN, ROOM1_COOLING_PIN, ROOM1_PIR_PIN, ROOM1_LIGHT_STRIP_IND, ROOM1_LIGHT_STRIP_LEN, LIGHT_BAR));
+INSTANCE_STATE RoomControl room2(ROOM2_NAME, RoomConfig(ROOM2_TEMP_SENSOR_PIN, ROOM2_HEATING_PIN, ROOM2_COOLING_PIN, ROOM2_PIR_PIN, ROOM2_LIGHT_STRIP_IND, ROOM2_LIGHT_STRIP_LEN, LIGHT_BAR));
+INSTANCE_STATE RoomControl* const rooms[ROOM_COUNT] = { &room1, &room2 };
+static_assert(ROOM_COUNT <= TELEMETRY_MAX_ROOMS, "telemetry would leave rooms out");
 
 void displayWelcomeScreen() {
     room1.isDisplayed = false;
     room2.isDisplayed = false;
-    printCentered(" Welcome Artem! ", 0);
-    printCentered("<Room 1  Room 2>", 1);
+    printCentered_P(PSTR(" Welcome Artem! "), 0);
+    printCentered_P(PSTR("<Room 1  Room 2>"), 1);
 }
 
 void handleWelcomeScreen() {
@@ -30,9 +74,68 @@ void handleWelcomeScreen() {
         room2.display();
         mainDisplay.clear();
         delay(200);
+    } else if (scheduleButtonPressed) {
+        stateStack.push(SYSTEM_MENU);
+        mainDisplay.clear();
+        delay(200);
     }
 }
 
+void displaySystemMenu() {
+    printCentered_P(PSTR("House"), 0);
+    printCentered_P(PSTR("<Scenes  Memory>"), 1);
+}
+
+void handleSystemMenu() {
+    if (leftButtonPressed) {
+        selectedScene = max(scenes.lastApplied(), (int8_t)0);
+        adjustRepeat.suppress();
+        stateStack.push(SCENE_MENU);
+        mainDisplay.clear();
+        delay(200);
+    } else if (rightButtonPressed) {
+        stateStack.push(DIAGNOSTICS);
+        mainDisplay.clear();
+        delay(200);
+    }
+}
+
+// Selected scene between arrows, and whether it is the one in effect
+void displaySceneMenu() {
+    Scene scene;
+    scenes.load(selectedScene, scene);
+    mainDisplay.clear();
+    mainDisplay.print(F("<"));
+    printCentered(scene.name, 0);
+    mainDisplay.setCursor(15, 0);
+    mainDisplay.print(F(">"));
+    printCentered_P(selectedScene == scenes.lastApplied() ? PSTR("active") : PSTR("Sched: apply"), 1);
+    latency.output(OUTPUT_LCD);
+}
+
+void handleSceneMenu() {
+    int8_t direction = (rightButtonPressed ? 1 : 0) - (leftButtonPressed ? 1 : 0);
+    if (adjustRepeat.steps(direction, millis(), SINGLE_PRESS) != 0) {
+        selectedScene = scenes.next(selectedScene, direction);
+        displaySceneMenu();
+    } else if (scheduleButtonPressed) {
+        scenes.apply(selectedScene, rooms, ROOM_COUNT);
+        displaySceneMenu();
+        delay(200);
+    }
+}
+
+// SRAM budget: free now/lowest ever, then static data, heap and stack peak
+void displayDiagnostics() {
+    char buffer[24];
+    snprintf_P(buffer, sizeof(buffer), PSTR("Free %u/%u"), memoryMonitor.freeNow(), memoryMonitor.minFree());
+    mainDisplay.clear();
+    printCentered(buffer, 0);
+    snprintf_P(buffer, sizeof(buffer), PSTR("D%u H%u S%u"), memoryMonitor.staticBytes(), memoryMonitor.heapBytes(),
+             memoryMonitor.stackPeak());
+    printCentered(buffer, 1);
+}
+
 void displayCurrentMenu() {
     RoomControl& room = (room1.isDisplayed) ? room1 : room2;
     switch (currentState) {
@@ -51,7 +154,23 @@ void displayCurrentMenu() {
     case ROOM_SCHEDULE:
         room.displayRoomSchedule();
         break;
+    case ROOM_HISTORY:
+        room.displayRoomHistory();
+        break;
+    case ROOM_STATS:
+        room.displayRoomStats();
+        break;
+    case SYSTEM_MENU:
+        displaySystemMenu();
+        break;
+    case DIAGNOSTICS:
+        displayDiagnostics();
+        break;
+    case SCENE_MENU:
+        displaySceneMenu();
+        break;
     }
+    latency.output(OUTPUT_LCD);
 }
 
 void handleCurrentMenu() {
@@ -72,6 +191,21 @@ void handleCurrentMenu() {
     case ROOM_SCHEDULE:
         room.handleRoomSchedule();
         break;
+    case ROOM_HISTORY:
+        room.handleRoomHistory();
+        break;
+    case ROOM_STATS:
+        // View only; back returns to the history
+        break;
+    case SYSTEM_MENU:
+        handleSystemMenu();
+        break;
+    case DIAGNOSTICS:
+        // View only; back returns to the house menu
+        break;
+    case SCENE_MENU:
+        handleSceneMenu();
+        break;
     }
 }
 
@@ -80,24 +214,16 @@ void displayCurrentTime() {
     if ((currentTime() % 60000) > 1000 && !timeAdjusted) {
         return;
     }
-    clockDisplay.clear();
-
-    int currentHour = hour();
-    int currentMinute = minute();
-
-    char timeStr[5]; // HHMM format
-    sprintf(timeStr, "%02d%02d", currentHour, currentMinute);
-
-    clockDisplay.drawColon(true);
-    clockDisplay.println(timeStr);
-    clockDisplay.writeDisplay();
-
+    // Only digits that differ from what the display shows are sent
+    segmentClock.show(hour(), minute());
     timeAdjusted = false;
 }
 
 void updateStartTime() {
-    unsigned long potValue = analogRead(TIME_WHEEL_PIN);
-    if (potValue != lastTimeWheelValue) {
+    int potValue = analogRead(TIME_WHEEL_PIN);
+    // Ignore ADC noise around the wheel's position, but still reach both ends
+    bool atEnd = (potValue == 0 || potValue == 1023) && potValue != lastTimeWheelValue;
+    if (abs(potValue - lastTimeWheelValue) > TIME_WHEEL_DEADBAND || atEnd) {
         ADDED_TIME = (unsigned long)((float)potValue / 1023.0 * TIME_WHEEL_RANGE);
         lastTimeWheelValue = potValue;
         timeAdjusted = true;
@@ -105,40 +231,82 @@ void updateStartTime() {
 }
 
 void loop() {
+    watchdog.enter(PHASE_WAKE);
+    inputTrace.samplePins();
+    motionSensors.poll();
+    if (!power.wait()) {
+        return;
+    }
+    watchdog.enter(PHASE_INPUT);
     leftButtonPressed = !digitalRead(LEFT_BUTTON_PIN);
     rightButtonPressed = !digitalRead(RIGHT_BUTTON_PIN);
     backButtonPressed = !digitalRead(BACK_BUTTON_PIN);
     scheduleButtonPressed = !digitalRead(SCHEDULE_BUTTON_PIN);
+    latency.buttons(leftButtonPressed | rightButtonPressed << 1 | backButtonPressed << 2 | scheduleButtonPressed << 3,
+        millis());
+    inputTrace.sample();
 
     updateStartTime();
+    watchdog.enter(PHASE_COMMANDS);
+    commands.poll(rooms, ROOM_COUNT);
 
+    watchdog.enter(PHASE_ROOMS);
     if (backButtonPressed && stateStack.isHistoryAvailable()) {
         stateStack.pop();
         mainDisplay.clear();
         delay(200);
     }
-    if (currentState != stateStack.topState() || room1.shouldUpdate() || room2.shouldUpdate()) {
+    if (currentState != stateStack.topState() || room1.shouldUpdate() || room2.shouldUpdate()
+        || (memoryAdjusted && currentState == DIAGNOSTICS)) {
         currentState = stateStack.topState();
         displayCurrentMenu();
         lightAdjusted = false;
         tempAdjusted = false;
         scheduleAdjusted = false;
+        historyAdjusted = false;
+        memoryAdjusted = false;
     }
+    power.updateDisplays(rooms, ROOM_COUNT, leftButtonPressed || rightButtonPressed || backButtonPressed || scheduleButtonPressed);
+    watchdog.enter(PHASE_MENU);
     handleCurrentMenu();
+    watchdog.enter(PHASE_CLOCK);
     displayCurrentTime();
+    watchdog.enter(PHASE_BUS);
+    i2cBus.service();
+    latency.endPass();
+
+    watchdog.enter(PHASE_TELEMETRY);
+    telemetry.sample(rooms, ROOM_COUNT);
+    if (memoryMonitor.service()) {
+        memoryAdjusted = true;
+    }
+    inputTrace.service();
+    telemetry.pump();
+    watchdog.heartbeat();
+    power.done();
 }
 
 void setup() {
-    Serial.begin(9600);
+    // Relays off before anything else: the expander powers up with all
+    // outputs high, and after a reset they may still be latched on
+    watchdog.begin();
     Wire.begin();
+    i2cBus.begin();
+    // The PCF8574 is only specified for standard mode
+    i2cBus.addDevice(EXPANDER_ADDRESS, I2CBus::STANDARD_MODE);
+    i2cBus.addDevice(CLOCK_ADDRESS, I2CBus::FAST_MODE);
+    PCF8574_Write(expanderPinStates);
+    i2cBus.flush();
+    Serial.begin(9600);
+    watchdog.reportBoot();
 
     clockDisplay.begin(CLOCK_ADDRESS);
     clockDisplay.setBrightness(15);
 
     mainDisplay.begin(16, 2);
-    mainDisplay.createChar(0, solidBlock);
-    mainDisplay.createChar(1, arrowUp);
-    mainDisplay.createChar(2, arrowDown);
+    createChar_P(0, solidBlock);
+    createChar_P(1, arrowUp);
+    createChar_P(2, arrowDown);
 
     pinMode(TIME_WHEEL_PIN, INPUT);
     pinMode(PHOTO_RESISTOR_PIN, INPUT);
@@ -146,13 +314,20 @@ void setup() {
     pinMode(RIGHT_BUTTON_PIN, INPUT_PULLUP);
     pinMode(BACK_BUTTON_PIN, INPUT_PULLUP);
     pinMode(SCHEDULE_BUTTON_PIN, INPUT_PULLUP);
+    power.addWakePin(LEFT_BUTTON_PIN);
+    power.addWakePin(RIGHT_BUTTON_PIN);
+    power.addWakePin(BACK_BUTTON_PIN);
+    power.addWakePin(SCHEDULE_BUTTON_PIN);
 
     room1.init();
     room2.init();
+    power.addWakePin(room1.config.pirPin);
+    power.addWakePin(room2.config.pirPin);
 
     strip.begin();
     strip.show();
 
     stateStack.push(WELCOME_SCREEN);
     displayCurrentMenu();
+    memoryMonitor.scan();
 }
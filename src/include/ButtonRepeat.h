@@ -0,0 +1,37 @@
+#ifndef BUTTON_REPEAT_H
+#define BUTTON_REPEAT_H
+
+#include <Arduino.h>
+
+// How a held button repeats: a pause after the press, then a step every
+// interval, with the step size doubling every few repeats up to a limit.
+// An interval of 0 means one step per press.
+struct RepeatRate {
+    uint16_t initialDelay;
+    uint16_t interval;
+    uint8_t accelerateAfter;
+    uint8_t maxStep;
+};
+
+// Turns a held left/right pair into signed steps without blocking the loop
+class ButtonRepeat {
+public:
+    ButtonRepeat();
+
+    // By value, so the rate constants never need a copy in SRAM
+    int steps(int8_t direction, unsigned long now, RepeatRate rate);
+    void suppress();
+
+private:
+    // A press this soon after a release is contact bounce, not a new press
+    static const uint8_t DEBOUNCE_MS = 30;
+
+    int8_t held;
+    bool blocked;
+    uint8_t repeats;
+    uint8_t stepSize;
+    unsigned long nextRepeat;
+    unsigned long releasedAt;
+};
+
+#endif // BUTTON_REPEAT_H
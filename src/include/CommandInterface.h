@@ -0,0 +1,65 @@
+#ifndef COMMAND_INTERFACE_H
+#define COMMAND_INTERFACE_H
+
+#include <Arduino.h>
+#include "instance.h"
+#include "RoomControl.h"
+#include "TelemetryFormat.h"
+
+// Line based command protocol read from Serial. Replies are sent as
+// telemetry TEXT frames so they share the framed output stream.
+//
+//   GET|SET <room> SCHED [24 digits 0-4]
+//   GET|SET <room> TARGET [10.0-30.0]
+//   GET|SET <room> LIGHT [0-4]
+//   GET <room> STATS
+//   GET|SET TIME [offset minutes]
+//   GET HEALTH
+//   GET BUS
+//   GET POWER
+//   GET MEM
+//   GET|SET TRACE [0|1]
+//   GET|SET LAT [0|1]
+//   GET LAT BUTTON|MOTION|COMMAND
+//   GET|SET|SAVE SCENE [name]
+//   DUMP (ends with DUMP <rooms>)
+class CommandInterface {
+public:
+    // Room fields that GET and SET take by name
+    enum RoomSetting { SETTING_SCHED, SETTING_TARGET, SETTING_LIGHT, SETTING_COUNT };
+
+private:
+    static const int LINE_SIZE = 40;
+    // Worst case encoded size of a single reply frame: the longest frame
+    // plus its COBS overhead byte and the delimiter
+    static const int REPLY_RESERVE = TELEMETRY_MAX_FRAME + 2;
+
+    char line[LINE_SIZE];
+    uint8_t lineLength;
+    bool overflow;
+    bool lineReady;
+    // When the line's newline arrived, the start of its latency
+    unsigned long lineTime;
+    int8_t dumpStep;
+
+    void execute(RoomControl* const rooms[], int roomCount);
+    void handleRoomCommand(bool set, RoomControl& room, int index, char* field, char* value);
+    void handleTimeCommand(bool set, char* value);
+    void handleTraceCommand(bool set, char* value);
+    void handleLatencyCommand(bool set, char* value);
+    void handleSceneCommand(bool set, bool save, char* name, RoomControl* const rooms[], int roomCount);
+    bool replyRoom(const RoomControl& room, int index, RoomSetting setting);
+    bool replyState(const RoomControl& room, int index);
+    bool replyStats(const RoomControl& room, int index);
+    bool replyTime();
+    void continueDump(RoomControl* const rooms[], int roomCount);
+
+public:
+    CommandInterface();
+
+    void poll(RoomControl* const rooms[], int roomCount);
+};
+
+extern INSTANCE_STATE CommandInterface commands;
+
+#endif // COMMAND_INTERFACE_H
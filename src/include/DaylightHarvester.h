@@ -0,0 +1,43 @@
+#ifndef DAYLIGHT_HARVESTER_H
+#define DAYLIGHT_HARVESTER_H
+
+#include <Arduino.h>
+
+// Turns the outdoor photoresistor into a room's automatic light level.
+// The reading is scaled by the room's gain and offset (windows facing
+// different ways see different daylight), smoothed, and looked up in a
+// PROGMEM curve that gives the wanted light in 1/64 levels. The level only
+// moves one step per update, once the curve is past the midpoint to the
+// next level by a margin, so a sensor hovering near a boundary doesn't
+// flicker the strip.
+class DaylightHarvester {
+public:
+    static const int MAX_LEVEL = 4;
+    static const unsigned long UPDATE_MS = 2000;
+    // Gain is in 1/256, so 256 passes the reading through unchanged
+    static const int16_t UNITY_GAIN = 256;
+
+    DaylightHarvester();
+
+    bool due(unsigned long now) const;
+    bool update(unsigned long now, int reading, int16_t gain, int16_t offset);
+    int level() const;
+
+    static int demand(int ambient);
+
+private:
+    static const uint8_t STEP = 64;
+    // Getting darker turns the lights up sooner than getting brighter dims them
+    static const uint8_t BRIGHTEN_MARGIN = 8;
+    static const uint8_t DIM_MARGIN = 16;
+    // New readings weigh 1/4
+    static const uint8_t FILTER_SHIFT = 2;
+
+    bool started;
+    uint8_t current;
+    // Ambient reading in 1/4 counts
+    uint16_t filtered;
+    unsigned long lastUpdate;
+};
+
+#endif // DAYLIGHT_HARVESTER_H
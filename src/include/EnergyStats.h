@@ -0,0 +1,37 @@
+#ifndef ENERGY_STATS_H
+#define ENERGY_STATS_H
+
+#include <Arduino.h>
+#include "enums.h"
+
+// Actuator accounting for one room. Updated only when an actuator actually
+// changes, never per loop: each change closes the interval spent in the old
+// state. Times are 24.8 fixed-point seconds (up to ~194 days), light is
+// counted in lit-pixel seconds in the same format.
+class EnergyStats {
+public:
+    static const uint8_t FRACTION_BITS = 8;
+
+    EnergyStats();
+
+    void setAC(unsigned long now, ACState state);
+    void setLight(unsigned long now, uint8_t lit);
+    uint32_t acTime(unsigned long now, ACState state) const;
+    uint32_t lightTime(unsigned long now) const;
+    uint16_t acSwitches() const;
+    uint16_t lightSwitches() const;
+
+private:
+    uint32_t acTotals[3];
+    uint32_t pixelTotal;
+    uint16_t acChanges;
+    uint16_t lightChanges;
+    ACState acState;
+    uint8_t pixels;
+    unsigned long acSince;
+    unsigned long lightSince;
+
+    static uint32_t toFixed(unsigned long ms);
+};
+
+#endif // ENERGY_STATS_H
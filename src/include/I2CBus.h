@@ -0,0 +1,76 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "instance.h"
+
+// Queued I2C writes. Callers never wait on the bus: write() only queues, and
+// service() runs queued transactions from the main loop within a small time
+// budget. A queued write to the same device register is replaced rather than
+// queued again, so the latest relay or digit state always wins. Every device
+// runs at its own clock and gets its own error and latency counters.
+class I2CBus {
+public:
+    static const uint32_t STANDARD_MODE = 100000;
+    static const uint32_t FAST_MODE = 400000;
+    // The longest write is a clock digit: register and two segment bytes
+    static const int MAX_DATA = 3;
+
+    struct DeviceStats {
+        uint8_t address;
+        uint8_t lastError;
+        uint16_t transactions;
+        uint16_t errors;
+        uint16_t timeouts;
+        // Saturates at 65535
+        uint16_t worstMicros;
+        uint32_t clock;
+    };
+
+    I2CBus();
+
+    void begin();
+    void addDevice(uint8_t address, uint32_t clock);
+    void write(uint8_t address, const uint8_t* data, uint8_t length);
+    void service();
+    void flush();
+    bool report();
+    uint16_t errors(uint8_t address);
+    // Whether a write to the device is still waiting in the queue
+    bool queued(uint8_t address) const;
+
+private:
+    // A full clock refresh (five positions) plus the relay byte
+    static const int QUEUE_SIZE = 6;
+    static const int MAX_DEVICES = 2;
+    static const uint8_t MAX_ATTEMPTS = 3;
+    // Longest a single transaction may hold the bus before Wire gives up
+    static const uint32_t TIMEOUT_US = 3000;
+    static const unsigned long SERVICE_BUDGET_US = 1000;
+    static const uint8_t ERROR_TIMEOUT = 5;
+
+    struct Transaction {
+        uint8_t address;
+        uint8_t length;
+        uint8_t attempts;
+        unsigned long queuedAt;
+        uint8_t data[MAX_DATA];
+    };
+
+    Transaction queue[QUEUE_SIZE];
+    uint8_t head;
+    uint8_t count;
+    uint16_t stalls;
+    uint32_t clock;
+    DeviceStats devices[MAX_DEVICES];
+    uint8_t deviceCount;
+
+    DeviceStats* device(uint8_t address);
+    bool transmit(Transaction& transaction);
+    void runNext();
+};
+
+extern INSTANCE_STATE I2CBus i2cBus;
+
+#endif // I2C_BUS_H
@@ -0,0 +1,66 @@
+#ifndef INPUT_TRACE_H
+#define INPUT_TRACE_H
+
+#include <Arduino.h>
+#include "TelemetryFormat.h"
+#include "instance.h"
+#include "diagnostics.h"
+
+// Records every change of the buttons, PIR sensors and analog inputs, and
+// every executed Serial command, as TRACE frames on the telemetry stream so
+// a session can be replayed on the host (host/trace_replay.cpp). The pins
+// are sampled on every pass, since the PIR and wake-up logic reads them
+// even while the loop is idle; the analog inputs only on passes that do
+// work, which is when the firmware reads them too. Records are batched and
+// sent at least every FLUSH_MS.
+#ifdef INPUT_TRACE
+class InputTrace {
+public:
+    InputTrace();
+
+    void start();
+    void stop();
+    bool active() const;
+    void samplePins();
+    void sample();
+    void command(const char* line);
+    void service();
+    unsigned int lost() const;
+
+private:
+    static const uint8_t MAX_BODY = TELEMETRY_MAX_FRAME - 3;
+    static const uint8_t MAX_INPUT_RECORD = 5 + 2 + TRACE_ANALOG_COUNT * 2;
+    static const unsigned long FLUSH_MS = 250;
+
+    bool recording;
+    // Set when records were lost; the next one is then a START record
+    bool resync;
+    uint8_t levels;
+    int16_t values[TRACE_ANALOG_COUNT];
+    unsigned long lastRecord;
+    unsigned long firstPending;
+    uint8_t body[MAX_BODY];
+    uint8_t length;
+    uint16_t lostFrames;
+
+    void appendInputs(unsigned long now, bool readAnalog);
+    void flush();
+};
+#else
+// Left out of the build: SET TRACE 1 has no effect and GET TRACE reads 0 0
+class InputTrace {
+public:
+    void start() {}
+    void stop() {}
+    bool active() const { return false; }
+    void samplePins() {}
+    void sample() {}
+    void command(const char*) {}
+    void service() {}
+    unsigned int lost() const { return 0; }
+};
+#endif
+
+extern INSTANCE_STATE InputTrace inputTrace;
+
+#endif // INPUT_TRACE_H
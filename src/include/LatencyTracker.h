@@ -0,0 +1,113 @@
+#ifndef LATENCY_TRACKER_H
+#define LATENCY_TRACKER_H
+
+#include <Arduino.h>
+#include "instance.h"
+#include "diagnostics.h"
+
+// Inputs whose effect is timed
+enum LatencySource {
+    LATENCY_BUTTON,
+    LATENCY_MOTION,
+    LATENCY_COMMAND,
+    LATENCY_SOURCE_COUNT
+};
+
+// Outputs an input can show up on, as bits of LatencyEvent::outputs
+const uint8_t OUTPUT_LCD = 0x01;
+const uint8_t OUTPUT_STRIP = 0x02;
+const uint8_t OUTPUT_RELAYS = 0x04;
+
+// One input and the outputs it led to. Times are ms after the input.
+struct LatencyEvent {
+    uint32_t input;
+    uint16_t first;
+    uint16_t settled;
+    uint8_t id;
+    uint8_t source;
+    uint8_t outputs;
+    // Loop passes ended since the event was opened
+    uint8_t passes;
+};
+
+// Times every button press, new PIR motion and Serial command from the
+// input to the outputs it causes. Each input gets an event ID when it is
+// opened. Outputs are reported where they reach the hardware: a finished LCD
+// draw, strip.show() and the expander write leaving the I2C queue. Every
+// output lands on all events still open. The firmware reacts to an input
+// in the pass that sees it, or in the next one after a debounce delay or
+// for PIR motion, so an event closes at the end of that next pass. It
+// settled at its last output then, or had no visible effect. Settled
+// latencies go into a histogram per source for GET LAT, and with SET LAT 1
+// every event is also sent as a text frame when it closes.
+#ifdef LATENCY_TRACE
+class LatencyTracker {
+public:
+    static const uint8_t MAX_OPEN = 4;
+    static const uint8_t BUCKETS = 12;
+
+    LatencyTracker();
+
+    uint8_t open(LatencySource source, unsigned long time);
+    void buttons(uint8_t pressed, unsigned long time);
+    void output(uint8_t kind);
+    void relaysQueued();
+    void endPass();
+    void setStreaming(bool on);
+    bool streaming() const;
+    // Events not timed because every slot was taken, or not sent in time
+    uint16_t lost() const;
+    bool report(LatencySource source);
+    // Source with the given Serial name, or -1
+    static int8_t sourceNamed(const char* name);
+
+#ifndef __AVR__
+    // Events closed so far, whether settled or without effect; the last
+    // MAX_OPEN of them can be read back with closedEvent()
+    uint32_t closedCount() const;
+    const LatencyEvent& closedEvent(uint32_t index) const;
+#endif
+    uint16_t percentile(LatencySource source, uint8_t percent) const;
+
+private:
+    LatencyEvent events[MAX_OPEN];
+    uint8_t openMask;
+    uint8_t lastId;
+    uint8_t lastButtons;
+    // Open events that were waiting on the expander write still queued
+    uint8_t relayMask;
+    bool stream;
+    uint8_t histogram[LATENCY_SOURCE_COUNT][BUCKETS];
+    uint16_t noEffect[LATENCY_SOURCE_COUNT];
+    uint16_t worst[LATENCY_SOURCE_COUNT];
+    uint16_t dropped;
+#ifndef __AVR__
+    LatencyEvent closed[MAX_OPEN];
+    uint32_t closedTotal;
+#endif
+
+    void outputTo(uint8_t slots, uint8_t kind);
+    void close(uint8_t slot, bool settled);
+    bool send(const LatencyEvent& event);
+};
+#else
+// Left out of the build: SET LAT 1 has no effect, GET LAT reads 0 0 and
+// GET LAT <source> replies ERR
+class LatencyTracker {
+public:
+    uint8_t open(LatencySource, unsigned long) { return 0; }
+    void buttons(uint8_t, unsigned long) {}
+    void output(uint8_t) {}
+    void relaysQueued() {}
+    void endPass() {}
+    void setStreaming(bool) {}
+    bool streaming() const { return false; }
+    uint16_t lost() const { return 0; }
+    bool report(LatencySource) { return false; }
+    static int8_t sourceNamed(const char*) { return -1; }
+};
+#endif
+
+extern INSTANCE_STATE LatencyTracker latency;
+
+#endif // LATENCY_TRACKER_H
@@ -0,0 +1,36 @@
+#ifndef LIGHT_SEGMENT_H
+#define LIGHT_SEGMENT_H
+
+#include <Adafruit_NeoPixel.h>
+#include "enums.h"
+
+// A room's run of pixels on the shared strip. Fills go straight into the
+// strip's pixel buffer with block copies, and only the pixels a level
+// change affects are rewritten, so the cost doesn't grow with the length
+// of a long strip. show() still has to send the whole strip, so the caller
+// only calls it when apply() reports a change.
+class LightSegment {
+public:
+    static const uint8_t MAX_LEVEL = 4;
+
+    LightSegment(uint16_t first, uint16_t length, LightStyle style);
+
+    bool apply(Adafruit_NeoPixel& strip, uint8_t level);
+    void invalidate();
+    uint16_t litPixels(uint8_t level) const;
+    uint16_t end() const;
+
+private:
+    // No level is shown yet, so the next apply() writes the whole segment
+    static const uint8_t UNKNOWN = 0xFF;
+
+    uint16_t first;
+    uint16_t length;
+    LightStyle style;
+    uint8_t shownLevel;
+
+    uint32_t color(uint8_t level) const;
+    static void fill(Adafruit_NeoPixel& strip, uint32_t color, uint16_t from, uint16_t count);
+};
+
+#endif // LIGHT_SEGMENT_H
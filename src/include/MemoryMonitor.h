@@ -0,0 +1,42 @@
+#ifndef MEMORY_MONITOR_H
+#define MEMORY_MONITOR_H
+
+#include <Arduino.h>
+#include "instance.h"
+
+// Tracks how much of the 2 KB SRAM is in use. The free RAM between the
+// heap and the stack is painted with a known byte before the C runtime
+// starts; the stack's high-water mark is the lowest painted byte that has
+// since been overwritten. scan() only walks the still untouched gap, so it
+// gets cheaper as the margin shrinks. Host builds have no SRAM layout to
+// inspect and report zeros.
+class MemoryMonitor {
+public:
+    static const unsigned long SCAN_MS = 1000;
+
+    MemoryMonitor();
+
+    bool service();
+    bool scan();
+    bool report();
+
+    // Bytes of .data, .bss and .noinit, fixed at link time
+    uint16_t staticBytes() const;
+    uint16_t heapBytes() const;
+    // Deepest the stack has been since reset
+    uint16_t stackPeak() const;
+    uint16_t freeNow() const;
+    // Smallest gap between heap and stack seen by any scan
+    uint16_t minFree() const;
+
+private:
+    unsigned long lastScan;
+    uint16_t heap;
+    uint16_t peak;
+    uint16_t current;
+    uint16_t lowest;
+};
+
+extern INSTANCE_STATE MemoryMonitor memoryMonitor;
+
+#endif // MEMORY_MONITOR_H
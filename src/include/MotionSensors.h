@@ -0,0 +1,47 @@
+#ifndef MOTION_SENSORS_H
+#define MOTION_SENSORS_H
+
+#include <Arduino.h>
+#include "instance.h"
+
+struct MotionEvent {
+    uint32_t time;
+    bool rising;
+};
+
+// PIR edges captured by the pin-change interrupt, timestamped with millis()
+// and queued per sensor. Each queue has a single producer (the interrupt)
+// and a single consumer (the loop), so one-byte indices are enough to keep
+// it lock free. Host builds have no interrupts; poll() stands in for them.
+class MotionSensors {
+public:
+    MotionSensors();
+
+    uint8_t watch(uint8_t pin);
+    void capture();
+    void poll();
+    bool pop(uint8_t channel, MotionEvent& event);
+    bool active(uint8_t channel) const;
+    uint16_t overflows() const;
+
+private:
+    static const uint8_t MAX_CHANNELS = 2;
+    // PIR edges are seconds apart; each pass drains the queue
+    static const uint8_t QUEUE_SIZE = 4;
+
+    struct Channel {
+        uint8_t pin;
+        volatile bool level;
+        volatile uint8_t head;
+        volatile uint8_t tail;
+        MotionEvent events[QUEUE_SIZE];
+    };
+
+    Channel channels[MAX_CHANNELS];
+    uint8_t channelCount;
+    volatile uint16_t dropped;
+};
+
+extern INSTANCE_STATE MotionSensors motionSensors;
+
+#endif // MOTION_SENSORS_H
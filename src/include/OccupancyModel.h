@@ -0,0 +1,31 @@
+#ifndef OCCUPANCY_MODEL_H
+#define OCCUPANCY_MODEL_H
+
+#include <Arduino.h>
+
+// Learns when a room is usually occupied. The day is split into half-hour
+// slots; each slot keeps an exponentially decayed likelihood (0-255) that it
+// sees PIR motion, updated once per day when the slot ends.
+class OccupancyModel {
+public:
+    static const int SLOT_COUNT = 48;
+    static const unsigned long SLOT_MS = 30UL * 60 * 1000;
+
+    OccupancyModel();
+
+    void recordMotion(unsigned long now);
+    void update(unsigned long now);
+    uint8_t likelihood(int slot) const;
+    int minutesUntilExpected(unsigned long now, int maxSlots) const;
+
+private:
+    // New observations weigh 1/4, so a habit is picked up after ~3 days
+    static const uint8_t DECAY_SHIFT = 2;
+    static const uint8_t EXPECTED_THRESHOLD = 128;
+
+    uint8_t bins[SLOT_COUNT];
+    int8_t currentSlot;
+    bool slotOccupied;
+};
+
+#endif // OCCUPANCY_MODEL_H
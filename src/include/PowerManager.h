@@ -0,0 +1,55 @@
+#ifndef POWER_MANAGER_H
+#define POWER_MANAGER_H
+
+#include <Arduino.h>
+#include "instance.h"
+#include "RoomControl.h"
+
+// Runs loop() work only once per tick or when an input changed, and idles
+// the CPU in between. On the board a pin-change interrupt on any wake pin,
+// the UART or the millis timer ends the sleep, so the CPU wakes at least
+// once a millisecond; host builds poll the wake pins instead. Counts the
+// passes that did work, not sleep exits. Also dims the displays while
+// nobody is home.
+class PowerManager {
+public:
+    static const unsigned long TICK_MS = 50;
+
+    PowerManager();
+
+    void addWakePin(uint8_t pin);
+    bool wait();
+    void done();
+    void updateDisplays(RoomControl* const rooms[], int roomCount, bool input);
+    bool report();
+    uint32_t passes() const;
+
+private:
+    static const int MAX_WAKE_PINS = 6;
+    static const unsigned long DISPLAY_TIMEOUT_MS = 30000;
+    static const uint8_t BRIGHT = 15;
+    static const uint8_t DIM = 1;
+
+    unsigned long lastTick;
+    unsigned long lastInput;
+    unsigned long workStart;
+    unsigned long idleStart;
+    uint32_t awakeMicros;
+    uint32_t totalMicros;
+    uint32_t tickPasses;
+    uint32_t inputPasses;
+    bool sleeping;
+    bool displaysOn;
+#ifndef __AVR__
+    uint8_t wakePins[MAX_WAKE_PINS];
+    uint8_t wakeLevels[MAX_WAKE_PINS];
+    uint8_t wakePinCount;
+#endif
+
+    bool inputChanged();
+    void account(unsigned long from, unsigned long to, bool awake);
+};
+
+extern INSTANCE_STATE PowerManager power;
+
+#endif // POWER_MANAGER_H
@@ -1,16 +1,25 @@
 #ifndef ROOM_CONFIG_H
 #define ROOM_CONFIG_H
 
+#include "enums.h"
+
 class RoomConfig {
 public:
-    int tempSensorPin;
-    int heatingPin;
-    int coolingPin;
-    int pirPin;
-    int lightStripStartIndex;
+    uint8_t tempSensorPin;
+    uint8_t heatingPin;
+    uint8_t coolingPin;
+    uint8_t pirPin;
+    uint8_t lightStripStartIndex;
+    uint8_t lightStripLength;
+    LightStyle lightStyle;
+    // Photoresistor reading as this room's windows see it: reading * gain / 256 + offset
+    int16_t daylightGain;
+    int16_t daylightOffset;
 
-    RoomConfig(int tempSensor, int heatPin, int coolPin, int pirSensor, int lightStripIndex)
-        : tempSensorPin(tempSensor), heatingPin(heatPin), coolingPin(coolPin), pirPin(pirSensor), lightStripStartIndex(lightStripIndex) {}
+    RoomConfig(uint8_t tempSensor, uint8_t heatPin, uint8_t coolPin, uint8_t pirSensor, uint8_t lightStripIndex, uint8_t lightStripLen,
+               LightStyle style, int16_t gain = 256, int16_t offset = 0)
+        : tempSensorPin(tempSensor), heatingPin(heatPin), coolingPin(coolPin), pirPin(pirSensor), lightStripStartIndex(lightStripIndex),
+          lightStripLength(lightStripLen), lightStyle(style), daylightGain(gain), daylightOffset(offset) {}
 };
 
 #endif
\ No newline at end of file
@@ -4,50 +4,115 @@
 #include <Arduino.h>
 #include "enums.h"
 #include "RoomConfig.h"
+#include "OccupancyModel.h"
+#include "ThermalModel.h"
+#include "SensorHistory.h"
+#include "EnergyStats.h"
+#include "ButtonRepeat.h"
+#include "DaylightHarvester.h"
+#include "LightSegment.h"
+#include "instance.h"
+
+const float SETBACK_TEMP = 18.0;
+// Pre-conditioning starts as early as the thermal model asks for, up to
+// two hours ahead; lights are only armed for the last quarter hour.
+const int PRECONDITION_MAX_SLOTS = 4;
+const int PRECONDITION_DEFAULT_MINUTES = 15;
+const int PRECONDITION_LIGHT_MINUTES = 15;
+const unsigned long STATS_REFRESH_MS = 1000;
+// 10 to 30 degrees in 0.5 steps takes about 0.8 s of holding; the schedule
+// wraps around, so it stays slow enough to stop on the wanted hour
+const RepeatRate TEMP_REPEAT = { 250, 50, 3, 8 };
+const RepeatRate SCHEDULE_REPEAT = { 300, 100, 4, 2 };
+const RepeatRate SINGLE_PRESS = { 0, 0, 0, 0 };
 
 class RoomControl {
 public:
-    String name;
+    // In flash
+    PGM_P name;
     RoomConfig config;
     float currentTemp = 0.0;
     float targetTemp = 22.0;
-    int lightIntensity = 0;
-    int selectedHour = 0;
-    int hourOverride = -1;
+    float comfortTemp = 22.0;
+    // Target lowered to SETBACK_TEMP while the room is empty; comfortTemp
+    // holds the setpoint to go back to
+    bool setback = false;
+    int8_t lightIntensity = 0;
+    uint8_t selectedHour = 0;
+    int8_t hourOverride = -1;
     unsigned long lastMotionTime = 0;
+    uint8_t motionChannel = 0;
     bool peoplePresent = false;
     bool inactive = false;
     bool scheduleActive = false;
+    // Cleared by scenes that hold the lights, e.g. while away
+    bool scheduleEnabled = true;
     bool autoLightEnabled = false;
+    bool preconditioning = false;
+    bool lightsArmed = false;
+    int etaMinutes = ThermalModel::UNKNOWN;
     bool isDisplayed = false;
-    int schedule[24] = { 0 };
+    // Light level 0-4 per hour, two hours to a byte with the even hour in
+    // the low nibble
+    uint8_t schedule[12] = { 0 };
     ACState acState = OFF;
-    SystemState menuStates[3];
+    OccupancyModel occupancy;
+    ThermalModel thermal;
+    SensorHistory history;
+    EnergyStats energy;
+    DaylightHarvester daylight;
+    LightSegment lights;
+    unsigned long statsDrawnAt = 0;
 
-    RoomControl(String roomName, RoomConfig roomConfig) : name(roomName), config(roomConfig) {}
+    RoomControl(PGM_P roomName, RoomConfig roomConfig)
+        : name(roomName), config(roomConfig),
+          lights(roomConfig.lightStripStartIndex, roomConfig.lightStripLength, roomConfig.lightStyle) {}
 
     void display();
     void init();
     void displayRoomMenu();
     void handleRoomMenu();
     void displayRoomTempControl();
+    void drawTempTarget();
     void handleRoomTempControl();
+    void displayRoomHistory();
+    void handleRoomHistory();
+    void displayRoomStats();
     void autoUpdateTemperature();
     float readTemperature();
     void adjustAC();
+    bool stageAC();
     void setACState(ACState state);
+    void stageACState(ACState state);
     void displayRoomLightControl();
     void handleRoomLightControl();
     void updateNeoPixelBrightness(bool manual);
+    bool stageLight();
     void autoAdjustLight();
     void displayRoomSchedule();
+    void drawScheduleLabel();
+    void drawScheduleHours();
     void handleRoomSchedule();
+    uint8_t scheduledLevel(int hour) const;
+    void setScheduledLevel(int hour, uint8_t level);
     void checkSchedule();
     void deactivateSchedule();
     void resetRoomOverride();
-    void detectRoomMotion(bool motionDetected);
+    void detectRoomMotion();
+    void registerMotion(unsigned long time);
     void handleInactivity();
+    void anticipateOccupancy();
+    void setTarget(float temp);
+    void setComfort(float temp);
+    void enterSetback();
+    void restoreComfort();
     bool shouldUpdate();
 };
 
+// Only the menu on screen reads the buttons, and every menu suppresses
+// these on entry, so all rooms and the scene menu share them: left/right
+// steps and the schedule button's store
+extern INSTANCE_STATE ButtonRepeat adjustRepeat;
+extern INSTANCE_STATE ButtonRepeat storeRepeat;
+
 #endif // ROOMCONTROL_H
\ No newline at end of file
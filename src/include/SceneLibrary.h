@@ -0,0 +1,57 @@
+#ifndef SCENE_LIBRARY_H
+#define SCENE_LIBRARY_H
+
+#include <Arduino.h>
+#include "instance.h"
+#include "RoomControl.h"
+
+const uint8_t SCENE_KEEP = 0xFF;
+const int SCENE_MAX_ROOMS = 4;
+const int SCENE_NAME_SIZE = 8;
+
+// One room's part of a scene; SCENE_KEEP leaves a setting as it is
+struct RoomScene {
+    uint8_t light;
+    // Half degrees, 20-60 for 10-30 C
+    uint8_t target;
+    uint8_t scheduleEnabled;
+};
+
+struct Scene {
+    char name[SCENE_NAME_SIZE];
+    RoomScene rooms[SCENE_MAX_ROOMS];
+};
+
+// Named house states: a few built into flash and a few saved by the user
+// into EEPROM. Applying one first changes the settings of every room and
+// then commits the actuators in one batch, a single strip.show() and a
+// single expander write, so the house never shows a half applied scene.
+class SceneLibrary {
+public:
+    static const uint8_t BUILT_IN = 3;
+    static const uint8_t USER_SLOTS = 3;
+    static const uint8_t COUNT = BUILT_IN + USER_SLOTS;
+    static const int8_t NONE = -1;
+
+    SceneLibrary();
+
+    bool load(uint8_t index, Scene& scene) const;
+    int8_t find(const char* name) const;
+    int8_t next(int8_t from, int8_t direction) const;
+    bool apply(uint8_t index, RoomControl* const rooms[], int roomCount);
+    int8_t save(const char* name, const RoomControl* const rooms[], int roomCount);
+    int8_t lastApplied() const;
+    bool report();
+
+private:
+    // Marks a written user slot; anything else reads as empty
+    static const uint8_t SLOT_MAGIC = 0x5C;
+    static const int EEPROM_BASE = 0;
+    static const int SLOT_SIZE = 1 + sizeof(Scene);
+
+    int8_t applied;
+};
+
+extern INSTANCE_STATE SceneLibrary scenes;
+
+#endif // SCENE_LIBRARY_H
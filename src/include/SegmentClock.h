@@ -0,0 +1,28 @@
+#ifndef SEGMENT_CLOCK_H
+#define SEGMENT_CLOCK_H
+
+#include <Arduino.h>
+#include "instance.h"
+
+// HH:MM on the 7-segment backpack. Remembers the segments last queued for
+// each position and only queues the positions that changed, one 3 byte
+// write each, so a minute change usually costs a single digit.
+class SegmentClock {
+public:
+    SegmentClock();
+
+    void show(uint8_t hours, uint8_t minutes);
+    void invalidate();
+
+private:
+    // Digits 0-1 and 3-4, the colon sits at position 2
+    static const uint8_t POSITIONS = 5;
+
+    uint16_t shown[POSITIONS];
+    bool valid;
+    uint16_t busErrors;
+};
+
+extern INSTANCE_STATE SegmentClock segmentClock;
+
+#endif // SEGMENT_CLOCK_H
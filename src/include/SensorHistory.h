@@ -0,0 +1,51 @@
+#ifndef SENSOR_HISTORY_H
+#define SENSOR_HISTORY_H
+
+#include <Arduino.h>
+
+// Downsampled history of one sensor: the last 48 half-hours (24 hours)
+// as min/max/avg in tenths, two bytes per slot. Averages are stored as the
+// difference to the previous slot and rebuilt backwards from the newest one;
+// min and max are packed as their distance to the average, one nibble each.
+class SensorHistory {
+public:
+    static const int SLOT_COUNT = 48;
+    static const unsigned long SLOT_MS = 30UL * 60 * 1000;
+
+    struct Sample {
+        int16_t min;
+        int16_t max;
+        int16_t avg;
+    };
+
+    SensorHistory();
+
+    bool record(unsigned long now, float value);
+    bool get(int age, Sample& sample) const;
+    int size() const;
+    uint16_t closedSlots() const;
+
+private:
+    static const unsigned long SAMPLE_MS = 1000;
+    static const uint8_t MAX_SPREAD = 15;
+
+    int8_t deltas[SLOT_COUNT];
+    uint8_t spreads[SLOT_COUNT];
+    uint8_t head;
+    uint8_t count;
+    int16_t newestAvg;
+    uint16_t closed;
+
+    // Slot in progress
+    unsigned long slotStart;
+    unsigned long lastSample;
+    long sum;
+    uint16_t samples;
+    int16_t low;
+    int16_t high;
+
+    int16_t currentAvg() const;
+    void closeSlot();
+};
+
+#endif // SENSOR_HISTORY_H
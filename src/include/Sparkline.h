@@ -0,0 +1,41 @@
+#ifndef SPARKLINE_H
+#define SPARKLINE_H
+
+#include <LiquidCrystal.h>
+#include "instance.h"
+#include "SensorHistory.h"
+
+// Draws the newest slots of a SensorHistory as min/max bars into the LCD
+// custom characters left free by setup() (3-7), one pixel column per slot.
+// The bitmaps are built from the history as they are uploaded; only the
+// newest character is kept to skip uploads that change nothing.
+class Sparkline {
+public:
+    static const int CHARS = 5;
+    static const int FIRST_CHAR = 3;
+    static const int COLUMNS = CHARS * 5;
+
+    Sparkline();
+
+    void invalidate();
+    void draw(const SensorHistory& history, LiquidCrystal& lcd);
+    int16_t low() const;
+    int16_t high() const;
+
+private:
+    // Smallest vertical range in tenths, so sensor noise stays flat
+    static const int16_t MIN_SPAN = 20;
+
+    uint8_t newest[8];
+    const SensorHistory* source;
+    uint16_t closedSlots;
+    int16_t scaleLow;
+    int16_t scaleHigh;
+
+    void rescale(const SensorHistory& history);
+    bool buildChar(int index, const SensorHistory& history, uint8_t* glyph) const;
+};
+
+extern INSTANCE_STATE Sparkline sparkline;
+
+#endif // SPARKLINE_H
@@ -4,12 +4,10 @@
 #include "enums.h"
 
 class StateStack {
-private:
-    static const int MAX_STACK_SIZE = 10;
-    SystemState stack[MAX_STACK_SIZE];
-    int top;
-
 public:
+    // Welcome screen, room menu, light control and schedule is the deepest
+    static const int MAX_STACK_SIZE = 4;
+
     StateStack();
 
     void push(SystemState state);
@@ -17,6 +15,13 @@ public:
     SystemState topState() const;
     bool isHistoryAvailable() const;
     int size() const;
+    // Bottom of the stack is index 0
+    SystemState at(int index) const;
+    void clear();
+
+private:
+    SystemState stack[MAX_STACK_SIZE];
+    int8_t top;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef SYSTEM_SNAPSHOT_H
+#define SYSTEM_SNAPSHOT_H
+
+#include <Arduino.h>
+#include "RoomControl.h"
+
+// Compact binary image of the controller's control state: the menu stack,
+// expander outputs, redraw flags, clock and every room's settings and
+// control fields. Restoring one into a freshly booted controller carries
+// on from where the snapshot was taken. Learned models (occupancy, thermal,
+// history, energy totals) and transient state such as debouncing and
+// telemetry start over, as after a reboot.
+//
+//   [magic] [version] [room count] [global] [stack...] [room...] [crc8]
+//
+// Multi-byte values are little endian. Bump SNAPSHOT_VERSION whenever the
+// layout changes; restore refuses any other version.
+const uint8_t SNAPSHOT_MAGIC = 0xA7;
+const uint8_t SNAPSHOT_VERSION = 2;
+
+// Worst case size, with a full menu stack
+size_t snapshotSize(int roomCount);
+// Returns the bytes written, 0 if size is too small
+size_t saveSnapshot(const RoomControl* const rooms[], int roomCount, uint8_t* out, size_t size);
+// Leaves the controller untouched unless the whole snapshot is valid: the
+// CRC matches and every menu state, AC state, hour and light level is in range
+bool restoreSnapshot(RoomControl* const rooms[], int roomCount, const uint8_t* data, size_t len);
+
+#endif // SYSTEM_SNAPSHOT_H
@@ -0,0 +1,55 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include "TelemetryFormat.h"
+#include "instance.h"
+#include "RoomControl.h"
+
+class Telemetry {
+private:
+    // Room for one frame of the largest size; the UART's own 64-byte
+    // buffer holds the one before it
+    static const int TX_BUFFER_SIZE = TELEMETRY_MAX_FRAME + 4;
+    static const unsigned long FRAME_INTERVAL = 1000;
+    static const uint8_t KEY_FRAME_INTERVAL = 16;
+
+    static_assert(TX_BUFFER_SIZE - 1 >= TELEMETRY_MAX_FRAME + 2, "an empty TX buffer must take the largest frame");
+
+    uint8_t txBuffer[TX_BUFFER_SIZE];
+    uint8_t txHead;
+    uint8_t txTail;
+    // Frame being encoded into txBuffer: next byte, its COBS code byte's
+    // slot, the code so far and the running CRC
+    uint8_t frameHead;
+    uint8_t codeAt;
+    uint8_t code;
+    uint8_t crc;
+    int32_t lastValues[TELEMETRY_MAX_FIELDS];
+    uint8_t seq;
+    uint8_t framesSinceKey;
+    unsigned long lastFrameTime;
+    unsigned int droppedFrames;
+
+    static uint8_t next(uint8_t index);
+    bool beginFrame(uint8_t type, size_t len);
+    void put(uint8_t data);
+    void putField(uint32_t value);
+    void encode(uint8_t data);
+    void endFrame();
+
+public:
+    Telemetry();
+
+    void sample(RoomControl* const rooms[], int roomCount);
+    bool sendText(const char* text);
+    bool sendText_P(PGM_P text);
+    bool sendTrace(const uint8_t* body, size_t len);
+    void pump();
+    int txFree() const;
+    unsigned int dropped() const;
+};
+
+extern INSTANCE_STATE Telemetry telemetry;
+
+#endif // TELEMETRY_H
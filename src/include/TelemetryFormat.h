@@ -0,0 +1,187 @@
+#ifndef TELEMETRY_FORMAT_H
+#define TELEMETRY_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Wire format shared by the firmware and the host tools.
+//
+// Every frame is COBS encoded and terminated by a single 0x00 byte:
+//   [type] [seq] [body...] [crc8]
+// KEY frames carry every field as an absolute value, DELTA frames carry a
+// varint bit mask of the changed fields followed by zigzag varint deltas
+// against the previous frame. Sequence numbers only advance for frames that
+// made it into the TX buffer, so a gap seen by a decoder means bytes were lost
+// on the line and it has to wait for the next KEY frame.
+//
+// TRACE frames carry input trace records while recording is on. Each record
+// starts with a varint of milliseconds since the previous record and a byte
+// whose top two bits give its kind:
+//   INPUT   low six bits are the TRACE_PIN_* levels, then a byte mask of the
+//           TRACE_ANALOG_* channels that changed and a zigzag varint delta
+//           for each of them
+//   START   like INPUT, but the time is absolute millis() and every analog
+//           channel follows as an absolute value; sent first and again after
+//           trace data was lost
+//   COMMAND a length byte and the Serial command line as it was executed
+
+enum TelemetryFrameType {
+    FRAME_KEY = 0x01,
+    FRAME_DELTA = 0x02,
+    FRAME_TEXT = 0x03,
+    FRAME_TRACE = 0x04
+};
+
+#define TRACE_KIND_MASK 0xC0
+#define TRACE_INPUT 0x00
+#define TRACE_START 0x40
+#define TRACE_COMMAND 0x80
+#define TRACE_PIN_MASK 0x3F
+
+// Bit order of the traced digital pins and analog channels
+enum TraceDigitalPin {
+    TRACE_PIN_LEFT,
+    TRACE_PIN_RIGHT,
+    TRACE_PIN_BACK,
+    TRACE_PIN_SCHEDULE,
+    TRACE_PIN_ROOM1_PIR,
+    TRACE_PIN_ROOM2_PIR,
+    TRACE_PIN_COUNT
+};
+
+enum TraceAnalogChannel {
+    TRACE_ANALOG_TIME_WHEEL,
+    TRACE_ANALOG_OUTDOOR_LIGHT,
+    TRACE_ANALOG_ROOM1_TEMP,
+    TRACE_ANALOG_ROOM2_TEMP,
+    TRACE_ANALOG_COUNT
+};
+
+// Field layout: global fields first, then ROOM_FIELD_COUNT fields per room.
+enum TelemetryField {
+    FIELD_UPTIME_MS,
+    FIELD_CLOCK_MINUTES,
+    FIELD_OUTDOOR_LIGHT,
+    GLOBAL_FIELD_COUNT
+};
+
+enum TelemetryRoomField {
+    ROOM_FIELD_TEMP,   // tenths of a degree
+    ROOM_FIELD_TARGET, // tenths of a degree
+    ROOM_FIELD_LIGHT,  // 0-4
+    ROOM_FIELD_FLAGS,  // see ROOM_FLAG_*
+    ROOM_FIELD_COUNT
+};
+
+#define ROOM_FLAG_AC_MASK 0x03
+#define ROOM_FLAG_PRESENT 0x04
+#define ROOM_FLAG_INACTIVE 0x08
+#define ROOM_FLAG_SCHEDULE 0x10
+#define ROOM_FLAG_AUTO_LIGHT 0x20
+#define ROOM_FLAG_PRECONDITION 0x40
+
+// As many rooms as a sample frame can carry in TELEMETRY_MAX_FRAME when
+// every field takes a 5-byte varint; checked in Telemetry.cpp
+#define TELEMETRY_MAX_ROOMS 2
+#define TELEMETRY_MAX_FIELDS (GLOBAL_FIELD_COUNT + TELEMETRY_MAX_ROOMS * ROOM_FIELD_COUNT)
+#define TELEMETRY_MAX_FRAME 64
+
+inline uint8_t crc8Update(uint8_t crc, uint8_t data) {
+    crc ^= data;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+inline uint8_t crc8(const uint8_t* data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc8Update(crc, data[i]);
+    }
+    return crc;
+}
+
+inline uint32_t zigzagEncode(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+inline int32_t zigzagDecode(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+inline size_t putVarint(uint8_t* out, uint32_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (uint8_t)value;
+    return len;
+}
+
+inline size_t varintSize(uint32_t value) {
+    size_t len = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        len++;
+    }
+    return len;
+}
+
+// Returns the number of bytes consumed, 0 if the input ends mid-varint.
+inline size_t getVarint(const uint8_t* in, size_t len, uint32_t* value) {
+    uint32_t result = 0;
+    for (size_t i = 0; i < len && i < 5; i++) {
+        result |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// Output needs room for len + len / 254 + 1 bytes. No trailing delimiter.
+inline size_t cobsEncode(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t codeIndex = 0;
+    size_t outIndex = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == 0) {
+            out[codeIndex] = code;
+            codeIndex = outIndex++;
+            code = 1;
+            continue;
+        }
+        out[outIndex++] = in[i];
+        if (++code == 0xFF) {
+            out[codeIndex] = code;
+            codeIndex = outIndex++;
+            code = 1;
+        }
+    }
+    out[codeIndex] = code;
+    return outIndex;
+}
+
+// Decodes one frame without its delimiter. Returns 0 on malformed input.
+inline size_t cobsDecode(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t inIndex = 0;
+    size_t outIndex = 0;
+    while (inIndex < len) {
+        uint8_t code = in[inIndex++];
+        if (code == 0 || inIndex + code - 1 > len) {
+            return 0;
+        }
+        for (uint8_t i = 1; i < code; i++) {
+            out[outIndex++] = in[inIndex++];
+        }
+        if (code != 0xFF && inIndex < len) {
+            out[outIndex++] = 0;
+        }
+    }
+    return outIndex;
+}
+
+#endif // TELEMETRY_FORMAT_H
@@ -0,0 +1,45 @@
+#ifndef THERMAL_MODEL_H
+#define THERMAL_MODEL_H
+
+#include <Arduino.h>
+#include "enums.h"
+
+// Online model of how fast a room's temperature moves in each AC state,
+// learned from its own sensor. Rates are kept in fixed point as thousandths
+// of a degree per minute.
+//
+// The TMP36 only resolves ~0.5 degrees, so a rate is measured over the time
+// the reading takes to move two ADC steps rather than over a fixed window.
+// A reading flickering by one step never closes a segment. The time until
+// the first change after a state switch is discarded.
+class ThermalModel {
+public:
+    static const int UNKNOWN = -1;
+    static const int MAX_MINUTES = 999;
+
+    ThermalModel();
+
+    void observe(unsigned long now, float temp, ACState state);
+    int minutesToReach(float from, float to) const;
+
+private:
+    // New measurements weigh 1/4
+    static const uint8_t RATE_SHIFT = 2;
+    // A reading that hasn't moved for this long counts as a flat segment
+    static const unsigned long MAX_SEGMENT_MS = 60UL * 60 * 1000;
+    // Two ADC steps of 5 V / 1023 at 10 mV per degree, in tenths
+    static const int16_t MIN_CHANGE = 9;
+
+    int16_t rates[3];
+    uint8_t samples[3];
+    int8_t segmentState;
+    bool segmentStarted;
+    int16_t segmentTemp;
+    int16_t lastTemp;
+    unsigned long segmentStart;
+
+    void startSegment(unsigned long now, int16_t temp);
+    void addSample(ACState state, long milliPerMinute);
+};
+
+#endif // THERMAL_MODEL_H
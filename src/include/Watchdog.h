@@ -0,0 +1,67 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <Arduino.h>
+#include "instance.h"
+
+// Scheduler phases of loop(), in the order they run
+enum LoopPhase {
+    PHASE_SETUP,
+    // Pin sampling and the power gate, on every pass including idle ones
+    PHASE_WAKE,
+    PHASE_INPUT,
+    PHASE_COMMANDS,
+    PHASE_ROOMS,
+    PHASE_MENU,
+    PHASE_CLOCK,
+    PHASE_BUS,
+    PHASE_TELEMETRY,
+    PHASE_COUNT
+};
+
+enum ResetCause {
+    RESET_POWER_ON,
+    RESET_EXTERNAL,
+    RESET_BROWN_OUT,
+    RESET_WATCHDOG,
+    RESET_UNKNOWN
+};
+
+// Survives a reset (.noinit on the board) so the next boot can tell where
+// the previous run stopped.
+struct CrashRecord {
+    uint16_t magic;
+    uint8_t phase;
+    uint8_t hungPhase;
+    uint32_t loops;
+};
+
+// Hardware watchdog fed once per loop. It first raises an interrupt that
+// records the phase that hung and resets on the second timeout. Each phase
+// also has a soft deadline; overruns are only counted.
+class Watchdog {
+public:
+    Watchdog();
+
+    void begin();
+    void enter(LoopPhase phase);
+    void heartbeat();
+    bool reportBoot();
+    bool reportHealth();
+
+private:
+    ResetCause cause;
+    CrashRecord previous;
+    unsigned long phaseStart;
+    bool timing;
+    uint16_t overruns;
+    uint8_t worstPhase;
+    uint16_t worstMs;
+
+    void endPhase(unsigned long now);
+};
+
+extern INSTANCE_STATE CrashRecord crashRecord;
+extern INSTANCE_STATE Watchdog watchdog;
+
+#endif // WATCHDOG_H
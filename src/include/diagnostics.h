@@ -0,0 +1,15 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+// Optional diagnostics. Host builds always have them. Board builds leave
+// them out to save SRAM unless they are defined here or with -D.
+#ifndef __AVR__
+#ifndef INPUT_TRACE
+#define INPUT_TRACE
+#endif
+#ifndef LATENCY_TRACE
+#define LATENCY_TRACE
+#endif
+#endif
+
+#endif // DIAGNOSTICS_H
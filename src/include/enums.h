@@ -1,19 +1,35 @@
 #ifndef ENUMS_H
 #define ENUMS_H
 
-// Enum for the system state
-enum SystemState {
+#include <stdint.h>
+
+// Enum for the system state. These enums are one byte each: they sit in
+// every room and in the menu stack.
+enum SystemState : uint8_t {
     WELCOME_SCREEN,
     ROOM_MENU,
     ROOM_LIGHT_CONTROL,
     ROOM_TEMP_CONTROL,
-    ROOM_SCHEDULE
+    ROOM_SCHEDULE,
+    ROOM_HISTORY,
+    ROOM_STATS,
+    SYSTEM_MENU,
+    DIAGNOSTICS,
+    SCENE_MENU
 };
 
-enum ACState {
+enum ACState : uint8_t {
     OFF,
     HEATING,
     COOLING
 };
 
+// How a light level 0-4 shows on a room's pixels
+enum LightStyle : uint8_t {
+    // level/4 of the pixels lit in full green, like an indicator
+    LIGHT_BAR,
+    // every pixel lit in warm white, dimmed along a perceptual curve
+    LIGHT_DIMMER
+};
+
 #endif // ENUMS_H
\ No newline at end of file
@@ -2,33 +2,39 @@
 #define GENERAL_H
 
 #include "StateStack.h"
+#include "instance.h"
 
-StateStack stateStack;
-SystemState currentState = WELCOME_SCREEN;
-byte expanderPinStates = 0x00;
+extern INSTANCE_STATE StateStack stateStack;
+extern INSTANCE_STATE SystemState currentState;
+extern INSTANCE_STATE byte expanderPinStates;
 
-bool leftButtonPressed = false;
-bool rightButtonPressed = false;
-bool backButtonPressed = false;
-bool scheduleButtonPressed = false;
-bool lightAdjusted = false;
-bool tempAdjusted = false;
-bool scheduleAdjusted = false;
-bool timeAdjusted = false;
+extern INSTANCE_STATE bool leftButtonPressed;
+extern INSTANCE_STATE bool rightButtonPressed;
+extern INSTANCE_STATE bool backButtonPressed;
+extern INSTANCE_STATE bool scheduleButtonPressed;
+extern INSTANCE_STATE bool lightAdjusted;
+extern INSTANCE_STATE bool tempAdjusted;
+extern INSTANCE_STATE bool scheduleAdjusted;
+extern INSTANCE_STATE bool timeAdjusted;
+extern INSTANCE_STATE bool historyAdjusted;
+extern INSTANCE_STATE bool memoryAdjusted;
 
 const int START_HOUR = 8;
-unsigned long START_TIME = 0;
-unsigned long ADDED_TIME = 0;
+extern INSTANCE_STATE unsigned long START_TIME;
+extern INSTANCE_STATE unsigned long ADDED_TIME;
 
 void PCF8574_Write(byte data);
 void setExpanderPin(int pin, bool state);
+void stageExpanderPin(int pin, bool state);
 void printTemperature(float temp);
 void printCentered(const char* text, int row);
+void printCentered_P(PGM_P text, int row);
+void createChar_P(uint8_t location, const byte* glyph);
 String getTimestamp();
 unsigned long currentTime();
+unsigned long currentTimeAt(unsigned long ms);
 unsigned long getMillisFromHour(int hour);
 int hour();
 int minute();
-int mapOutdoorLighting(int lightReading);
 
 #endif // GENERAL_H
@@ -6,10 +6,11 @@
 #include <Adafruit_NeoPixel.h>
 #include "Adafruit_LEDBackpack.h"
 #include "Adafruit_GFX.h"
+#include "instance.h"
 
-LiquidCrystal mainDisplay;
-Adafruit_NeoPixel strip;
-Adafruit_7segment clockDisplay;
+extern INSTANCE_STATE LiquidCrystal mainDisplay;
+extern INSTANCE_STATE Adafruit_NeoPixel strip;
+extern INSTANCE_STATE Adafruit_7segment clockDisplay;
 
 #define EXPANDER_ADDRESS 0x20
 #define CLOCK_ADDRESS 0x70
@@ -26,6 +27,7 @@ Adafruit_7segment clockDisplay;
 #define ROOM1_COOLING_PIN 1
 #define ROOM1_PIR_PIN 5
 #define ROOM1_LIGHT_STRIP_IND 0
+#define ROOM1_LIGHT_STRIP_LEN 4
 
 // Room 2 pin definitions
 #define ROOM2_TEMP_SENSOR_PIN A0
@@ -33,34 +35,15 @@ Adafruit_7segment clockDisplay;
 #define ROOM2_COOLING_PIN 6
 #define ROOM2_PIR_PIN 6
 #define ROOM2_LIGHT_STRIP_IND 4
+#define ROOM2_LIGHT_STRIP_LEN 4
+
+// One strip chained through both rooms; each room owns a segment of it
+#define LIGHT_STRIP_PIN 4
+#define LIGHT_STRIP_PIXELS (ROOM2_LIGHT_STRIP_IND + ROOM2_LIGHT_STRIP_LEN)
 
 // Custom characters for the LCD
-byte solidBlock[8] = {
-    B11111,
-    B11111,
-    B11111,
-    B11111,
-    B11111,
-    B11111,
-    B11111,
-    B11111 };
-byte arrowUp[8] = {
-    B00100,
-    B01110,
-    B11111,
-    B00100,
-    B00100,
-    B00100,
-    B00100,
-    B00000 };
-byte arrowDown[8] = {
-    B00100,
-    B00100,
-    B00100,
-    B00100,
-    B11111,
-    B01110,
-    B00100,
-    B00000 };
+extern const byte solidBlock[8] PROGMEM;
+extern const byte arrowUp[8] PROGMEM;
+extern const byte arrowDown[8] PROGMEM;
 
 #endif // HARDWARE_H
\ No newline at end of file
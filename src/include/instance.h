@@ -0,0 +1,13 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+// Marks globals that belong to one controller. On the board this is plain
+// static storage; host builds make it thread local so a simulator can run
+// many controllers in one process (see host/FirmwareInstance.h).
+#ifdef __AVR__
+#define INSTANCE_STATE
+#else
+#define INSTANCE_STATE thread_local
+#endif
+
+#endif // INSTANCE_H
@@ -2,20 +2,32 @@
 #define MAIN_H
 
 #include "RoomControl.h"
+#include "instance.h"
 
-RoomConfig room1Config;
-RoomConfig room2Config;
-RoomControl room1;
-RoomControl room2;
+extern INSTANCE_STATE RoomControl room1;
+extern INSTANCE_STATE RoomControl room2;
 
-unsigned long TIME_WHEEL_RANGE = 0;
-int lastTimeWheelValue = 0;
+#define ROOM_COUNT 2
+extern INSTANCE_STATE RoomControl* const rooms[ROOM_COUNT];
+
+extern INSTANCE_STATE unsigned long TIME_WHEEL_RANGE;
+extern INSTANCE_STATE int lastTimeWheelValue;
+extern INSTANCE_STATE int8_t selectedScene;
+// ADC counts the time wheel must move before the clock is adjusted
+const int TIME_WHEEL_DEADBAND = 2;
 
 void displayWelcomeScreen();
 void handleWelcomeScreen();
+void displaySystemMenu();
+void handleSystemMenu();
+void displayDiagnostics();
+void displaySceneMenu();
+void handleSceneMenu();
 void displayCurrentMenu();
 void handleCurrentMenu();
 void displayCurrentTime();
 void updateStartTime();
+void setup();
+void loop();
 
 #endif
\ No newline at end of file
@@ -1,9 +1,110 @@
+// Generated by tools/amalgamate.py from src/include and src/impl.
+// Do not edit; change the sources and run the script again.
+// ---- src/include/ButtonRepeat.h ----
+#include <Arduino.h>
+
+// How a held button repeats: a pause after the press, then a step every
+// interval, with the step size doubling every few repeats up to a limit.
+// An interval of 0 means one step per press.
+struct RepeatRate {
+    uint16_t initialDelay;
+    uint16_t interval;
+    uint8_t accelerateAfter;
+    uint8_t maxStep;
+};
+
+// Turns a held left/right pair into signed steps without blocking the loop
+class ButtonRepeat {
+public:
+    ButtonRepeat();
+
+    // By value, so the rate constants never need a copy in SRAM
+    int steps(int8_t direction, unsigned long now, RepeatRate rate);
+    void suppress();
+
+private:
+    // A press this soon after a release is contact bounce, not a new press
+    static const uint8_t DEBOUNCE_MS = 30;
+
+    int8_t held;
+    bool blocked;
+    uint8_t repeats;
+    uint8_t stepSize;
+    unsigned long nextRepeat;
+    unsigned long releasedAt;
+};
+
+// ---- src/impl/ButtonRepeat.cpp ----
+ButtonRepeat::ButtonRepeat() : held(0), blocked(false), repeats(0), stepSize(1), nextRepeat(0), releasedAt(0) {}
+
+// Returns how many steps to move in the given direction (-1, 0 or 1) on
+// this pass: one on the press, none until the initial delay has passed,
+// then a growing number per interval while the button stays down.
+int ButtonRepeat::steps(int8_t direction, unsigned long now, RepeatRate rate) {
+    if (direction == 0) {
+        if (held != 0) {
+            releasedAt = now;
+        }
+        held = 0;
+        blocked = false;
+        return 0;
+    }
+    if (blocked) {
+        return 0;
+    }
+    if (direction != held) {
+        bool bounce = held == 0 && now - releasedAt < DEBOUNCE_MS;
+        held = direction;
+        repeats = 0;
+        stepSize = 1;
+        nextRepeat = now + rate.initialDelay;
+        return bounce ? 0 : direction;
+    }
+    if (rate.interval == 0 || (long)(now - nextRepeat) < 0) {
+        return 0;
+    }
+    // Keep the cadence when a pass is a little late, but don't catch up
+    // on a backlog of missed repeats
+    nextRepeat += rate.interval;
+    if ((long)(now - nextRepeat) >= 0) {
+        nextRepeat = now + rate.interval;
+    }
+    int step = stepSize;
+    if (++repeats >= rate.accelerateAfter && stepSize < rate.maxStep) {
+        repeats = 0;
+        stepSize = min(stepSize * 2, (int)rate.maxStep);
+    }
+    return direction * step;
+}
+
+// Ignores the buttons until both are released, so a press that opened a
+// menu does not also adjust its value
+void ButtonRepeat::suppress() {
+    blocked = true;
+}
+
+// ---- src/include/hardware.h ----
 #include <Wire.h>
 #include <LiquidCrystal.h>
 #include <Adafruit_NeoPixel.h>
 #include "Adafruit_LEDBackpack.h"
 #include "Adafruit_GFX.h"
 
+// ---- src/include/instance.h ----
+// Marks globals that belong to one controller. On the board this is plain
+// static storage; host builds make it thread local so a simulator can run
+// many controllers in one process (see host/FirmwareInstance.h).
+#ifdef __AVR__
+#define INSTANCE_STATE
+#else
+#define INSTANCE_STATE thread_local
+#endif
+
+// ---- src/include/hardware.h ----
+extern INSTANCE_STATE LiquidCrystal mainDisplay;
+extern INSTANCE_STATE Adafruit_NeoPixel strip;
+extern INSTANCE_STATE Adafruit_7segment clockDisplay;
+
 #define EXPANDER_ADDRESS 0x20
 #define CLOCK_ADDRESS 0x70
 #define LEFT_BUTTON_PIN 3
@@ -19,6 +120,7 @@
 #define ROOM1_COOLING_PIN 1
 #define ROOM1_PIR_PIN 5
 #define ROOM1_LIGHT_STRIP_IND 0
+#define ROOM1_LIGHT_STRIP_LEN 4
 
 // Room 2 pin definitions
 #define ROOM2_TEMP_SENSOR_PIN A0
@@ -26,95 +128,55 @@
 #define ROOM2_COOLING_PIN 6
 #define ROOM2_PIR_PIN 6
 #define ROOM2_LIGHT_STRIP_IND 4
+#define ROOM2_LIGHT_STRIP_LEN 4
 
-// Enum for the system state
-enum SystemState {
+// One strip chained through both rooms; each room owns a segment of it
+#define LIGHT_STRIP_PIN 4
+#define LIGHT_STRIP_PIXELS (ROOM2_LIGHT_STRIP_IND + ROOM2_LIGHT_STRIP_LEN)
+
+// Custom characters for the LCD
+extern const byte solidBlock[8] PROGMEM;
+extern const byte arrowUp[8] PROGMEM;
+extern const byte arrowDown[8] PROGMEM;
+
+// ---- src/include/enums.h ----
+#include <stdint.h>
+
+// Enum for the system state. These enums are one byte each: they sit in
+// every room and in the menu stack.
+enum SystemState : uint8_t {
     WELCOME_SCREEN,
     ROOM_MENU,
     ROOM_LIGHT_CONTROL,
     ROOM_TEMP_CONTROL,
-    ROOM_SCHEDULE
+    ROOM_SCHEDULE,
+    ROOM_HISTORY,
+    ROOM_STATS,
+    SYSTEM_MENU,
+    DIAGNOSTICS,
+    SCENE_MENU
 };
 
-enum ACState {
+enum ACState : uint8_t {
     OFF,
     HEATING,
     COOLING
 };
 
-class RoomConfig {
-public:
-    int tempSensorPin;
-    int heatingPin;
-    int coolingPin;
-    int pirPin;
-    int lightStripStartIndex;
-
-    RoomConfig(int tempSensor, int heatPin, int coolPin, int pirSensor, int lightStripIndex)
-        : tempSensorPin(tempSensor), heatingPin(heatPin), coolingPin(coolPin), pirPin(pirSensor), lightStripStartIndex(lightStripIndex) {}
-};
-
-class RoomControl {
-public:
-    String name;
-    RoomConfig config;
-    float currentTemp = 0.0;
-    float targetTemp = 22.0;
-    int lightIntensity = 0;
-    int selectedHour = 0;
-    int hourOverride = -1;
-    unsigned long lastMotionTime = 0;
-    bool peoplePresent = false;
-    bool inactive = false;
-    bool scheduleActive = false;
-    bool autoLightEnabled = false;
-    bool isDisplayed = false;
-    int schedule[24] = { 0 };
-    ACState acState = OFF;
-    SystemState menuStates[3];
-
-    RoomControl(String roomName, RoomConfig roomConfig) : name(roomName), config(roomConfig) {}
-
-    void display();
-    void init();
-    void displayRoomMenu();
-    void handleRoomMenu();
-    void displayRoomTempControl();
-    void handleRoomTempControl();
-    void autoUpdateTemperature();
-    float readTemperature();
-    void adjustAC();
-    void setACState(ACState state);
-    void displayRoomLightControl();
-    void handleRoomLightControl();
-    void updateNeoPixelBrightness(bool manual);
-    void autoAdjustLight();
-    void displayRoomSchedule();
-    void handleRoomSchedule();
-    void checkSchedule();
-    void deactivateSchedule();
-    void resetRoomOverride();
-    void detectRoomMotion(bool motionDetected);
-    void handleInactivity();
-    bool shouldUpdate();
+// How a light level 0-4 shows on a room's pixels
+enum LightStyle : uint8_t {
+    // level/4 of the pixels lit in full green, like an indicator
+    LIGHT_BAR,
+    // every pixel lit in warm white, dimmed along a perceptual curve
+    LIGHT_DIMMER
 };
 
-// general
-void displayWelcomeScreen();
-void handleWelcomeScreen();
-void displayCurrentMenu();
-void handleCurrentMenu();
-void displayCurrentTime();
-void updateStartTime();
-
-// helper methods
+// ---- src/include/StateStack.h ----
 class StateStack {
-private:
-    static const int MAX_STACK_SIZE = 10;
-    SystemState stack[MAX_STACK_SIZE];
-    int top;
-
 public:
+    // Welcome screen, room menu, light control and schedule is the deepest
+    static const int MAX_STACK_SIZE = 4;
+
     StateStack();
 
     void push(SystemState state);
@@ -122,370 +184,4418 @@ public:
     SystemState topState() const;
     bool isHistoryAvailable() const;
     int size() const;
+    // Bottom of the stack is index 0
+    SystemState at(int index) const;
+    void clear();
+
+private:
+    SystemState stack[MAX_STACK_SIZE];
+    int8_t top;
 };
 
-void printTemperature(float temp);
-void printCentered(const char* text, int row);
+// ---- src/include/general.h ----
+extern INSTANCE_STATE StateStack stateStack;
+extern INSTANCE_STATE SystemState currentState;
+extern INSTANCE_STATE byte expanderPinStates;
+
+extern INSTANCE_STATE bool leftButtonPressed;
+extern INSTANCE_STATE bool rightButtonPressed;
+extern INSTANCE_STATE bool backButtonPressed;
+extern INSTANCE_STATE bool scheduleButtonPressed;
+extern INSTANCE_STATE bool lightAdjusted;
+extern INSTANCE_STATE bool tempAdjusted;
+extern INSTANCE_STATE bool scheduleAdjusted;
+extern INSTANCE_STATE bool timeAdjusted;
+extern INSTANCE_STATE bool historyAdjusted;
+extern INSTANCE_STATE bool memoryAdjusted;
+
+const int START_HOUR = 8;
+extern INSTANCE_STATE unsigned long START_TIME;
+extern INSTANCE_STATE unsigned long ADDED_TIME;
+
 void PCF8574_Write(byte data);
 void setExpanderPin(int pin, bool state);
+void stageExpanderPin(int pin, bool state);
+void printTemperature(float temp);
+void printCentered(const char* text, int row);
+void printCentered_P(PGM_P text, int row);
+void createChar_P(uint8_t location, const byte* glyph);
 String getTimestamp();
 unsigned long currentTime();
+unsigned long currentTimeAt(unsigned long ms);
 unsigned long getMillisFromHour(int hour);
 int hour();
 int minute();
-int mapOutdoorLighting(int lightReading);
 
-// Hardware
-LiquidCrystal mainDisplay(12, 13, 11, 10, 9, 8);
-Adafruit_NeoPixel strip(8, 4, NEO_GRB + NEO_KHZ800);
-Adafruit_7segment clockDisplay = Adafruit_7segment();
+// ---- src/include/TelemetryFormat.h ----
+#include <stddef.h>
 
-// Custom characters for the LCD
-byte solidBlock[8] = {
-    B11111,
-    B11111,
-    B11111,
-    B11111,
-    B11111,
-    B11111,
-    B11111,
-    B11111 };
-byte arrowUp[8] = {
-    B00100,
-    B01110,
-    B11111,
-    B00100,
-    B00100,
-    B00100,
-    B00100,
-    B00000 };
-byte arrowDown[8] = {
-    B00100,
-    B00100,
-    B00100,
-    B00100,
-    B11111,
-    B01110,
-    B00100,
-    B00000 };
+// Wire format shared by the firmware and the host tools.
+//
+// Every frame is COBS encoded and terminated by a single 0x00 byte:
+//   [type] [seq] [body...] [crc8]
+// KEY frames carry every field as an absolute value, DELTA frames carry a
+// varint bit mask of the changed fields followed by zigzag varint deltas
+// against the previous frame. Sequence numbers only advance for frames that
+// made it into the TX buffer, so a gap seen by a decoder means bytes were lost
+// on the line and it has to wait for the next KEY frame.
+//
+// TRACE frames carry input trace records while recording is on. Each record
+// starts with a varint of milliseconds since the previous record and a byte
+// whose top two bits give its kind:
+//   INPUT   low six bits are the TRACE_PIN_* levels, then a byte mask of the
+//           TRACE_ANALOG_* channels that changed and a zigzag varint delta
+//           for each of them
+//   START   like INPUT, but the time is absolute millis() and every analog
+//           channel follows as an absolute value; sent first and again after
+//           trace data was lost
+//   COMMAND a length byte and the Serial command line as it was executed
 
-StateStack stateStack;
-SystemState currentState = WELCOME_SCREEN;
-RoomConfig room1Config(ROOM1_TEMP_SENSOR_PIN, ROOM1_HEATING_PIN, ROOM1_COOLING_PIN, ROOM1_PIR_PIN, ROOM1_LIGHT_STRIP_IND);
-RoomConfig room2Config(ROOM2_TEMP_SENSOR_PIN, ROOM2_HEATING_PIN, ROOM2_COOLING_PIN, ROOM2_PIR_PIN, ROOM2_LIGHT_STRIP_IND);
-RoomControl room1("Room 1", room1Config);
-RoomControl room2("Room 2", room2Config);
-byte expanderPinStates = 0x00;
-
-bool leftButtonPressed = false;
-bool rightButtonPressed = false;
-bool backButtonPressed = false;
-bool scheduleButtonPressed = false;
-bool lightAdjusted = false;
-bool tempAdjusted = false;
-bool scheduleAdjusted = false;
-bool timeAdjusted = false;
+enum TelemetryFrameType {
+    FRAME_KEY = 0x01,
+    FRAME_DELTA = 0x02,
+    FRAME_TEXT = 0x03,
+    FRAME_TRACE = 0x04
+};
 
-const int START_HOUR = 8;
-const unsigned long TIME_WHEEL_RANGE = getMillisFromHour(4);
-unsigned long START_TIME = getMillisFromHour(START_HOUR);
-unsigned long ADDED_TIME = 0;
-int lastTimeWheelValue = 0;
+#define TRACE_KIND_MASK 0xC0
+#define TRACE_INPUT 0x00
+#define TRACE_START 0x40
+#define TRACE_COMMAND 0x80
+#define TRACE_PIN_MASK 0x3F
 
-void RoomControl::display() {
-    isDisplayed = true;
-    stateStack.push(ROOM_MENU);
-}
+// Bit order of the traced digital pins and analog channels
+enum TraceDigitalPin {
+    TRACE_PIN_LEFT,
+    TRACE_PIN_RIGHT,
+    TRACE_PIN_BACK,
+    TRACE_PIN_SCHEDULE,
+    TRACE_PIN_ROOM1_PIR,
+    TRACE_PIN_ROOM2_PIR,
+    TRACE_PIN_COUNT
+};
 
-void RoomControl::init() {
-    pinMode(config.pirPin, INPUT);
-}
+enum TraceAnalogChannel {
+    TRACE_ANALOG_TIME_WHEEL,
+    TRACE_ANALOG_OUTDOOR_LIGHT,
+    TRACE_ANALOG_ROOM1_TEMP,
+    TRACE_ANALOG_ROOM2_TEMP,
+    TRACE_ANALOG_COUNT
+};
 
-void RoomControl::displayRoomMenu() {
-    printCentered(name.c_str(), 0);
-    mainDisplay.setCursor(0, 1);
-    mainDisplay.print(F("<Light    Temp.>"));
-}
+// Field layout: global fields first, then ROOM_FIELD_COUNT fields per room.
+enum TelemetryField {
+    FIELD_UPTIME_MS,
+    FIELD_CLOCK_MINUTES,
+    FIELD_OUTDOOR_LIGHT,
+    GLOBAL_FIELD_COUNT
+};
 
-void RoomControl::handleRoomMenu() {
-    if (leftButtonPressed) {
-        stateStack.push(ROOM_LIGHT_CONTROL);
-        mainDisplay.clear();
-        delay(200);
-    } else if (rightButtonPressed) {
-        stateStack.push(ROOM_TEMP_CONTROL);
-        mainDisplay.clear();
-        delay(200);
-    }
-}
+enum TelemetryRoomField {
+    ROOM_FIELD_TEMP,   // tenths of a degree
+    ROOM_FIELD_TARGET, // tenths of a degree
+    ROOM_FIELD_LIGHT,  // 0-4
+    ROOM_FIELD_FLAGS,  // see ROOM_FLAG_*
+    ROOM_FIELD_COUNT
+};
 
-void RoomControl::displayRoomTempControl() {
-    mainDisplay.setCursor(0, 0);
-    mainDisplay.print(name.c_str());
-    mainDisplay.print(F(": "));
-    mainDisplay.setCursor(9, 0);
-    mainDisplay.print(currentTemp, 1);
-    if (currentTemp != targetTemp) {
-        mainDisplay.write(byte((targetTemp > currentTemp) ? 1 : 2));
+#define ROOM_FLAG_AC_MASK 0x03
+#define ROOM_FLAG_PRESENT 0x04
+#define ROOM_FLAG_INACTIVE 0x08
+#define ROOM_FLAG_SCHEDULE 0x10
+#define ROOM_FLAG_AUTO_LIGHT 0x20
+#define ROOM_FLAG_PRECONDITION 0x40
+
+// As many rooms as a sample frame can carry in TELEMETRY_MAX_FRAME when
+// every field takes a 5-byte varint; checked in Telemetry.cpp
+#define TELEMETRY_MAX_ROOMS 2
+#define TELEMETRY_MAX_FIELDS (GLOBAL_FIELD_COUNT + TELEMETRY_MAX_ROOMS * ROOM_FIELD_COUNT)
+#define TELEMETRY_MAX_FRAME 64
+
+inline uint8_t crc8Update(uint8_t crc, uint8_t data) {
+    crc ^= data;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
     }
-    mainDisplay.print(F("   "));
-    printTemperature(targetTemp);
-    mainDisplay.setCursor(0, 1);
-    mainDisplay.print(F("-"));
-    mainDisplay.setCursor(15, 1);
-    mainDisplay.print(F("+"));
+    return crc;
 }
 
-void RoomControl::handleRoomTempControl() {
-    if (leftButtonPressed && targetTemp > 10) {
-        targetTemp -= 0.5;
-        tempAdjusted = true;
-        delay(200);
-    } else if (rightButtonPressed && targetTemp < 30) {
-        targetTemp += 0.5;
-        tempAdjusted = true;
-        delay(200);
+inline uint8_t crc8(const uint8_t* data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc8Update(crc, data[i]);
     }
+    return crc;
 }
 
-void RoomControl::autoUpdateTemperature() {
-    float temp = readTemperature();
-    if (temp != currentTemp) {
-        currentTemp = temp;
-        tempAdjusted = true;
-    }
-    adjustAC();
+inline uint32_t zigzagEncode(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
 }
 
-float RoomControl::readTemperature() {
-    int sensorValue = analogRead(config.tempSensorPin);
-    float voltage = sensorValue * (5.0 / 1023.0);
-    float temperatureC = (voltage - 0.5) * 100.0;
-    return round(temperatureC * 10) / 10.0;
+inline int32_t zigzagDecode(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
 }
 
-void RoomControl::adjustAC() {
-    if (currentTemp < targetTemp && acState != HEATING) {
-        setACState(HEATING);
-    } else if (currentTemp > targetTemp && acState != COOLING) {
-        setACState(COOLING);
-    } else if (currentTemp == targetTemp && acState != OFF) {
-        setACState(OFF);
+inline size_t putVarint(uint8_t* out, uint32_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
     }
+    out[len++] = (uint8_t)value;
+    return len;
 }
 
-void RoomControl::setACState(ACState state) {
-    switch (state) {
-    case HEATING:
-        setExpanderPin(config.heatingPin, HIGH);
-        setExpanderPin(config.coolingPin, LOW);
-        break;
-    case COOLING:
-        setExpanderPin(config.heatingPin, LOW);
-        setExpanderPin(config.coolingPin, HIGH);
-        break;
-    case OFF:
-        setExpanderPin(config.heatingPin, LOW);
-        setExpanderPin(config.coolingPin, LOW);
-        break;
+inline size_t varintSize(uint32_t value) {
+    size_t len = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        len++;
     }
-    acState = state;
+    return len;
 }
 
-void RoomControl::displayRoomLightControl() {
-    char buffer[17];
-    snprintf(buffer, sizeof(buffer), "%s Light", name.c_str());
-    printCentered(buffer, 0);
-    mainDisplay.setCursor(0, 1);
-    mainDisplay.print(F("- "));
-    int fullBlocks = lightIntensity * 12 / 4;
-    for (int i = 0; i < 12; i++) {
-        if (i < fullBlocks) {
-            mainDisplay.write(byte(0));
-        } else {
-            mainDisplay.write(' ');
+// Returns the number of bytes consumed, 0 if the input ends mid-varint.
+inline size_t getVarint(const uint8_t* in, size_t len, uint32_t* value) {
+    uint32_t result = 0;
+    for (size_t i = 0; i < len && i < 5; i++) {
+        result |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80)) {
+            *value = result;
+            return i + 1;
         }
     }
-    mainDisplay.print(F(" +"));
+    return 0;
 }
 
-void RoomControl::handleRoomLightControl() {
-    if (leftButtonPressed && lightIntensity > 0) {
-        --lightIntensity;
-        updateNeoPixelBrightness(true);
-        hourOverride = hour();
-        delay(200);
-    } else if (rightButtonPressed && lightIntensity < 4) {
-        ++lightIntensity;
-        updateNeoPixelBrightness(true);
-        hourOverride = hour();
-        delay(200);
-    } else if (scheduleButtonPressed) {
-        stateStack.push(ROOM_SCHEDULE);
-        selectedHour = hour();
-        delay(200);
+// Output needs room for len + len / 254 + 1 bytes. No trailing delimiter.
+inline size_t cobsEncode(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t codeIndex = 0;
+    size_t outIndex = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == 0) {
+            out[codeIndex] = code;
+            codeIndex = outIndex++;
+            code = 1;
+            continue;
+        }
+        out[outIndex++] = in[i];
+        if (++code == 0xFF) {
+            out[codeIndex] = code;
+            codeIndex = outIndex++;
+            code = 1;
+        }
     }
+    out[codeIndex] = code;
+    return outIndex;
 }
 
-void RoomControl::updateNeoPixelBrightness(bool manual) {
-    if (manual) {
-        autoLightEnabled = false;
-    }
-    int startIndex = config.lightStripStartIndex;
-    int endIndex = startIndex + 4;
-    // clearing
-    for (int i = startIndex; i < endIndex; i++) {
-        strip.setPixelColor(i, strip.Color(0, 0, 0));
-    }
-    // setting color
-    for (int i = startIndex; i < startIndex + lightIntensity; i++) {
-        strip.setPixelColor(i, strip.Color(0, 255, 0));
+// Decodes one frame without its delimiter. Returns 0 on malformed input.
+inline size_t cobsDecode(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t inIndex = 0;
+    size_t outIndex = 0;
+    while (inIndex < len) {
+        uint8_t code = in[inIndex++];
+        if (code == 0 || inIndex + code - 1 > len) {
+            return 0;
+        }
+        for (uint8_t i = 1; i < code; i++) {
+            out[outIndex++] = in[inIndex++];
+        }
+        if (code != 0xFF && inIndex < len) {
+            out[outIndex++] = 0;
+        }
     }
-    strip.show();
-    lightAdjusted = true;
-
+    return outIndex;
 }
 
-void RoomControl::autoAdjustLight() {
-    int outdoorLightLevel = analogRead(PHOTO_RESISTOR_PIN);
-    int targetIntensity = mapOutdoorLighting(outdoorLightLevel);
-    if (autoLightEnabled && !scheduleActive && targetIntensity != lightIntensity) {
-        lightIntensity = targetIntensity;
-        updateNeoPixelBrightness(false);
-    }
-}
+// ---- src/include/RoomConfig.h ----
+class RoomConfig {
+public:
+    uint8_t tempSensorPin;
+    uint8_t heatingPin;
+    uint8_t coolingPin;
+    uint8_t pirPin;
+    uint8_t lightStripStartIndex;
+    uint8_t lightStripLength;
+    LightStyle lightStyle;
+    // Photoresistor reading as this room's windows see it: reading * gain / 256 + offset
+    int16_t daylightGain;
+    int16_t daylightOffset;
 
-void RoomControl::displayRoomSchedule() {
-    int nextHour = (selectedHour + 1) % 24;
-    int scheduledLightIntensity = schedule[selectedHour];
+    RoomConfig(uint8_t tempSensor, uint8_t heatPin, uint8_t coolPin, uint8_t pirSensor, uint8_t lightStripIndex, uint8_t lightStripLen,
+               LightStyle style, int16_t gain = 256, int16_t offset = 0)
+        : tempSensorPin(tempSensor), heatingPin(heatPin), coolingPin(coolPin), pirPin(pirSensor), lightStripStartIndex(lightStripIndex),
+          lightStripLength(lightStripLen), lightStyle(style), daylightGain(gain), daylightOffset(offset) {}
+};
 
-    mainDisplay.clear();
-    char buffer[17];
+// ---- src/include/OccupancyModel.h ----
+// Learns when a room is usually occupied. The day is split into half-hour
+// slots; each slot keeps an exponentially decayed likelihood (0-255) that it
+// sees PIR motion, updated once per day when the slot ends.
+class OccupancyModel {
+public:
+    static const int SLOT_COUNT = 48;
+    static const unsigned long SLOT_MS = 30UL * 60 * 1000;
 
-    if (scheduledLightIntensity == 0) {
-        printCentered("[unset]", 0);
-    } else {
-        int percentage = scheduledLightIntensity * 25;
-        sprintf(buffer, "[%d%% light]", percentage);
-        printCentered(buffer, 0);
-    }
+    OccupancyModel();
 
-    sprintf(buffer, "< %02d:00", selectedHour);
-    mainDisplay.setCursor(0, 1);
-    mainDisplay.print(buffer);
+    void recordMotion(unsigned long now);
+    void update(unsigned long now);
+    uint8_t likelihood(int slot) const;
+    int minutesUntilExpected(unsigned long now, int maxSlots) const;
+
+private:
+    // New observations weigh 1/4, so a habit is picked up after ~3 days
+    static const uint8_t DECAY_SHIFT = 2;
+    static const uint8_t EXPECTED_THRESHOLD = 128;
+
+    uint8_t bins[SLOT_COUNT];
+    int8_t currentSlot;
+    bool slotOccupied;
+};
+
+// ---- src/include/ThermalModel.h ----
+// Online model of how fast a room's temperature moves in each AC state,
+// learned from its own sensor. Rates are kept in fixed point as thousandths
+// of a degree per minute.
+//
+// The TMP36 only resolves ~0.5 degrees, so a rate is measured over the time
+// the reading takes to move two ADC steps rather than over a fixed window.
+// A reading flickering by one step never closes a segment. The time until
+// the first change after a state switch is discarded.
+class ThermalModel {
+public:
+    static const int UNKNOWN = -1;
+    static const int MAX_MINUTES = 999;
+
+    ThermalModel();
+
+    void observe(unsigned long now, float temp, ACState state);
+    int minutesToReach(float from, float to) const;
+
+private:
+    // New measurements weigh 1/4
+    static const uint8_t RATE_SHIFT = 2;
+    // A reading that hasn't moved for this long counts as a flat segment
+    static const unsigned long MAX_SEGMENT_MS = 60UL * 60 * 1000;
+    // Two ADC steps of 5 V / 1023 at 10 mV per degree, in tenths
+    static const int16_t MIN_CHANGE = 9;
+
+    int16_t rates[3];
+    uint8_t samples[3];
+    int8_t segmentState;
+    bool segmentStarted;
+    int16_t segmentTemp;
+    int16_t lastTemp;
+    unsigned long segmentStart;
+
+    void startSegment(unsigned long now, int16_t temp);
+    void addSample(ACState state, long milliPerMinute);
+};
+
+// ---- src/include/SensorHistory.h ----
+// Downsampled history of one sensor: the last 48 half-hours (24 hours)
+// as min/max/avg in tenths, two bytes per slot. Averages are stored as the
+// difference to the previous slot and rebuilt backwards from the newest one;
+// min and max are packed as their distance to the average, one nibble each.
+class SensorHistory {
+public:
+    static const int SLOT_COUNT = 48;
+    static const unsigned long SLOT_MS = 30UL * 60 * 1000;
+
+    struct Sample {
+        int16_t min;
+        int16_t max;
+        int16_t avg;
+    };
+
+    SensorHistory();
+
+    bool record(unsigned long now, float value);
+    bool get(int age, Sample& sample) const;
+    int size() const;
+    uint16_t closedSlots() const;
+
+private:
+    static const unsigned long SAMPLE_MS = 1000;
+    static const uint8_t MAX_SPREAD = 15;
+
+    int8_t deltas[SLOT_COUNT];
+    uint8_t spreads[SLOT_COUNT];
+    uint8_t head;
+    uint8_t count;
+    int16_t newestAvg;
+    uint16_t closed;
+
+    // Slot in progress
+    unsigned long slotStart;
+    unsigned long lastSample;
+    long sum;
+    uint16_t samples;
+    int16_t low;
+    int16_t high;
+
+    int16_t currentAvg() const;
+    void closeSlot();
+};
+
+// ---- src/include/EnergyStats.h ----
+// Actuator accounting for one room. Updated only when an actuator actually
+// changes, never per loop: each change closes the interval spent in the old
+// state. Times are 24.8 fixed-point seconds (up to ~194 days), light is
+// counted in lit-pixel seconds in the same format.
+class EnergyStats {
+public:
+    static const uint8_t FRACTION_BITS = 8;
+
+    EnergyStats();
+
+    void setAC(unsigned long now, ACState state);
+    void setLight(unsigned long now, uint8_t lit);
+    uint32_t acTime(unsigned long now, ACState state) const;
+    uint32_t lightTime(unsigned long now) const;
+    uint16_t acSwitches() const;
+    uint16_t lightSwitches() const;
+
+private:
+    uint32_t acTotals[3];
+    uint32_t pixelTotal;
+    uint16_t acChanges;
+    uint16_t lightChanges;
+    ACState acState;
+    uint8_t pixels;
+    unsigned long acSince;
+    unsigned long lightSince;
+
+    static uint32_t toFixed(unsigned long ms);
+};
+
+// ---- src/include/DaylightHarvester.h ----
+// Turns the outdoor photoresistor into a room's automatic light level.
+// The reading is scaled by the room's gain and offset (windows facing
+// different ways see different daylight), smoothed, and looked up in a
+// PROGMEM curve that gives the wanted light in 1/64 levels. The level only
+// moves one step per update, once the curve is past the midpoint to the
+// next level by a margin, so a sensor hovering near a boundary doesn't
+// flicker the strip.
+class DaylightHarvester {
+public:
+    static const int MAX_LEVEL = 4;
+    static const unsigned long UPDATE_MS = 2000;
+    // Gain is in 1/256, so 256 passes the reading through unchanged
+    static const int16_t UNITY_GAIN = 256;
+
+    DaylightHarvester();
+
+    bool due(unsigned long now) const;
+    bool update(unsigned long now, int reading, int16_t gain, int16_t offset);
+    int level() const;
+
+    static int demand(int ambient);
+
+private:
+    static const uint8_t STEP = 64;
+    // Getting darker turns the lights up sooner than getting brighter dims them
+    static const uint8_t BRIGHTEN_MARGIN = 8;
+    static const uint8_t DIM_MARGIN = 16;
+    // New readings weigh 1/4
+    static const uint8_t FILTER_SHIFT = 2;
+
+    bool started;
+    uint8_t current;
+    // Ambient reading in 1/4 counts
+    uint16_t filtered;
+    unsigned long lastUpdate;
+};
+
+// ---- src/include/LightSegment.h ----
+// A room's run of pixels on the shared strip. Fills go straight into the
+// strip's pixel buffer with block copies, and only the pixels a level
+// change affects are rewritten, so the cost doesn't grow with the length
+// of a long strip. show() still has to send the whole strip, so the caller
+// only calls it when apply() reports a change.
+class LightSegment {
+public:
+    static const uint8_t MAX_LEVEL = 4;
+
+    LightSegment(uint16_t first, uint16_t length, LightStyle style);
+
+    bool apply(Adafruit_NeoPixel& strip, uint8_t level);
+    void invalidate();
+    uint16_t litPixels(uint8_t level) const;
+    uint16_t end() const;
+
+private:
+    // No level is shown yet, so the next apply() writes the whole segment
+    static const uint8_t UNKNOWN = 0xFF;
+
+    uint16_t first;
+    uint16_t length;
+    LightStyle style;
+    uint8_t shownLevel;
+
+    uint32_t color(uint8_t level) const;
+    static void fill(Adafruit_NeoPixel& strip, uint32_t color, uint16_t from, uint16_t count);
+};
+
+// ---- src/include/RoomControl.h ----
+const float SETBACK_TEMP = 18.0;
+// Pre-conditioning starts as early as the thermal model asks for, up to
+// two hours ahead; lights are only armed for the last quarter hour.
+const int PRECONDITION_MAX_SLOTS = 4;
+const int PRECONDITION_DEFAULT_MINUTES = 15;
+const int PRECONDITION_LIGHT_MINUTES = 15;
+const unsigned long STATS_REFRESH_MS = 1000;
+// 10 to 30 degrees in 0.5 steps takes about 0.8 s of holding; the schedule
+// wraps around, so it stays slow enough to stop on the wanted hour
+const RepeatRate TEMP_REPEAT = { 250, 50, 3, 8 };
+const RepeatRate SCHEDULE_REPEAT = { 300, 100, 4, 2 };
+const RepeatRate SINGLE_PRESS = { 0, 0, 0, 0 };
+
+class RoomControl {
+public:
+    // In flash
+    PGM_P name;
+    RoomConfig config;
+    float currentTemp = 0.0;
+    float targetTemp = 22.0;
+    float comfortTemp = 22.0;
+    // Target lowered to SETBACK_TEMP while the room is empty; comfortTemp
+    // holds the setpoint to go back to
+    bool setback = false;
+    int8_t lightIntensity = 0;
+    uint8_t selectedHour = 0;
+    int8_t hourOverride = -1;
+    unsigned long lastMotionTime = 0;
+    uint8_t motionChannel = 0;
+    bool peoplePresent = false;
+    bool inactive = false;
+    bool scheduleActive = false;
+    // Cleared by scenes that hold the lights, e.g. while away
+    bool scheduleEnabled = true;
+    bool autoLightEnabled = false;
+    bool preconditioning = false;
+    bool lightsArmed = false;
+    int etaMinutes = ThermalModel::UNKNOWN;
+    bool isDisplayed = false;
+    // Light level 0-4 per hour, two hours to a byte with the even hour in
+    // the low nibble
+    uint8_t schedule[12] = { 0 };
+    ACState acState = OFF;
+    OccupancyModel occupancy;
+    ThermalModel thermal;
+    SensorHistory history;
+    EnergyStats energy;
+    DaylightHarvester daylight;
+    LightSegment lights;
+    unsigned long statsDrawnAt = 0;
+
+    RoomControl(PGM_P roomName, RoomConfig roomConfig)
+        : name(roomName), config(roomConfig),
+          lights(roomConfig.lightStripStartIndex, roomConfig.lightStripLength, roomConfig.lightStyle) {}
+
+    void display();
+    void init();
+    void displayRoomMenu();
+    void handleRoomMenu();
+    void displayRoomTempControl();
+    void drawTempTarget();
+    void handleRoomTempControl();
+    void displayRoomHistory();
+    void handleRoomHistory();
+    void displayRoomStats();
+    void autoUpdateTemperature();
+    float readTemperature();
+    void adjustAC();
+    bool stageAC();
+    void setACState(ACState state);
+    void stageACState(ACState state);
+    void displayRoomLightControl();
+    void handleRoomLightControl();
+    void updateNeoPixelBrightness(bool manual);
+    bool stageLight();
+    void autoAdjustLight();
+    void displayRoomSchedule();
+    void drawScheduleLabel();
+    void drawScheduleHours();
+    void handleRoomSchedule();
+    uint8_t scheduledLevel(int hour) const;
+    void setScheduledLevel(int hour, uint8_t level);
+    void checkSchedule();
+    void deactivateSchedule();
+    void resetRoomOverride();
+    void detectRoomMotion();
+    void registerMotion(unsigned long time);
+    void handleInactivity();
+    void anticipateOccupancy();
+    void setTarget(float temp);
+    void setComfort(float temp);
+    void enterSetback();
+    void restoreComfort();
+    bool shouldUpdate();
+};
+
+// Only the menu on screen reads the buttons, and every menu suppresses
+// these on entry, so all rooms and the scene menu share them: left/right
+// steps and the schedule button's store
+extern INSTANCE_STATE ButtonRepeat adjustRepeat;
+extern INSTANCE_STATE ButtonRepeat storeRepeat;
+
+// ---- src/include/Telemetry.h ----
+class Telemetry {
+private:
+    // Room for one frame of the largest size; the UART's own 64-byte
+    // buffer holds the one before it
+    static const int TX_BUFFER_SIZE = TELEMETRY_MAX_FRAME + 4;
+    static const unsigned long FRAME_INTERVAL = 1000;
+    static const uint8_t KEY_FRAME_INTERVAL = 16;
+
+    static_assert(TX_BUFFER_SIZE - 1 >= TELEMETRY_MAX_FRAME + 2, "an empty TX buffer must take the largest frame");
+
+    uint8_t txBuffer[TX_BUFFER_SIZE];
+    uint8_t txHead;
+    uint8_t txTail;
+    // Frame being encoded into txBuffer: next byte, its COBS code byte's
+    // slot, the code so far and the running CRC
+    uint8_t frameHead;
+    uint8_t codeAt;
+    uint8_t code;
+    uint8_t crc;
+    int32_t lastValues[TELEMETRY_MAX_FIELDS];
+    uint8_t seq;
+    uint8_t framesSinceKey;
+    unsigned long lastFrameTime;
+    unsigned int droppedFrames;
+
+    static uint8_t next(uint8_t index);
+    bool beginFrame(uint8_t type, size_t len);
+    void put(uint8_t data);
+    void putField(uint32_t value);
+    void encode(uint8_t data);
+    void endFrame();
+
+public:
+    Telemetry();
+
+    void sample(RoomControl* const rooms[], int roomCount);
+    bool sendText(const char* text);
+    bool sendText_P(PGM_P text);
+    bool sendTrace(const uint8_t* body, size_t len);
+    void pump();
+    int txFree() const;
+    unsigned int dropped() const;
+};
+
+extern INSTANCE_STATE Telemetry telemetry;
+
+// ---- src/include/CommandInterface.h ----
+// Line based command protocol read from Serial. Replies are sent as
+// telemetry TEXT frames so they share the framed output stream.
+//
+//   GET|SET <room> SCHED [24 digits 0-4]
+//   GET|SET <room> TARGET [10.0-30.0]
+//   GET|SET <room> LIGHT [0-4]
+//   GET <room> STATS
+//   GET|SET TIME [offset minutes]
+//   GET HEALTH
+//   GET BUS
+//   GET POWER
+//   GET MEM
+//   GET|SET TRACE [0|1]
+//   GET|SET LAT [0|1]
+//   GET LAT BUTTON|MOTION|COMMAND
+//   GET|SET|SAVE SCENE [name]
+//   DUMP (ends with DUMP <rooms>)
+class CommandInterface {
+public:
+    // Room fields that GET and SET take by name
+    enum RoomSetting { SETTING_SCHED, SETTING_TARGET, SETTING_LIGHT, SETTING_COUNT };
+
+private:
+    static const int LINE_SIZE = 40;
+    // Worst case encoded size of a single reply frame: the longest frame
+    // plus its COBS overhead byte and the delimiter
+    static const int REPLY_RESERVE = TELEMETRY_MAX_FRAME + 2;
+
+    char line[LINE_SIZE];
+    uint8_t lineLength;
+    bool overflow;
+    bool lineReady;
+    // When the line's newline arrived, the start of its latency
+    unsigned long lineTime;
+    int8_t dumpStep;
+
+    void execute(RoomControl* const rooms[], int roomCount);
+    void handleRoomCommand(bool set, RoomControl& room, int index, char* field, char* value);
+    void handleTimeCommand(bool set, char* value);
+    void handleTraceCommand(bool set, char* value);
+    void handleLatencyCommand(bool set, char* value);
+    void handleSceneCommand(bool set, bool save, char* name, RoomControl* const rooms[], int roomCount);
+    bool replyRoom(const RoomControl& room, int index, RoomSetting setting);
+    bool replyState(const RoomControl& room, int index);
+    bool replyStats(const RoomControl& room, int index);
+    bool replyTime();
+    void continueDump(RoomControl* const rooms[], int roomCount);
+
+public:
+    CommandInterface();
+
+    void poll(RoomControl* const rooms[], int roomCount);
+};
+
+extern INSTANCE_STATE CommandInterface commands;
+
+// ---- src/include/Watchdog.h ----
+// Scheduler phases of loop(), in the order they run
+enum LoopPhase {
+    PHASE_SETUP,
+    // Pin sampling and the power gate, on every pass including idle ones
+    PHASE_WAKE,
+    PHASE_INPUT,
+    PHASE_COMMANDS,
+    PHASE_ROOMS,
+    PHASE_MENU,
+    PHASE_CLOCK,
+    PHASE_BUS,
+    PHASE_TELEMETRY,
+    PHASE_COUNT
+};
+
+enum ResetCause {
+    RESET_POWER_ON,
+    RESET_EXTERNAL,
+    RESET_BROWN_OUT,
+    RESET_WATCHDOG,
+    RESET_UNKNOWN
+};
+
+// Survives a reset (.noinit on the board) so the next boot can tell where
+// the previous run stopped.
+struct CrashRecord {
+    uint16_t magic;
+    uint8_t phase;
+    uint8_t hungPhase;
+    uint32_t loops;
+};
+
+// Hardware watchdog fed once per loop. It first raises an interrupt that
+// records the phase that hung and resets on the second timeout. Each phase
+// also has a soft deadline; overruns are only counted.
+class Watchdog {
+public:
+    Watchdog();
+
+    void begin();
+    void enter(LoopPhase phase);
+    void heartbeat();
+    bool reportBoot();
+    bool reportHealth();
+
+private:
+    ResetCause cause;
+    CrashRecord previous;
+    unsigned long phaseStart;
+    bool timing;
+    uint16_t overruns;
+    uint8_t worstPhase;
+    uint16_t worstMs;
+
+    void endPhase(unsigned long now);
+};
+
+extern INSTANCE_STATE CrashRecord crashRecord;
+extern INSTANCE_STATE Watchdog watchdog;
+
+// ---- src/include/I2CBus.h ----
+// Queued I2C writes. Callers never wait on the bus: write() only queues, and
+// service() runs queued transactions from the main loop within a small time
+// budget. A queued write to the same device register is replaced rather than
+// queued again, so the latest relay or digit state always wins. Every device
+// runs at its own clock and gets its own error and latency counters.
+class I2CBus {
+public:
+    static const uint32_t STANDARD_MODE = 100000;
+    static const uint32_t FAST_MODE = 400000;
+    // The longest write is a clock digit: register and two segment bytes
+    static const int MAX_DATA = 3;
+
+    struct DeviceStats {
+        uint8_t address;
+        uint8_t lastError;
+        uint16_t transactions;
+        uint16_t errors;
+        uint16_t timeouts;
+        // Saturates at 65535
+        uint16_t worstMicros;
+        uint32_t clock;
+    };
+
+    I2CBus();
+
+    void begin();
+    void addDevice(uint8_t address, uint32_t clock);
+    void write(uint8_t address, const uint8_t* data, uint8_t length);
+    void service();
+    void flush();
+    bool report();
+    uint16_t errors(uint8_t address);
+    // Whether a write to the device is still waiting in the queue
+    bool queued(uint8_t address) const;
+
+private:
+    // A full clock refresh (five positions) plus the relay byte
+    static const int QUEUE_SIZE = 6;
+    static const int MAX_DEVICES = 2;
+    static const uint8_t MAX_ATTEMPTS = 3;
+    // Longest a single transaction may hold the bus before Wire gives up
+    static const uint32_t TIMEOUT_US = 3000;
+    static const unsigned long SERVICE_BUDGET_US = 1000;
+    static const uint8_t ERROR_TIMEOUT = 5;
+
+    struct Transaction {
+        uint8_t address;
+        uint8_t length;
+        uint8_t attempts;
+        unsigned long queuedAt;
+        uint8_t data[MAX_DATA];
+    };
+
+    Transaction queue[QUEUE_SIZE];
+    uint8_t head;
+    uint8_t count;
+    uint16_t stalls;
+    uint32_t clock;
+    DeviceStats devices[MAX_DEVICES];
+    uint8_t deviceCount;
+
+    DeviceStats* device(uint8_t address);
+    bool transmit(Transaction& transaction);
+    void runNext();
+};
+
+extern INSTANCE_STATE I2CBus i2cBus;
+
+// ---- src/include/PowerManager.h ----
+// Runs loop() work only once per tick or when an input changed, and idles
+// the CPU in between. On the board a pin-change interrupt on any wake pin,
+// the UART or the millis timer ends the sleep, so the CPU wakes at least
+// once a millisecond; host builds poll the wake pins instead. Counts the
+// passes that did work, not sleep exits. Also dims the displays while
+// nobody is home.
+class PowerManager {
+public:
+    static const unsigned long TICK_MS = 50;
+
+    PowerManager();
+
+    void addWakePin(uint8_t pin);
+    bool wait();
+    void done();
+    void updateDisplays(RoomControl* const rooms[], int roomCount, bool input);
+    bool report();
+    uint32_t passes() const;
+
+private:
+    static const int MAX_WAKE_PINS = 6;
+    static const unsigned long DISPLAY_TIMEOUT_MS = 30000;
+    static const uint8_t BRIGHT = 15;
+    static const uint8_t DIM = 1;
+
+    unsigned long lastTick;
+    unsigned long lastInput;
+    unsigned long workStart;
+    unsigned long idleStart;
+    uint32_t awakeMicros;
+    uint32_t totalMicros;
+    uint32_t tickPasses;
+    uint32_t inputPasses;
+    bool sleeping;
+    bool displaysOn;
+#ifndef __AVR__
+    uint8_t wakePins[MAX_WAKE_PINS];
+    uint8_t wakeLevels[MAX_WAKE_PINS];
+    uint8_t wakePinCount;
+#endif
+
+    bool inputChanged();
+    void account(unsigned long from, unsigned long to, bool awake);
+};
+
+extern INSTANCE_STATE PowerManager power;
+
+// ---- src/include/diagnostics.h ----
+// Optional diagnostics. Host builds always have them. Board builds leave
+// them out to save SRAM unless they are defined here or with -D.
+#ifndef __AVR__
+#ifndef INPUT_TRACE
+#define INPUT_TRACE
+#endif
+#ifndef LATENCY_TRACE
+#define LATENCY_TRACE
+#endif
+#endif
+
+// ---- src/include/InputTrace.h ----
+// Records every change of the buttons, PIR sensors and analog inputs, and
+// every executed Serial command, as TRACE frames on the telemetry stream so
+// a session can be replayed on the host (host/trace_replay.cpp). The pins
+// are sampled on every pass, since the PIR and wake-up logic reads them
+// even while the loop is idle; the analog inputs only on passes that do
+// work, which is when the firmware reads them too. Records are batched and
+// sent at least every FLUSH_MS.
+#ifdef INPUT_TRACE
+class InputTrace {
+public:
+    InputTrace();
+
+    void start();
+    void stop();
+    bool active() const;
+    void samplePins();
+    void sample();
+    void command(const char* line);
+    void service();
+    unsigned int lost() const;
+
+private:
+    static const uint8_t MAX_BODY = TELEMETRY_MAX_FRAME - 3;
+    static const uint8_t MAX_INPUT_RECORD = 5 + 2 + TRACE_ANALOG_COUNT * 2;
+    static const unsigned long FLUSH_MS = 250;
+
+    bool recording;
+    // Set when records were lost; the next one is then a START record
+    bool resync;
+    uint8_t levels;
+    int16_t values[TRACE_ANALOG_COUNT];
+    unsigned long lastRecord;
+    unsigned long firstPending;
+    uint8_t body[MAX_BODY];
+    uint8_t length;
+    uint16_t lostFrames;
+
+    void appendInputs(unsigned long now, bool readAnalog);
+    void flush();
+};
+#else
+// Left out of the build: SET TRACE 1 has no effect and GET TRACE reads 0 0
+class InputTrace {
+public:
+    void start() {}
+    void stop() {}
+    bool active() const { return false; }
+    void samplePins() {}
+    void sample() {}
+    void command(const char*) {}
+    void service() {}
+    unsigned int lost() const { return 0; }
+};
+#endif
+
+extern INSTANCE_STATE InputTrace inputTrace;
+
+// ---- src/include/MemoryMonitor.h ----
+// Tracks how much of the 2 KB SRAM is in use. The free RAM between the
+// heap and the stack is painted with a known byte before the C runtime
+// starts; the stack's high-water mark is the lowest painted byte that has
+// since been overwritten. scan() only walks the still untouched gap, so it
+// gets cheaper as the margin shrinks. Host builds have no SRAM layout to
+// inspect and report zeros.
+class MemoryMonitor {
+public:
+    static const unsigned long SCAN_MS = 1000;
+
+    MemoryMonitor();
+
+    bool service();
+    bool scan();
+    bool report();
+
+    // Bytes of .data, .bss and .noinit, fixed at link time
+    uint16_t staticBytes() const;
+    uint16_t heapBytes() const;
+    // Deepest the stack has been since reset
+    uint16_t stackPeak() const;
+    uint16_t freeNow() const;
+    // Smallest gap between heap and stack seen by any scan
+    uint16_t minFree() const;
+
+private:
+    unsigned long lastScan;
+    uint16_t heap;
+    uint16_t peak;
+    uint16_t current;
+    uint16_t lowest;
+};
+
+extern INSTANCE_STATE MemoryMonitor memoryMonitor;
+
+// ---- src/include/SceneLibrary.h ----
+const uint8_t SCENE_KEEP = 0xFF;
+const int SCENE_MAX_ROOMS = 4;
+const int SCENE_NAME_SIZE = 8;
+
+// One room's part of a scene; SCENE_KEEP leaves a setting as it is
+struct RoomScene {
+    uint8_t light;
+    // Half degrees, 20-60 for 10-30 C
+    uint8_t target;
+    uint8_t scheduleEnabled;
+};
+
+struct Scene {
+    char name[SCENE_NAME_SIZE];
+    RoomScene rooms[SCENE_MAX_ROOMS];
+};
+
+// Named house states: a few built into flash and a few saved by the user
+// into EEPROM. Applying one first changes the settings of every room and
+// then commits the actuators in one batch, a single strip.show() and a
+// single expander write, so the house never shows a half applied scene.
+class SceneLibrary {
+public:
+    static const uint8_t BUILT_IN = 3;
+    static const uint8_t USER_SLOTS = 3;
+    static const uint8_t COUNT = BUILT_IN + USER_SLOTS;
+    static const int8_t NONE = -1;
+
+    SceneLibrary();
+
+    bool load(uint8_t index, Scene& scene) const;
+    int8_t find(const char* name) const;
+    int8_t next(int8_t from, int8_t direction) const;
+    bool apply(uint8_t index, RoomControl* const rooms[], int roomCount);
+    int8_t save(const char* name, const RoomControl* const rooms[], int roomCount);
+    int8_t lastApplied() const;
+    bool report();
+
+private:
+    // Marks a written user slot; anything else reads as empty
+    static const uint8_t SLOT_MAGIC = 0x5C;
+    static const int EEPROM_BASE = 0;
+    static const int SLOT_SIZE = 1 + sizeof(Scene);
+
+    int8_t applied;
+};
+
+extern INSTANCE_STATE SceneLibrary scenes;
+
+// ---- src/include/LatencyTracker.h ----
+// Inputs whose effect is timed
+enum LatencySource {
+    LATENCY_BUTTON,
+    LATENCY_MOTION,
+    LATENCY_COMMAND,
+    LATENCY_SOURCE_COUNT
+};
+
+// Outputs an input can show up on, as bits of LatencyEvent::outputs
+const uint8_t OUTPUT_LCD = 0x01;
+const uint8_t OUTPUT_STRIP = 0x02;
+const uint8_t OUTPUT_RELAYS = 0x04;
+
+// One input and the outputs it led to. Times are ms after the input.
+struct LatencyEvent {
+    uint32_t input;
+    uint16_t first;
+    uint16_t settled;
+    uint8_t id;
+    uint8_t source;
+    uint8_t outputs;
+    // Loop passes ended since the event was opened
+    uint8_t passes;
+};
+
+// Times every button press, new PIR motion and Serial command from the
+// input to the outputs it causes. Each input gets an event ID when it is
+// opened. Outputs are reported where they reach the hardware: a finished LCD
+// draw, strip.show() and the expander write leaving the I2C queue. Every
+// output lands on all events still open. The firmware reacts to an input
+// in the pass that sees it, or in the next one after a debounce delay or
+// for PIR motion, so an event closes at the end of that next pass. It
+// settled at its last output then, or had no visible effect. Settled
+// latencies go into a histogram per source for GET LAT, and with SET LAT 1
+// every event is also sent as a text frame when it closes.
+#ifdef LATENCY_TRACE
+class LatencyTracker {
+public:
+    static const uint8_t MAX_OPEN = 4;
+    static const uint8_t BUCKETS = 12;
+
+    LatencyTracker();
+
+    uint8_t open(LatencySource source, unsigned long time);
+    void buttons(uint8_t pressed, unsigned long time);
+    void output(uint8_t kind);
+    void relaysQueued();
+    void endPass();
+    void setStreaming(bool on);
+    bool streaming() const;
+    // Events not timed because every slot was taken, or not sent in time
+    uint16_t lost() const;
+    bool report(LatencySource source);
+    // Source with the given Serial name, or -1
+    static int8_t sourceNamed(const char* name);
+
+#ifndef __AVR__
+    // Events closed so far, whether settled or without effect; the last
+    // MAX_OPEN of them can be read back with closedEvent()
+    uint32_t closedCount() const;
+    const LatencyEvent& closedEvent(uint32_t index) const;
+#endif
+    uint16_t percentile(LatencySource source, uint8_t percent) const;
+
+private:
+    LatencyEvent events[MAX_OPEN];
+    uint8_t openMask;
+    uint8_t lastId;
+    uint8_t lastButtons;
+    // Open events that were waiting on the expander write still queued
+    uint8_t relayMask;
+    bool stream;
+    uint8_t histogram[LATENCY_SOURCE_COUNT][BUCKETS];
+    uint16_t noEffect[LATENCY_SOURCE_COUNT];
+    uint16_t worst[LATENCY_SOURCE_COUNT];
+    uint16_t dropped;
+#ifndef __AVR__
+    LatencyEvent closed[MAX_OPEN];
+    uint32_t closedTotal;
+#endif
+
+    void outputTo(uint8_t slots, uint8_t kind);
+    void close(uint8_t slot, bool settled);
+    bool send(const LatencyEvent& event);
+};
+#else
+// Left out of the build: SET LAT 1 has no effect, GET LAT reads 0 0 and
+// GET LAT <source> replies ERR
+class LatencyTracker {
+public:
+    uint8_t open(LatencySource, unsigned long) { return 0; }
+    void buttons(uint8_t, unsigned long) {}
+    void output(uint8_t) {}
+    void relaysQueued() {}
+    void endPass() {}
+    void setStreaming(bool) {}
+    bool streaming() const { return false; }
+    uint16_t lost() const { return 0; }
+    bool report(LatencySource) { return false; }
+    static int8_t sourceNamed(const char*) { return -1; }
+};
+#endif
+
+extern INSTANCE_STATE LatencyTracker latency;
+
+// ---- src/impl/CommandInterface.cpp ----
+INSTANCE_STATE CommandInterface commands;
+
+static const char ROOM_SETTING_NAMES[CommandInterface::SETTING_COUNT][7] PROGMEM = {
+    "SCHED", "TARGET", "LIGHT"
+};
+
+// Returns the length written. The sign goes separately, or -0.5 would
+// lose it to the integer part.
+static int formatTenths(char* buffer, size_t size, float value) {
+    int tenths = (int)round(value * 10);
+    return snprintf_P(buffer, size, tenths < 0 ? PSTR("-%d.%d") : PSTR("%d.%d"), abs(tenths) / 10, abs(tenths) % 10);
+}
+
+// The whole token must be a number: "1x" is rejected rather than read as 1
+static bool parseLong(const char* text, long& value) {
+    char* end;
+    value = strtol(text, &end, 10);
+    return end != text && *end == '\0';
+}
+
+static bool parseFloat(const char* text, float& value) {
+    char* end;
+    value = strtod(text, &end);
+    return end != text && *end == '\0';
+}
+
+CommandInterface::CommandInterface()
+    : lineLength(0), overflow(false), lineReady(false), lineTime(0), dumpStep(-1) {}
+
+// Consumes whatever is already in the RX buffer; never waits for more.
+// A complete line is only executed once its reply is sure to fit into the
+// TX buffer, otherwise it is kept and the rest stays queued in the UART.
+void CommandInterface::poll(RoomControl* const rooms[], int roomCount) {
+    continueDump(rooms, roomCount);
+    while (dumpStep < 0 && (lineReady || Serial.available() > 0)) {
+        if (lineReady) {
+            if (telemetry.txFree() < REPLY_RESERVE) {
+                return;
+            }
+            if (overflow) {
+                telemetry.sendText_P(PSTR("ERR too long"));
+            } else if (lineLength > 0) {
+                line[lineLength] = '\0';
+                execute(rooms, roomCount);
+            }
+            lineLength = 0;
+            overflow = false;
+            lineReady = false;
+            continueDump(rooms, roomCount);
+            continue;
+        }
+        char c = Serial.read();
+        if (c == '\r') {
+            continue;
+        }
+        if (c == '\n') {
+            lineReady = true;
+            lineTime = millis();
+        } else if (lineLength < LINE_SIZE - 1) {
+            line[lineLength++] = c;
+        } else {
+            overflow = true;
+        }
+    }
+}
+
+void CommandInterface::execute(RoomControl* const rooms[], int roomCount) {
+    inputTrace.command(line);
+    latency.open(LATENCY_COMMAND, lineTime);
+    char* command = strtok(line, " ");
+    if (command == NULL) {
+        return;
+    }
+    if (strcmp_P(command, PSTR("DUMP")) == 0) {
+        dumpStep = 0;
+        return;
+    }
+    bool set = strcmp_P(command, PSTR("SET")) == 0;
+    bool save = strcmp_P(command, PSTR("SAVE")) == 0;
+    if (!set && !save && strcmp_P(command, PSTR("GET")) != 0) {
+        telemetry.sendText_P(PSTR("ERR command"));
+        return;
+    }
+    char* target = strtok(NULL, " ");
+    if (target == NULL) {
+        telemetry.sendText_P(PSTR("ERR syntax"));
+        return;
+    }
+    if (strcmp_P(target, PSTR("SCENE")) == 0) {
+        handleSceneCommand(set, save, strtok(NULL, " "), rooms, roomCount);
+        return;
+    }
+    if (save) {
+        telemetry.sendText_P(PSTR("ERR command"));
+        return;
+    }
+    if (strcmp_P(target, PSTR("TIME")) == 0) {
+        handleTimeCommand(set, strtok(NULL, " "));
+        return;
+    }
+    if (strcmp_P(target, PSTR("HEALTH")) == 0 && !set) {
+        watchdog.reportHealth();
+        return;
+    }
+    if (strcmp_P(target, PSTR("BUS")) == 0 && !set) {
+        i2cBus.report();
+        return;
+    }
+    if (strcmp_P(target, PSTR("POWER")) == 0 && !set) {
+        power.report();
+        return;
+    }
+    if (strcmp_P(target, PSTR("MEM")) == 0 && !set) {
+        memoryMonitor.report();
+        return;
+    }
+    if (strcmp_P(target, PSTR("TRACE")) == 0) {
+        handleTraceCommand(set, strtok(NULL, " "));
+        return;
+    }
+    if (strcmp_P(target, PSTR("LAT")) == 0) {
+        handleLatencyCommand(set, strtok(NULL, " "));
+        return;
+    }
+    long index;
+    if (!parseLong(target, index) || index < 1 || index > roomCount) {
+        telemetry.sendText_P(PSTR("ERR room"));
+        return;
+    }
+    char* field = strtok(NULL, " ");
+    char* value = strtok(NULL, " ");
+    if (field == NULL || (set && value == NULL) || strtok(NULL, " ") != NULL) {
+        telemetry.sendText_P(PSTR("ERR syntax"));
+        return;
+    }
+    handleRoomCommand(set, *rooms[index - 1], index, field, value);
+}
+
+void CommandInterface::handleRoomCommand(bool set, RoomControl& room, int index, char* field, char* value) {
+    if (strcmp_P(field, PSTR("STATS")) == 0 && !set) {
+        replyStats(room, index);
+        return;
+    }
+    RoomSetting setting = SETTING_COUNT;
+    for (uint8_t i = 0; i < SETTING_COUNT; i++) {
+        if (strcmp_P(field, ROOM_SETTING_NAMES[i]) == 0) {
+            setting = (RoomSetting)i;
+        }
+    }
+    if (setting == SETTING_SCHED) {
+        if (set) {
+            if (strlen(value) != 24) {
+                telemetry.sendText_P(PSTR("ERR value"));
+                return;
+            }
+            for (int i = 0; i < 24; i++) {
+                if (value[i] < '0' || value[i] > '4') {
+                    telemetry.sendText_P(PSTR("ERR value"));
+                    return;
+                }
+            }
+            for (int i = 0; i < 24; i++) {
+                room.setScheduledLevel(i, value[i] - '0');
+            }
+            scheduleAdjusted = true;
+        }
+    } else if (setting == SETTING_TARGET) {
+        if (set) {
+            float temp;
+            if (!parseFloat(value, temp) || temp < 10 || temp > 30) {
+                telemetry.sendText_P(PSTR("ERR value"));
+                return;
+            }
+            room.setTarget(round(temp * 2) / 2.0);
+            tempAdjusted = true;
+        }
+    } else if (setting == SETTING_LIGHT) {
+        if (set) {
+            long intensity;
+            if (!parseLong(value, intensity) || intensity < 0 || intensity > 4) {
+                telemetry.sendText_P(PSTR("ERR value"));
+                return;
+            }
+            room.lightIntensity = intensity;
+            room.updateNeoPixelBrightness(true);
+            room.hourOverride = hour();
+        }
+    } else {
+        telemetry.sendText_P(PSTR("ERR field"));
+        return;
+    }
+    replyRoom(room, index, setting);
+}
+
+void CommandInterface::handleTimeCommand(bool set, char* value) {
+    if (set) {
+        long minutes;
+        if (value == NULL || !parseLong(value, minutes) || minutes < 0 || minutes >= 24 * 60) {
+            telemetry.sendText_P(PSTR("ERR value"));
+            return;
+        }
+        ADDED_TIME = (unsigned long)minutes * 60000;
+        timeAdjusted = true;
+    }
+    replyTime();
+}
+
+// SET applies the named scene, SAVE stores the rooms' settings under the
+// name; both reply like GET with the scene list
+void CommandInterface::handleSceneCommand(bool set, bool save, char* name, RoomControl* const rooms[], int roomCount) {
+    if (set || save) {
+        if (name == NULL || strlen(name) >= SCENE_NAME_SIZE) {
+            telemetry.sendText_P(PSTR("ERR value"));
+            return;
+        }
+        if (save) {
+            int8_t existing = scenes.find(name);
+            if (existing != SceneLibrary::NONE && existing < SceneLibrary::BUILT_IN) {
+                telemetry.sendText_P(PSTR("ERR value"));
+                return;
+            }
+            if (scenes.save(name, rooms, roomCount) == SceneLibrary::NONE) {
+                telemetry.sendText_P(PSTR("ERR full"));
+                return;
+            }
+        } else {
+            int8_t index = scenes.find(name);
+            if (index == SceneLibrary::NONE) {
+                telemetry.sendText_P(PSTR("ERR scene"));
+                return;
+            }
+            scenes.apply(index, rooms, roomCount);
+        }
+    }
+    scenes.report();
+}
+
+// TRACE <recording> <frames lost>
+void CommandInterface::handleTraceCommand(bool set, char* value) {
+    if (set) {
+        if (value == NULL || (strcmp_P(value, PSTR("0")) != 0 && strcmp_P(value, PSTR("1")) != 0)) {
+            telemetry.sendText_P(PSTR("ERR value"));
+            return;
+        }
+        if (value[0] == '1') {
+            inputTrace.start();
+        } else {
+            inputTrace.stop();
+        }
+    }
+    char buffer[24];
+    snprintf_P(buffer, sizeof(buffer), PSTR("TRACE %d %u"), inputTrace.active(), inputTrace.lost());
+    telemetry.sendText(buffer);
+}
+
+// SET turns the EVT frames on or off and replies LAT <streaming> <lost>;
+// GET with a source replies with that source's figures instead
+void CommandInterface::handleLatencyCommand(bool set, char* value) {
+    if (!set && value != NULL) {
+        int8_t source = LatencyTracker::sourceNamed(value);
+        if (source >= 0) {
+            latency.report((LatencySource)source);
+            return;
+        }
+        telemetry.sendText_P(PSTR("ERR value"));
+        return;
+    }
+    if (set) {
+        if (value == NULL || (strcmp_P(value, PSTR("0")) != 0 && strcmp_P(value, PSTR("1")) != 0)) {
+            telemetry.sendText_P(PSTR("ERR value"));
+            return;
+        }
+        latency.setStreaming(value[0] == '1');
+    }
+    char buffer[24];
+    snprintf_P(buffer, sizeof(buffer), PSTR("LAT %d %u"), latency.streaming(), latency.lost());
+    telemetry.sendText(buffer);
+}
+
+bool CommandInterface::replyRoom(const RoomControl& room, int index, RoomSetting setting) {
+    char buffer[40];
+    int length = snprintf_P(buffer, sizeof(buffer), PSTR("%d "), index);
+    strcpy_P(buffer + length, ROOM_SETTING_NAMES[setting]);
+    length += strlen(buffer + length);
+    buffer[length++] = ' ';
+    if (setting == SETTING_SCHED) {
+        for (int i = 0; i < 24; i++) {
+            buffer[length++] = '0' + room.scheduledLevel(i);
+        }
+        buffer[length] = '\0';
+    } else if (setting == SETTING_TARGET) {
+        formatTenths(buffer + length, sizeof(buffer) - length, room.targetTemp);
+    } else {
+        snprintf_P(buffer + length, sizeof(buffer) - length, PSTR("%d"), room.lightIntensity);
+    }
+    return telemetry.sendText(buffer);
+}
+
+// <room> STATE <temp> <target> <light> <ac> <present> <inactive> <schedule> <auto light>
+bool CommandInterface::replyState(const RoomControl& room, int index) {
+    char buffer[TELEMETRY_MAX_FRAME];
+    int length = snprintf_P(buffer, sizeof(buffer), PSTR("%d STATE "), index);
+    length += formatTenths(buffer + length, sizeof(buffer) - length, room.currentTemp);
+    buffer[length++] = ' ';
+    length += formatTenths(buffer + length, sizeof(buffer) - length, room.targetTemp);
+    snprintf_P(buffer + length, sizeof(buffer) - length, PSTR(" %d %d %d %d %d %d"),
+        room.lightIntensity, room.acState, room.peoplePresent, room.inactive,
+        room.scheduleActive, room.autoLightEnabled);
+    return telemetry.sendText(buffer);
+}
+
+// <room> STATS <heating s> <cooling s> <off s> <ac switches> <lit-pixel s> <light switches>
+bool CommandInterface::replyStats(const RoomControl& room, int index) {
+    char buffer[TELEMETRY_MAX_FRAME];
+    unsigned long now = millis();
+    const EnergyStats& energy = room.energy;
+    snprintf_P(buffer, sizeof(buffer), PSTR("%d STATS %lu %lu %lu %u %lu %u"), index,
+        (unsigned long)(energy.acTime(now, HEATING) >> EnergyStats::FRACTION_BITS),
+        (unsigned long)(energy.acTime(now, COOLING) >> EnergyStats::FRACTION_BITS),
+        (unsigned long)(energy.acTime(now, OFF) >> EnergyStats::FRACTION_BITS),
+        energy.acSwitches(),
+        (unsigned long)(energy.lightTime(now) >> EnergyStats::FRACTION_BITS),
+        energy.lightSwitches());
+    return telemetry.sendText(buffer);
+}
+
+bool CommandInterface::replyTime() {
+    char buffer[32];
+    snprintf_P(buffer, sizeof(buffer), PSTR("TIME %lu %02d:%02d"), ADDED_TIME / 60000, hour(), minute());
+    return telemetry.sendText(buffer);
+}
+
+// DUMP is spread over several loops: each line is only sent once the
+// previous one fitted into the TX buffer. Each room takes three lines, and
+// a last DUMP <rooms> line marks the end.
+void CommandInterface::continueDump(RoomControl* const rooms[], int roomCount) {
+    while (dumpStep >= 0 && telemetry.txFree() >= REPLY_RESERVE) {
+        bool sent;
+        if (dumpStep == 0) {
+            sent = replyTime();
+        } else {
+            int index = (dumpStep - 1) / 3;
+            if (index >= roomCount) {
+                char buffer[17];
+                snprintf_P(buffer, sizeof(buffer), PSTR("DUMP %d"), roomCount);
+                if (telemetry.sendText(buffer)) {
+                    dumpStep = -1;
+                }
+                return;
+            }
+            switch ((dumpStep - 1) % 3) {
+            case 0:
+                sent = replyState(*rooms[index], index + 1);
+                break;
+            case 1:
+                sent = replyRoom(*rooms[index], index + 1, SETTING_SCHED);
+                break;
+            default:
+                sent = replyStats(*rooms[index], index + 1);
+                break;
+            }
+        }
+        if (!sent) {
+            return;
+        }
+        dumpStep++;
+    }
+}
+
+// ---- src/impl/DaylightHarvester.cpp ----
+// Wanted light in 1/64 levels at ambient readings 0, 64, ..., 1024. Full
+// light in the dark, falling off between dusk (~350) and daylight (~700).
+static const uint16_t DAYLIGHT_CURVE[17] PROGMEM = {
+    256, 256, 256, 256, 256, 256, 192, 150, 108, 66, 24, 0, 0, 0, 0, 0, 0
+};
+
+DaylightHarvester::DaylightHarvester() : started(false), current(0), filtered(0), lastUpdate(0) {
+}
+
+// Linear interpolation between the two nearest curve points
+int DaylightHarvester::demand(int ambient) {
+    ambient = constrain(ambient, 0, 1023);
+    uint8_t index = ambient >> 6;
+    uint8_t fraction = ambient & 63;
+    int low = pgm_read_word(&DAYLIGHT_CURVE[index]);
+    int high = pgm_read_word(&DAYLIGHT_CURVE[index + 1]);
+    return low + ((high - low) * fraction) / 64;
+}
+
+bool DaylightHarvester::due(unsigned long now) const {
+    return !started || now - lastUpdate >= UPDATE_MS;
+}
+
+// Returns true if the level changed. The first update takes the nearest
+// level straight away, so the lights are right from boot.
+bool DaylightHarvester::update(unsigned long now, int reading, int16_t gain, int16_t offset) {
+    if (!due(now)) {
+        return false;
+    }
+    lastUpdate = now;
+    long ambient = constrain((long)reading * gain / UNITY_GAIN + offset, 0L, 1023L);
+    if (!started) {
+        started = true;
+        filtered = ambient << FILTER_SHIFT;
+        current = (demand(ambient) + STEP / 2) / STEP;
+        return true;
+    }
+    filtered += ambient - (filtered >> FILTER_SHIFT);
+    int wanted = demand(filtered >> FILTER_SHIFT);
+    uint8_t next = current;
+    if (current < MAX_LEVEL && wanted >= current * STEP + STEP / 2 + BRIGHTEN_MARGIN) {
+        next++;
+    } else if (current > 0 && wanted <= current * STEP - STEP / 2 - DIM_MARGIN) {
+        next--;
+    }
+    if (next == current) {
+        return false;
+    }
+    current = next;
+    return true;
+}
+
+int DaylightHarvester::level() const {
+    return current;
+}
+
+// ---- src/impl/EnergyStats.cpp ----
+EnergyStats::EnergyStats()
+    : pixelTotal(0), acChanges(0), lightChanges(0), acState(OFF), pixels(0), acSince(0), lightSince(0) {
+    memset(acTotals, 0, sizeof(acTotals));
+}
+
+// Milliseconds to 24.8 seconds without a 64-bit intermediate
+uint32_t EnergyStats::toFixed(unsigned long ms) {
+    return ((uint32_t)(ms / 1000) << FRACTION_BITS) + ((ms % 1000) << FRACTION_BITS) / 1000;
+}
+
+void EnergyStats::setAC(unsigned long now, ACState state) {
+    if (state == acState) {
+        return;
+    }
+    acTotals[acState] += toFixed(now - acSince);
+    acSince = now;
+    acState = state;
+    acChanges++;
+}
+
+void EnergyStats::setLight(unsigned long now, uint8_t lit) {
+    if (lit == pixels) {
+        return;
+    }
+    pixelTotal += toFixed(now - lightSince) * pixels;
+    lightSince = now;
+    pixels = lit;
+    lightChanges++;
+}
+
+// Totals include the interval still running
+uint32_t EnergyStats::acTime(unsigned long now, ACState state) const {
+    uint32_t total = acTotals[state];
+    if (state == acState) {
+        total += toFixed(now - acSince);
+    }
+    return total;
+}
+
+uint32_t EnergyStats::lightTime(unsigned long now) const {
+    return pixelTotal + toFixed(now - lightSince) * pixels;
+}
+
+uint16_t EnergyStats::acSwitches() const {
+    return acChanges;
+}
+
+uint16_t EnergyStats::lightSwitches() const {
+    return lightChanges;
+}
+
+// ---- src/impl/I2CBus.cpp ----
+INSTANCE_STATE I2CBus i2cBus;
+
+I2CBus::I2CBus() : head(0), count(0), stalls(0), clock(0), deviceCount(0) {}
+
+void I2CBus::begin() {
+#ifdef WIRE_HAS_TIMEOUT
+    Wire.setWireTimeout(TIMEOUT_US, true);
+#endif
+}
+
+// Devices not registered here share the standard mode clock and no counters
+void I2CBus::addDevice(uint8_t address, uint32_t deviceClock) {
+    if (deviceCount < MAX_DEVICES) {
+        DeviceStats& stats = devices[deviceCount++];
+        memset(&stats, 0, sizeof(stats));
+        stats.address = address;
+        stats.clock = deviceClock;
+    }
+}
+
+I2CBus::DeviceStats* I2CBus::device(uint8_t address) {
+    for (int i = 0; i < deviceCount; i++) {
+        if (devices[i].address == address) {
+            return &devices[i];
+        }
+    }
+    return NULL;
+}
+
+void I2CBus::write(uint8_t address, const uint8_t* data, uint8_t length) {
+    if (length > MAX_DATA) {
+        length = MAX_DATA;
+    }
+    for (int i = 0; i < count; i++) {
+        Transaction& queued = queue[(head + i) % QUEUE_SIZE];
+        bool sameRegister = queued.address == address && queued.length == length && (length == 1 || queued.data[0] == data[0]);
+        // The head may be mid-retry; leave it alone
+        if (sameRegister && (i > 0 || queued.attempts == 0)) {
+            memcpy(queued.data, data, length);
+            return;
+        }
+    }
+    if (count == QUEUE_SIZE) {
+        stalls++;
+        while (count == QUEUE_SIZE) {
+            runNext();
+        }
+    }
+    Transaction& transaction = queue[(head + count) % QUEUE_SIZE];
+    transaction.address = address;
+    transaction.length = length;
+    transaction.attempts = 0;
+    transaction.queuedAt = micros();
+    memcpy(transaction.data, data, length);
+    count++;
+}
+
+bool I2CBus::transmit(Transaction& transaction) {
+    DeviceStats* stats = device(transaction.address);
+    uint32_t wanted = stats ? stats->clock : STANDARD_MODE;
+    if (wanted != clock) {
+        Wire.setClock(wanted);
+        clock = wanted;
+    }
+    Wire.beginTransmission(transaction.address);
+    Wire.write(transaction.data, transaction.length);
+    uint8_t result = Wire.endTransmission();
+    transaction.attempts++;
+    if (stats == NULL) {
+        return result == 0;
+    }
+    stats->transactions++;
+    if (result != 0) {
+        stats->errors++;
+        stats->lastError = result;
+        if (result == ERROR_TIMEOUT) {
+            stats->timeouts++;
+        }
+#ifdef WIRE_HAS_TIMEOUT
+        Wire.clearWireTimeoutFlag();
+#endif
+        return false;
+    }
+    // A write can wait behind delay() calls for far longer than 16 bits of us
+    unsigned long latency = micros() - transaction.queuedAt;
+    if (latency > stats->worstMicros) {
+        stats->worstMicros = latency > 0xFFFF ? 0xFFFF : latency;
+    }
+    return true;
+}
+
+// Sends the head of the queue; a failed write stays queued for a retry on
+// the next call until it runs out of attempts.
+void I2CBus::runNext() {
+    Transaction& transaction = queue[head];
+    if (transmit(transaction) || transaction.attempts >= MAX_ATTEMPTS) {
+        head = (head + 1) % QUEUE_SIZE;
+        count--;
+    }
+}
+
+void I2CBus::service() {
+    unsigned long start = micros();
+    while (count > 0 && micros() - start < SERVICE_BUDGET_US) {
+        uint8_t before = count;
+        runNext();
+        if (count == before) {
+            return;
+        }
+    }
+}
+
+// Blocks until everything queued has been sent or given up on
+void I2CBus::flush() {
+    while (count > 0) {
+        runNext();
+    }
+}
+
+uint16_t I2CBus::errors(uint8_t address) {
+    DeviceStats* stats = device(address);
+    return stats ? stats->errors : 0;
+}
+
+bool I2CBus::queued(uint8_t address) const {
+    for (int i = 0; i < count; i++) {
+        if (queue[(head + i) % QUEUE_SIZE].address == address) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// BUS <stalls> then <address> <transactions> <errors> <timeouts> <worst us> per device
+bool I2CBus::report() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    int length = snprintf_P(buffer, sizeof(buffer), PSTR("BUS %u"), stalls);
+    for (int i = 0; i < deviceCount && length < (int)sizeof(buffer); i++) {
+        const DeviceStats& stats = devices[i];
+        length += snprintf_P(buffer + length, sizeof(buffer) - length, PSTR(" %02X %u %u %u %u"), stats.address,
+            stats.transactions, stats.errors, stats.timeouts, stats.worstMicros);
+    }
+    return telemetry.sendText(buffer);
+}
+
+// ---- src/impl/InputTrace.cpp ----
+INSTANCE_STATE InputTrace inputTrace;
+
+#ifdef INPUT_TRACE
+static const uint8_t DIGITAL_PINS[TRACE_PIN_COUNT] = {
+    LEFT_BUTTON_PIN, RIGHT_BUTTON_PIN, BACK_BUTTON_PIN, SCHEDULE_BUTTON_PIN, ROOM1_PIR_PIN, ROOM2_PIR_PIN
+};
+static const uint8_t ANALOG_PINS[TRACE_ANALOG_COUNT] = {
+    TIME_WHEEL_PIN, PHOTO_RESISTOR_PIN, ROOM1_TEMP_SENSOR_PIN, ROOM2_TEMP_SENSOR_PIN
+};
+
+InputTrace::InputTrace()
+    : recording(false), resync(true), levels(0), lastRecord(0), firstPending(0), length(0), lostFrames(0) {
+    memset(values, 0, sizeof(values));
+}
+
+void InputTrace::start() {
+    if (recording) {
+        return;
+    }
+    recording = true;
+    resync = true;
+    length = 0;
+    appendInputs(millis(), true);
+    flush();
+}
+
+void InputTrace::stop() {
+    if (recording) {
+        flush();
+        recording = false;
+    }
+}
+
+bool InputTrace::active() const {
+    return recording;
+}
+
+void InputTrace::samplePins() {
+    if (recording) {
+        appendInputs(millis(), false);
+    }
+}
+
+void InputTrace::sample() {
+    if (recording) {
+        appendInputs(millis(), true);
+    }
+}
+
+// Appends an INPUT record if anything changed since the last one, or a
+// START record with the full state if the trace has to be resynchronised
+void InputTrace::appendInputs(unsigned long now, bool readAnalog) {
+    if (length + MAX_INPUT_RECORD > MAX_BODY) {
+        flush();
+    }
+    uint8_t currentLevels = 0;
+    for (uint8_t i = 0; i < TRACE_PIN_COUNT; i++) {
+        if (digitalRead(DIGITAL_PINS[i])) {
+            currentLevels |= 1 << i;
+        }
+    }
+    int16_t current[TRACE_ANALOG_COUNT];
+    uint8_t mask = 0;
+    for (uint8_t i = 0; i < TRACE_ANALOG_COUNT; i++) {
+        current[i] = (readAnalog || resync) ? analogRead(ANALOG_PINS[i]) : values[i];
+        if (current[i] != values[i]) {
+            mask |= 1 << i;
+        }
+    }
+    if (!resync && mask == 0 && currentLevels == levels) {
+        return;
+    }
+    if (length == 0) {
+        firstPending = now;
+    }
+    if (resync) {
+        length += putVarint(&body[length], now);
+        body[length++] = TRACE_START | currentLevels;
+        mask = (1 << TRACE_ANALOG_COUNT) - 1;
+        memset(values, 0, sizeof(values));
+    } else {
+        length += putVarint(&body[length], now - lastRecord);
+        body[length++] = TRACE_INPUT | currentLevels;
+    }
+    body[length++] = mask;
+    for (uint8_t i = 0; i < TRACE_ANALOG_COUNT; i++) {
+        if (mask & (1 << i)) {
+            length += putVarint(&body[length], zigzagEncode(current[i] - values[i]));
+            values[i] = current[i];
+        }
+    }
+    levels = currentLevels;
+    lastRecord = now;
+    resync = false;
+}
+
+// Records a Serial command line just before it is executed
+void InputTrace::command(const char* line) {
+    if (!recording) {
+        return;
+    }
+    uint8_t size = min(strlen(line), (size_t)(MAX_BODY - MAX_INPUT_RECORD - 7));
+    if (length + MAX_INPUT_RECORD + 7 + size > MAX_BODY) {
+        flush();
+    }
+    unsigned long now = millis();
+    if (resync) {
+        appendInputs(now, true);
+    }
+    if (length == 0) {
+        firstPending = now;
+    }
+    length += putVarint(&body[length], now - lastRecord);
+    body[length++] = TRACE_COMMAND;
+    body[length++] = size;
+    memcpy(&body[length], line, size);
+    length += size;
+    lastRecord = now;
+}
+
+void InputTrace::service() {
+    if (length > 0 && millis() - firstPending >= FLUSH_MS) {
+        flush();
+    }
+}
+
+// A frame that doesn't fit into the TX buffer is dropped. Sequence numbers
+// only count queued frames, so the host can't see the loss; the next
+// record is a START instead.
+void InputTrace::flush() {
+    if (length == 0) {
+        return;
+    }
+    if (!telemetry.sendTrace(body, length)) {
+        lostFrames++;
+        resync = true;
+    }
+    length = 0;
+}
+
+unsigned int InputTrace::lost() const {
+    return lostFrames;
+}
+
+#endif
+
+// ---- src/impl/LatencyTracker.cpp ----
+INSTANCE_STATE LatencyTracker latency;
+
+#ifdef LATENCY_TRACE
+static const char LATENCY_SOURCE_NAMES[LATENCY_SOURCE_COUNT][8] PROGMEM = {
+    "BUTTON", "MOTION", "COMMAND"
+};
+// Upper bound of each histogram bucket in ms, finest around the UI's delays
+static const uint16_t LATENCY_BOUNDS[LatencyTracker::BUCKETS] PROGMEM = {
+    10, 20, 35, 50, 75, 100, 150, 200, 300, 500, 1000, 0xFFFF
+};
+
+LatencyTracker::LatencyTracker()
+    : openMask(0), lastId(0), lastButtons(0), relayMask(0), stream(false), dropped(0) {
+    memset(histogram, 0, sizeof(histogram));
+    memset(noEffect, 0, sizeof(noEffect));
+    memset(worst, 0, sizeof(worst));
+#ifndef __AVR__
+    closedTotal = 0;
+#endif
+}
+
+// Returns the new event's ID, 0 if every slot is taken
+uint8_t LatencyTracker::open(LatencySource source, unsigned long time) {
+    for (uint8_t slot = 0; slot < MAX_OPEN; slot++) {
+        if (openMask & (1 << slot)) {
+            continue;
+        }
+        LatencyEvent& event = events[slot];
+        // IDs wrap, skipping 0
+        lastId = lastId == 0xFF ? 1 : lastId + 1;
+        event.input = time;
+        event.first = 0;
+        event.settled = 0;
+        event.id = lastId;
+        event.source = source;
+        event.outputs = 0;
+        event.passes = 0;
+        openMask |= 1 << slot;
+        return lastId;
+    }
+    if (dropped < 0xFFFF) {
+        dropped++;
+    }
+    return 0;
+}
+
+// Button levels of an awake pass; a press of any button opens an event
+void LatencyTracker::buttons(uint8_t pressed, unsigned long time) {
+    if (pressed & ~lastButtons) {
+        open(LATENCY_BUTTON, time);
+    }
+    lastButtons = pressed;
+}
+
+void LatencyTracker::output(uint8_t kind) {
+    outputTo(openMask, kind);
+}
+
+void LatencyTracker::outputTo(uint8_t slots, uint8_t kind) {
+    if (slots == 0) {
+        return;
+    }
+    unsigned long now = millis();
+    for (uint8_t slot = 0; slot < MAX_OPEN; slot++) {
+        if (!(slots & (1 << slot))) {
+            continue;
+        }
+        LatencyEvent& event = events[slot];
+        unsigned long elapsed = now - event.input;
+        uint16_t ms = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+        if (event.outputs == 0) {
+            event.first = ms;
+        }
+        event.settled = ms;
+        event.outputs |= kind;
+    }
+}
+
+// The expander byte went into the I2C queue; it counts as output of the
+// events open now once it is sent
+void LatencyTracker::relaysQueued() {
+    relayMask |= openMask;
+}
+
+// End of an awake loop pass, after the I2C queue was serviced
+void LatencyTracker::endPass() {
+    if (relayMask != 0 && !i2cBus.queued(EXPANDER_ADDRESS)) {
+        outputTo(relayMask & openMask, OUTPUT_RELAYS);
+        relayMask = 0;
+    }
+    for (uint8_t slot = 0; slot < MAX_OPEN; slot++) {
+        if (!(openMask & (1 << slot))) {
+            continue;
+        }
+        LatencyEvent& event = events[slot];
+        if (++event.passes >= 2) {
+            close(slot, event.outputs != 0);
+        }
+    }
+}
+
+void LatencyTracker::close(uint8_t slot, bool settled) {
+    LatencyEvent& event = events[slot];
+    openMask &= ~(1 << slot);
+    relayMask &= ~(1 << slot);
+    if (settled) {
+        uint8_t* counts = histogram[event.source];
+        uint8_t bucket = 0;
+        while (event.settled > pgm_read_word(&LATENCY_BOUNDS[bucket])) {
+            bucket++;
+        }
+        // Halving keeps the shape of the distribution when a count is full
+        if (counts[bucket] == 0xFF) {
+            for (uint8_t i = 0; i < BUCKETS; i++) {
+                counts[i] /= 2;
+            }
+        }
+        counts[bucket]++;
+        if (event.settled > worst[event.source]) {
+            worst[event.source] = event.settled;
+        }
+    } else if (noEffect[event.source] < 0xFFFF) {
+        noEffect[event.source]++;
+    }
+    // Sent right away; an event the Serial buffer has no room for is lost
+    if (stream && !send(event) && dropped < 0xFFFF) {
+        dropped++;
+    }
+#ifndef __AVR__
+    closed[closedTotal % MAX_OPEN] = event;
+    closedTotal++;
+#endif
+}
+
+void LatencyTracker::setStreaming(bool on) {
+    stream = on;
+}
+
+bool LatencyTracker::streaming() const {
+    return stream;
+}
+
+uint16_t LatencyTracker::lost() const {
+    return dropped;
+}
+
+// EVT <id> <source> <input ms> <first output ms> <settled ms> <outputs>
+// Outputs are L(CD), S(trip) and R(elays), or - for none
+bool LatencyTracker::send(const LatencyEvent& event) {
+    char buffer[TELEMETRY_MAX_FRAME];
+    char name[8];
+    char outputs[4];
+    uint8_t length = 0;
+    if (event.outputs & OUTPUT_LCD) outputs[length++] = 'L';
+    if (event.outputs & OUTPUT_STRIP) outputs[length++] = 'S';
+    if (event.outputs & OUTPUT_RELAYS) outputs[length++] = 'R';
+    if (length == 0) outputs[length++] = '-';
+    outputs[length] = '\0';
+    strcpy_P(name, LATENCY_SOURCE_NAMES[event.source]);
+    snprintf_P(buffer, sizeof(buffer), PSTR("EVT %u %s %lu %u %u %s"), event.id, name, (unsigned long)event.input,
+        event.first, event.settled, outputs);
+    return telemetry.sendText(buffer);
+}
+
+// LAT <source> <settled> <no effect> <p50 ms> <p99 ms> <max ms> <lost>
+bool LatencyTracker::report(LatencySource source) {
+    char buffer[TELEMETRY_MAX_FRAME];
+    char name[8];
+    uint32_t settled = 0;
+    for (uint8_t i = 0; i < BUCKETS; i++) {
+        settled += histogram[source][i];
+    }
+    strcpy_P(name, LATENCY_SOURCE_NAMES[source]);
+    snprintf_P(buffer, sizeof(buffer), PSTR("LAT %s %lu %u %u %u %u %u"), name, (unsigned long)settled, noEffect[source],
+        percentile(source, 50), percentile(source, 99), worst[source], dropped);
+    return telemetry.sendText(buffer);
+}
+
+int8_t LatencyTracker::sourceNamed(const char* name) {
+    for (uint8_t i = 0; i < LATENCY_SOURCE_COUNT; i++) {
+        if (strcmp_P(name, LATENCY_SOURCE_NAMES[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#ifndef __AVR__
+uint32_t LatencyTracker::closedCount() const {
+    return closedTotal;
+}
+
+const LatencyEvent& LatencyTracker::closedEvent(uint32_t index) const {
+    return closed[index % MAX_OPEN];
+}
+#endif
+
+// Upper bound of the bucket holding the percentile, capped at the maximum
+uint16_t LatencyTracker::percentile(LatencySource source, uint8_t percent) const {
+    const uint8_t* counts = histogram[source];
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < BUCKETS; i++) {
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint32_t rank = (total * percent + 99) / 100;
+    uint32_t seen = 0;
+    uint8_t bucket = 0;
+    while (bucket < BUCKETS - 1) {
+        seen += counts[bucket];
+        if (seen >= rank) {
+            break;
+        }
+        bucket++;
+    }
+    uint16_t bound = pgm_read_word(&LATENCY_BOUNDS[bucket]);
+    return bound < worst[source] ? bound : worst[source];
+}
+
+#endif
+
+// ---- src/impl/LightSegment.cpp ----
+// Warm white channel scale per level, roughly even steps to the eye
+static const uint8_t DIMMER_LEVELS[LightSegment::MAX_LEVEL + 1] PROGMEM = { 0, 24, 64, 140, 255 };
+
+LightSegment::LightSegment(uint16_t first, uint16_t length, LightStyle style)
+    : first(first), length(length), style(style), shownLevel(UNKNOWN) {
+}
+
+uint16_t LightSegment::litPixels(uint8_t level) const {
+    return (uint32_t)length * level / MAX_LEVEL;
+}
+
+uint16_t LightSegment::end() const {
+    return first + length;
+}
+
+uint32_t LightSegment::color(uint8_t level) const {
+    if (level == 0) {
+        return 0;
+    }
+    if (style == LIGHT_BAR) {
+        return Adafruit_NeoPixel::Color(0, 255, 0);
+    }
+    uint8_t scale = pgm_read_byte(&DIMMER_LEVELS[level]);
+    return Adafruit_NeoPixel::Color(scale, (uint16_t)scale * 180 / 255, (uint16_t)scale * 100 / 255);
+}
+
+// The first pixel goes through setPixelColor() for the strip's colour
+// order; the rest of the run is copied from it in doubling blocks
+void LightSegment::fill(Adafruit_NeoPixel& strip, uint32_t color, uint16_t from, uint16_t count) {
+    if (count == 0) {
+        return;
+    }
+    strip.setPixelColor(from, color);
+    uint8_t* start = strip.getPixels() + from * 3;
+    uint16_t done = 3;
+    uint16_t total = count * 3;
+    while (done < total) {
+        uint16_t block = min(done, (uint16_t)(total - done));
+        memcpy(start + done, start, block);
+        done += block;
+    }
+}
+
+// Returns true if any pixel changed
+bool LightSegment::apply(Adafruit_NeoPixel& strip, uint8_t level) {
+    if (level > MAX_LEVEL) {
+        level = MAX_LEVEL;
+    }
+    if (level == shownLevel) {
+        return false;
+    }
+    if (style == LIGHT_DIMMER || shownLevel == UNKNOWN) {
+        uint16_t lit = style == LIGHT_DIMMER ? (level ? length : 0) : litPixels(level);
+        fill(strip, color(level), first, lit);
+        fill(strip, 0, first + lit, length - lit);
+    } else {
+        uint16_t before = litPixels(shownLevel);
+        uint16_t after = litPixels(level);
+        if (after > before) {
+            fill(strip, color(level), first + before, after - before);
+        } else {
+            fill(strip, 0, first + after, before - after);
+        }
+    }
+    shownLevel = level;
+    return true;
+}
+
+void LightSegment::invalidate() {
+    shownLevel = UNKNOWN;
+}
+
+// ---- src/impl/MemoryMonitor.cpp ----
+INSTANCE_STATE MemoryMonitor memoryMonitor;
+
+#ifdef __AVR__
+static const uint8_t PAINT = 0xC5;
+
+extern uint8_t _end;
+extern uint8_t __stack;
+extern uint8_t __heap_start;
+extern char* __brkval;
+
+// Runs before the stack pointer and r1 are set up, so no C. Fills
+// everything from the end of .noinit up to RAMEND; .data and .bss are
+// initialised after this.
+void paintStack() __attribute__((naked, used, section(".init1")));
+void paintStack() {
+    __asm volatile(
+        "    ldi r30, lo8(_end)\n"
+        "    ldi r31, hi8(_end)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(__stack)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(__stack)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        "    breq 1b\n"
+        :: "i"(PAINT));
+}
+
+static uint8_t* heapEnd() {
+    return __brkval ? (uint8_t*)__brkval : &__heap_start;
+}
+#endif
+
+MemoryMonitor::MemoryMonitor() : lastScan(0), heap(0), peak(0), current(0), lowest(0xFFFF) {
+}
+
+bool MemoryMonitor::service() {
+    unsigned long now = millis();
+    if (now - lastScan < SCAN_MS) {
+        return false;
+    }
+    lastScan = now;
+    return scan();
+}
+
+// Returns true if any of the figures changed
+bool MemoryMonitor::scan() {
+#ifdef __AVR__
+    uint8_t* bottom = heapEnd();
+    // Everything above the previous mark is known to be used already
+    uint8_t* mark = &__stack + 1 - peak;
+    uint8_t* p = bottom;
+    while (p < mark && *p == PAINT) {
+        p++;
+    }
+    uint16_t newHeap = bottom - &__heap_start;
+    uint16_t newPeak = &__stack + 1 - p;
+    uint16_t newCurrent = (uint8_t*)SP - bottom;
+    uint16_t gap = p - bottom;
+    bool changed = newHeap != heap || newPeak != peak || newCurrent != current || gap < lowest;
+    heap = newHeap;
+    peak = newPeak;
+    current = newCurrent;
+    if (gap < lowest) {
+        lowest = gap;
+    }
+    return changed;
+#else
+    return false;
+#endif
+}
+
+uint16_t MemoryMonitor::staticBytes() const {
+#ifdef __AVR__
+    return &__heap_start - (uint8_t*)RAMSTART;
+#else
+    return 0;
+#endif
+}
+
+uint16_t MemoryMonitor::heapBytes() const {
+    return heap;
+}
+
+uint16_t MemoryMonitor::stackPeak() const {
+    return peak;
+}
+
+uint16_t MemoryMonitor::freeNow() const {
+    return current;
+}
+
+uint16_t MemoryMonitor::minFree() const {
+    return lowest == 0xFFFF ? 0 : lowest;
+}
+
+// MEM <static> <heap> <stack peak> <free now> <min free>
+bool MemoryMonitor::report() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    snprintf_P(buffer, sizeof(buffer), PSTR("MEM %u %u %u %u %u"), staticBytes(), heapBytes(), stackPeak(), freeNow(), minFree());
+    return telemetry.sendText(buffer);
+}
+
+// ---- src/include/MotionSensors.h ----
+struct MotionEvent {
+    uint32_t time;
+    bool rising;
+};
+
+// PIR edges captured by the pin-change interrupt, timestamped with millis()
+// and queued per sensor. Each queue has a single producer (the interrupt)
+// and a single consumer (the loop), so one-byte indices are enough to keep
+// it lock free. Host builds have no interrupts; poll() stands in for them.
+class MotionSensors {
+public:
+    MotionSensors();
+
+    uint8_t watch(uint8_t pin);
+    void capture();
+    void poll();
+    bool pop(uint8_t channel, MotionEvent& event);
+    bool active(uint8_t channel) const;
+    uint16_t overflows() const;
+
+private:
+    static const uint8_t MAX_CHANNELS = 2;
+    // PIR edges are seconds apart; each pass drains the queue
+    static const uint8_t QUEUE_SIZE = 4;
+
+    struct Channel {
+        uint8_t pin;
+        volatile bool level;
+        volatile uint8_t head;
+        volatile uint8_t tail;
+        MotionEvent events[QUEUE_SIZE];
+    };
+
+    Channel channels[MAX_CHANNELS];
+    uint8_t channelCount;
+    volatile uint16_t dropped;
+};
+
+extern INSTANCE_STATE MotionSensors motionSensors;
+
+// ---- src/impl/MotionSensors.cpp ----
+INSTANCE_STATE MotionSensors motionSensors;
+
+// Keeps the compiler from moving event accesses across the index updates
+static inline void barrier() {
+    __asm__ __volatile__("" ::: "memory");
+}
+
+MotionSensors::MotionSensors() : channelCount(0), dropped(0) {}
+
+// Registers a sensor and returns its channel. The pin-change interrupt for
+// the pin is enabled by the PowerManager.
+uint8_t MotionSensors::watch(uint8_t pin) {
+    if (channelCount >= MAX_CHANNELS) {
+        return channelCount - 1;
+    }
+    Channel& channel = channels[channelCount];
+    channel.pin = pin;
+    channel.level = digitalRead(pin);
+    channel.head = 0;
+    channel.tail = 0;
+    return channelCount++;
+}
+
+// Interrupt context: one event per sensor whose level changed
+void MotionSensors::capture() {
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < channelCount; i++) {
+        Channel& channel = channels[i];
+        bool level = digitalRead(channel.pin);
+        if (level == channel.level) {
+            continue;
+        }
+        channel.level = level;
+        uint8_t next = (channel.head + 1) % QUEUE_SIZE;
+        if (next == channel.tail) {
+            dropped++;
+            continue;
+        }
+        channel.events[channel.head].time = now;
+        channel.events[channel.head].rising = level;
+        barrier();
+        channel.head = next;
+    }
+}
+
+void MotionSensors::poll() {
+#ifndef __AVR__
+    capture();
+#endif
+}
+
+bool MotionSensors::pop(uint8_t channel, MotionEvent& event) {
+    Channel& queue = channels[channel];
+    if (queue.tail == queue.head) {
+        return false;
+    }
+    barrier();
+    event = queue.events[queue.tail];
+    queue.tail = (queue.tail + 1) % QUEUE_SIZE;
+    return true;
+}
+
+// True while the sensor output is high, i.e. motion is still going on
+bool MotionSensors::active(uint8_t channel) const {
+    return channels[channel].level;
+}
+
+uint16_t MotionSensors::overflows() const {
+    noInterrupts();
+    uint16_t count = dropped;
+    interrupts();
+    return count;
+}
+
+// ---- src/impl/OccupancyModel.cpp ----
+OccupancyModel::OccupancyModel() : currentSlot(-1), slotOccupied(false) {
+    memset(bins, 0, sizeof(bins));
+}
+
+void OccupancyModel::recordMotion(unsigned long now) {
+    update(now);
+    slotOccupied = true;
+}
+
+// Folds the slot that just ended into its bin. Slots skipped by a clock
+// adjustment were never observed and keep their old value.
+void OccupancyModel::update(unsigned long now) {
+    int8_t slot = (now / SLOT_MS) % SLOT_COUNT;
+    if (slot == currentSlot) {
+        return;
+    }
+    if (currentSlot >= 0) {
+        int target = slotOccupied ? 255 : 0;
+        int bin = bins[currentSlot];
+        bins[currentSlot] = bin + ((target - bin) >> DECAY_SHIFT);
+    }
+    currentSlot = slot;
+    slotOccupied = false;
+}
+
+uint8_t OccupancyModel::likelihood(int slot) const {
+    return bins[slot % SLOT_COUNT];
+}
+
+// Minutes until the next slot that is usually occupied, looking at most
+// maxSlots ahead; 0 if the current one is, -1 if none is
+int OccupancyModel::minutesUntilExpected(unsigned long now, int maxSlots) const {
+    if (currentSlot < 0) {
+        return -1;
+    }
+    for (int i = 0; i <= maxSlots; i++) {
+        if (likelihood(currentSlot + i) >= EXPECTED_THRESHOLD) {
+            return i == 0 ? 0 : (SLOT_MS * i - now % SLOT_MS) / 60000;
+        }
+    }
+    return -1;
+}
+
+// ---- src/impl/PowerManager.cpp ----
+#ifdef __AVR__
+#include <avr/sleep.h>
+
+static volatile bool pinChanged = false;
+
+// The PIR sensors sit on PCINT2 (D5, D6), buttons on PCINT1 and PCINT2
+ISR(PCINT0_vect) {
+    pinChanged = true;
+}
+
+ISR(PCINT1_vect) {
+    pinChanged = true;
+}
+
+ISR(PCINT2_vect) {
+    pinChanged = true;
+    motionSensors.capture();
+}
+#endif
+
+// HT16K33 dimming command, low nibble is the duty cycle
+#define HT16K33_DIMMING 0xE0
+
+INSTANCE_STATE PowerManager power;
+
+PowerManager::PowerManager()
+    : lastTick(0), lastInput(0), workStart(0), idleStart(0), awakeMicros(0), totalMicros(0),
+      tickPasses(0), inputPasses(0), sleeping(false), displaysOn(true) {
+#ifndef __AVR__
+    wakePinCount = 0;
+#endif
+}
+
+void PowerManager::addWakePin(uint8_t pin) {
+#ifdef __AVR__
+    *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+    *digitalPinToPCICR(pin) |= _BV(digitalPinToPCICRbit(pin));
+#else
+    if (wakePinCount < MAX_WAKE_PINS) {
+        wakePins[wakePinCount] = pin;
+        wakeLevels[wakePinCount] = digitalRead(pin);
+        wakePinCount++;
+    }
+#endif
+}
+
+bool PowerManager::inputChanged() {
+#ifdef __AVR__
+    noInterrupts();
+    bool changed = pinChanged;
+    pinChanged = false;
+    interrupts();
+    return changed;
+#else
+    bool changed = false;
+    for (int i = 0; i < wakePinCount; i++) {
+        uint8_t level = digitalRead(wakePins[i]);
+        if (level != wakeLevels[i]) {
+            wakeLevels[i] = level;
+            changed = true;
+        }
+    }
+    return changed;
+#endif
+}
+
+// Keeps the ratio exact while never overflowing: both halve together
+void PowerManager::account(unsigned long from, unsigned long to, bool awake) {
+    uint32_t elapsed = to - from;
+    if (totalMicros + elapsed < totalMicros) {
+        awakeMicros /= 2;
+        totalMicros /= 2;
+    }
+    totalMicros += elapsed;
+    if (awake) {
+        awakeMicros += elapsed;
+    }
+}
+
+// Called first thing in loop(). Returns true if there is work to do,
+// otherwise idles until the next interrupt and returns false.
+bool PowerManager::wait() {
+    unsigned long now = millis();
+    bool event = inputChanged() || Serial.available() > 0;
+    bool tick = now - lastTick >= TICK_MS;
+    if (!event && !tick) {
+        if (!sleeping) {
+            sleeping = true;
+            idleStart = micros();
+        }
+#ifdef __AVR__
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        sleep_mode();
+#endif
+        return false;
+    }
+    if (tick) {
+        lastTick = now;
+        tickPasses++;
+    } else {
+        inputPasses++;
+    }
+    workStart = micros();
+    if (sleeping) {
+        sleeping = false;
+        account(idleStart, workStart, false);
+    }
+    return true;
+}
+
+void PowerManager::done() {
+    unsigned long now = micros();
+    account(workStart, now, true);
+    sleeping = true;
+    idleStart = now;
+}
+
+// Clock dimmed and LCD blanked while every room is empty and nobody has
+// touched a button for a while. The LCD backlight isn't switchable on this
+// board, so blanking the text is all it can do.
+void PowerManager::updateDisplays(RoomControl* const rooms[], int roomCount, bool input) {
+    unsigned long now = millis();
+    if (input) {
+        lastInput = now;
+    }
+    bool anyonePresent = false;
+    for (int i = 0; i < roomCount; i++) {
+        anyonePresent = anyonePresent || rooms[i]->peoplePresent;
+    }
+    bool on = anyonePresent || now - lastInput < DISPLAY_TIMEOUT_MS;
+    if (on == displaysOn) {
+        return;
+    }
+    displaysOn = on;
+    uint8_t command = HT16K33_DIMMING | (on ? BRIGHT : DIM);
+    i2cBus.write(CLOCK_ADDRESS, &command, 1);
+    if (on) {
+        mainDisplay.display();
+        latency.output(OUTPUT_LCD);
+    } else {
+        mainDisplay.noDisplay();
+    }
+}
+
+// POWER <tick passes> <input passes> <awake per mille> <lost PIR edges>
+// Loop passes that did work, for tick or input
+uint32_t PowerManager::passes() const {
+    return tickPasses + inputPasses;
+}
+
+bool PowerManager::report() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    uint32_t perMille = totalMicros / 1000;
+    unsigned long duty = perMille ? awakeMicros / perMille : 1000;
+    snprintf_P(buffer, sizeof(buffer), PSTR("POWER %lu %lu %lu %u"), (unsigned long)tickPasses, (unsigned long)inputPasses, duty,
+             motionSensors.overflows());
+    return telemetry.sendText(buffer);
+}
+
+// ---- src/include/Sparkline.h ----
+// Draws the newest slots of a SensorHistory as min/max bars into the LCD
+// custom characters left free by setup() (3-7), one pixel column per slot.
+// The bitmaps are built from the history as they are uploaded; only the
+// newest character is kept to skip uploads that change nothing.
+class Sparkline {
+public:
+    static const int CHARS = 5;
+    static const int FIRST_CHAR = 3;
+    static const int COLUMNS = CHARS * 5;
+
+    Sparkline();
+
+    void invalidate();
+    void draw(const SensorHistory& history, LiquidCrystal& lcd);
+    int16_t low() const;
+    int16_t high() const;
+
+private:
+    // Smallest vertical range in tenths, so sensor noise stays flat
+    static const int16_t MIN_SPAN = 20;
+
+    uint8_t newest[8];
+    const SensorHistory* source;
+    uint16_t closedSlots;
+    int16_t scaleLow;
+    int16_t scaleHigh;
+
+    void rescale(const SensorHistory& history);
+    bool buildChar(int index, const SensorHistory& history, uint8_t* glyph) const;
+};
+
+extern INSTANCE_STATE Sparkline sparkline;
+
+// ---- src/impl/RoomControl.cpp ----
+INSTANCE_STATE ButtonRepeat adjustRepeat;
+INSTANCE_STATE ButtonRepeat storeRepeat;
+
+void RoomControl::display() {
+    isDisplayed = true;
+    stateStack.push(ROOM_MENU);
+}
+
+void RoomControl::init() {
+    pinMode(config.pirPin, INPUT);
+    motionChannel = motionSensors.watch(config.pirPin);
+}
+
+void RoomControl::displayRoomMenu() {
+    printCentered_P(name, 0);
+    mainDisplay.setCursor(0, 1);
+    mainDisplay.print(F("<Light    Temp.>"));
+}
+
+void RoomControl::handleRoomMenu() {
+    if (leftButtonPressed) {
+        stateStack.push(ROOM_LIGHT_CONTROL);
+        mainDisplay.clear();
+        delay(200);
+    } else if (rightButtonPressed) {
+        stateStack.push(ROOM_TEMP_CONTROL);
+        adjustRepeat.suppress();
+        mainDisplay.clear();
+        delay(200);
+    } else if (scheduleButtonPressed) {
+        stateStack.push(ROOM_HISTORY);
+        sparkline.invalidate();
+        mainDisplay.clear();
+        delay(200);
+    }
+}
+
+void RoomControl::displayRoomTempControl() {
+    char buffer[9];
+    strcpy_P(buffer, name);
+    strcat_P(buffer, PSTR(": "));
+    mainDisplay.setCursor(0, 0);
+    mainDisplay.print(buffer);
+    drawTempTarget();
+    mainDisplay.setCursor(0, 1);
+    mainDisplay.print(F("-"));
+    mainDisplay.setCursor(11, 1);
+    if (acState != OFF && etaMinutes > 0) {
+        char buffer[12];
+        snprintf_P(buffer, sizeof(buffer), PSTR("%3dm"), etaMinutes);
+        mainDisplay.print(buffer);
+    } else {
+        mainDisplay.print(F("    "));
+    }
+    mainDisplay.setCursor(15, 1);
+    mainDisplay.print(F("+"));
+}
+
+// Current temperature with the heading arrow, and the target below it
+void RoomControl::drawTempTarget() {
+    mainDisplay.setCursor(9, 0);
+    mainDisplay.print(currentTemp, 1);
+    if (currentTemp != targetTemp) {
+        mainDisplay.write(byte((targetTemp > currentTemp) ? 1 : 2));
+    }
+    mainDisplay.print(F("   "));
+    printTemperature(targetTemp);
+    latency.output(OUTPUT_LCD);
+}
+
+void RoomControl::handleRoomTempControl() {
+    int8_t direction = (rightButtonPressed ? 1 : 0) - (leftButtonPressed ? 1 : 0);
+    int steps = adjustRepeat.steps(direction, millis(), TEMP_REPEAT);
+    if (steps == 0) {
+        return;
+    }
+    float target = constrain(targetTemp + steps * 0.5f, 10.0f, 30.0f);
+    if (target != targetTemp) {
+        setTarget(target);
+        drawTempTarget();
+    }
+}
+
+// Last 12 hours of temperature, one column per half hour, and the range
+void RoomControl::displayRoomHistory() {
+    char buffer[17];
+    strcpy_P(buffer, name);
+    strcat_P(buffer, PSTR(" last 12h"));
+    printCentered(buffer, 0);
+    sparkline.draw(history, mainDisplay);
+    mainDisplay.setCursor(0, 1);
+    for (int i = 0; i < Sparkline::CHARS; i++) {
+        mainDisplay.write(byte(Sparkline::FIRST_CHAR + i));
+    }
+    int16_t low = sparkline.low();
+    int16_t high = sparkline.high();
+    // The sign goes separately, or -0.5 would lose it to the integer part
+    int length = snprintf_P(buffer, sizeof(buffer), low < 0 ? PSTR(" -%d.%d") : PSTR(" %d.%d"), abs(low) / 10, abs(low) % 10);
+    snprintf_P(buffer + length, sizeof(buffer) - length, high < 0 ? PSTR("--%d.%d") : PSTR("-%d.%d"), abs(high) / 10,
+        abs(high) % 10);
+    mainDisplay.print(buffer);
+}
+
+void RoomControl::handleRoomHistory() {
+    if (scheduleButtonPressed) {
+        stateStack.push(ROOM_STATS);
+        mainDisplay.clear();
+        delay(200);
+    }
+}
+
+// Fixed-point seconds as hours, one decimal below 100 h
+static void formatHours(char* buffer, size_t size, uint32_t fixedSeconds) {
+    unsigned long tenths = (fixedSeconds >> EnergyStats::FRACTION_BITS) / 360;
+    if (tenths < 1000) {
+        snprintf_P(buffer, size, PSTR("%lu.%lu"), tenths / 10, tenths % 10);
+    } else {
+        snprintf_P(buffer, size, PSTR("%lu"), tenths / 10);
+    }
+}
+
+// Heating and cooling hours, lit-pixel hours and relay switch count
+void RoomControl::displayRoomStats() {
+    unsigned long now = millis();
+    char heat[12];
+    char cool[12];
+    char buffer[40];
+    formatHours(heat, sizeof(heat), energy.acTime(now, HEATING));
+    formatHours(cool, sizeof(cool), energy.acTime(now, COOLING));
+    snprintf_P(buffer, sizeof(buffer), PSTR("H %sh C %sh"), heat, cool);
+    mainDisplay.clear();
+    printCentered(buffer, 0);
+    formatHours(heat, sizeof(heat), energy.lightTime(now));
+    snprintf_P(buffer, sizeof(buffer), PSTR("L %spxh S%u"), heat, energy.acSwitches());
+    printCentered(buffer, 1);
+    statsDrawnAt = now;
+}
+
+void RoomControl::autoUpdateTemperature() {
+    float temp = readTemperature();
+    thermal.observe(millis(), temp, acState);
+    if (history.record(millis(), temp)) {
+        historyAdjusted = true;
+    }
+    if (temp != currentTemp) {
+        currentTemp = temp;
+        tempAdjusted = true;
+    }
+    adjustAC();
+    int eta = thermal.minutesToReach(currentTemp, targetTemp);
+    if (eta != etaMinutes) {
+        etaMinutes = eta;
+        tempAdjusted = true;
+    }
+}
+
+float RoomControl::readTemperature() {
+    int sensorValue = analogRead(config.tempSensorPin);
+    float voltage = sensorValue * (5.0 / 1023.0);
+    float temperatureC = (voltage - 0.5) * 100.0;
+    return round(temperatureC * 10) / 10.0;
+}
+
+void RoomControl::adjustAC() {
+    if (stageAC()) {
+        PCF8574_Write(expanderPinStates);
+    }
+}
+
+// Picks the AC state for the target and sets the relay bits without
+// writing the expander. Returns true if the state changed.
+bool RoomControl::stageAC() {
+    ACState state = OFF;
+    if (currentTemp < targetTemp) {
+        state = HEATING;
+    } else if (currentTemp > targetTemp) {
+        state = COOLING;
+    }
+    if (state == acState) {
+        return false;
+    }
+    stageACState(state);
+    return true;
+}
+
+void RoomControl::setACState(ACState state) {
+    stageACState(state);
+    PCF8574_Write(expanderPinStates);
+}
+
+void RoomControl::stageACState(ACState state) {
+    stageExpanderPin(config.heatingPin, state == HEATING);
+    stageExpanderPin(config.coolingPin, state == COOLING);
+    energy.setAC(millis(), state);
+    acState = state;
+}
+
+void RoomControl::displayRoomLightControl() {
+    char buffer[17];
+    strcpy_P(buffer, name);
+    strcat_P(buffer, PSTR(" Light"));
+    printCentered(buffer, 0);
+    mainDisplay.setCursor(0, 1);
+    mainDisplay.print(F("- "));
+    int fullBlocks = lightIntensity * 12 / 4;
+    for (int i = 0; i < 12; i++) {
+        if (i < fullBlocks) {
+            mainDisplay.write(byte(0));
+        } else {
+            mainDisplay.write(' ');
+        }
+    }
+    mainDisplay.print(F(" +"));
+}
+
+void RoomControl::handleRoomLightControl() {
+    if (leftButtonPressed && lightIntensity > 0) {
+        --lightIntensity;
+        updateNeoPixelBrightness(true);
+        hourOverride = hour();
+        delay(200);
+    } else if (rightButtonPressed && lightIntensity < 4) {
+        ++lightIntensity;
+        updateNeoPixelBrightness(true);
+        hourOverride = hour();
+        delay(200);
+    } else if (scheduleButtonPressed) {
+        stateStack.push(ROOM_SCHEDULE);
+        adjustRepeat.suppress();
+        storeRepeat.suppress();
+        selectedHour = hour();
+        delay(200);
+    }
+}
+
+void RoomControl::updateNeoPixelBrightness(bool manual) {
+    if (manual) {
+        autoLightEnabled = false;
+    }
+    // The whole strip goes out on every show(), so skip it if nothing changed
+    if (stageLight()) {
+        strip.show();
+        latency.output(OUTPUT_STRIP);
+    }
+}
+
+// Puts the level into the strip's buffer only; the caller shows it.
+// Returns true if any pixel changed.
+bool RoomControl::stageLight() {
+    bool changed = lights.apply(strip, lightIntensity);
+    energy.setLight(millis(), lightIntensity);
+    lightAdjusted = true;
+    return changed;
+}
+
+void RoomControl::autoAdjustLight() {
+    unsigned long now = millis();
+    if (daylight.due(now)) {
+        daylight.update(now, analogRead(PHOTO_RESISTOR_PIN), config.daylightGain, config.daylightOffset);
+    }
+    int targetIntensity = daylight.level();
+    if (autoLightEnabled && !scheduleActive && targetIntensity != lightIntensity) {
+        lightIntensity = targetIntensity;
+        updateNeoPixelBrightness(false);
+    }
+}
+
+void RoomControl::displayRoomSchedule() {
+    mainDisplay.clear();
+    drawScheduleLabel();
+    mainDisplay.setCursor(0, 1);
+    mainDisplay.print(F("<"));
+    mainDisplay.setCursor(4, 1);
+    mainDisplay.print(F(":00"));
+    mainDisplay.setCursor(11, 1);
+    mainDisplay.print(F(":00 >"));
+    drawScheduleHours();
+}
+
+// Scheduled level of the selected hour, padded over the whole row since
+// the label changes width
+void RoomControl::drawScheduleLabel() {
+    char label[14];
+    if (scheduledLevel(selectedHour) == 0) {
+        strcpy_P(label, PSTR("[unset]"));
+    } else {
+        sprintf_P(label, PSTR("[%d%% light]"), scheduledLevel(selectedHour) * 25);
+    }
+    char row[17];
+    int startPos = (16 - strlen(label)) / 2;
+    snprintf_P(row, sizeof(row), PSTR("%*s%-*s"), startPos, "", 16 - startPos, label);
+    mainDisplay.setCursor(0, 0);
+    mainDisplay.print(row);
+    latency.output(OUTPUT_LCD);
+}
+
+void RoomControl::drawScheduleHours() {
+    char buffer[4];
+    sprintf_P(buffer, PSTR("%02d"), selectedHour);
+    mainDisplay.setCursor(2, 1);
+    mainDisplay.print(buffer);
+    sprintf_P(buffer, PSTR("%02d"), (selectedHour + 1) % 24);
+    mainDisplay.setCursor(9, 1);
+    mainDisplay.print(buffer);
+    latency.output(OUTPUT_LCD);
+}
+
+void RoomControl::handleRoomSchedule() {
+    int8_t direction = (rightButtonPressed ? 1 : 0) - (leftButtonPressed ? 1 : 0);
+    int steps = adjustRepeat.steps(direction, millis(), SCHEDULE_REPEAT);
+    if (steps != 0) {
+        int previousLevel = scheduledLevel(selectedHour);
+        selectedHour = ((selectedHour + steps) % 24 + 24) % 24;
+        drawScheduleHours();
+        if (scheduledLevel(selectedHour) != previousLevel) {
+            drawScheduleLabel();
+        }
+    } else if (storeRepeat.steps(scheduleButtonPressed ? 1 : 0, millis(), SINGLE_PRESS) != 0) {
+        setScheduledLevel(selectedHour, lightIntensity);
+        if (lightIntensity != 0) {
+            scheduleActive = true;
+        }
+        drawScheduleLabel();
+    }
+}
+
+uint8_t RoomControl::scheduledLevel(int hour) const {
+    uint8_t pair = schedule[hour / 2];
+    return hour % 2 ? pair >> 4 : pair & 0x0F;
+}
+
+void RoomControl::setScheduledLevel(int hour, uint8_t level) {
+    uint8_t& pair = schedule[hour / 2];
+    pair = hour % 2 ? (pair & 0x0F) | level << 4 : (pair & 0xF0) | level;
+}
+
+void RoomControl::checkSchedule() {
+    int currentHour = hour();
+    if (!scheduleEnabled) {
+        scheduleActive = false;
+        if (currentHour != hourOverride && hourOverride != -1) {
+            resetRoomOverride();
+        }
+        return;
+    }
+    int scheduledLight = scheduledLevel(currentHour);
+    bool shouldUpdate = scheduledLight != 0 && scheduledLight != lightIntensity;
+
+    if (shouldUpdate && currentHour != hourOverride) {
+        lightIntensity = scheduledLight;
+        scheduleActive = true;
+        updateNeoPixelBrightness(false);
+    } else if (scheduledLight == 0 && scheduleActive) {
+        deactivateSchedule();
+    }
+    if (currentHour != hourOverride && hourOverride != -1) {
+        resetRoomOverride();
+    }
+}
+
+void RoomControl::deactivateSchedule() {
+    scheduleActive = false;
+    lightIntensity = 0;
+    updateNeoPixelBrightness(false);
+}
+
+void RoomControl::resetRoomOverride() {
+    hourOverride = -1;
+    inactive = false;
+    peoplePresent = true;
+    lastMotionTime = currentTime();
+}
+
+// Works through the PIR edges queued since the last call. A rising edge is
+// new motion unless it comes within 2 s of the last one; a falling edge
+// means motion went on until then. No inactivity while the output is high.
+void RoomControl::detectRoomMotion() {
+    MotionEvent event;
+    while (motionSensors.pop(motionChannel, event)) {
+        unsigned long time = currentTimeAt(event.time);
+        if (!event.rising) {
+            lastMotionTime = time;
+        } else if (time - lastMotionTime > 2000) {
+            latency.open(LATENCY_MOTION, event.time);
+            registerMotion(time);
+        }
+    }
+    if (peoplePresent && !scheduleActive && hour() != hourOverride && !motionSensors.active(motionChannel)) {
+        handleInactivity();
+    }
+}
+
+void RoomControl::registerMotion(unsigned long time) {
+    occupancy.recordMotion(time);
+    if (!peoplePresent || inactive) {
+        restoreComfort();
+        inactive = false;
+    }
+    lastMotionTime = time;
+    autoLightEnabled = true;
+    peoplePresent = true;
+}
+
+void RoomControl::handleInactivity() {
+    unsigned long timeDiff = currentTime() - lastMotionTime;
+
+    if (timeDiff > 20000 && inactive) { // 20 seconds of inactivity
+        if (lightIntensity != 0) {
+            lightIntensity = 0;
+            updateNeoPixelBrightness(true);
+        }
+        peoplePresent = false;
+        inactive = false;
+    } else if (timeDiff > 15000 && !inactive) { // 15 seconds of inactivity
+        enterSetback();
+        if (lightIntensity > 0) {
+            lightIntensity = (lightIntensity > 1) ? 1 : 0;
+            updateNeoPixelBrightness(true);
+        }
+        inactive = true;
+    }
+}
+
+// Brings an empty room to its comfort setpoint ahead of a slot in which it
+// is usually occupied, early enough for the thermal model to get there, and
+// puts its lights on auto shortly before. Drops back to the setback once the
+// prediction window passes without anyone showing up.
+void RoomControl::anticipateOccupancy() {
+    unsigned long now = currentTime();
+    occupancy.update(now);
+    if (peoplePresent) {
+        preconditioning = false;
+        return;
+    }
+    int untilOccupied = occupancy.minutesUntilExpected(now, PRECONDITION_MAX_SLOTS);
+    if (!preconditioning && untilOccupied >= 0) {
+        int lead = thermal.minutesToReach(currentTemp, comfortTemp);
+        if (untilOccupied <= max(lead, PRECONDITION_DEFAULT_MINUTES)) {
+            preconditioning = true;
+            lightsArmed = false;
+            restoreComfort();
+        }
+    } else if (preconditioning && untilOccupied < 0) {
+        preconditioning = false;
+        enterSetback();
+        if (lightsArmed) {
+            if (lightIntensity != 0) {
+                lightIntensity = 0;
+                updateNeoPixelBrightness(true);
+            }
+            autoLightEnabled = false;
+        }
+    }
+    if (preconditioning && !lightsArmed && untilOccupied <= PRECONDITION_LIGHT_MINUTES) {
+        lightsArmed = true;
+        autoLightEnabled = true;
+    }
+}
+
+// A setpoint chosen by hand, over Serial or by a scene. It becomes the
+// comfort setpoint and ends any setback.
+void RoomControl::setTarget(float temp) {
+    targetTemp = temp;
+    comfortTemp = temp;
+    setback = false;
+}
+
+// A setpoint that is not meant for whoever is in the room right now, from a
+// scene. An empty room keeps its setback and gets the new comfort setpoint
+// when someone comes in.
+void RoomControl::setComfort(float temp) {
+    setTarget(temp);
+    if ((!peoplePresent && !preconditioning) || inactive) {
+        enterSetback();
+    }
+}
+
+// Never raises the target: a comfort setpoint below the setback stays
+void RoomControl::enterSetback() {
+    if (!setback) {
+        setback = true;
+        targetTemp = min(comfortTemp, SETBACK_TEMP);
+        tempAdjusted = true;
+    }
+}
+
+// Only undoes our own setback; a setpoint set in the meantime ended it
+void RoomControl::restoreComfort() {
+    if (setback) {
+        setback = false;
+        targetTemp = comfortTemp;
+        tempAdjusted = true;
+    }
+}
+
+bool RoomControl::shouldUpdate() {
+    autoAdjustLight();
+    autoUpdateTemperature();
+    checkSchedule();
+    detectRoomMotion();
+    anticipateOccupancy();
+    if (lightAdjusted && (currentState == ROOM_LIGHT_CONTROL)) {
+        return true;
+    }
+    if (tempAdjusted && (currentState == ROOM_TEMP_CONTROL)) {
+        return true;
+    }
+    if (scheduleAdjusted && (currentState == ROOM_SCHEDULE)) {
+        return true;
+    }
+    if (historyAdjusted && (currentState == ROOM_HISTORY)) {
+        return true;
+    }
+    if (isDisplayed && (currentState == ROOM_STATS) && millis() - statsDrawnAt >= STATS_REFRESH_MS) {
+        return true;
+    }
+    return false;
+}
+
+// ---- src/impl/SceneLibrary.cpp ----
+#include <EEPROM.h>
+
+INSTANCE_STATE SceneLibrary scenes;
+
+#define K SCENE_KEEP
+static const Scene BUILT_IN_SCENES[SceneLibrary::BUILT_IN] PROGMEM = {
+    // Schedules back on at the comfort setpoint, lights left alone
+    { "HOME", { { K, 44, 1 }, { K, 44, 1 }, { K, 44, 1 }, { K, 44, 1 } } },
+    { "NIGHT", { { 0, 36, 0 }, { 0, 36, 0 }, { 0, 36, 0 }, { 0, 36, 0 } } },
+    { "AWAY", { { 0, 30, 0 }, { 0, 30, 0 }, { 0, 30, 0 }, { 0, 30, 0 } } }
+};
+#undef K
+
+SceneLibrary::SceneLibrary() : applied(NONE) {
+}
+
+// False for an empty user slot
+bool SceneLibrary::load(uint8_t index, Scene& scene) const {
+    if (index < BUILT_IN) {
+        memcpy_P(&scene, &BUILT_IN_SCENES[index], sizeof(Scene));
+        return true;
+    }
+    if (index >= COUNT) {
+        return false;
+    }
+    int address = EEPROM_BASE + (index - BUILT_IN) * SLOT_SIZE;
+    if (EEPROM.read(address) != SLOT_MAGIC) {
+        return false;
+    }
+    EEPROM.get(address + 1, scene);
+    scene.name[SCENE_NAME_SIZE - 1] = '\0';
+    return true;
+}
+
+int8_t SceneLibrary::find(const char* name) const {
+    Scene scene;
+    for (uint8_t i = 0; i < COUNT; i++) {
+        if (load(i, scene) && strcmp(scene.name, name) == 0) {
+            return i;
+        }
+    }
+    return NONE;
+}
+
+// Steps through the scenes that exist, wrapping around
+int8_t SceneLibrary::next(int8_t from, int8_t direction) const {
+    Scene scene;
+    int8_t index = from;
+    for (uint8_t i = 0; i < COUNT; i++) {
+        index = (index + direction + COUNT) % COUNT;
+        if (load(index, scene)) {
+            return index;
+        }
+    }
+    return from;
+}
+
+bool SceneLibrary::apply(uint8_t index, RoomControl* const rooms[], int roomCount) {
+    Scene scene;
+    if (!load(index, scene)) {
+        return false;
+    }
+    roomCount = min(roomCount, SCENE_MAX_ROOMS);
+    for (int r = 0; r < roomCount; r++) {
+        const RoomScene& target = scene.rooms[r];
+        RoomControl& room = *rooms[r];
+        if (target.scheduleEnabled != SCENE_KEEP) {
+            room.scheduleEnabled = target.scheduleEnabled;
+        }
+        // Like a manual change: holds against the schedule for this hour
+        if (target.light != SCENE_KEEP) {
+            room.lightIntensity = min(target.light, (uint8_t)LightSegment::MAX_LEVEL);
+            room.autoLightEnabled = false;
+            room.hourOverride = hour();
+        }
+        if (target.target != SCENE_KEEP) {
+            room.setComfort(constrain(target.target, (uint8_t)20, (uint8_t)60) / 2.0);
+            tempAdjusted = true;
+        }
+    }
+    bool lightsChanged = false;
+    bool acChanged = false;
+    for (int r = 0; r < roomCount; r++) {
+        lightsChanged |= rooms[r]->stageLight();
+        acChanged |= rooms[r]->stageAC();
+    }
+    if (lightsChanged) {
+        strip.show();
+        latency.output(OUTPUT_STRIP);
+    }
+    if (acChanged) {
+        PCF8574_Write(expanderPinStates);
+    }
+    applied = index;
+    return true;
+}
+
+// Stores the rooms' current settings under the name, replacing a user
+// scene of the same name or taking the first free slot. Returns the index,
+// or NONE if the name is a built-in one or every slot is taken.
+int8_t SceneLibrary::save(const char* name, const RoomControl* const rooms[], int roomCount) {
+    int8_t index = find(name);
+    if (index != NONE && index < BUILT_IN) {
+        return NONE;
+    }
+    Scene scene;
+    for (uint8_t i = BUILT_IN; index == NONE && i < COUNT; i++) {
+        if (!load(i, scene)) {
+            index = i;
+        }
+    }
+    if (index == NONE) {
+        return NONE;
+    }
+    memset(&scene, 0, sizeof(scene));
+    strncpy(scene.name, name, SCENE_NAME_SIZE - 1);
+    for (int r = 0; r < SCENE_MAX_ROOMS; r++) {
+        RoomScene& target = scene.rooms[r];
+        if (r < roomCount) {
+            target.light = rooms[r]->lightIntensity;
+            target.target = (uint8_t)round(rooms[r]->targetTemp * 2);
+            target.scheduleEnabled = rooms[r]->scheduleEnabled;
+        } else {
+            target.light = target.target = target.scheduleEnabled = SCENE_KEEP;
+        }
+    }
+    // Magic last, so a reset halfway leaves the slot empty rather than corrupt
+    int address = EEPROM_BASE + (index - BUILT_IN) * SLOT_SIZE;
+    EEPROM.update(address, 0xFF);
+    EEPROM.put(address + 1, scene);
+    EEPROM.update(address, SLOT_MAGIC);
+    return index;
+}
+
+int8_t SceneLibrary::lastApplied() const {
+    return applied;
+}
+
+// SCENE <last applied or -> <name of every scene that exists>
+bool SceneLibrary::report() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    Scene scene;
+    strcpy_P(buffer, PSTR("SCENE "));
+    if (applied != NONE && load(applied, scene)) {
+        strcat(buffer, scene.name);
+    } else {
+        strcat_P(buffer, PSTR("-"));
+    }
+    for (uint8_t i = 0; i < COUNT; i++) {
+        if (load(i, scene)) {
+            strcat_P(buffer, PSTR(" "));
+            strcat(buffer, scene.name);
+        }
+    }
+    return telemetry.sendText(buffer);
+}
+
+// ---- src/include/SegmentClock.h ----
+// HH:MM on the 7-segment backpack. Remembers the segments last queued for
+// each position and only queues the positions that changed, one 3 byte
+// write each, so a minute change usually costs a single digit.
+class SegmentClock {
+public:
+    SegmentClock();
+
+    void show(uint8_t hours, uint8_t minutes);
+    void invalidate();
+
+private:
+    // Digits 0-1 and 3-4, the colon sits at position 2
+    static const uint8_t POSITIONS = 5;
+
+    uint16_t shown[POSITIONS];
+    bool valid;
+    uint16_t busErrors;
+};
+
+extern INSTANCE_STATE SegmentClock segmentClock;
+
+// ---- src/impl/SegmentClock.cpp ----
+INSTANCE_STATE SegmentClock segmentClock;
+
+SegmentClock::SegmentClock() : valid(false), busErrors(0) {
+    memset(shown, 0, sizeof(shown));
+}
+
+void SegmentClock::show(uint8_t hours, uint8_t minutes) {
+    // A failed write may have left any position stale
+    uint16_t errors = i2cBus.errors(CLOCK_ADDRESS);
+    if (errors != busErrors) {
+        busErrors = errors;
+        valid = false;
+    }
+    clockDisplay.writeDigitNum(0, hours / 10);
+    clockDisplay.writeDigitNum(1, hours % 10);
+    clockDisplay.drawColon(true);
+    clockDisplay.writeDigitNum(3, minutes / 10);
+    clockDisplay.writeDigitNum(4, minutes % 10);
+    for (uint8_t i = 0; i < POSITIONS; i++) {
+        uint16_t segments = clockDisplay.displaybuffer[i];
+        if (valid && segments == shown[i]) {
+            continue;
+        }
+        uint8_t data[3] = { (uint8_t)(i * 2), (uint8_t)(segments & 0xFF), (uint8_t)(segments >> 8) };
+        i2cBus.write(CLOCK_ADDRESS, data, sizeof(data));
+        shown[i] = segments;
+    }
+    valid = true;
+}
+
+// Makes the next show() queue every position
+void SegmentClock::invalidate() {
+    valid = false;
+}
+
+// ---- src/impl/SensorHistory.cpp ----
+SensorHistory::SensorHistory()
+    : head(0), count(0), newestAvg(0), closed(0), slotStart(0), lastSample(0), sum(0), samples(0), low(0), high(0) {
+    memset(deltas, 0, sizeof(deltas));
+    memset(spreads, 0, sizeof(spreads));
+}
+
+int16_t SensorHistory::currentAvg() const {
+    return (sum + (sum >= 0 ? samples / 2 : -(long)samples / 2)) / (long)samples;
+}
+
+void SensorHistory::closeSlot() {
+    int16_t avg = currentAvg();
+    int delta = count == 0 ? 0 : constrain(avg - newestAvg, -127, 127);
+    // A clamped delta only shifts the slots before it; the chain stays exact
+    newestAvg = count == 0 ? avg : newestAvg + delta;
+    deltas[head] = delta;
+    int below = min(max(newestAvg - low, 0), (int)MAX_SPREAD);
+    int above = min(max(high - newestAvg, 0), (int)MAX_SPREAD);
+    spreads[head] = (below << 4) | above;
+    head = (head + 1) % SLOT_COUNT;
+    if (count < SLOT_COUNT) {
+        count++;
+    }
+    closed++;
+    samples = 0;
+}
+
+// Takes a reading at most once a second and closes the slot every half
+// hour of uptime. Returns true when anything get() reports has changed.
+bool SensorHistory::record(unsigned long now, float value) {
+    bool changed = false;
+    if (now - slotStart >= SLOT_MS) {
+        if (samples > 0) {
+            closeSlot();
+            changed = true;
+        }
+        slotStart = now;
+    }
+    if (samples > 0 && now - lastSample < SAMPLE_MS) {
+        return changed;
+    }
+    lastSample = now;
+
+    int16_t tenths = (int16_t)round(value * 10);
+    if (samples == 0) {
+        low = high = tenths;
+        sum = tenths;
+        samples = 1;
+        return true;
+    }
+    int16_t before = currentAvg();
+    if (tenths < low) {
+        low = tenths;
+        changed = true;
+    }
+    if (tenths > high) {
+        high = tenths;
+        changed = true;
+    }
+    sum += tenths;
+    samples++;
+    return changed || currentAvg() != before;
+}
+
+// Age 0 is the slot in progress, 1 the last completed one and so on
+bool SensorHistory::get(int age, Sample& sample) const {
+    if (age == 0) {
+        if (samples == 0) {
+            return false;
+        }
+        sample.avg = currentAvg();
+        sample.min = low;
+        sample.max = high;
+        return true;
+    }
+    if (age > count) {
+        return false;
+    }
+    int index = (head + SLOT_COUNT - 1) % SLOT_COUNT;
+    int16_t avg = newestAvg;
+    for (int i = 1; i < age; i++) {
+        avg -= deltas[index];
+        index = (index + SLOT_COUNT - 1) % SLOT_COUNT;
+    }
+    sample.avg = avg;
+    sample.min = avg - (spreads[index] >> 4);
+    sample.max = avg + (spreads[index] & 0x0F);
+    return true;
+}
+
+int SensorHistory::size() const {
+    return count;
+}
+
+uint16_t SensorHistory::closedSlots() const {
+    return closed;
+}
+
+// ---- src/impl/Sparkline.cpp ----
+INSTANCE_STATE Sparkline sparkline;
+
+Sparkline::Sparkline() : source(NULL), closedSlots(0), scaleLow(0), scaleHigh(MIN_SPAN) {
+    memset(newest, 0, sizeof(newest));
+}
+
+void Sparkline::invalidate() {
+    source = NULL;
+}
+
+int16_t Sparkline::low() const {
+    return scaleLow;
+}
+
+int16_t Sparkline::high() const {
+    return scaleHigh;
+}
+
+// Scales the vertical axis to the range of the shown slots
+void Sparkline::rescale(const SensorHistory& history) {
+    SensorHistory::Sample sample;
+    bool any = false;
+    for (int age = 0; age < COLUMNS; age++) {
+        if (!history.get(age, sample)) {
+            continue;
+        }
+        if (!any || sample.min < scaleLow) scaleLow = sample.min;
+        if (!any || sample.max > scaleHigh) scaleHigh = sample.max;
+        any = true;
+    }
+    if (!any) {
+        scaleLow = scaleHigh = 0;
+    }
+    if (scaleHigh - scaleLow < MIN_SPAN) {
+        scaleLow = (scaleLow + scaleHigh) / 2 - MIN_SPAN / 2;
+        scaleHigh = scaleLow + MIN_SPAN;
+    }
+}
+
+// Draws the five columns of one character. Returns false if a slot
+// doesn't fit the current scale.
+bool Sparkline::buildChar(int index, const SensorHistory& history, uint8_t* glyph) const {
+    memset(glyph, 0, 8);
+    int span = scaleHigh - scaleLow;
+    for (int i = 0; i < 5; i++) {
+        SensorHistory::Sample sample;
+        if (!history.get(COLUMNS - 1 - (index * 5 + i), sample)) {
+            continue;
+        }
+        if (sample.min < scaleLow || sample.max > scaleHigh) {
+            return false;
+        }
+        uint8_t bit = 1 << (4 - i);
+        int bottom = (sample.min - scaleLow) * 7 / span;
+        int top = (sample.max - scaleLow) * 7 / span;
+        for (int level = bottom; level <= top; level++) {
+            glyph[7 - level] |= bit;
+        }
+    }
+    return true;
+}
+
+// Between closed slots only the newest column can change, so only the last
+// character is redrawn then, and uploaded if it differs
+void Sparkline::draw(const SensorHistory& history, LiquidCrystal& lcd) {
+    uint8_t glyph[8];
+    bool full = source != &history || history.closedSlots() != closedSlots;
+    if (!full) {
+        if (!buildChar(CHARS - 1, history, glyph)) {
+            full = true;
+        } else if (memcmp(glyph, newest, sizeof(newest)) != 0) {
+            memcpy(newest, glyph, sizeof(newest));
+            lcd.createChar(FIRST_CHAR + CHARS - 1, glyph);
+        }
+    }
+    if (full) {
+        rescale(history);
+        for (int c = 0; c < CHARS; c++) {
+            buildChar(c, history, glyph);
+            lcd.createChar(FIRST_CHAR + c, glyph);
+        }
+        memcpy(newest, glyph, sizeof(newest));
+        source = &history;
+        closedSlots = history.closedSlots();
+    }
+}
+
+// ---- src/impl/StateStack.cpp ----
+StateStack::StateStack() : top(-1) {}
+
+void StateStack::push(SystemState state) {
+    if (top < MAX_STACK_SIZE - 1) {
+        stack[++top] = state;
+    }
+}
+
+void StateStack::pop() {
+    if (top >= 0) {
+        top--;
+    }
+}
+
+SystemState StateStack::topState() const {
+    if (top >= 0) {
+        return stack[top];
+    }
+    return WELCOME_SCREEN;
+}
+
+bool StateStack::isHistoryAvailable() const {
+    return top > 0;
+}
+
+int StateStack::size() const {
+    return top + 1;
+}
+
+SystemState StateStack::at(int index) const {
+    return stack[index];
+}
+
+void StateStack::clear() {
+    top = -1;
+}
+
+// ---- src/include/main.h ----
+extern INSTANCE_STATE RoomControl room1;
+extern INSTANCE_STATE RoomControl room2;
+
+#define ROOM_COUNT 2
+extern INSTANCE_STATE RoomControl* const rooms[ROOM_COUNT];
+
+extern INSTANCE_STATE unsigned long TIME_WHEEL_RANGE;
+extern INSTANCE_STATE int lastTimeWheelValue;
+extern INSTANCE_STATE int8_t selectedScene;
+// ADC counts the time wheel must move before the clock is adjusted
+const int TIME_WHEEL_DEADBAND = 2;
+
+void displayWelcomeScreen();
+void handleWelcomeScreen();
+void displaySystemMenu();
+void handleSystemMenu();
+void displayDiagnostics();
+void displaySceneMenu();
+void handleSceneMenu();
+void displayCurrentMenu();
+void handleCurrentMenu();
+void displayCurrentTime();
+void updateStartTime();
+void setup();
+void loop();
+
+// ---- src/include/SystemSnapshot.h ----
+// Compact binary image of the controller's control state: the menu stack,
+// expander outputs, redraw flags, clock and every room's settings and
+// control fields. Restoring one into a freshly booted controller carries
+// on from where the snapshot was taken. Learned models (occupancy, thermal,
+// history, energy totals) and transient state such as debouncing and
+// telemetry start over, as after a reboot.
+//
+//   [magic] [version] [room count] [global] [stack...] [room...] [crc8]
+//
+// Multi-byte values are little endian. Bump SNAPSHOT_VERSION whenever the
+// layout changes; restore refuses any other version.
+const uint8_t SNAPSHOT_MAGIC = 0xA7;
+const uint8_t SNAPSHOT_VERSION = 2;
+
+// Worst case size, with a full menu stack
+size_t snapshotSize(int roomCount);
+// Returns the bytes written, 0 if size is too small
+size_t saveSnapshot(const RoomControl* const rooms[], int roomCount, uint8_t* out, size_t size);
+// Leaves the controller untouched unless the whole snapshot is valid: the
+// CRC matches and every menu state, AC state, hour and light level is in range
+bool restoreSnapshot(RoomControl* const rooms[], int roomCount, const uint8_t* data, size_t len);
+
+// ---- src/impl/SystemSnapshot.cpp ----
+static const size_t SNAPSHOT_HEADER_SIZE = 3;
+// currentState, stack depth, expander, flags, clock, time wheel
+static const size_t SNAPSHOT_GLOBAL_SIZE = 10;
+// Three temperatures, light, selected hour, override, motion age, flags,
+// ETA, AC state, the schedule packed two hours to a byte and more flags
+static const size_t SNAPSHOT_ROOM_SIZE = 30;
+static_assert(sizeof(RoomControl::schedule) == 12, "the snapshot copies the packed schedule as is");
+
+static const uint8_t ADJUSTED_LIGHT = 0x01;
+static const uint8_t ADJUSTED_TEMP = 0x02;
+static const uint8_t ADJUSTED_SCHEDULE = 0x04;
+static const uint8_t ADJUSTED_TIME = 0x08;
+static const uint8_t ADJUSTED_HISTORY = 0x10;
+static const uint8_t ADJUSTED_MEMORY = 0x20;
+
+static const uint8_t SNAPSHOT_PRESENT = 0x01;
+static const uint8_t SNAPSHOT_INACTIVE = 0x02;
+static const uint8_t SNAPSHOT_SCHEDULE_ACTIVE = 0x04;
+static const uint8_t SNAPSHOT_SCHEDULE_ENABLED = 0x08;
+static const uint8_t SNAPSHOT_AUTO_LIGHT = 0x10;
+static const uint8_t SNAPSHOT_PRECONDITIONING = 0x20;
+static const uint8_t SNAPSHOT_LIGHTS_ARMED = 0x40;
+static const uint8_t SNAPSHOT_DISPLAYED = 0x80;
+// Second flags byte
+static const uint8_t SNAPSHOT_SETBACK = 0x01;
+
+static uint8_t* putLE16(uint8_t* out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    return out + 2;
+}
+
+static uint8_t* putLE32(uint8_t* out, uint32_t value) {
+    out = putLE16(out, value);
+    return putLE16(out, value >> 16);
+}
+
+static uint16_t getLE16(const uint8_t* in) {
+    return in[0] | (uint16_t)in[1] << 8;
+}
+
+static uint32_t getLE32(const uint8_t* in) {
+    return getLE16(in) | (uint32_t)getLE16(in + 2) << 16;
+}
+
+static int16_t toTenths(float temp) {
+    return (int16_t)round(temp * 10);
+}
+
+size_t snapshotSize(int roomCount) {
+    return SNAPSHOT_HEADER_SIZE + SNAPSHOT_GLOBAL_SIZE + StateStack::MAX_STACK_SIZE +
+        roomCount * SNAPSHOT_ROOM_SIZE + 1;
+}
+
+size_t saveSnapshot(const RoomControl* const rooms[], int roomCount, uint8_t* out, size_t size) {
+    int depth = stateStack.size();
+    size_t len = snapshotSize(roomCount) - (StateStack::MAX_STACK_SIZE - depth);
+    if (size < len) {
+        return 0;
+    }
+    unsigned long clock = currentTime();
+    uint8_t* p = out;
+    *p++ = SNAPSHOT_MAGIC;
+    *p++ = SNAPSHOT_VERSION;
+    *p++ = roomCount;
+
+    *p++ = currentState;
+    *p++ = depth;
+    *p++ = expanderPinStates;
+    uint8_t adjusted = 0;
+    if (lightAdjusted) adjusted |= ADJUSTED_LIGHT;
+    if (tempAdjusted) adjusted |= ADJUSTED_TEMP;
+    if (scheduleAdjusted) adjusted |= ADJUSTED_SCHEDULE;
+    if (timeAdjusted) adjusted |= ADJUSTED_TIME;
+    if (historyAdjusted) adjusted |= ADJUSTED_HISTORY;
+    if (memoryAdjusted) adjusted |= ADJUSTED_MEMORY;
+    *p++ = adjusted;
+    p = putLE32(p, clock);
+    p = putLE16(p, lastTimeWheelValue);
+    for (int i = 0; i < depth; i++) {
+        *p++ = stateStack.at(i);
+    }
+
+    for (int r = 0; r < roomCount; r++) {
+        const RoomControl& room = *rooms[r];
+        p = putLE16(p, toTenths(room.currentTemp));
+        p = putLE16(p, toTenths(room.targetTemp));
+        p = putLE16(p, toTenths(room.comfortTemp));
+        *p++ = room.lightIntensity;
+        *p++ = room.selectedHour;
+        *p++ = room.hourOverride;
+        // Motion times are clock times, so they are kept as ages
+        p = putLE32(p, clock - room.lastMotionTime);
+        uint8_t flags = 0;
+        if (room.peoplePresent) flags |= SNAPSHOT_PRESENT;
+        if (room.inactive) flags |= SNAPSHOT_INACTIVE;
+        if (room.scheduleActive) flags |= SNAPSHOT_SCHEDULE_ACTIVE;
+        if (room.scheduleEnabled) flags |= SNAPSHOT_SCHEDULE_ENABLED;
+        if (room.autoLightEnabled) flags |= SNAPSHOT_AUTO_LIGHT;
+        if (room.preconditioning) flags |= SNAPSHOT_PRECONDITIONING;
+        if (room.lightsArmed) flags |= SNAPSHOT_LIGHTS_ARMED;
+        if (room.isDisplayed) flags |= SNAPSHOT_DISPLAYED;
+        *p++ = flags;
+        p = putLE16(p, room.etaMinutes);
+        *p++ = room.acState;
+        // Same packing as in RoomControl
+        memcpy(p, room.schedule, sizeof(room.schedule));
+        p += sizeof(room.schedule);
+        *p++ = room.setback ? SNAPSHOT_SETBACK : 0;
+    }
+
+    *p = crc8(out, p - out);
+    return len;
+}
+
+static bool validLevel(uint8_t level) {
+    return level <= LightSegment::MAX_LEVEL;
+}
+
+// Every field that indexes a table or drives an output must be in range
+static bool validRoom(const uint8_t* p) {
+    int8_t hourOverride = (int8_t)p[8];
+    if (!validLevel(p[6]) || p[7] >= 24 || hourOverride < -1 || hourOverride >= 24 || p[16] > COOLING ||
+        (p[29] & ~SNAPSHOT_SETBACK) != 0) {
+        return false;
+    }
+    for (int i = 0; i < 12; i++) {
+        if (!validLevel(p[17 + i] & 0x0F) || !validLevel(p[17 + i] >> 4)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool restoreSnapshot(RoomControl* const rooms[], int roomCount, const uint8_t* data, size_t len) {
+    if (len < SNAPSHOT_HEADER_SIZE + SNAPSHOT_GLOBAL_SIZE + 1 || data[0] != SNAPSHOT_MAGIC ||
+        data[1] != SNAPSHOT_VERSION || data[2] != roomCount) {
+        return false;
+    }
+    const uint8_t* p = data + SNAPSHOT_HEADER_SIZE;
+    int depth = p[1];
+    if (depth > StateStack::MAX_STACK_SIZE ||
+        len != snapshotSize(roomCount) - (StateStack::MAX_STACK_SIZE - depth) ||
+        crc8(data, len - 1) != data[len - 1] || p[0] > SCENE_MENU) {
+        return false;
+    }
+    const uint8_t* stack = p + SNAPSHOT_GLOBAL_SIZE;
+    for (int i = 0; i < depth; i++) {
+        if (stack[i] > SCENE_MENU) {
+            return false;
+        }
+    }
+    for (int r = 0; r < roomCount; r++) {
+        if (!validRoom(stack + depth + r * SNAPSHOT_ROOM_SIZE)) {
+            return false;
+        }
+    }
+
+    currentState = (SystemState)p[0];
+    expanderPinStates = p[2];
+    uint8_t adjusted = p[3];
+    // The clock carries on from the snapshot's time
+    unsigned long clock = getLE32(p + 4);
+    ADDED_TIME = clock - START_TIME - millis();
+    lastTimeWheelValue = (int16_t)getLE16(p + 8);
+    p += SNAPSHOT_GLOBAL_SIZE;
+    stateStack.clear();
+    for (int i = 0; i < depth; i++) {
+        stateStack.push((SystemState)*p++);
+    }
+
+    for (int r = 0; r < roomCount; r++) {
+        RoomControl& room = *rooms[r];
+        room.currentTemp = (int16_t)getLE16(p) / 10.0;
+        room.targetTemp = (int16_t)getLE16(p + 2) / 10.0;
+        room.comfortTemp = (int16_t)getLE16(p + 4) / 10.0;
+        room.lightIntensity = p[6];
+        room.selectedHour = p[7];
+        room.hourOverride = (int8_t)p[8];
+        room.lastMotionTime = clock - getLE32(p + 9);
+        uint8_t flags = p[13];
+        room.peoplePresent = flags & SNAPSHOT_PRESENT;
+        room.inactive = flags & SNAPSHOT_INACTIVE;
+        room.scheduleActive = flags & SNAPSHOT_SCHEDULE_ACTIVE;
+        room.scheduleEnabled = flags & SNAPSHOT_SCHEDULE_ENABLED;
+        room.autoLightEnabled = flags & SNAPSHOT_AUTO_LIGHT;
+        room.preconditioning = flags & SNAPSHOT_PRECONDITIONING;
+        room.lightsArmed = flags & SNAPSHOT_LIGHTS_ARMED;
+        room.isDisplayed = flags & SNAPSHOT_DISPLAYED;
+        room.etaMinutes = (int16_t)getLE16(p + 14);
+        ACState state = (ACState)p[16];
+        memcpy(room.schedule, p + 17, sizeof(room.schedule));
+        room.setback = p[29] & SNAPSHOT_SETBACK;
+        p += SNAPSHOT_ROOM_SIZE;
+        // Outputs are staged per room and committed together below
+        room.stageACState(state);
+        room.stageLight();
+    }
+    PCF8574_Write(expanderPinStates);
+    strip.show();
+    mainDisplay.clear();
+    displayCurrentMenu();
+    segmentClock.show(hour(), minute());
+
+    // Last, so redraws still pending in the snapshot stay pending
+    lightAdjusted = adjusted & ADJUSTED_LIGHT;
+    tempAdjusted = adjusted & ADJUSTED_TEMP;
+    scheduleAdjusted = adjusted & ADJUSTED_SCHEDULE;
+    timeAdjusted = adjusted & ADJUSTED_TIME;
+    historyAdjusted = adjusted & ADJUSTED_HISTORY;
+    memoryAdjusted = adjusted & ADJUSTED_MEMORY;
+    return true;
+}
+
+// ---- src/impl/Telemetry.cpp ----
+INSTANCE_STATE Telemetry telemetry;
+
+// Type, sequence, room count or field mask, every field, CRC
+static_assert(3 + (TELEMETRY_MAX_FIELDS + 6) / 7 + TELEMETRY_MAX_FIELDS * 5 + 1 <= TELEMETRY_MAX_FRAME,
+    "a sample frame with every room must fit TELEMETRY_MAX_FRAME");
+static_assert(TELEMETRY_MAX_FRAME <= 252, "frames must stay within one COBS block and txBuffer within 8-bit indexes");
+
+Telemetry::Telemetry()
+    : txHead(0), txTail(0), frameHead(0), codeAt(0), code(0), crc(0), seq(0), framesSinceKey(KEY_FRAME_INTERVAL),
+      lastFrameTime(0), droppedFrames(0) {
+    memset(lastValues, 0, sizeof(lastValues));
+}
+
+int Telemetry::txFree() const {
+    int used = (txHead - txTail + TX_BUFFER_SIZE) % TX_BUFFER_SIZE;
+    return TX_BUFFER_SIZE - 1 - used;
+}
+
+uint8_t Telemetry::next(uint8_t index) {
+    return index + 1 == TX_BUFFER_SIZE ? 0 : index + 1;
+}
+
+// Frames are COBS encoded straight into txBuffer, so no frame is ever
+// copied on the stack. Under 254 bytes the encoding adds exactly one code
+// byte, so a frame of len bytes plus its CRC takes len + 3 bytes with the
+// delimiter. The whole frame is dropped when that doesn't fit, so the
+// stream never carries half a frame. len covers the type and sequence
+// bytes and must match what is put() before endFrame().
+bool Telemetry::beginFrame(uint8_t type, size_t len) {
+    if (txFree() < (int)len + 3) {
+        droppedFrames++;
+        return false;
+    }
+    codeAt = txHead;
+    frameHead = next(txHead);
+    code = 1;
+    crc = 0;
+    put(type);
+    put(seq);
+    return true;
+}
+
+void Telemetry::put(uint8_t data) {
+    crc = crc8Update(crc, data);
+    encode(data);
+}
+
+void Telemetry::putField(uint32_t value) {
+    while (value >= 0x80) {
+        put((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    put((uint8_t)value);
+}
+
+// Same output as cobsEncode(); frames never reach its 254-byte blocks
+void Telemetry::encode(uint8_t data) {
+    if (data == 0) {
+        txBuffer[codeAt] = code;
+        codeAt = frameHead;
+        code = 1;
+    } else {
+        txBuffer[frameHead] = data;
+        code++;
+    }
+    frameHead = next(frameHead);
+}
+
+// Appends the CRC and delimiter and hands the frame to pump()
+void Telemetry::endFrame() {
+    encode(crc);
+    txBuffer[codeAt] = code;
+    txBuffer[frameHead] = 0;
+    txHead = next(frameHead);
+    seq++;
+}
+
+void Telemetry::sample(RoomControl* const rooms[], int roomCount) {
+    unsigned long now = millis();
+    if (now - lastFrameTime < FRAME_INTERVAL) {
+        return;
+    }
+    lastFrameTime = now;
+    if (roomCount > TELEMETRY_MAX_ROOMS) {
+        roomCount = TELEMETRY_MAX_ROOMS;
+    }
+
+    int32_t values[TELEMETRY_MAX_FIELDS];
+    int fieldCount = GLOBAL_FIELD_COUNT + roomCount * ROOM_FIELD_COUNT;
+    values[FIELD_UPTIME_MS] = (int32_t)now;
+    values[FIELD_CLOCK_MINUTES] = hour() * 60 + minute();
+    values[FIELD_OUTDOOR_LIGHT] = analogRead(PHOTO_RESISTOR_PIN);
+    for (int r = 0; r < roomCount; r++) {
+        const RoomControl& room = *rooms[r];
+        int32_t* roomValues = &values[GLOBAL_FIELD_COUNT + r * ROOM_FIELD_COUNT];
+        uint8_t flags = room.acState & ROOM_FLAG_AC_MASK;
+        if (room.peoplePresent) flags |= ROOM_FLAG_PRESENT;
+        if (room.inactive) flags |= ROOM_FLAG_INACTIVE;
+        if (room.scheduleActive) flags |= ROOM_FLAG_SCHEDULE;
+        if (room.autoLightEnabled) flags |= ROOM_FLAG_AUTO_LIGHT;
+        if (room.preconditioning) flags |= ROOM_FLAG_PRECONDITION;
+        roomValues[ROOM_FIELD_TEMP] = (int32_t)round(room.currentTemp * 10);
+        roomValues[ROOM_FIELD_TARGET] = (int32_t)round(room.targetTemp * 10);
+        roomValues[ROOM_FIELD_LIGHT] = room.lightIntensity;
+        roomValues[ROOM_FIELD_FLAGS] = flags;
+    }
+
+    bool keyFrame = framesSinceKey >= KEY_FRAME_INTERVAL;
+    uint32_t mask = 0;
+    size_t len = 2;
+    if (keyFrame) {
+        len++;
+        for (int i = 0; i < fieldCount; i++) {
+            len += varintSize(zigzagEncode(values[i]));
+        }
+    } else {
+        for (int i = 0; i < fieldCount; i++) {
+            if (values[i] != lastValues[i]) {
+                mask |= 1UL << i;
+                len += varintSize(zigzagEncode(values[i] - lastValues[i]));
+            }
+        }
+        len += varintSize(mask);
+    }
+
+    // Deltas are always taken against the last frame that was actually queued
+    if (!beginFrame(keyFrame ? FRAME_KEY : FRAME_DELTA, len)) {
+        return;
+    }
+    if (keyFrame) {
+        put(roomCount);
+        for (int i = 0; i < fieldCount; i++) {
+            putField(zigzagEncode(values[i]));
+        }
+    } else {
+        putField(mask);
+        for (int i = 0; i < fieldCount; i++) {
+            if (mask & (1UL << i)) {
+                putField(zigzagEncode(values[i] - lastValues[i]));
+            }
+        }
+    }
+    endFrame();
+    memcpy(lastValues, values, fieldCount * sizeof(int32_t));
+    framesSinceKey = keyFrame ? 1 : framesSinceKey + 1;
+}
+
+// Text beyond TELEMETRY_MAX_FRAME is cut off
+bool Telemetry::sendText(const char* text) {
+    size_t length = min(strlen(text), (size_t)(TELEMETRY_MAX_FRAME - 3));
+    if (!beginFrame(FRAME_TEXT, length + 2)) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        put(text[i]);
+    }
+    endFrame();
+    return true;
+}
+
+bool Telemetry::sendText_P(PGM_P text) {
+    size_t length = min(strlen_P(text), (size_t)(TELEMETRY_MAX_FRAME - 3));
+    if (!beginFrame(FRAME_TEXT, length + 2)) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        put(pgm_read_byte(text + i));
+    }
+    endFrame();
+    return true;
+}
+
+bool Telemetry::sendTrace(const uint8_t* body, size_t len) {
+    if (len > TELEMETRY_MAX_FRAME - 3 || !beginFrame(FRAME_TRACE, len + 2)) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        put(body[i]);
+    }
+    endFrame();
+    return true;
+}
+
+// Moves queued bytes into the UART buffer without ever waiting on it
+void Telemetry::pump() {
+    while (txTail != txHead && Serial.availableForWrite() > 0) {
+        Serial.write(txBuffer[txTail]);
+        txTail = next(txTail);
+    }
+}
+
+unsigned int Telemetry::dropped() const {
+    return droppedFrames;
+}
+
+// ---- src/impl/ThermalModel.cpp ----
+ThermalModel::ThermalModel()
+    : segmentState(-1), segmentStarted(false), segmentTemp(0), lastTemp(0), segmentStart(0) {
+    memset(rates, 0, sizeof(rates));
+    memset(samples, 0, sizeof(samples));
+}
+
+void ThermalModel::startSegment(unsigned long now, int16_t temp) {
+    segmentStarted = true;
+    segmentTemp = temp;
+    segmentStart = now;
+}
+
+void ThermalModel::addSample(ACState state, long milliPerMinute) {
+    milliPerMinute = constrain(milliPerMinute, -32000L, 32000L);
+    if (samples[state] == 0) {
+        rates[state] = milliPerMinute;
+    } else {
+        rates[state] += (milliPerMinute - rates[state]) >> RATE_SHIFT;
+    }
+    if (samples[state] < 255) {
+        samples[state]++;
+    }
+}
+
+// Called with the state the AC was in while temp was read
+void ThermalModel::observe(unsigned long now, float temp, ACState state) {
+    int16_t tenths = (int16_t)round(temp * 10);
+    if (state != segmentState) {
+        segmentState = state;
+        segmentStarted = false;
+        lastTemp = tenths;
+        return;
+    }
+    if (!segmentStarted) {
+        if (tenths != lastTemp) {
+            startSegment(now, tenths);
+        }
+        return;
+    }
+    unsigned long elapsed = now - segmentStart;
+    if (abs(tenths - segmentTemp) >= MIN_CHANGE) {
+        if (elapsed > 0) {
+            // Milli-degrees per minute. Whole seconds keep the product within
+            // 32 bits for any change an int16_t holds; a segment lasts minutes.
+            unsigned long seconds = max(elapsed / 1000, 1UL);
+            addSample(state, (long)(tenths - segmentTemp) * 100 * 60 / (long)seconds);
+        }
+        startSegment(now, tenths);
+    } else if (elapsed > MAX_SEGMENT_MS) {
+        addSample(state, 0);
+        startSegment(now, tenths);
+    }
+}
+
+// Minutes the AC needs to move the room from one temperature to another, or
+// UNKNOWN if it hasn't been seen to make progress in that direction yet
+int ThermalModel::minutesToReach(float from, float to) const {
+    long delta = (long)round((to - from) * 10) * 100;
+    if (delta == 0) {
+        return 0;
+    }
+    ACState state = delta > 0 ? HEATING : COOLING;
+    long milliPerMinute = samples[state] ? rates[state] : 0;
+    if ((delta > 0 && milliPerMinute <= 0) || (delta < 0 && milliPerMinute >= 0)) {
+        return UNKNOWN;
+    }
+    long minutes = (delta + milliPerMinute - (delta > 0 ? 1 : -1)) / milliPerMinute;
+    return minutes > MAX_MINUTES ? MAX_MINUTES : (int)minutes;
+}
+
+// ---- src/impl/Watchdog.cpp ----
+#ifdef __AVR__
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#define NOINIT __attribute__((section(".noinit")))
+#else
+#define NOINIT
+#endif
+
+static const uint16_t CRASH_MAGIC = 0xC0DE;
+static const uint8_t NO_PHASE = 0xFF;
+
+static const char PHASE_NAMES[PHASE_COUNT][10] PROGMEM = {
+    "SETUP", "WAKE", "INPUT", "COMMANDS", "ROOMS", "MENU", "CLOCK", "BUS", "TELEMETRY"
+};
+static const char RESET_NAMES[][9] PROGMEM = {
+    "POWER_ON", "EXTERNAL", "BROWNOUT", "WATCHDOG", "UNKNOWN"
+};
+// Soft deadlines in ms; MENU includes the 200 ms button debounce delays.
+// WAKE is not checked, on idle passes it runs until the next wake-up.
+static const uint16_t PHASE_DEADLINE_MS[PHASE_COUNT] PROGMEM = {
+    0, 0, 10, 20, 100, 300, 50, 5, 10
+};
+
+INSTANCE_STATE CrashRecord crashRecord NOINIT;
+INSTANCE_STATE Watchdog watchdog;
+
+#ifdef __AVR__
+static uint8_t resetFlags NOINIT;
+
+// Runs before the C runtime starts. After a watchdog reset the watchdog
+// stays enabled, so it has to be stopped before anything slow happens.
+void captureResetFlags() __attribute__((naked, used, section(".init3")));
+void captureResetFlags() {
+    resetFlags = MCUSR;
+    MCUSR = 0;
+    wdt_disable();
+}
+
+ISR(WDT_vect) {
+    crashRecord.hungPhase = crashRecord.phase;
+}
+#endif
+
+Watchdog::Watchdog() : cause(RESET_POWER_ON), phaseStart(0), timing(false), overruns(0), worstPhase(NO_PHASE), worstMs(0) {
+    memset(&previous, 0, sizeof(previous));
+    previous.hungPhase = NO_PHASE;
+}
+
+void Watchdog::begin() {
+    bool valid = crashRecord.magic == CRASH_MAGIC;
+    if (valid) {
+        previous = crashRecord;
+    }
+#ifdef __AVR__
+    // Optiboot may already have cleared MCUSR, the crash record doesn't lie
+    if ((valid && previous.hungPhase != NO_PHASE) || (resetFlags & _BV(WDRF))) {
+        cause = RESET_WATCHDOG;
+    } else if (resetFlags & _BV(BORF)) {
+        cause = RESET_BROWN_OUT;
+    } else if (resetFlags & _BV(EXTRF)) {
+        cause = RESET_EXTERNAL;
+    } else if ((resetFlags & _BV(PORF)) || !valid) {
+        cause = RESET_POWER_ON;
+    } else {
+        cause = RESET_UNKNOWN;
+    }
+#else
+    cause = (valid && previous.hungPhase != NO_PHASE) ? RESET_WATCHDOG : RESET_POWER_ON;
+#endif
+    crashRecord.magic = CRASH_MAGIC;
+    crashRecord.phase = PHASE_SETUP;
+    crashRecord.hungPhase = NO_PHASE;
+    crashRecord.loops = 0;
+    phaseStart = millis();
+#ifdef __AVR__
+    wdt_enable(WDTO_1S);
+    WDTCSR |= _BV(WDIE);
+#endif
+}
+
+void Watchdog::endPhase(unsigned long now) {
+    uint8_t phase = crashRecord.phase;
+    unsigned long elapsed = now - phaseStart;
+    uint16_t deadline = pgm_read_word(&PHASE_DEADLINE_MS[phase]);
+    if (deadline > 0 && elapsed > deadline) {
+        overruns++;
+        if (elapsed > worstMs) {
+            worstMs = elapsed > 0xFFFF ? 0xFFFF : elapsed;
+            worstPhase = phase;
+        }
+    }
+}
+
+void Watchdog::enter(LoopPhase phase) {
+    unsigned long now = millis();
+    if (timing) {
+        endPhase(now);
+    }
+    crashRecord.phase = phase;
+    phaseStart = now;
+    timing = true;
+}
+
+// End of loop(): the only place the watchdog gets fed
+void Watchdog::heartbeat() {
+    endPhase(millis());
+    timing = false;
+    crashRecord.loops++;
+#ifdef __AVR__
+    wdt_reset();
+    WDTCSR |= _BV(WDIE);
+#endif
+}
+
+// BOOT <reset cause> <phase the last run was in> <loops it completed>
+bool Watchdog::reportBoot() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    char causeName[9];
+    char phaseName[10];
+    strcpy_P(causeName, RESET_NAMES[cause]);
+    uint8_t lastPhase = previous.hungPhase != NO_PHASE ? previous.hungPhase : previous.phase;
+    bool known = previous.magic == CRASH_MAGIC && lastPhase < PHASE_COUNT;
+    strcpy_P(phaseName, known ? PHASE_NAMES[lastPhase] : PSTR("-"));
+    snprintf_P(buffer, sizeof(buffer), PSTR("BOOT %s %s %lu"), causeName, phaseName, (unsigned long)previous.loops);
+    return telemetry.sendText(buffer);
+}
+
+// HEALTH <loops> <overruns> <worst phase> <worst ms>
+bool Watchdog::reportHealth() {
+    char buffer[TELEMETRY_MAX_FRAME];
+    char phaseName[10];
+    strcpy_P(phaseName, worstPhase < PHASE_COUNT ? PHASE_NAMES[worstPhase] : PSTR("-"));
+    snprintf_P(buffer, sizeof(buffer), PSTR("HEALTH %lu %u %s %u"), (unsigned long)crashRecord.loops, overruns, phaseName, worstMs);
+    return telemetry.sendText(buffer);
+}
+
+// ---- src/impl/general.cpp ----
+INSTANCE_STATE StateStack stateStack;
+INSTANCE_STATE SystemState currentState = WELCOME_SCREEN;
+INSTANCE_STATE byte expanderPinStates = 0x00;
+
+INSTANCE_STATE bool leftButtonPressed = false;
+INSTANCE_STATE bool rightButtonPressed = false;
+INSTANCE_STATE bool backButtonPressed = false;
+INSTANCE_STATE bool scheduleButtonPressed = false;
+INSTANCE_STATE bool lightAdjusted = false;
+INSTANCE_STATE bool tempAdjusted = false;
+INSTANCE_STATE bool scheduleAdjusted = false;
+INSTANCE_STATE bool timeAdjusted = false;
+INSTANCE_STATE bool historyAdjusted = false;
+INSTANCE_STATE bool memoryAdjusted = false;
+
+INSTANCE_STATE unsigned long START_TIME = getMillisFromHour(START_HOUR);
+INSTANCE_STATE unsigned long ADDED_TIME = 0;
+
+void setExpanderPin(int pin, bool state) {
+    stageExpanderPin(pin, state);
+    PCF8574_Write(expanderPinStates);
+}
+
+// Changes the pin in expanderPinStates only; several changes can then go
+// out in one PCF8574_Write()
+void stageExpanderPin(int pin, bool state) {
+    if (state) {
+        expanderPinStates |= (1 << pin);
+    } else {
+        expanderPinStates &= ~(1 << pin);
+    }
+}
+
+void PCF8574_Write(byte data) {
+    i2cBus.write(EXPANDER_ADDRESS, &data, 1);
+    latency.relaysQueued();
+}
+
+void printTemperature(float temp) {
+    int integerPart = (int)temp;
+    int fractionalPart = (int)((temp - integerPart) * 10);
+    char displayStr[10];
+    snprintf_P(displayStr, sizeof(displayStr), PSTR("%d.%d C"), integerPart, fractionalPart);
+    printCentered(displayStr, 1);
+}
+
+void printCentered(const char* text, int row) {
+    int startPos = (16 - strlen(text)) / 2;
+    mainDisplay.setCursor(startPos, row);
+    mainDisplay.print(text);
+}
 
-    sprintf(buffer, "%02d:00 >", nextHour);
-    mainDisplay.setCursor(9, 1);
-    mainDisplay.print(buffer);
+void printCentered_P(PGM_P text, int row) {
+    char buffer[17];
+    strncpy_P(buffer, text, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    printCentered(buffer, row);
 }
 
-void RoomControl::handleRoomSchedule() {
-    if (leftButtonPressed) {
-        selectedHour = (selectedHour == 0) ? 23 : selectedHour - 1;
-        scheduleAdjusted = true;
-        delay(200);
-    } else if (rightButtonPressed) {
-        selectedHour = (selectedHour + 1) % 24;
-        scheduleAdjusted = true;
-        delay(200);
-    } else if (scheduleButtonPressed) {
-        schedule[selectedHour] = lightIntensity;
-        if (schedule[selectedHour] != 0) {
-            scheduleActive = true;
-        }
-        scheduleAdjusted = true;
-        delay(200);
-    }
+void createChar_P(uint8_t location, const byte* glyph) {
+    byte buffer[8];
+    memcpy_P(buffer, glyph, sizeof(buffer));
+    mainDisplay.createChar(location, buffer);
 }
 
-void RoomControl::checkSchedule() {
-    int currentHour = hour();
-    int scheduledLight = schedule[currentHour];
-    bool shouldUpdate = scheduledLight != 0 && scheduledLight != lightIntensity;
+String getTimestamp() {
+    unsigned long millisec = currentTime();
+    unsigned long hours = (millisec / 3600000) % 24;
+    unsigned long mins = (millisec / 60000) % 60;
+    unsigned long secs = (millisec / 1000) % 60;
+    unsigned long ms = millisec % 1000;
 
-    if (shouldUpdate && currentHour != hourOverride) {
-        lightIntensity = scheduledLight;
-        scheduleActive = true;
-        updateNeoPixelBrightness(false);
-    } else if (scheduledLight == 0 && scheduleActive) {
-        deactivateSchedule();
-    }
-    if (currentHour != hourOverride && hourOverride != -1) {
-        resetRoomOverride();
-    }
-}
+    char formattedTime[13]; // Buffer to hold formatted time string
+    sprintf_P(formattedTime, PSTR("%02lu:%02lu:%02lu.%03lu"), hours, mins, secs, ms);
 
-void RoomControl::deactivateSchedule() {
-    scheduleActive = false;
-    lightIntensity = 0;
-    updateNeoPixelBrightness(false);
+    return String(formattedTime);
 }
 
-void RoomControl::resetRoomOverride() {
-    hourOverride = -1;
-    inactive = false;
-    peoplePresent = true;
-    lastMotionTime = currentTime();
+unsigned long currentTime() {
+    return currentTimeAt(millis());
 }
 
-void RoomControl::detectRoomMotion(bool motionDetected) {
-    unsigned long timeDiff = currentTime() - lastMotionTime;
-
-    if (motionDetected && (timeDiff > 2000)) {
-        lastMotionTime = currentTime();
-        autoLightEnabled = true;
-        peoplePresent = true;
-    }
-    if (peoplePresent && !scheduleActive && hour() != hourOverride) {
-        handleInactivity();
-    }
+// Clock time of an earlier millis() reading
+unsigned long currentTimeAt(unsigned long ms) {
+    return ms + START_TIME + ADDED_TIME;
 }
 
-void RoomControl::handleInactivity() {
-    unsigned long timeDiff = currentTime() - lastMotionTime;
+unsigned long getMillisFromHour(int hour) {
+    return (unsigned long)hour * 60 * 60 * 1000;
+}
 
-    if (timeDiff > 20000 && inactive) { // 20 seconds of inactivity
-        if (lightIntensity != 0) {
-            lightIntensity = 0;
-            updateNeoPixelBrightness(true);
-        }
-        peoplePresent = false;
-        inactive = false;
-    } else if (timeDiff > 15000 && !inactive) { // 15 seconds of inactivity
-        if (targetTemp != 18.0) {
-            targetTemp = 18.0;
-            tempAdjusted = true;
-        }
-        if (lightIntensity > 0) {
-            lightIntensity = (lightIntensity > 1) ? 1 : 0;
-            updateNeoPixelBrightness(true);
-        }
-        inactive = true;
-    }
+int hour() {
+    return (currentTime() / 3600000) % 24;
 }
 
-bool RoomControl::shouldUpdate() {
-    autoAdjustLight();
-    autoUpdateTemperature();
-    checkSchedule();
-    detectRoomMotion(digitalRead(config.pirPin));
-    if (lightAdjusted && (currentState == ROOM_LIGHT_CONTROL)) {
-        return true;
-    }
-    if (tempAdjusted && (currentState == ROOM_TEMP_CONTROL)) {
-        return true;
-    }
-    if (scheduleAdjusted && (currentState == ROOM_SCHEDULE)) {
-        return true;
-    }
-    return false;
+int minute() {
+    return (currentTime() / 60000) % 60;
 }
 
+// ---- src/impl/main.cpp ----
+// Hardware
+INSTANCE_STATE LiquidCrystal mainDisplay(12, 13, 11, 10, 9, 8);
+INSTANCE_STATE Adafruit_NeoPixel strip(LIGHT_STRIP_PIXELS, LIGHT_STRIP_PIN, NEO_GRB + NEO_KHZ800);
+INSTANCE_STATE Adafruit_7segment clockDisplay = Adafruit_7segment();
+INSTANCE_STATE unsigned long TIME_WHEEL_RANGE = getMillisFromHour(4);
+INSTANCE_STATE int lastTimeWheelValue = 0;
+INSTANCE_STATE int8_t selectedScene = 0;
+
+// Custom characters for the LCD, copied out of flash when they are created
+const byte solidBlock[8] PROGMEM = {
+    B11111,
+    B11111,
+    B11111,
+    B11111,
+    B11111,
+    B11111,
+    B11111,
+    B11111 };
+const byte arrowUp[8] PROGMEM = {
+    B00100,
+    B01110,
+    B11111,
+    B00100,
+    B00100,
+    B00100,
+    B00100,
+    B00000 };
+const byte arrowDown[8] PROGMEM = {
+    B00100,
+    B00100,
+    B00100,
+    B00100,
+    B11111,
+    B01110,
+    B00100,
+    B00000 };
+
+// Rooms
+static const char ROOM1_NAME[] PROGMEM = "Room 1";
+static const char ROOM2_NAME[] PROGMEM = "Room 2";
+INSTANCE_STATE RoomControl room1(ROOM1_NAME, RoomConfig(ROOM1_TEMP_SENSOR_PIN, ROOM1_HEATING_PIN, ROOM1_COOLING_PIN, ROOM1_PIR_PIN, ROOM1_LIGHT_STRIP_IND, ROOM1_LIGHT_STRIP_LEN, LIGHT_BAR));
+INSTANCE_STATE RoomControl room2(ROOM2_NAME, RoomConfig(ROOM2_TEMP_SENSOR_PIN, ROOM2_HEATING_PIN, ROOM2_COOLING_PIN, ROOM2_PIR_PIN, ROOM2_LIGHT_STRIP_IND, ROOM2_LIGHT_STRIP_LEN, LIGHT_BAR));
+INSTANCE_STATE RoomControl* const rooms[ROOM_COUNT] = { &room1, &room2 };
+static_assert(ROOM_COUNT <= TELEMETRY_MAX_ROOMS, "telemetry would leave rooms out");
+
 void displayWelcomeScreen() {
     room1.isDisplayed = false;
     room2.isDisplayed = false;
-    printCentered(" Welcome Artem! ", 0);
-    printCentered("<Room 1  Room 2>", 1);
+    printCentered_P(PSTR(" Welcome Artem! "), 0);
+    printCentered_P(PSTR("<Room 1  Room 2>"), 1);
 }
 
 void handleWelcomeScreen() {
@@ -497,9 +4607,68 @@ void handleWelcomeScreen() {
         room2.display();
         mainDisplay.clear();
         delay(200);
+    } else if (scheduleButtonPressed) {
+        stateStack.push(SYSTEM_MENU);
+        mainDisplay.clear();
+        delay(200);
+    }
+}
+
+void displaySystemMenu() {
+    printCentered_P(PSTR("House"), 0);
+    printCentered_P(PSTR("<Scenes  Memory>"), 1);
+}
+
+void handleSystemMenu() {
+    if (leftButtonPressed) {
+        selectedScene = max(scenes.lastApplied(), (int8_t)0);
+        adjustRepeat.suppress();
+        stateStack.push(SCENE_MENU);
+        mainDisplay.clear();
+        delay(200);
+    } else if (rightButtonPressed) {
+        stateStack.push(DIAGNOSTICS);
+        mainDisplay.clear();
+        delay(200);
+    }
+}
+
+// Selected scene between arrows, and whether it is the one in effect
+void displaySceneMenu() {
+    Scene scene;
+    scenes.load(selectedScene, scene);
+    mainDisplay.clear();
+    mainDisplay.print(F("<"));
+    printCentered(scene.name, 0);
+    mainDisplay.setCursor(15, 0);
+    mainDisplay.print(F(">"));
+    printCentered_P(selectedScene == scenes.lastApplied() ? PSTR("active") : PSTR("Sched: apply"), 1);
+    latency.output(OUTPUT_LCD);
+}
+
+void handleSceneMenu() {
+    int8_t direction = (rightButtonPressed ? 1 : 0) - (leftButtonPressed ? 1 : 0);
+    if (adjustRepeat.steps(direction, millis(), SINGLE_PRESS) != 0) {
+        selectedScene = scenes.next(selectedScene, direction);
+        displaySceneMenu();
+    } else if (scheduleButtonPressed) {
+        scenes.apply(selectedScene, rooms, ROOM_COUNT);
+        displaySceneMenu();
+        delay(200);
     }
 }
 
+// SRAM budget: free now/lowest ever, then static data, heap and stack peak
+void displayDiagnostics() {
+    char buffer[24];
+    snprintf_P(buffer, sizeof(buffer), PSTR("Free %u/%u"), memoryMonitor.freeNow(), memoryMonitor.minFree());
+    mainDisplay.clear();
+    printCentered(buffer, 0);
+    snprintf_P(buffer, sizeof(buffer), PSTR("D%u H%u S%u"), memoryMonitor.staticBytes(), memoryMonitor.heapBytes(),
+             memoryMonitor.stackPeak());
+    printCentered(buffer, 1);
+}
+
 void displayCurrentMenu() {
     RoomControl& room = (room1.isDisplayed) ? room1 : room2;
     switch (currentState) {
@@ -518,7 +4687,23 @@ void displayCurrentMenu() {
     case ROOM_SCHEDULE:
         room.displayRoomSchedule();
         break;
+    case ROOM_HISTORY:
+        room.displayRoomHistory();
+        break;
+    case ROOM_STATS:
+        room.displayRoomStats();
+        break;
+    case SYSTEM_MENU:
+        displaySystemMenu();
+        break;
+    case DIAGNOSTICS:
+        displayDiagnostics();
+        break;
+    case SCENE_MENU:
+        displaySceneMenu();
+        break;
     }
+    latency.output(OUTPUT_LCD);
 }
 
 void handleCurrentMenu() {
@@ -539,6 +4724,21 @@ void handleCurrentMenu() {
     case ROOM_SCHEDULE:
         room.handleRoomSchedule();
         break;
+    case ROOM_HISTORY:
+        room.handleRoomHistory();
+        break;
+    case ROOM_STATS:
+        // View only; back returns to the history
+        break;
+    case SYSTEM_MENU:
+        handleSystemMenu();
+        break;
+    case DIAGNOSTICS:
+        // View only; back returns to the house menu
+        break;
+    case SCENE_MENU:
+        handleSceneMenu();
+        break;
     }
 }
 
@@ -547,24 +4747,16 @@ void displayCurrentTime() {
     if ((currentTime() % 60000) > 1000 && !timeAdjusted) {
         return;
     }
-    clockDisplay.clear();
-
-    int currentHour = hour();
-    int currentMinute = minute();
-
-    char timeStr[5]; // HHMM format
-    sprintf(timeStr, "%02d%02d", currentHour, currentMinute);
-
-    clockDisplay.drawColon(true);
-    clockDisplay.println(timeStr);
-    clockDisplay.writeDisplay();
-
+    // Only digits that differ from what the display shows are sent
+    segmentClock.show(hour(), minute());
     timeAdjusted = false;
 }
 
 void updateStartTime() {
-    unsigned long potValue = analogRead(TIME_WHEEL_PIN);
-    if (potValue != lastTimeWheelValue) {
+    int potValue = analogRead(TIME_WHEEL_PIN);
+    // Ignore ADC noise around the wheel's position, but still reach both ends
+    bool atEnd = (potValue == 0 || potValue == 1023) && potValue != lastTimeWheelValue;
+    if (abs(potValue - lastTimeWheelValue) > TIME_WHEEL_DEADBAND || atEnd) {
         ADDED_TIME = (unsigned long)((float)potValue / 1023.0 * TIME_WHEEL_RANGE);
         lastTimeWheelValue = potValue;
         timeAdjusted = true;
@@ -572,40 +4764,82 @@ void updateStartTime() {
 }
 
 void loop() {
+    watchdog.enter(PHASE_WAKE);
+    inputTrace.samplePins();
+    motionSensors.poll();
+    if (!power.wait()) {
+        return;
+    }
+    watchdog.enter(PHASE_INPUT);
     leftButtonPressed = !digitalRead(LEFT_BUTTON_PIN);
     rightButtonPressed = !digitalRead(RIGHT_BUTTON_PIN);
     backButtonPressed = !digitalRead(BACK_BUTTON_PIN);
     scheduleButtonPressed = !digitalRead(SCHEDULE_BUTTON_PIN);
+    latency.buttons(leftButtonPressed | rightButtonPressed << 1 | backButtonPressed << 2 | scheduleButtonPressed << 3,
+        millis());
+    inputTrace.sample();
 
     updateStartTime();
+    watchdog.enter(PHASE_COMMANDS);
+    commands.poll(rooms, ROOM_COUNT);
 
+    watchdog.enter(PHASE_ROOMS);
     if (backButtonPressed && stateStack.isHistoryAvailable()) {
         stateStack.pop();
         mainDisplay.clear();
         delay(200);
     }
-    if (currentState != stateStack.topState() || room1.shouldUpdate() || room2.shouldUpdate()) {
+    if (currentState != stateStack.topState() || room1.shouldUpdate() || room2.shouldUpdate()
+        || (memoryAdjusted && currentState == DIAGNOSTICS)) {
         currentState = stateStack.topState();
         displayCurrentMenu();
         lightAdjusted = false;
         tempAdjusted = false;
         scheduleAdjusted = false;
+        historyAdjusted = false;
+        memoryAdjusted = false;
     }
+    power.updateDisplays(rooms, ROOM_COUNT, leftButtonPressed || rightButtonPressed || backButtonPressed || scheduleButtonPressed);
+    watchdog.enter(PHASE_MENU);
     handleCurrentMenu();
+    watchdog.enter(PHASE_CLOCK);
     displayCurrentTime();
+    watchdog.enter(PHASE_BUS);
+    i2cBus.service();
+    latency.endPass();
+
+    watchdog.enter(PHASE_TELEMETRY);
+    telemetry.sample(rooms, ROOM_COUNT);
+    if (memoryMonitor.service()) {
+        memoryAdjusted = true;
+    }
+    inputTrace.service();
+    telemetry.pump();
+    watchdog.heartbeat();
+    power.done();
 }
 
 void setup() {
-    Serial.begin(9600);
+    // Relays off before anything else: the expander powers up with all
+    // outputs high, and after a reset they may still be latched on
+    watchdog.begin();
     Wire.begin();
+    i2cBus.begin();
+    // The PCF8574 is only specified for standard mode
+    i2cBus.addDevice(EXPANDER_ADDRESS, I2CBus::STANDARD_MODE);
+    i2cBus.addDevice(CLOCK_ADDRESS, I2CBus::FAST_MODE);
+    PCF8574_Write(expanderPinStates);
+    i2cBus.flush();
+    Serial.begin(9600);
+    watchdog.reportBoot();
 
     clockDisplay.begin(CLOCK_ADDRESS);
     clockDisplay.setBrightness(15);
 
     mainDisplay.begin(16, 2);
-    mainDisplay.createChar(0, solidBlock);
-    mainDisplay.createChar(1, arrowUp);
-    mainDisplay.createChar(2, arrowDown);
+    createChar_P(0, solidBlock);
+    createChar_P(1, arrowUp);
+    createChar_P(2, arrowDown);
 
     pinMode(TIME_WHEEL_PIN, INPUT);
     pinMode(PHOTO_RESISTOR_PIN, INPUT);
@@ -613,110 +4847,20 @@ void setup() {
     pinMode(RIGHT_BUTTON_PIN, INPUT_PULLUP);
     pinMode(BACK_BUTTON_PIN, INPUT_PULLUP);
     pinMode(SCHEDULE_BUTTON_PIN, INPUT_PULLUP);
+    power.addWakePin(LEFT_BUTTON_PIN);
+    power.addWakePin(RIGHT_BUTTON_PIN);
+    power.addWakePin(BACK_BUTTON_PIN);
+    power.addWakePin(SCHEDULE_BUTTON_PIN);
 
     room1.init();
     room2.init();
+    power.addWakePin(room1.config.pirPin);
+    power.addWakePin(room2.config.pirPin);
 
     strip.begin();
     strip.show();
 
     stateStack.push(WELCOME_SCREEN);
     displayCurrentMenu();
-}
-
-// HELPER FUNCTIONS
-
-StateStack::StateStack() : top(-1) {}
-
-void StateStack::push(SystemState state) {
-    if (top < MAX_STACK_SIZE - 1) {
-        stack[++top] = state;
-    }
-}
-
-void StateStack::pop() {
-    if (top >= 0) {
-        top--;
-    }
-}
-
-SystemState StateStack::topState() const {
-    if (top >= 0) {
-        return stack[top];
-    }
-    return WELCOME_SCREEN;
-}
-
-bool StateStack::isHistoryAvailable() const {
-    return top > 0;
-}
-
-int StateStack::size() const {
-    return top + 1;
-}
-
-int mapOutdoorLighting(int lightReading) {
-    if (lightReading < 380) {
-        return 4;
-    } else {
-        return map(lightReading, 380, 679, 3, 0);
-    }
-}
-
-void printTemperature(float temp) {
-    int integerPart = (int)temp;
-    int fractionalPart = (int)((temp - integerPart) * 10);
-    char displayStr[10];
-    snprintf(displayStr, sizeof(displayStr), "%d.%d C", integerPart, fractionalPart);
-    printCentered(displayStr, 1);
-}
-
-void printCentered(const char* text, int row) {
-    int startPos = (16 - strlen(text)) / 2;
-    mainDisplay.setCursor(startPos, row);
-    mainDisplay.print(text);
-}
-
-String getTimestamp() {
-    unsigned long millisec = currentTime();
-    unsigned long hours = (millisec / 3600000) % 24;
-    unsigned long mins = (millisec / 60000) % 60;
-    unsigned long secs = (millisec / 1000) % 60;
-    unsigned long ms = millisec % 1000;
-
-    char formattedTime[13]; // Buffer to hold formatted time string
-    sprintf(formattedTime, "%02lu:%02lu:%02lu.%03lu", hours, mins, secs, ms);
-
-    return String(formattedTime);
-}
-
-unsigned long currentTime() {
-    return (unsigned long)millis() + START_TIME + ADDED_TIME;
-}
-
-unsigned long getMillisFromHour(int hour) {
-    return (unsigned long)hour * 60 * 60 * 1000;
-}
-
-int hour() {
-    return (currentTime() / 3600000) % 24;
-}
-
-int minute() {
-    return (currentTime() / 60000) % 60;
-}
-
-void setExpanderPin(int pin, bool state) {
-    if (state) {
-        expanderPinStates |= (1 << pin);
-    } else {
-        expanderPinStates &= ~(1 << pin);
-    }
-    PCF8574_Write(expanderPinStates);
-}
-
-void PCF8574_Write(byte data) {
-    Wire.beginTransmission(EXPANDER_ADDRESS);
-    Wire.write(data);
-    Wire.endTransmission();
+    memoryMonitor.scan();
 }
@@ -0,0 +1,48 @@
+#ifndef SERIAL_PORT_H
+#define SERIAL_PORT_H
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Opens a serial device (or PTY) in raw mode. Regular files and pipes are
+// opened as-is so captured streams can be decoded offline. Returns -1 on error.
+inline int openSerialPort(const char* path, speed_t baud, bool nonBlocking = false) {
+    int fd = open(path, O_RDWR | O_NOCTTY | (nonBlocking ? O_NONBLOCK : 0));
+    if (fd < 0) {
+        fd = open(path, O_RDONLY | (nonBlocking ? O_NONBLOCK : 0));
+        return fd;
+    }
+    if (!isatty(fd)) {
+        return fd;
+    }
+    termios tty;
+    if (tcgetattr(fd, &tty) != 0) {
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, baud);
+    cfsetospeed(&tty, baud);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cc[VMIN] = 1;
+    tty.c_cc[VTIME] = 0;
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+inline speed_t baudConstant(long baud) {
+    switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    default: return 0;
+    }
+}
+
+#endif // SERIAL_PORT_H
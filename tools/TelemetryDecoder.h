@@ -0,0 +1,160 @@
+#ifndef TELEMETRY_DECODER_H
+#define TELEMETRY_DECODER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "TelemetryFormat.h"
+
+// Host-side stream decoder for the firmware's telemetry frames. Feed it raw
+// bytes as they arrive; it calls back once per valid record or text frame.
+struct TelemetryRecord {
+    uint8_t seq;
+    int roomCount;
+    int32_t values[TELEMETRY_MAX_FIELDS];
+
+    int32_t room(int index, TelemetryRoomField field) const {
+        return values[GLOBAL_FIELD_COUNT + index * ROOM_FIELD_COUNT + field];
+    }
+};
+
+class TelemetryDecoder {
+public:
+    struct Stats {
+        unsigned long frames = 0;
+        unsigned long badFrames = 0;
+        unsigned long seqGaps = 0;
+        unsigned long skippedDeltas = 0;
+    };
+
+    virtual ~TelemetryDecoder() {}
+
+    void feed(const uint8_t* data, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            if (data[i] != 0) {
+                if (pending.size() < TELEMETRY_MAX_FRAME * 2) {
+                    pending.push_back(data[i]);
+                }
+                continue;
+            }
+            if (!pending.empty()) {
+                handleFrame();
+                pending.clear();
+            }
+        }
+    }
+
+    const Stats& stats() const { return counters; }
+
+protected:
+    virtual void onRecord(const TelemetryRecord& record) = 0;
+    virtual void onText(uint8_t seq, const std::string& text) {}
+    virtual void onTrace(uint8_t seq, const uint8_t* body, size_t len) {}
+
+private:
+    std::vector<uint8_t> pending;
+    TelemetryRecord current = {};
+    bool synced = false;
+    bool haveSeq = false;
+    uint8_t lastSeq = 0;
+    Stats counters;
+
+    void handleFrame() {
+        uint8_t frame[TELEMETRY_MAX_FRAME * 2];
+        size_t len = cobsDecode(pending.data(), pending.size(), frame);
+        if (len < 3 || crc8(frame, len - 1) != frame[len - 1]) {
+            counters.badFrames++;
+            synced = false;
+            return;
+        }
+        len--;
+        counters.frames++;
+        uint8_t seq = frame[1];
+        if (haveSeq && seq != (uint8_t)(lastSeq + 1)) {
+            counters.seqGaps++;
+            synced = false;
+        }
+        haveSeq = true;
+        lastSeq = seq;
+
+        switch (frame[0]) {
+        case FRAME_KEY:
+            if (decodeKey(frame + 2, len - 2)) {
+                current.seq = seq;
+                synced = true;
+                onRecord(current);
+            } else {
+                counters.badFrames++;
+            }
+            break;
+        case FRAME_DELTA:
+            if (!synced) {
+                counters.skippedDeltas++;
+            } else if (decodeDelta(frame + 2, len - 2)) {
+                current.seq = seq;
+                onRecord(current);
+            } else {
+                counters.badFrames++;
+                synced = false;
+            }
+            break;
+        case FRAME_TEXT:
+            onText(seq, std::string((const char*)frame + 2, len - 2));
+            break;
+        case FRAME_TRACE:
+            onTrace(seq, frame + 2, len - 2);
+            break;
+        default:
+            counters.badFrames++;
+            break;
+        }
+    }
+
+    bool decodeKey(const uint8_t* body, size_t len) {
+        if (len < 1 || body[0] > TELEMETRY_MAX_ROOMS) {
+            return false;
+        }
+        TelemetryRecord next = current;
+        next.roomCount = body[0];
+        size_t pos = 1;
+        int fieldCount = GLOBAL_FIELD_COUNT + next.roomCount * ROOM_FIELD_COUNT;
+        for (int i = 0; i < fieldCount; i++) {
+            uint32_t raw;
+            size_t used = getVarint(body + pos, len - pos, &raw);
+            if (used == 0) {
+                return false;
+            }
+            pos += used;
+            next.values[i] = zigzagDecode(raw);
+        }
+        current = next;
+        return pos == len;
+    }
+
+    bool decodeDelta(const uint8_t* body, size_t len) {
+        uint32_t mask;
+        size_t pos = getVarint(body, len, &mask);
+        if (pos == 0) {
+            return false;
+        }
+        TelemetryRecord next = current;
+        int fieldCount = GLOBAL_FIELD_COUNT + next.roomCount * ROOM_FIELD_COUNT;
+        for (int i = 0; i < fieldCount; i++) {
+            if (!(mask & (1UL << i))) {
+                continue;
+            }
+            uint32_t raw;
+            size_t used = getVarint(body + pos, len - pos, &raw);
+            if (used == 0) {
+                return false;
+            }
+            pos += used;
+            next.values[i] += zigzagDecode(raw);
+        }
+        current = next;
+        return pos == len;
+    }
+};
+
+#endif // TELEMETRY_DECODER_H
@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+"""Merges src/include and src/impl into a single translation unit.
+
+    tools/amalgamate.py                      regenerate tinkercad/upload.cpp
+    tools/amalgamate.py --check              fail if tinkercad/upload.cpp is stale
+    tools/amalgamate.py --sketch build/unity write an Arduino sketch for a unity build
+    arduino-cli compile --fqbn arduino:avr:uno build/unity
+    tools/amalgamate.py --namespace reference --source ../old/src --output build/reference.cpp
+
+Every .cpp is copied in name order. A project header is inlined at its
+first #include, after the headers it includes itself, and left out after
+that; its include guard is dropped. Library includes are kept, but a
+top-level one that already appeared is not repeated. File-scope statics
+share one namespace in the result, so two files defining the same one is
+an error rather than a silent clash.
+
+The sketch keeps #line directives so compiler messages point into src/.
+
+--namespace wraps the firmware in a namespace, with the library includes
+hoisted in front of it, so two versions of the firmware can be linked into
+one host program (see host/lockstep.cpp). Only unconditional library
+includes are hoisted, which is enough for host builds. --source takes the
+src directory of another checkout.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SOURCE_DIR = os.path.join(ROOT, "src")
+TINKERCAD_OUTPUT = os.path.join(ROOT, "tinkercad", "upload.cpp")
+
+INCLUDE = re.compile(r'^\s*#\s*include\s*([<"])([^>"]+)[>"]')
+CONDITIONAL_START = re.compile(r"^\s*#\s*if")
+CONDITIONAL_END = re.compile(r"^\s*#\s*endif")
+GUARD_START = re.compile(r"^#ifndef\s+(\w+)\s*\n#define\s+\1\s*\n")
+GUARD_END = re.compile(r"\n#endif[^\n]*\s*$")
+STATIC = re.compile(r"^static\s+(?:(?:inline|const|volatile)\s+)*[\w:<>]+[\s*&]+(\w+)\s*[(\[=;]", re.M)
+
+HEADER = """\
+// Generated by tools/amalgamate.py from src/include and src/impl.
+// Do not edit; change the sources and run the script again.
+"""
+
+
+class Amalgamation:
+    def __init__(self, source_dir, line_directives, namespace):
+        self.source_dir = source_dir
+        self.include_dir = os.path.join(source_dir, "include")
+        self.line_directives = line_directives
+        self.namespace = namespace
+        self.includes = []
+        self.lines = []
+        self.headers = set()
+        self.libraries = set()
+        self.statics = {}
+
+    def relative(self, path):
+        return os.path.relpath(path, os.path.dirname(self.source_dir))
+
+    def add_header(self, name):
+        if name in self.headers:
+            return
+        self.headers.add(name)
+        path = os.path.join(self.include_dir, name)
+        with open(path) as f:
+            text = f.read()
+        first_line = 1
+        guard = GUARD_START.match(text)
+        if guard and GUARD_END.search(text):
+            first_line += text[:guard.end()].count("\n")
+            text = GUARD_END.sub("", text[guard.end():])
+        self.walk(path, text, first_line)
+
+    def add_source(self, path):
+        with open(path) as f:
+            text = f.read()
+        for name in STATIC.findall(text):
+            if name in self.statics:
+                sys.exit("%s: static %s is also defined in %s"
+                         % (self.relative(path), name, self.statics[name]))
+            self.statics[name] = self.relative(path)
+        self.walk(path, text, 1)
+
+    def walk(self, path, text, first_line):
+        # Headers are inlined where they are included, so the file's banner
+        # (and #line) is repeated before the first line that follows one
+        pending = True
+        depth = 0
+        for number, line in enumerate(text.rstrip("\n").split("\n"), first_line):
+            if CONDITIONAL_START.match(line):
+                depth += 1
+            elif CONDITIONAL_END.match(line):
+                depth -= 1
+            match = INCLUDE.match(line)
+            if match and os.path.exists(os.path.join(self.include_dir, match.group(2))):
+                name = match.group(2)
+                if depth > 0:
+                    sys.exit("%s:%d: project header %s is included conditionally"
+                             % (self.relative(path), number, name))
+                if name not in self.headers:
+                    self.add_header(name)
+                    pending = True
+                continue
+            if match and depth == 0:
+                if match.group(2) in self.libraries:
+                    continue
+                self.libraries.add(match.group(2))
+                if self.namespace:
+                    self.includes.append(line)
+                    continue
+            if pending:
+                if not line.strip():
+                    continue
+                self.lines.append("")
+                self.lines.append("// ---- %s ----" % self.relative(path))
+                if self.line_directives:
+                    self.lines.append('#line %d "%s"' % (number, self.relative(path)))
+                pending = False
+            self.lines.append(line)
+
+    def text(self):
+        body = "\n".join(self.lines).lstrip("\n")
+        if self.namespace:
+            body = "%s\n\nnamespace %s {\n\n%s\n\n} // namespace %s" % (
+                "\n".join(self.includes), self.namespace, body, self.namespace)
+        return HEADER + body + "\n"
+
+
+def amalgamate(line_directives, source_dir=SOURCE_DIR, namespace=None):
+    result = Amalgamation(source_dir, line_directives, namespace)
+    impl_dir = os.path.join(source_dir, "impl")
+    for name in sorted(os.listdir(impl_dir)):
+        if name.endswith(".cpp"):
+            result.add_source(os.path.join(impl_dir, name))
+    return result.text()
+
+
+def write_if_changed(path, text):
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == text:
+                return
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, "w") as f:
+        f.write(text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--check", action="store_true",
+                        help="exit non-zero if tinkercad/upload.cpp does not match src/")
+    parser.add_argument("--sketch", metavar="DIR",
+                        help="write an Arduino sketch folder instead of tinkercad/upload.cpp")
+    parser.add_argument("--namespace", metavar="NAME",
+                        help="wrap the firmware in a namespace; needs --output")
+    parser.add_argument("--source", metavar="DIR", default=SOURCE_DIR,
+                        help="src directory to read (default: this checkout's)")
+    parser.add_argument("--output", metavar="FILE",
+                        help="write the translation unit here instead of tinkercad/upload.cpp")
+    args = parser.parse_args()
+    source = os.path.abspath(args.source)
+
+    if args.namespace or args.output:
+        if not (args.namespace and args.output) or args.check or args.sketch:
+            parser.error("--namespace and --output go together, without --check or --sketch")
+        write_if_changed(args.output, amalgamate(True, source, args.namespace))
+        return 0
+
+    if args.sketch:
+        # The .ino is only there to make the folder a sketch; all code is in
+        # the .cpp so the IDE does not generate prototypes for it
+        sketch = os.path.abspath(args.sketch)
+        name = os.path.basename(sketch)
+        write_if_changed(os.path.join(sketch, name + ".ino"), HEADER)
+        write_if_changed(os.path.join(sketch, "firmware.cpp"), amalgamate(True, source))
+        return 0
+
+    text = amalgamate(False, source)
+    if args.check:
+        with open(TINKERCAD_OUTPUT) as f:
+            if f.read() != text:
+                print("tinkercad/upload.cpp is out of date; run tools/amalgamate.py", file=sys.stderr)
+                return 1
+        return 0
+    write_if_changed(TINKERCAD_OUTPUT, text)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
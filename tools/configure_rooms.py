@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""Uploads schedules and setpoints for every room in one batched write.
+
+    tools/configure_rooms.py /dev/ttyACM0 rooms.json [--dump]
+
+rooms.json:
+    {
+        "time": "08:30",
+        "rooms": {
+            "1": {"target": 21.5, "light": 2, "schedule": "000000003333000000444400"},
+            "2": {"target": 19.0, "schedule": [0, 0, 0, 0, 0, 0, 2, 2, 0, 0, 0, 0,
+                                                0, 0, 0, 0, 0, 0, 4, 4, 3, 1, 0, 0]}
+        }
+    }
+
+Every command line is answered with one TEXT telemetry frame, and DUMP
+with several ending in "DUMP <rooms>"; the script prints the replies and
+exits non-zero if any of them is an error.
+"""
+
+import argparse
+import json
+import os
+import select
+import sys
+import termios
+import time
+
+FRAME_TEXT = 0x03
+
+
+def crc8(data):
+    crc = 0
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def open_port(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    if os.isatty(fd):
+        attrs = termios.tcgetattr(fd)
+        attrs[0] = 0
+        attrs[1] = 0
+        attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        attrs[3] = 0
+        speed = getattr(termios, "B%d" % baud)
+        attrs[4] = speed
+        attrs[5] = speed
+        termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+def parse_time(value):
+    if isinstance(value, int):
+        return value
+    hours, minutes = value.split(":")
+    return int(hours) * 60 + int(minutes)
+
+
+def build_commands(config):
+    lines = []
+    if "time" in config:
+        # The firmware offset is added to its 08:00 start time
+        offset = (parse_time(config["time"]) - 8 * 60) % (24 * 60)
+        lines.append("SET TIME %d" % offset)
+    for room, settings in sorted(config.get("rooms", {}).items()):
+        if "schedule" in settings:
+            schedule = settings["schedule"]
+            if not isinstance(schedule, str):
+                schedule = "".join(str(level) for level in schedule)
+            lines.append("SET %s SCHED %s" % (room, schedule))
+        if "target" in settings:
+            lines.append("SET %s TARGET %.1f" % (room, settings["target"]))
+        if "light" in settings:
+            lines.append("SET %s LIGHT %d" % (room, settings["light"]))
+    return lines
+
+
+def read_replies(fd, done, timeout):
+    replies = []
+    pending = bytearray()
+    deadline = time.monotonic() + timeout
+    while not done(replies):
+        remaining = deadline - time.monotonic()
+        if remaining <= 0:
+            break
+        ready, _, _ = select.select([fd], [], [], remaining)
+        if not ready:
+            break
+        for byte in os.read(fd, 256):
+            if byte != 0:
+                pending.append(byte)
+                continue
+            frame = cobs_decode(bytes(pending))
+            pending.clear()
+            if not frame or len(frame) < 3 or crc8(frame[:-1]) != frame[-1]:
+                continue
+            if frame[0] == FRAME_TEXT:
+                replies.append(frame[2:-1].decode("ascii", "replace"))
+    return replies
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port")
+    parser.add_argument("config")
+    parser.add_argument("--baud", type=int, default=9600)
+    parser.add_argument("--dump", action="store_true", help="request a full state dump afterwards")
+    parser.add_argument("--timeout", type=float, default=5.0)
+    args = parser.parse_args()
+
+    with open(args.config) as f:
+        config = json.load(f)
+    lines = build_commands(config)
+    expected = len(lines)
+    if args.dump:
+        lines.append("DUMP")
+
+    # The dump's length depends on the controller's room count, so it is
+    # read up to its closing DUMP line
+    def done(replies):
+        if len(replies) < expected:
+            return False
+        return not args.dump or any(reply.startswith("DUMP ") for reply in replies[expected:])
+
+    fd = open_port(args.port, args.baud)
+    os.write(fd, ("\n".join(lines) + "\n").encode("ascii"))
+    replies = read_replies(fd, done, args.timeout)
+    os.close(fd)
+
+    for reply in replies:
+        print(reply)
+    if not done(replies):
+        print("timed out after %d replies" % len(replies), file=sys.stderr)
+        return 1
+    return 1 if any(reply.startswith("ERR") for reply in replies) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,475 @@
+// Serial-to-socket gateway: collects telemetry from one or more controllers
+// and serves it on a local publish/subscribe endpoint, so clients never poll
+// the boards themselves.
+//
+//   g++ -std=c++17 -O2 -Isrc/include -Itools tools/gateway.cpp -o gateway
+//   ./gateway --unix /tmp/ha-gateway.sock --tcp 7878 hall=/dev/ttyACM0 attic=/dev/ttyUSB0
+//   options: --batch-ms N (command batching window, default 50), -b BAUD (default 9600)
+//
+// Clients speak newline terminated text on the socket:
+//   SUB <pattern>          stream "PUB <topic> <value>" for matching topics,
+//                          starting with the cached value of each
+//   UNSUB <pattern>
+//   GET <pattern>          cached values as "VAL <topic> <value>", then "END"
+//   PUB <topic> <value>    publish to other clients (local stand-in broker)
+//   CMD <controller> <command line>
+//                          queue a firmware command; the reply is published
+//                          on <controller>/reply
+//   LIST                   controllers and their link state
+// Patterns follow MQTT rules: '+' matches one level, a trailing '#' the rest.
+//
+// Topics: <controller>/{link,uptime_ms,clock,outdoor_light,reply}
+//         <controller>/room<N>/{temp,target,light,ac,present,inactive,schedule,auto_light,
+//                                 precondition}
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "SerialPort.h"
+#include "TelemetryDecoder.h"
+
+static const size_t CLIENT_OUTPUT_LIMIT = 1 << 20;
+static const uint64_t RECONNECT_MS = 2000;
+
+static volatile sig_atomic_t running = 1;
+
+static uint64_t monotonicMs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool topicMatches(const std::string& pattern, const std::string& topic) {
+    size_t p = 0;
+    size_t t = 0;
+    while (p < pattern.size()) {
+        if (pattern[p] == '#') {
+            return true;
+        }
+        size_t patternEnd = pattern.find('/', p);
+        size_t topicEnd = topic.find('/', t);
+        if (patternEnd == std::string::npos) patternEnd = pattern.size();
+        if (topicEnd == std::string::npos) topicEnd = topic.size();
+        if (t > topic.size()) {
+            return false;
+        }
+        if (pattern.compare(p, patternEnd - p, "+") != 0
+            && pattern.compare(p, patternEnd - p, topic, t, topicEnd - t) != 0) {
+            return false;
+        }
+        p = patternEnd + 1;
+        t = topicEnd + 1;
+    }
+    return t > topic.size();
+}
+
+struct Client {
+    int fd;
+    std::string input;
+    std::string output;
+    std::vector<std::string> subscriptions;
+};
+
+class Gateway;
+
+class Controller : public TelemetryDecoder {
+public:
+    std::string name;
+    std::string path;
+    speed_t baud;
+    int fd = -1;
+    uint64_t retryAt = 0;
+    std::string commandBatch;
+    uint64_t batchDeadline = 0;
+    Gateway* gateway;
+
+    Controller(Gateway* owner, const std::string& controllerName, const std::string& devicePath, speed_t speed)
+        : name(controllerName), path(devicePath), baud(speed), gateway(owner) {}
+
+protected:
+    void onRecord(const TelemetryRecord& record) override;
+    void onText(uint8_t seq, const std::string& text) override;
+};
+
+class Gateway {
+public:
+    std::vector<std::unique_ptr<Controller>> controllers;
+    std::vector<std::unique_ptr<Client>> clients;
+    std::map<std::string, std::string> cache;
+    std::vector<int> listeners;
+    uint64_t batchMs = 50;
+
+    void publish(const std::string& topic, const std::string& value, bool onlyIfChanged) {
+        auto it = cache.find(topic);
+        if (onlyIfChanged && it != cache.end() && it->second == value) {
+            return;
+        }
+        cache[topic] = value;
+        std::string message = "PUB " + topic + " " + value + "\n";
+        for (auto& client : clients) {
+            for (const std::string& pattern : client->subscriptions) {
+                if (topicMatches(pattern, topic)) {
+                    client->output += message;
+                    break;
+                }
+            }
+        }
+    }
+
+    void run() {
+        while (running) {
+            uint64_t now = monotonicMs();
+            reconnectControllers(now);
+            flushBatches(now);
+
+            std::vector<pollfd> fds;
+            for (int listener : listeners) {
+                fds.push_back({ listener, POLLIN, 0 });
+            }
+            for (auto& controller : controllers) {
+                fds.push_back({ controller->fd, POLLIN, 0 });
+            }
+            for (auto& client : clients) {
+                fds.push_back({ client->fd, (short)(POLLIN | (client->output.empty() ? 0 : POLLOUT)), 0 });
+            }
+            if (poll(fds.data(), fds.size(), (int)nextTimeout(now)) < 0 && errno != EINTR) {
+                perror("poll");
+                return;
+            }
+
+            size_t index = 0;
+            size_t clientCount = clients.size();
+            for (int listener : listeners) {
+                if (fds[index++].revents & POLLIN) {
+                    accept(listener);
+                }
+            }
+            for (auto& controller : controllers) {
+                if (fds[index++].revents & (POLLIN | POLLHUP | POLLERR)) {
+                    readController(*controller);
+                }
+            }
+            for (size_t i = 0; i < clientCount; i++) {
+                serviceClient(*clients[i], fds[index++].revents);
+            }
+            dropClosedClients();
+        }
+    }
+
+private:
+    uint64_t nextTimeout(uint64_t now) {
+        uint64_t timeout = 1000;
+        for (auto& controller : controllers) {
+            if (!controller->commandBatch.empty() && controller->fd >= 0) {
+                timeout = std::min(timeout, controller->batchDeadline > now ? controller->batchDeadline - now : 0);
+            }
+            if (controller->fd < 0) {
+                timeout = std::min(timeout, controller->retryAt > now ? controller->retryAt - now : 0);
+            }
+        }
+        return timeout;
+    }
+
+    void reconnectControllers(uint64_t now) {
+        for (auto& controller : controllers) {
+            if (controller->fd >= 0 || now < controller->retryAt) {
+                continue;
+            }
+            controller->fd = openSerialPort(controller->path.c_str(), controller->baud, true);
+            if (controller->fd < 0) {
+                controller->retryAt = now + RECONNECT_MS;
+                continue;
+            }
+            publish(controller->name + "/link", "up", true);
+        }
+    }
+
+    void disconnect(Controller& controller) {
+        close(controller.fd);
+        controller.fd = -1;
+        controller.retryAt = monotonicMs() + RECONNECT_MS;
+        publish(controller.name + "/link", "down", true);
+    }
+
+    // Every command queued within batchMs goes out in a single write
+    void flushBatches(uint64_t now) {
+        for (auto& controller : controllers) {
+            if (controller->fd < 0 || controller->commandBatch.empty() || now < controller->batchDeadline) {
+                continue;
+            }
+            ssize_t n = write(controller->fd, controller->commandBatch.data(), controller->commandBatch.size());
+            if (n > 0) {
+                controller->commandBatch.erase(0, n);
+            } else if (n < 0 && errno != EAGAIN) {
+                disconnect(*controller);
+            }
+        }
+    }
+
+    void readController(Controller& controller) {
+        if (controller.fd < 0) {
+            return;
+        }
+        uint8_t buffer[512];
+        ssize_t n = read(controller.fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            controller.feed(buffer, n);
+        } else if (n == 0 || errno != EAGAIN) {
+            disconnect(controller);
+        }
+    }
+
+    void accept(int listener) {
+        int fd = ::accept(listener, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        clients.emplace_back(new Client { fd, "", "", {} });
+    }
+
+    void serviceClient(Client& client, short revents) {
+        if (revents & POLLIN) {
+            char buffer[1024];
+            ssize_t n = read(client.fd, buffer, sizeof(buffer));
+            if (n <= 0) {
+                closeClient(client);
+                return;
+            }
+            client.input.append(buffer, n);
+            size_t end;
+            while ((end = client.input.find('\n')) != std::string::npos) {
+                std::string line = client.input.substr(0, end);
+                client.input.erase(0, end + 1);
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                handleClientLine(client, line);
+            }
+        } else if (revents & (POLLHUP | POLLERR)) {
+            closeClient(client);
+            return;
+        }
+        if (!client.output.empty()) {
+            ssize_t n = write(client.fd, client.output.data(), client.output.size());
+            if (n > 0) {
+                client.output.erase(0, n);
+            } else if (n < 0 && errno != EAGAIN) {
+                closeClient(client);
+                return;
+            }
+        }
+        if (client.output.size() > CLIENT_OUTPUT_LIMIT) {
+            closeClient(client);
+        }
+    }
+
+    void handleClientLine(Client& client, const std::string& line) {
+        size_t space = line.find(' ');
+        std::string verb = line.substr(0, space);
+        std::string rest = (space == std::string::npos) ? "" : line.substr(space + 1);
+        size_t restSpace = rest.find(' ');
+        std::string first = rest.substr(0, restSpace);
+        std::string second = (restSpace == std::string::npos) ? "" : rest.substr(restSpace + 1);
+
+        if (verb == "SUB" && !first.empty()) {
+            client.subscriptions.push_back(first);
+            for (const auto& entry : cache) {
+                if (topicMatches(first, entry.first)) {
+                    client.output += "PUB " + entry.first + " " + entry.second + "\n";
+                }
+            }
+        } else if (verb == "UNSUB") {
+            for (size_t i = 0; i < client.subscriptions.size(); i++) {
+                if (client.subscriptions[i] == first) {
+                    client.subscriptions.erase(client.subscriptions.begin() + i);
+                    break;
+                }
+            }
+        } else if (verb == "GET" && !first.empty()) {
+            for (const auto& entry : cache) {
+                if (topicMatches(first, entry.first)) {
+                    client.output += "VAL " + entry.first + " " + entry.second + "\n";
+                }
+            }
+            client.output += "END\n";
+        } else if (verb == "PUB" && !first.empty()) {
+            publish(first, second, false);
+        } else if (verb == "CMD" && !second.empty()) {
+            Controller* controller = findController(first);
+            if (controller == NULL) {
+                client.output += "ERR unknown controller\n";
+                return;
+            }
+            if (controller->commandBatch.empty()) {
+                controller->batchDeadline = monotonicMs() + batchMs;
+            }
+            controller->commandBatch += second + "\n";
+        } else if (verb == "LIST") {
+            for (auto& controller : controllers) {
+                client.output += "CTRL " + controller->name + " " + (controller->fd >= 0 ? "up" : "down") + "\n";
+            }
+            client.output += "END\n";
+        } else {
+            client.output += "ERR syntax\n";
+        }
+    }
+
+    Controller* findController(const std::string& name) {
+        for (auto& controller : controllers) {
+            if (controller->name == name) {
+                return controller.get();
+            }
+        }
+        return NULL;
+    }
+
+    void closeClient(Client& client) {
+        if (client.fd >= 0) {
+            close(client.fd);
+            client.fd = -1;
+        }
+    }
+
+    void dropClosedClients() {
+        for (size_t i = 0; i < clients.size();) {
+            if (clients[i]->fd < 0) {
+                clients.erase(clients.begin() + i);
+            } else {
+                i++;
+            }
+        }
+    }
+};
+
+static const char* const AC_STATE_NAMES[] = { "off", "heating", "cooling", "unknown" };
+
+static std::string formatTenths(int32_t tenths) {
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%.1f", tenths / 10.0);
+    return buffer;
+}
+
+void Controller::onRecord(const TelemetryRecord& record) {
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%02ld:%02ld", (long)(record.values[FIELD_CLOCK_MINUTES] / 60),
+        (long)(record.values[FIELD_CLOCK_MINUTES] % 60));
+    gateway->publish(name + "/uptime_ms", std::to_string(record.values[FIELD_UPTIME_MS]), true);
+    gateway->publish(name + "/clock", buffer, true);
+    gateway->publish(name + "/outdoor_light", std::to_string(record.values[FIELD_OUTDOOR_LIGHT]), true);
+    for (int r = 0; r < record.roomCount; r++) {
+        std::string prefix = name + "/room" + std::to_string(r + 1) + "/";
+        int32_t flags = record.room(r, ROOM_FIELD_FLAGS);
+        gateway->publish(prefix + "temp", formatTenths(record.room(r, ROOM_FIELD_TEMP)), true);
+        gateway->publish(prefix + "target", formatTenths(record.room(r, ROOM_FIELD_TARGET)), true);
+        gateway->publish(prefix + "light", std::to_string(record.room(r, ROOM_FIELD_LIGHT)), true);
+        gateway->publish(prefix + "ac", AC_STATE_NAMES[flags & ROOM_FLAG_AC_MASK], true);
+        gateway->publish(prefix + "present", (flags & ROOM_FLAG_PRESENT) ? "1" : "0", true);
+        gateway->publish(prefix + "inactive", (flags & ROOM_FLAG_INACTIVE) ? "1" : "0", true);
+        gateway->publish(prefix + "schedule", (flags & ROOM_FLAG_SCHEDULE) ? "1" : "0", true);
+        gateway->publish(prefix + "auto_light", (flags & ROOM_FLAG_AUTO_LIGHT) ? "1" : "0", true);
+        gateway->publish(prefix + "precondition", (flags & ROOM_FLAG_PRECONDITION) ? "1" : "0", true);
+    }
+}
+
+void Controller::onText(uint8_t seq, const std::string& text) {
+    gateway->publish(name + "/reply", text, false);
+}
+
+static int listenUnix(const char* path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+    if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 16) != 0) {
+        perror(path);
+        exit(1);
+    }
+    return fd;
+}
+
+// Loopback only: the gateway is a local endpoint, not a network service
+static int listenTcp(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 16) != 0) {
+        perror("tcp listen");
+        exit(1);
+    }
+    return fd;
+}
+
+static void stop(int) {
+    running = 0;
+}
+
+int main(int argc, char** argv) {
+    Gateway gateway;
+    const char* unixPath = NULL;
+    long baud = 9600;
+    std::vector<std::pair<std::string, std::string>> devices;
+    int tcpPort = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            unixPath = argv[++i];
+        } else if (strcmp(argv[i], "--tcp") == 0 && i + 1 < argc) {
+            tcpPort = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--batch-ms") == 0 && i + 1 < argc) {
+            gateway.batchMs = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            baud = atol(argv[++i]);
+        } else if (strchr(argv[i], '=')) {
+            std::string spec = argv[i];
+            size_t eq = spec.find('=');
+            devices.push_back({ spec.substr(0, eq), spec.substr(eq + 1) });
+        } else {
+            fprintf(stderr, "usage: %s [--unix PATH] [--tcp PORT] [--batch-ms N] [-b BAUD] name=device...\n", argv[0]);
+            return 2;
+        }
+    }
+    speed_t speed = baudConstant(baud);
+    if (devices.empty() || (!unixPath && !tcpPort) || speed == 0) {
+        fprintf(stderr, "need at least one controller, a listening endpoint and a supported baud rate\n");
+        return 2;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    for (const auto& device : devices) {
+        gateway.controllers.emplace_back(new Controller(&gateway, device.first, device.second, speed));
+        gateway.publish(device.first + "/link", "down", true);
+    }
+    if (unixPath) {
+        gateway.listeners.push_back(listenUnix(unixPath));
+    }
+    if (tcpPort) {
+        gateway.listeners.push_back(listenTcp(tcpPort));
+    }
+
+    gateway.run();
+
+    if (unixPath) {
+        unlink(unixPath);
+    }
+    return 0;
+}
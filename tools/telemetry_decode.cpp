@@ -0,0 +1,93 @@
+// Decodes the controller's binary telemetry stream into CSV.
+//
+//   g++ -std=c++17 -O2 -Isrc/include -Itools tools/telemetry_decode.cpp -o telemetry_decode
+//   ./telemetry_decode /dev/ttyACM0 > log.csv      (or pipe a capture into stdin)
+//
+// Text frames (command replies) go to stderr prefixed with '#'.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SerialPort.h"
+#include "TelemetryDecoder.h"
+
+static const char* const AC_STATE_NAMES[] = { "off", "heating", "cooling", "?" };
+
+class CsvWriter : public TelemetryDecoder {
+private:
+    int headerRooms = -1;
+
+    void printHeader(int roomCount) {
+        printf("seq,uptime_ms,clock,outdoor_light");
+        for (int r = 1; r <= roomCount; r++) {
+            printf(",r%d_temp,r%d_target,r%d_light,r%d_ac,r%d_present,r%d_inactive,r%d_schedule,r%d_auto_light,r%d_precondition",
+                r, r, r, r, r, r, r, r, r);
+        }
+        printf("\n");
+        headerRooms = roomCount;
+    }
+
+protected:
+    void onRecord(const TelemetryRecord& record) override {
+        if (record.roomCount != headerRooms) {
+            printHeader(record.roomCount);
+        }
+        int32_t clock = record.values[FIELD_CLOCK_MINUTES];
+        printf("%u,%ld,%02ld:%02ld,%ld", record.seq, (long)record.values[FIELD_UPTIME_MS],
+            (long)(clock / 60), (long)(clock % 60), (long)record.values[FIELD_OUTDOOR_LIGHT]);
+        for (int r = 0; r < record.roomCount; r++) {
+            int32_t flags = record.room(r, ROOM_FIELD_FLAGS);
+            int32_t temp = record.room(r, ROOM_FIELD_TEMP);
+            int32_t target = record.room(r, ROOM_FIELD_TARGET);
+            printf(",%.1f,%.1f,%ld,%s,%d,%d,%d,%d,%d", temp / 10.0, target / 10.0,
+                (long)record.room(r, ROOM_FIELD_LIGHT), AC_STATE_NAMES[flags & ROOM_FLAG_AC_MASK],
+                !!(flags & ROOM_FLAG_PRESENT), !!(flags & ROOM_FLAG_INACTIVE),
+                !!(flags & ROOM_FLAG_SCHEDULE), !!(flags & ROOM_FLAG_AUTO_LIGHT),
+                !!(flags & ROOM_FLAG_PRECONDITION));
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    void onText(uint8_t seq, const std::string& text) override {
+        fprintf(stderr, "# %s\n", text.c_str());
+    }
+};
+
+int main(int argc, char** argv) {
+    long baud = 9600;
+    const char* path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            baud = atol(argv[++i]);
+        } else {
+            path = argv[i];
+        }
+    }
+
+    int fd = 0;
+    if (path) {
+        speed_t speed = baudConstant(baud);
+        if (speed == 0) {
+            fprintf(stderr, "unsupported baud rate %ld\n", baud);
+            return 2;
+        }
+        fd = openSerialPort(path, speed);
+        if (fd < 0) {
+            perror(path);
+            return 1;
+        }
+    }
+
+    CsvWriter writer;
+    uint8_t buffer[256];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        writer.feed(buffer, n);
+    }
+
+    const TelemetryDecoder::Stats& stats = writer.stats();
+    fprintf(stderr, "# frames=%lu bad=%lu gaps=%lu skipped_deltas=%lu\n",
+        stats.frames, stats.badFrames, stats.seqGaps, stats.skippedDeltas);
+    return 0;
+}